@@ -0,0 +1,392 @@
+//cell balance and anomaly checks over the voltage snapshots of one telemetry round
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <math.h>
+#include "bms_analytics.h"
+#include "dfu_log.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BMS_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BMS_TARGET_AVX2     //msvc emits any intrinsic without /arch
+#else
+#define BMS_TARGET_AVX2     __attribute__((target("avx2")))
+#endif
+#endif
+
+//readings are clamped so the squared deviations of 32 cells stay in 32 bits
+#define BMS_CELL_MV_CLAMP   8000
+
+//lanes hold deviations from the first cell, so the sums stay small and the variance exact
+static void finish_pack(BmsCellStats &st, int16_t v0, int16_t min, int16_t max, int16_t minIdx, int16_t maxIdx,
+    int32_t sum, uint32_t sumSq, uint8_t cellCnt)
+{
+    double m = (double)sum / cellCnt;
+    double var = (double)sumSq / cellCnt - m * m;
+    st.min = (uint16_t)min;
+    st.max = (uint16_t)max;
+    st.minCell = (uint8_t)minIdx;
+    st.maxCell = (uint8_t)maxIdx;
+    st.delta = (uint16_t)(max - min);
+    st.mean = (float)(v0 + m);
+    st.stddev = (float)(var > 0.0 ? sqrt(var) : 0.0);
+}
+
+static void cell_stats_scalar(const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt, BmsCellStats *out)
+{
+    for (uint8_t p=0; p<packCnt; ++p) {
+        int16_t v0 = (int16_t)volt[p];
+        int16_t mn = v0, mx = v0, mnIdx = 0, mxIdx = 0;
+        int32_t sum = 0;
+        uint32_t sq = 0;
+        for (uint8_t c=1; c<cellCnt; ++c) {
+            int16_t v = (int16_t)volt[c * stride + p];
+            int32_t d = v - v0;
+            if (v < mn) {
+                mn = v;
+                mnIdx = c;
+            }
+            if (v > mx) {
+                mx = v;
+                mxIdx = c;
+            }
+            sum += d;
+            sq += (uint32_t)(d * d);
+        }
+        finish_pack(out[p], v0, mn, mx, mnIdx, mxIdx, sum, sq, cellCnt);
+    }
+}
+
+#ifdef BMS_SIMD
+//8 packs per register, cmpgt keeps the first cell of equal readings like the scalar loop
+//the packs after the last full register go through the scalar loop, no lane past packCnt is read
+static void cell_stats_sse2(const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt, BmsCellStats *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t p = 0;
+    for (; p+8<=packCnt; p+=8) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(volt + p));
+        __m128i mn = v0, mx = v0, mnIdx = zero, mxIdx = zero;
+        __m128i sumLo = zero, sumHi = zero, sqLo = zero, sqHi = zero;
+        for (uint8_t c=1; c<cellCnt; ++c) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(volt + c * stride + p));
+            __m128i idx = _mm_set1_epi16(c);
+            __m128i lt = _mm_cmplt_epi16(v, mn);
+            __m128i gt = _mm_cmpgt_epi16(v, mx);
+            mnIdx = _mm_or_si128(_mm_and_si128(lt, idx), _mm_andnot_si128(lt, mnIdx));
+            mxIdx = _mm_or_si128(_mm_and_si128(gt, idx), _mm_andnot_si128(gt, mxIdx));
+            mn = _mm_min_epi16(mn, v);
+            mx = _mm_max_epi16(mx, v);
+            __m128i d = _mm_sub_epi16(v, v0);
+            sumLo = _mm_add_epi32(sumLo, _mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16));
+            sumHi = _mm_add_epi32(sumHi, _mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16));
+            __m128i lo = _mm_unpacklo_epi16(d, zero);
+            __m128i hi = _mm_unpackhi_epi16(d, zero);
+            sqLo = _mm_add_epi32(sqLo, _mm_madd_epi16(lo, lo));
+            sqHi = _mm_add_epi32(sqHi, _mm_madd_epi16(hi, hi));
+        }
+        int16_t a0[8], aMn[8], aMx[8], aMnIdx[8], aMxIdx[8];
+        int32_t aSum[8];
+        uint32_t aSq[8];
+        _mm_storeu_si128((__m128i *)a0, v0);
+        _mm_storeu_si128((__m128i *)aMn, mn);
+        _mm_storeu_si128((__m128i *)aMx, mx);
+        _mm_storeu_si128((__m128i *)aMnIdx, mnIdx);
+        _mm_storeu_si128((__m128i *)aMxIdx, mxIdx);
+        _mm_storeu_si128((__m128i *)aSum, sumLo);
+        _mm_storeu_si128((__m128i *)(aSum + 4), sumHi);
+        _mm_storeu_si128((__m128i *)aSq, sqLo);
+        _mm_storeu_si128((__m128i *)(aSq + 4), sqHi);
+        for (uint8_t k=0; k<8; ++k) {
+            finish_pack(out[p + k], a0[k], aMn[k], aMx[k], aMnIdx[k], aMxIdx[k], aSum[k], aSq[k], cellCnt);
+        }
+    }
+    cell_stats_scalar(volt + p, stride, (uint8_t)(packCnt - p), cellCnt, out + p);
+}
+
+//16 packs per register, unpack works inside the 128 bit halves so the 32 bit sums come out as packs 0-3,8-11 and 4-7,12-15
+BMS_TARGET_AVX2 static void cell_stats_avx2(const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt, BmsCellStats *out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t p = 0;
+    for (; p+16<=packCnt; p+=16) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(volt + p));
+        __m256i mn = v0, mx = v0, mnIdx = zero, mxIdx = zero;
+        __m256i sumLo = zero, sumHi = zero, sqLo = zero, sqHi = zero;
+        for (uint8_t c=1; c<cellCnt; ++c) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(volt + c * stride + p));
+            __m256i idx = _mm256_set1_epi16(c);
+            __m256i lt = _mm256_cmpgt_epi16(mn, v);
+            __m256i gt = _mm256_cmpgt_epi16(v, mx);
+            mnIdx = _mm256_blendv_epi8(mnIdx, idx, lt);
+            mxIdx = _mm256_blendv_epi8(mxIdx, idx, gt);
+            mn = _mm256_min_epi16(mn, v);
+            mx = _mm256_max_epi16(mx, v);
+            __m256i d = _mm256_sub_epi16(v, v0);
+            sumLo = _mm256_add_epi32(sumLo, _mm256_srai_epi32(_mm256_unpacklo_epi16(d, d), 16));
+            sumHi = _mm256_add_epi32(sumHi, _mm256_srai_epi32(_mm256_unpackhi_epi16(d, d), 16));
+            __m256i lo = _mm256_unpacklo_epi16(d, zero);
+            __m256i hi = _mm256_unpackhi_epi16(d, zero);
+            sqLo = _mm256_add_epi32(sqLo, _mm256_madd_epi16(lo, lo));
+            sqHi = _mm256_add_epi32(sqHi, _mm256_madd_epi16(hi, hi));
+        }
+        int16_t a0[16], aMn[16], aMx[16], aMnIdx[16], aMxIdx[16];
+        int32_t aSumLo[8], aSumHi[8];
+        uint32_t aSqLo[8], aSqHi[8];
+        _mm256_storeu_si256((__m256i *)a0, v0);
+        _mm256_storeu_si256((__m256i *)aMn, mn);
+        _mm256_storeu_si256((__m256i *)aMx, mx);
+        _mm256_storeu_si256((__m256i *)aMnIdx, mnIdx);
+        _mm256_storeu_si256((__m256i *)aMxIdx, mxIdx);
+        _mm256_storeu_si256((__m256i *)aSumLo, sumLo);
+        _mm256_storeu_si256((__m256i *)aSumHi, sumHi);
+        _mm256_storeu_si256((__m256i *)aSqLo, sqLo);
+        _mm256_storeu_si256((__m256i *)aSqHi, sqHi);
+        for (uint8_t k=0; k<16; ++k) {
+            uint8_t j = (uint8_t)((k & 3) | ((k & 8) >> 1));    //lane of pack k in the lo/hi sums
+            bool hi = (k & 4) != 0;
+            finish_pack(out[p + k], a0[k], aMn[k], aMx[k], aMnIdx[k], aMxIdx[k],
+                hi ? aSumHi[j] : aSumLo[j], hi ? aSqHi[j] : aSqLo[j], cellCnt);
+        }
+    }
+    cell_stats_sse2(volt + p, stride, (uint8_t)(packCnt - p), cellCnt, out + p);
+}
+
+static bool cpu_avx2(void)
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) {
+        return false;
+    }
+    __cpuid(r, 1);
+    if (!(r[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6) {   //OS saves the ymm registers
+        return false;
+    }
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+typedef void (*cell_stats_fn)(const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt, BmsCellStats *out);
+
+struct CellStatsKernel {
+    cell_stats_fn fn;
+    const char *name;
+};
+
+//fastest first, the scalar loop runs everywhere
+static const CellStatsKernel kernels[] = {
+#ifdef BMS_SIMD
+    { cell_stats_avx2, "avx2" },
+    { cell_stats_sse2, "sse2" },    //part of every x64 cpu
+#endif
+    { cell_stats_scalar, "scalar" },
+};
+
+static bool kernel_supported(const CellStatsKernel &k)
+{
+#ifdef BMS_SIMD
+    if (k.fn == cell_stats_avx2) {
+        return cpu_avx2();
+    }
+#endif
+    return true;
+}
+
+static const CellStatsKernel *pick_kernel(void)
+{
+    for (const CellStatsKernel &k : kernels) {
+        if (kernel_supported(k)) {
+            return &k;
+        }
+    }
+    return NULL;
+}
+
+static const CellStatsKernel &kernel(void)
+{
+    static const CellStatsKernel *k = pick_kernel();
+    return *k;
+}
+
+//every lane a kernel loads is inside the row of its cell
+static bool cell_stats_fits(uint32_t stride, uint8_t packCnt, uint8_t cellCnt)
+{
+    if (packCnt > stride || cellCnt > BMS_TELEMETRY_MAX_CELLS) {
+        LOG_ERR("%d packs of %d cells do not fit rows of %u\n", packCnt, cellCnt, stride);
+        return false;
+    }
+    return packCnt != 0 && cellCnt != 0;
+}
+
+void bms_cellStats(const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt, BmsCellStats *out)
+{
+    if (!cell_stats_fits(stride, packCnt, cellCnt)) {
+        return;
+    }
+    kernel().fn(volt, stride, packCnt, cellCnt, out);
+}
+
+const char *bms_cellStatsKernel(void)
+{
+    return kernel().name;
+}
+
+bool bms_cellStatsUsing(const char *name, const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt,
+    BmsCellStats *out)
+{
+    for (const CellStatsKernel &k : kernels) {
+        if (strcmp(k.name, name) == 0) {
+            if (!kernel_supported(k)) {
+                return false;
+            }
+            if (cell_stats_fits(stride, packCnt, cellCnt)) {
+                k.fn(volt, stride, packCnt, cellCnt, out);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void bms_defaultAnalyticsConfig(BmsAnalyticsConfig &cfg)
+{
+    cfg.maxDeltaMv = 50;
+    cfg.overVoltMv = 3650;
+    cfg.underVoltMv = 2500;
+    cfg.outlierMinMv = 20;
+    cfg.outlierSigma = 3.0f;
+    cfg.overTemp = 550;
+    cfg.tempSpread = 100;
+}
+
+BmsAnalytics::BmsAnalytics()
+    : packCnt(0), cellCnt(0), seen(0), round(0), cb(NULL), cbCtx(NULL)
+{
+    bms_defaultAnalyticsConfig(cfg);
+    memset(index, -1, sizeof(index));
+    memset(volt, 0x00, sizeof(volt));
+}
+
+bool BmsAnalytics::configure(const uint8_t *a, uint8_t n, uint8_t cells, const BmsAnalyticsConfig &c)
+{
+    if (n == 0 || n > BMS_TELEMETRY_MAX_ADDR || cells == 0 || cells > BMS_TELEMETRY_MAX_CELLS) {
+        LOG_ERR("illegal analytics config, %d packs, %d cells\n", n, cells);
+        return false;
+    }
+    cfg = c;
+    packCnt = n;
+    cellCnt = cells;
+    memcpy(addrs, a, n);
+    memset(index, -1, sizeof(index));
+    for (uint8_t i=0; i<n; ++i) {
+        index[a[i]] = (int8_t)i;
+    }
+    memset(volt, 0x00, sizeof(volt));
+    memset(voltOk, 0x00, sizeof(voltOk));
+    memset(tempOk, 0x00, sizeof(tempOk));
+    memset(result, 0x00, sizeof(result));
+    seen = 0;
+    round = 0;
+    LOG_INFO("cell analytics uses the %s kernel\n", bms_cellStatsKernel());
+    return true;
+}
+
+void BmsAnalytics::onAnomaly(BmsAnomalyCb c, void *ctx)
+{
+    cb = c;
+    cbCtx = ctx;
+}
+
+void BmsAnalytics::add(const BmsSnapshot &snap)
+{
+    int8_t p = index[snap.addr];
+    if (p < 0) {
+        return;
+    }
+    if (seen != 0 && snap.round != round) {
+        flush();
+    }
+    round = snap.round;
+    voltOk[p] = (snap.valid & BMS_INFO_VOLT) && snap.volt.cellCnt >= cellCnt;
+    if (voltOk[p]) {
+        for (uint8_t c=0; c<cellCnt; ++c) {
+            uint16_t v = snap.volt.cell[c];
+            volt[c * BMS_PACK_STRIDE + p] = v > BMS_CELL_MV_CLAMP ? BMS_CELL_MV_CLAMP : v;
+        }
+    }
+    tempOk[p] = (snap.valid & BMS_INFO_TEMP) != 0;
+    temp[p] = snap.temp;
+    if (++seen == packCnt) {
+        flush();
+    }
+}
+
+//one pass of the kernel over every pack, the limits are per pack compares on the results
+void BmsAnalytics::flush(void)
+{
+    if (seen == 0) {
+        return;
+    }
+    bms_cellStats(volt, BMS_PACK_STRIDE, packCnt, cellCnt, result);
+    for (uint8_t p=0; p<packCnt; ++p) {
+        BmsCellStats &st = result[p];
+        st.addr = addrs[p];
+        st.round = round;
+        st.flags = 0;
+        st.outlierCell = 0;
+        if (!voltOk[p]) {
+            st.flags = BMS_ANOM_STALE;
+            continue;
+        }
+        if (st.delta > cfg.maxDeltaMv) {
+            st.flags |= BMS_ANOM_IMBALANCE;
+        }
+        if (st.max > cfg.overVoltMv) {
+            st.flags |= BMS_ANOM_OVERVOLT;
+        }
+        if (st.min < cfg.underVoltMv) {
+            st.flags |= BMS_ANOM_UNDERVOLT;
+        }
+        float limit = cfg.outlierSigma * st.stddev;
+        limit = limit < cfg.outlierMinMv ? cfg.outlierMinMv : limit;
+        if (st.max - st.mean > limit || st.mean - st.min > limit) {
+            st.flags |= BMS_ANOM_OUTLIER;
+            st.outlierCell = (st.max - st.mean >= st.mean - st.min) ? st.maxCell : st.minCell;
+        }
+        if (tempOk[p]) {
+            if (temp[p].cellMax > cfg.overTemp || temp[p].mos > cfg.overTemp) {
+                st.flags |= BMS_ANOM_OVERTEMP;
+            }
+            if (temp[p].cellMax - temp[p].cellMin > cfg.tempSpread) {
+                st.flags |= BMS_ANOM_TEMP_SPREAD;
+            }
+        }
+        if (st.flags != 0 && cb != NULL) {
+            cb(&st, cbCtx);
+        }
+    }
+    memset(voltOk, 0x00, sizeof(voltOk));
+    memset(tempOk, 0x00, sizeof(tempOk));
+    seen = 0;
+}
+
+const BmsCellStats *BmsAnalytics::stats(uint8_t addr) const
+{
+    int8_t p = index[addr];
+    return p < 0 ? NULL : &result[p];
+}
+
+void bms_analyticsSnapshot(const BmsSnapshot *snap, void *ctx)
+{
+    ((BmsAnalytics *)ctx)->add(*snap);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+//cell balance and anomaly checks over the voltage snapshots of one telemetry round
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include "bms_telemetry.h"
+
+#define BMS_PACK_STRIDE             BMS_TELEMETRY_MAX_ADDR  //packs per cell row
+
+//BmsCellStats.flags
+#define BMS_ANOM_IMBALANCE          0x01    //max - min cell above maxDeltaMv
+#define BMS_ANOM_OUTLIER            0x02    //one cell more than outlierSigma deviations off the mean
+#define BMS_ANOM_OVERVOLT           0x04
+#define BMS_ANOM_UNDERVOLT          0x08
+#define BMS_ANOM_OVERTEMP           0x10
+#define BMS_ANOM_TEMP_SPREAD        0x20    //cell max - cell min temperature above tempSpread
+#define BMS_ANOM_STALE              0x80    //no voltage answer in this round, the rest is not valid
+
+struct BmsAnalyticsConfig {
+    uint16_t maxDeltaMv;
+    uint16_t overVoltMv;
+    uint16_t underVoltMv;
+    uint16_t outlierMinMv;      //deviation below this is never an outlier, quiet packs have a tiny sigma
+    float outlierSigma;
+    int16_t overTemp;           //0.1C
+    int16_t tempSpread;         //0.1C
+};
+
+struct BmsCellStats {
+    uint8_t addr;
+    uint8_t flags;
+    uint8_t minCell;
+    uint8_t maxCell;
+    uint8_t outlierCell;        //minCell or maxCell when BMS_ANOM_OUTLIER is set
+    uint16_t min;               //mV
+    uint16_t max;
+    uint16_t delta;
+    float mean;
+    float stddev;
+    uint32_t round;
+};
+
+//cell c of pack p is volt[c * stride + p], nothing is done when packCnt is above stride
+void bms_cellStats(const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt, BmsCellStats *out);
+//"avx2", "sse2" or "scalar", picked once from cpuid
+const char *bms_cellStatsKernel(void);
+//bms_cellStats on the named kernel, false when it is unknown or this cpu lacks it
+bool bms_cellStatsUsing(const char *kernel, const uint16_t *volt, uint32_t stride, uint8_t packCnt, uint8_t cellCnt,
+    BmsCellStats *out);
+void bms_defaultAnalyticsConfig(BmsAnalyticsConfig &cfg);
+
+//runs on the polling thread for every flagged pack
+typedef void (*BmsAnomalyCb)(const BmsCellStats *stats, void *ctx);
+
+//snapshots are scattered into cell major rows as they come, a round is analysed in one pass when it is complete
+class BmsAnalytics {
+public:
+    BmsAnalytics();
+
+    bool configure(const uint8_t *addrs, uint8_t packCnt, uint8_t cellCnt, const BmsAnalyticsConfig &cfg);
+    void onAnomaly(BmsAnomalyCb cb, void *ctx);
+    void add(const BmsSnapshot &snap);
+    //analyse the packs of the round so far, called by add() when the round is full or a newer one starts
+    void flush(void);
+    //last result of a pack, NULL when the address is unknown
+    const BmsCellStats *stats(uint8_t addr) const;
+
+private:
+    BmsAnalyticsConfig cfg;
+    uint8_t addrs[BMS_TELEMETRY_MAX_ADDR];
+    int8_t index[256];
+    uint8_t packCnt;
+    uint8_t cellCnt;
+    uint8_t seen;               //packs of the round added so far
+    uint32_t round;
+    bool voltOk[BMS_TELEMETRY_MAX_ADDR];
+    BmsTempInfo temp[BMS_TELEMETRY_MAX_ADDR];
+    bool tempOk[BMS_TELEMETRY_MAX_ADDR];
+    uint16_t volt[BMS_TELEMETRY_MAX_CELLS * BMS_PACK_STRIDE];
+    BmsCellStats result[BMS_TELEMETRY_MAX_ADDR];
+    BmsAnomalyCb cb;
+    void *cbCtx;
+};
+
+//BmsTelemetryCb that feeds the BmsAnalytics passed as ctx
+void bms_analyticsSnapshot(const BmsSnapshot *snap, void *ctx);
@@ -0,0 +1,515 @@
+//streaming export of telemetry snapshots to parquet or csv
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include <chrono>
+#include "bms_export.h"
+#include "dfu_log.h"
+
+#define PQ_INT32                1
+#define PQ_INT64                2
+#define PQ_TIMESTAMP_MILLIS     9       //converted type
+#define PQ_RLE                  3
+#define PQ_DELTA_BINARY_PACKED  5
+#define PQ_DATA_PAGE            0
+#define PQ_REQUIRED             0
+#define PQ_OPTIONAL             1
+
+//thrift compact protocol types
+#define TC_I32                  5
+#define TC_I64                  6
+#define TC_BINARY               8
+#define TC_LIST                 9
+#define TC_STRUCT               12
+
+#define CSV_LINE_SIZE           2048
+#define DELTA_BLOCK             128     //values per block of DELTA_BINARY_PACKED
+#define DELTA_MINIBLOCKS        4
+#define DELTA_MINIBLOCK         (DELTA_BLOCK / DELTA_MINIBLOCKS)
+#define FILE_BUF_SIZE           (1 << 20)
+
+//columns of every export, the cells follow as cell_1..cell_n
+static const struct {
+    const char *name;
+    uint8_t type;
+    uint8_t part;
+    uint8_t converted;
+} columnDefs[] = {
+    { "time_ms", PQ_INT64, 0, PQ_TIMESTAMP_MILLIS },
+    { "addr", PQ_INT32, 0, 0 },
+    { "round", PQ_INT64, 0, 0 },
+    { "valid", PQ_INT32, 0, 0 },
+    { "bat_voltage", PQ_INT32, BMS_INFO_BAT, 0 },
+    { "bat_current", PQ_INT32, BMS_INFO_BAT, 0 },
+    { "bat_soc", PQ_INT32, BMS_INFO_BAT, 0 },
+    { "bat_soh", PQ_INT32, BMS_INFO_BAT, 0 },
+    { "bat_cycles", PQ_INT32, BMS_INFO_BAT, 0 },
+    { "bat_alarm", PQ_INT32, BMS_INFO_BAT, 0 },
+    { "cur_current", PQ_INT32, BMS_INFO_CUR, 0 },
+    { "cur_charge_limit", PQ_INT32, BMS_INFO_CUR, 0 },
+    { "cur_discharge_limit", PQ_INT32, BMS_INFO_CUR, 0 },
+    { "cur_charge_voltage", PQ_INT32, BMS_INFO_CUR, 0 },
+    { "temp_cell_min", PQ_INT32, BMS_INFO_TEMP, 0 },
+    { "temp_cell_max", PQ_INT32, BMS_INFO_TEMP, 0 },
+    { "temp_mos", PQ_INT32, BMS_INFO_TEMP, 0 },
+    { "temp_ambient", PQ_INT32, BMS_INFO_TEMP, 0 },
+    { "soc_soc", PQ_INT32, BMS_INFO_SOC, 0 },
+    { "soc_soh", PQ_INT32, BMS_INFO_SOC, 0 },
+    { "soc_remain_cap", PQ_INT64, BMS_INFO_SOC, 0 },
+    { "soc_full_cap", PQ_INT64, BMS_INFO_SOC, 0 },
+    { "pcs_charge_voltage", PQ_INT32, BMS_INFO_PCS, 0 },
+    { "pcs_charge_current", PQ_INT32, BMS_INFO_PCS, 0 },
+    { "pcs_discharge_current", PQ_INT32, BMS_INFO_PCS, 0 },
+    { "pcs_flags", PQ_INT32, BMS_INFO_PCS, 0 },
+};
+#define COLUMN_DEF_CNT      (sizeof(columnDefs) / sizeof(columnDefs[0]))
+
+//same order as columnDefs, col past the table is a cell
+static int64_t column_value(const BmsSnapshot &s, size_t col)
+{
+    switch (col) {
+    case 0: return (int64_t)s.timeMs;
+    case 1: return s.addr;
+    case 2: return s.round;
+    case 3: return s.valid;
+    case 4: return s.bat.voltage;
+    case 5: return s.bat.current;
+    case 6: return s.bat.soc;
+    case 7: return s.bat.soh;
+    case 8: return s.bat.cycles;
+    case 9: return s.bat.alarm;
+    case 10: return s.cur.current;
+    case 11: return s.cur.chargeLimit;
+    case 12: return s.cur.dischargeLimit;
+    case 13: return s.cur.chargeVoltage;
+    case 14: return s.temp.cellMin;
+    case 15: return s.temp.cellMax;
+    case 16: return s.temp.mos;
+    case 17: return s.temp.ambient;
+    case 18: return s.soc.soc;
+    case 19: return s.soc.soh;
+    case 20: return s.soc.remainCap;
+    case 21: return s.soc.fullCap;
+    case 22: return s.pcs.chargeVoltage;
+    case 23: return s.pcs.chargeCurrent;
+    case 24: return s.pcs.dischargeCurrent;
+    case 25: return s.pcs.flags;
+    default: return s.volt.cell[col - COLUMN_DEF_CNT];
+    }
+}
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+//thrift compact protocol, enough of it for the parquet page headers and footer
+class ThriftWriter {
+public:
+    explicit ThriftWriter(std::vector<uint8_t> &out) : b(out), depth(0) { last[0] = 0; }
+
+    void varint(uint64_t v) { put_varint(b, v); }
+    void field(int16_t id, uint8_t type)
+    {
+        int16_t delta = (int16_t)(id - last[depth]);
+        if (delta > 0 && delta <= 15) {
+            b.push_back((uint8_t)((delta << 4) | type));
+        } else {
+            b.push_back(type);
+            varint(zigzag(id));
+        }
+        last[depth] = id;
+    }
+    void i32(int16_t id, int32_t v) { field(id, TC_I32); varint(zigzag(v)); }
+    void i64(int16_t id, int64_t v) { field(id, TC_I64); varint(zigzag(v)); }
+    void str(int16_t id, const std::string &s) { field(id, TC_BINARY); elemStr(s); }
+    void list(int16_t id, uint8_t type, uint32_t n)
+    {
+        field(id, TC_LIST);
+        if (n < 15) {
+            b.push_back((uint8_t)((n << 4) | type));
+        } else {
+            b.push_back((uint8_t)(0xF0 | type));
+            varint(n);
+        }
+    }
+    void elemI32(int32_t v) { varint(zigzag(v)); }
+    void elemStr(const std::string &s)
+    {
+        varint(s.size());
+        b.insert(b.end(), s.begin(), s.end());
+    }
+    //a struct field, or an element of a list of structs when id is 0
+    void begin(int16_t id)
+    {
+        if (id != 0) {
+            field(id, TC_STRUCT);
+        }
+        last[++depth] = 0;
+    }
+    void end(void)
+    {
+        b.push_back(0x00);
+        --depth;
+    }
+    void stop(void) { b.push_back(0x00); }
+
+private:
+    std::vector<uint8_t> &b;
+    int16_t last[8];
+    int depth;
+};
+
+//DELTA_BINARY_PACKED of parquet: every block stores its min delta and bit packs delta - min per miniblock,
+//slowly moving telemetry costs a few bits per value
+static void delta_encode(const int64_t *v, uint32_t n, std::vector<uint8_t> &out)
+{
+    put_varint(out, DELTA_BLOCK);
+    put_varint(out, DELTA_MINIBLOCKS);
+    put_varint(out, n);
+    put_varint(out, zigzag(n ? v[0] : 0));
+    for (uint32_t at=1; at<n; at+=DELTA_BLOCK) {
+        uint32_t cnt = n - at < DELTA_BLOCK ? n - at : DELTA_BLOCK;
+        int64_t d[DELTA_BLOCK];
+        int64_t minDelta = INT64_MAX;
+        for (uint32_t i=0; i<cnt; ++i) {
+            d[i] = v[at + i] - v[at + i - 1];
+            minDelta = d[i] < minDelta ? d[i] : minDelta;
+        }
+        uint8_t width[DELTA_MINIBLOCKS] = { 0 };
+        for (uint32_t i=0; i<cnt; ++i) {
+            uint64_t u = (uint64_t)(d[i] - minDelta);
+            uint8_t w = 0;
+            while (w < 64 && (u >> w) != 0) {
+                ++w;
+            }
+            uint8_t &mw = width[i / DELTA_MINIBLOCK];
+            mw = w > mw ? w : mw;
+        }
+        put_varint(out, zigzag(minDelta));
+        out.insert(out.end(), width, width + DELTA_MINIBLOCKS);
+        //a miniblock with values is padded to full length, the ones after the last value are left out
+        for (uint32_t m=0; m*DELTA_MINIBLOCK<cnt; ++m) {
+            uint8_t cur = 0;
+            uint8_t used = 0;
+            for (uint32_t i=m*DELTA_MINIBLOCK; i<(m+1)*DELTA_MINIBLOCK; ++i) {
+                uint64_t u = i < cnt ? (uint64_t)(d[i] - minDelta) : 0;
+                for (uint8_t left=width[m]; left>0; ) {
+                    uint8_t take = (uint8_t)(left < 8 - used ? left : 8 - used);
+                    cur |= (uint8_t)((u & ((1U << take) - 1)) << used);
+                    u >>= take;
+                    used += take;
+                    left -= take;
+                    if (used == 8) {
+                        out.push_back(cur);
+                        cur = 0;
+                        used = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+BmsExport::BmsExport()
+    : fd(NULL), format(BMS_EXPORT_CSV), cells(0), groupCnt(0), offset(0), rowCnt(0), ring(NULL),
+      head(0), tail(0), drop(0), running(false), fileBuf(NULL)
+{
+}
+
+BmsExport::~BmsExport()
+{
+    close();
+}
+
+bool BmsExport::open(const char *path, uint8_t cellCnt)
+{
+    if (fd != NULL || cellCnt > BMS_TELEMETRY_MAX_CELLS) {
+        LOG_ERR("export is already opened or has too many cells\n");
+        return false;
+    }
+    fd = fopen(path, "wb");
+    if (fd == NULL) {
+        LOG_ERR("Cannot open file %s\n", path);
+        return false;
+    }
+    fileBuf = new char[FILE_BUF_SIZE];
+    setvbuf(fd, fileBuf, _IOFBF, FILE_BUF_SIZE);
+    size_t n = strlen(path);
+    format = (n > 8 && strcmp(path + n - 8, ".parquet") == 0) ? BMS_EXPORT_PARQUET : BMS_EXPORT_CSV;
+    cells = cellCnt;
+    cols.clear();
+    cols.resize(COLUMN_DEF_CNT + cellCnt);
+    for (size_t i=0; i<cols.size(); ++i) {
+        Column &c = cols[i];
+        if (i < COLUMN_DEF_CNT) {
+            c.name = columnDefs[i].name;
+            c.type = columnDefs[i].type;
+            c.part = columnDefs[i].part;
+            c.converted = columnDefs[i].converted;
+        } else {
+            c.name = "cell_" + std::to_string(i - COLUMN_DEF_CNT + 1);
+            c.type = PQ_INT32;
+            c.part = BMS_INFO_VOLT;
+            c.converted = 0;
+        }
+        if (format == BMS_EXPORT_PARQUET) {
+            c.val.resize(BMS_EXPORT_ROW_GROUP);
+            c.def.resize(BMS_EXPORT_ROW_GROUP / 8);
+        }
+        c.cnt = 0;
+    }
+    chunks.clear();
+    groupRows.clear();
+    groupCnt = 0;
+    rowCnt = 0;
+    offset = 0;
+    if (format == BMS_EXPORT_PARQUET) {
+        fwrite("PAR1", 1, 4, fd);
+        offset = 4;
+    } else {
+        for (size_t i=0; i<cols.size(); ++i) {
+            fprintf(fd, "%s%c", cols[i].name.c_str(), i + 1 < cols.size() ? ',' : '\n');
+        }
+    }
+    ring = new Slot[BMS_EXPORT_QUEUE_SIZE];
+    for (size_t i=0; i<BMS_EXPORT_QUEUE_SIZE; ++i) {
+        ring[i].seq.store(i);
+    }
+    head.store(0);
+    tail = 0;
+    drop.store(0);
+    running.store(true);
+    writer = std::thread(&BmsExport::run, this);
+    return true;
+}
+
+void BmsExport::close(void)
+{
+    if (fd == NULL) {
+        return;
+    }
+    running.store(false);
+    writer.join();
+    drain();
+    if (format == BMS_EXPORT_PARQUET) {
+        if (groupCnt != 0) {
+            writeRowGroup();
+        }
+        writeFooter();
+    }
+    fclose(fd);
+    fd = NULL;
+    delete[] ring;
+    ring = NULL;
+    delete[] fileBuf;
+    fileBuf = NULL;
+    if (drop.load() != 0) {
+        LOG_WARN("export dropped %u snapshots, the disk did not keep up\n", drop.load());
+    }
+}
+
+bool BmsExport::push(const BmsSnapshot &snap)
+{
+    if (ring == NULL) {
+        return false;
+    }
+    size_t pos = head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &ring[pos & (BMS_EXPORT_QUEUE_SIZE - 1)];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            drop.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->snap = snap;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t BmsExport::drain(void)
+{
+    uint32_t cnt = 0;
+    for (;;) {
+        Slot &slot = ring[tail & (BMS_EXPORT_QUEUE_SIZE - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+            break;
+        }
+        if (format == BMS_EXPORT_PARQUET) {
+            addRow(slot.snap);
+        } else {
+            writeCsv(slot.snap);
+        }
+        slot.seq.store(tail + BMS_EXPORT_QUEUE_SIZE, std::memory_order_release);
+        ++tail;
+        ++cnt;
+        ++rowCnt;
+    }
+    return cnt;
+}
+
+void BmsExport::run(void)
+{
+    while (running.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(BMS_EXPORT_IDLE_MS));
+        }
+    }
+}
+
+//parts the pack did not answer are left empty
+void BmsExport::writeCsv(const BmsSnapshot &s)
+{
+    char line[CSV_LINE_SIZE];
+    int n = 0;
+    for (size_t i=0; i<cols.size(); ++i) {
+        const Column &c = cols[i];
+        if (c.part == 0 || (s.valid & c.part)) {
+            n += snprintf(line + n, sizeof(line) - n, "%lld", (long long)column_value(s, i));
+        }
+        line[n++] = (i + 1 < cols.size()) ? ',' : '\n';
+    }
+    fwrite(line, 1, n, fd);
+}
+
+void BmsExport::addRow(const BmsSnapshot &s)
+{
+    for (size_t i=0; i<cols.size(); ++i) {
+        Column &c = cols[i];
+        bool present = c.part == 0 || (s.valid & c.part);
+        if (c.part != 0) {
+            uint8_t &bits = c.def[groupCnt >> 3];
+            bits = (uint8_t)((groupCnt & 7) == 0 ? 0 : bits);
+            bits |= (uint8_t)(present ? 1U << (groupCnt & 7) : 0U);
+        }
+        if (present) {
+            c.val[c.cnt++] = column_value(s, i);
+        }
+    }
+    if (++groupCnt == BMS_EXPORT_ROW_GROUP) {
+        writeRowGroup();
+    }
+}
+
+//one uncompressed data page per column, definition levels as one bit packed run
+void BmsExport::writeRowGroup(void)
+{
+    for (Column &c : cols) {
+        page.clear();
+        if (c.part != 0) {
+            uint32_t groups = (groupCnt + 7) / 8;
+            std::vector<uint8_t> lv;
+            ThriftWriter w(lv);
+            w.varint(((uint64_t)groups << 1) | 1);
+            lv.insert(lv.end(), c.def.begin(), c.def.begin() + groups);
+            uint32_t len = (uint32_t)lv.size();
+            page.insert(page.end(), (uint8_t *)&len, (uint8_t *)&len + 4);
+            page.insert(page.end(), lv.begin(), lv.end());
+        }
+        delta_encode(c.val.data(), c.cnt, page);
+        std::vector<uint8_t> hdr;
+        ThriftWriter w(hdr);
+        w.i32(1, PQ_DATA_PAGE);
+        w.i32(2, (int32_t)page.size());
+        w.i32(3, (int32_t)page.size());
+        w.begin(5);
+        w.i32(1, (int32_t)groupCnt);
+        w.i32(2, PQ_DELTA_BINARY_PACKED);
+        w.i32(3, PQ_RLE);
+        w.i32(4, PQ_RLE);
+        w.end();
+        w.stop();
+        fwrite(hdr.data(), 1, hdr.size(), fd);
+        fwrite(page.data(), 1, page.size(), fd);
+        chunks.push_back({ offset, (uint32_t)(hdr.size() + page.size()), groupCnt });
+        offset += hdr.size() + page.size();
+        c.cnt = 0;
+    }
+    groupRows.push_back(groupCnt);
+    groupCnt = 0;
+}
+
+void BmsExport::writeFooter(void)
+{
+    std::vector<uint8_t> meta;
+    ThriftWriter w(meta);
+    w.i32(1, 1);
+    w.list(2, TC_STRUCT, (uint32_t)cols.size() + 1);
+    w.begin(0);
+    w.str(4, "schema");
+    w.i32(5, (int32_t)cols.size());
+    w.end();
+    for (const Column &c : cols) {
+        w.begin(0);
+        w.i32(1, c.type);
+        w.i32(3, c.part != 0 ? PQ_OPTIONAL : PQ_REQUIRED);
+        w.str(4, c.name);
+        if (c.converted != 0) {
+            w.i32(6, c.converted);
+        }
+        w.end();
+    }
+    w.i64(3, (int64_t)rowCnt);
+    w.list(4, TC_STRUCT, (uint32_t)groupRows.size());
+    size_t k = 0;
+    for (uint32_t rows : groupRows) {
+        int64_t bytes = 0;
+        w.begin(0);
+        w.list(1, TC_STRUCT, (uint32_t)cols.size());
+        for (const Column &c : cols) {
+            const Chunk &ch = chunks[k++];
+            bytes += ch.size;
+            w.begin(0);
+            w.i64(2, (int64_t)ch.offset);
+            w.begin(3);
+            w.i32(1, c.type);
+            w.list(2, TC_I32, 2);
+            w.elemI32(PQ_DELTA_BINARY_PACKED);
+            w.elemI32(PQ_RLE);
+            w.list(3, TC_BINARY, 1);
+            w.elemStr(c.name);
+            w.i32(4, 0);    //uncompressed
+            w.i64(5, ch.values);
+            w.i64(6, ch.size);
+            w.i64(7, ch.size);
+            w.i64(9, (int64_t)ch.offset);
+            w.end();
+            w.end();
+        }
+        w.i64(2, bytes);
+        w.i64(3, rows);
+        w.end();
+    }
+    w.str(6, "bms_export");
+    w.stop();
+    uint32_t len = (uint32_t)meta.size();
+    fwrite(meta.data(), 1, meta.size(), fd);
+    fwrite(&len, 1, 4, fd);
+    fwrite("PAR1", 1, 4, fd);
+}
+
+void bms_exportSnapshot(const BmsSnapshot *snap, void *ctx)
+{
+    ((BmsExport *)ctx)->push(*snap);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+//streaming export of telemetry snapshots to parquet or csv
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include "bms_telemetry.h"
+
+#define BMS_EXPORT_QUEUE_SIZE       4096    //snapshots waiting for the writer, power of 2
+#define BMS_EXPORT_ROW_GROUP        8192    //rows buffered per parquet row group, ~4MB at 32 cells
+#define BMS_EXPORT_IDLE_MS          10
+#define BMS_EXPORT_CSV              0
+#define BMS_EXPORT_PARQUET          1
+
+//push() copies the snapshot into a lock-free queue and returns, a writer thread owns the file.
+//parquet keeps one row group of columns in memory, csv only the stdio buffer
+class BmsExport {
+public:
+    BmsExport();
+    ~BmsExport();
+
+    //.parquet selects parquet, anything else csv
+    bool open(const char *path, uint8_t cellCnt);
+    //drains the queue, writes the last row group and the parquet footer
+    void close(void);
+    //false when the queue is full, the snapshot is dropped and counted
+    bool push(const BmsSnapshot &snap);
+    uint32_t dropped(void) const { return drop.load(); }
+    uint64_t rows(void) const { return rowCnt; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        BmsSnapshot snap;
+    };
+    struct Column {
+        std::string name;
+        uint8_t type;           //parquet physical type
+        uint8_t part;           //BMS_INFO bit, 0 for the columns every row has
+        uint8_t converted;      //parquet converted type, 0 none
+        std::vector<int64_t> val;
+        std::vector<uint8_t> def;   //1 bit per row, the part was answered
+        uint32_t cnt;           //values, rows without the part are null
+    };
+    struct Chunk {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t values;
+    };
+
+    uint32_t drain(void);
+    void addRow(const BmsSnapshot &s);
+    void writeCsv(const BmsSnapshot &s);
+    void writeRowGroup(void);
+    void writeFooter(void);
+    void run(void);
+
+    FILE *fd;
+    uint8_t format;
+    uint8_t cells;
+    std::vector<Column> cols;
+    std::vector<Chunk> chunks;      //of every column of every row group written
+    std::vector<uint32_t> groupRows;
+    std::vector<uint8_t> page;
+    uint32_t groupCnt;              //rows in the row group being filled
+    uint64_t offset;
+    uint64_t rowCnt;
+    Slot *ring;
+    std::atomic<size_t> head;
+    size_t tail;
+    std::atomic<uint32_t> drop;
+    std::atomic<bool> running;
+    std::thread writer;
+    char *fileBuf;
+};
+
+//BmsTelemetryCb that queues into the BmsExport passed as ctx
+void bms_exportSnapshot(const BmsSnapshot *snap, void *ctx);
@@ -0,0 +1,389 @@
+//RTC synchronisation of every pack on one bus with latency compensation
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include "bms_rtc.h"
+#include "dfu_log.h"
+
+#define RTC_FIELD_CNT       7       //second parked at 0, year, month, day, hour, minute, second
+#define RTC_PROBE_GAP_US    20000   //a skew probe is planned at least this far ahead
+#define RTC_LATE_US         2000    //a second frame later than this is reported
+#define US_PER_SEC          1000000LL
+
+#define PHASE_MEASURE       0
+#define PHASE_VERIFY        1
+
+static inline int64_t now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void rtc_fields(int64_t us, bool utc, struct tm &tm)
+{
+    time_t tt = (time_t)(us / US_PER_SEC);
+#ifdef _WIN32
+    if (utc) {
+        gmtime_s(&tm, &tt);
+    } else {
+        localtime_s(&tm, &tt);
+    }
+#else
+    if (utc) {
+        gmtime_r(&tt, &tm);
+    } else {
+        localtime_r(&tt, &tm);
+    }
+#endif
+}
+
+void bms_rtcDefaultConfig(BmsRtcConfig &cfg)
+{
+    memset(&cfg, 0x00, sizeof(cfg));
+    cfg.probes = BMS_RTC_PROBES;
+    cfg.verifySteps = BMS_RTC_VERIFY_STEPS;
+    cfg.timeoutMs = BMS_RTC_TIMEOUT_MS;
+    cfg.utc = false;
+}
+
+BmsRtcSync::BmsRtcSync(DfuTransport &transport)
+    : t(transport), engine(transport), phase(PHASE_MEASURE)
+{
+    bms_rtcDefaultConfig(cfg);
+    memset(index, 0xFF, sizeof(index));
+}
+
+bool BmsRtcSync::configure(const BmsRtcConfig &c)
+{
+    if (c.addrCnt == 0 || c.addrCnt > BMS_RTC_MAX_ADDR || c.probes == 0 || c.timeoutMs == 0) {
+        LOG_ERR("invalid rtc sync config\n");
+        return false;
+    }
+    cfg = c;
+    memset(index, 0xFF, sizeof(index));
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        index[cfg.addrs[i]] = (int8_t)i;
+    }
+    return true;
+}
+
+int BmsRtcSync::sendField(Station &s, uint8_t sub, uint8_t field, uint16_t value)
+{
+    if (sub == SYS_GET_TIME) {
+        dfu_loadCmd(cmd, getRtcTimeCmd);
+    } else if (field == BMS_RTC_YEAR) {
+        dfu_loadCmd(cmd, setRtcYearCmd);
+        cmd[CMD_DAT_OFFSET + 2] = value & 0xFF;
+        cmd[CMD_DAT_OFFSET + 3] = (value >> 8) & 0xFF;
+    } else {
+        dfu_loadCmd(cmd, setRtcTimeCmd);
+        cmd[CMD_DAT_OFFSET + 2] = (uint8_t)value;
+    }
+    cmd[CMD_DAT_OFFSET + 1] = field;
+    if (engine.sendCmd(cmd, s.addr) < 0) {
+        return -1;
+    }
+    s.txUs = now_us();
+    s.pending = true;
+    s.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(cfg.timeoutMs);
+    return 0;
+}
+
+void BmsRtcSync::onFrame(const DfuFrame &f, int64_t rxUs)
+{
+    const uint8_t *b = engine.body(f);
+    int8_t i = index[b[RSP_ADR_OFFSET - 1]];
+    if (i < 0 || b[RSP_STA_OFFSET - 1] != APP_SYS_CMD + 0x40 || b[0] < 4) {
+        return;     //another station or another command
+    }
+    Station &s = stations[i];
+    const uint8_t *dat = b + RSP_DAT_OFFSET - 1;
+    if (dat[0] == SYS_SET_TIME) {
+        ++s.acks;
+        s.pending = false;
+        return;
+    }
+    if (dat[0] != SYS_GET_TIME || dat[1] != BMS_RTC_SECOND || b[0] < 5 || !s.pending) {
+        return;
+    }
+    s.pending = false;
+    int64_t rtt = rxUs - s.txUs;
+    if (phase == PHASE_MEASURE) {
+        if (rtt < s.res.rttUs) {
+            s.res.rttUs = (uint32_t)rtt;
+        }
+        return;
+    }
+    //the pack read its clock at h, so its second dat[2] started within the last second of h + skew
+    int64_t h = s.txUs + s.oneWayUs;
+    int64_t mid = (s.lo + s.hi) / 2;
+    int64_t r = (h + mid) / US_PER_SEC;
+    int64_t sec = r + ((dat[2] - r % 60) % 60 + 90) % 60 - 30;
+    int64_t lo = sec * US_PER_SEC - h;
+    int64_t hi = lo + US_PER_SEC;
+    if (lo < s.hi && hi > s.lo) {
+        s.lo = lo > s.lo ? lo : s.lo;
+        s.hi = hi < s.hi ? hi : s.hi;
+    } else {
+        LOG_DEBUG("pack %d skew left [%lld, %lld) us, restarting\n", s.addr, (long long)s.lo, (long long)s.hi);
+        s.lo = lo;
+        s.hi = hi;
+    }
+    //the next probe reaches the pack when the middle of the interval crosses a second
+    mid = (s.lo + s.hi) / 2;
+    int64_t at = (rxUs + s.oneWayUs + RTC_PROBE_GAP_US + mid + US_PER_SEC - 1) / US_PER_SEC * US_PER_SEC - mid;
+    s.nextUs = at - s.oneWayUs;
+}
+
+int BmsRtcSync::pump(int64_t untilUs, Station *s)
+{
+    DfuFrame f;
+    for (;;) {
+        if (s != NULL && !s->pending) {
+            return 0;
+        }
+        auto now = std::chrono::steady_clock::now();
+        DfuDeadline wake = now + std::chrono::milliseconds(cfg.timeoutMs);
+        if (s == NULL) {
+            int64_t left = untilUs - now_us();
+            if (left <= 0) {
+                return 0;
+            }
+            wake = now + std::chrono::microseconds(left);
+        }
+        for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+            if (stations[i].pending && stations[i].deadline < wake) {
+                wake = stations[i].deadline;
+            }
+        }
+        int ret = t.receive(f, wake);
+        if (ret < 0) {
+            LOG_ERR("rtc sync receive failed\n");
+            return -1;
+        }
+        if (ret == 1 && (engine.useSop() || f.id == CAN_RSP_ID)) {
+            onFrame(f, now_us());
+            if (s == NULL) {
+                return 0;   //the caller may have to plan again
+            }
+            continue;
+        }
+        now = std::chrono::steady_clock::now();
+        for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+            Station &p = stations[i];
+            if (p.pending && p.deadline <= now) {
+                LOG_DEBUG("pack %d rtc answer timeout\n", p.addr);
+                p.pending = false;
+                if (engine.useSop()) {
+                    t.flush();
+                }
+            }
+        }
+    }
+}
+
+//packs are probed one by one, answers queued behind each other on the bus would only add to the round trip
+int BmsRtcSync::measure(void)
+{
+    phase = PHASE_MEASURE;
+    for (uint8_t p=0; p<cfg.probes; ++p) {
+        for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+            Station &s = stations[i];
+            if (sendField(s, SYS_GET_TIME, BMS_RTC_SECOND, 0) < 0 || pump(0, &s) < 0) {
+                return -1;
+            }
+        }
+    }
+    int cnt = 0;
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        Station &s = stations[i];
+        if (s.res.rttUs == UINT32_MAX) {
+            LOG_WARN("pack %d does not answer the rtc query\n", s.addr);
+            continue;
+        }
+        s.oneWayUs = s.res.rttUs / 2;
+        ++cnt;
+    }
+    return cnt;
+}
+
+//the second is parked at 0 first so it can not carry into the fields while they are written,
+//the fields are those of the coming boundary and the last frame restarts the second right on it
+int BmsRtcSync::setClocks(Station **group, uint8_t cnt)
+{
+    const bool lockstep = engine.useSop();
+    int64_t oneWay = 0;
+    for (uint8_t i=0; i<cnt; ++i) {
+        oneWay = group[i]->oneWayUs > oneWay ? group[i]->oneWayUs : oneWay;
+    }
+    int64_t lead = BMS_RTC_LEAD_MS * 1000LL + RTC_FIELD_CNT * cnt * oneWay * (lockstep ? 2 : 1);
+    int64_t target = (now_us() + lead + oneWay) / US_PER_SEC * US_PER_SEC + US_PER_SEC;
+    struct tm tm;
+    rtc_fields(target, cfg.utc, tm);
+    const uint8_t field[RTC_FIELD_CNT - 1] = {
+        BMS_RTC_SECOND, BMS_RTC_YEAR, BMS_RTC_MONTH, BMS_RTC_DAY, BMS_RTC_HOUR, BMS_RTC_MINUTE,
+    };
+    const uint16_t value[RTC_FIELD_CNT - 1] = {
+        0, (uint16_t)(tm.tm_year + 1900), (uint16_t)(tm.tm_mon + 1), (uint16_t)tm.tm_mday, (uint16_t)tm.tm_hour, (uint16_t)tm.tm_min,
+    };
+    for (uint8_t i=0; i<cnt; ++i) {
+        Station &s = *group[i];
+        s.acks = 0;
+        s.targetUs = target;
+        for (uint8_t k=0; k<RTC_FIELD_CNT - 1; ++k) {
+            if (sendField(s, SYS_SET_TIME, field[k], value[k]) < 0) {
+                return -1;
+            }
+            if (lockstep && pump(0, &s) < 0) {
+                return -1;
+            }
+        }
+    }
+    //the pack furthest away goes first
+    Station *order[BMS_RTC_MAX_ADDR];
+    memcpy(order, group, cnt * sizeof(Station *));
+    for (uint8_t i=1; i<cnt; ++i) {
+        for (uint8_t k=i; k>0 && order[k]->oneWayUs > order[k - 1]->oneWayUs; --k) {
+            Station *tmp = order[k];
+            order[k] = order[k - 1];
+            order[k - 1] = tmp;
+        }
+    }
+    for (uint8_t i=0; i<cnt; ++i) {
+        Station &s = *order[i];
+        int64_t at = target - s.oneWayUs;
+        while (now_us() < at) {
+            if (pump(at, NULL) < 0) {
+                return -1;
+            }
+        }
+        int64_t late = now_us() - at;
+        if (late > RTC_LATE_US) {
+            LOG_WARN("pack %d second set %lld us late\n", s.addr, (long long)late);
+        }
+        if (sendField(s, SYS_SET_TIME, BMS_RTC_SECOND, (uint16_t)tm.tm_sec) < 0) {
+            return -1;
+        }
+        if (lockstep && pump(0, &s) < 0) {
+            return -1;
+        }
+    }
+    int ok = 0;
+    for (uint8_t i=0; i<cnt; ++i) {
+        Station &s = *group[i];
+        if (pump(0, &s) < 0) {
+            return -1;
+        }
+        s.res.ok = s.acks == RTC_FIELD_CNT;
+        if (!s.res.ok) {
+            LOG_WARN("pack %d acknowledged %d of %d rtc fields\n", s.addr, s.acks, RTC_FIELD_CNT);
+        } else {
+            ++ok;
+        }
+    }
+    return ok;
+}
+
+//every answer bounds the skew to one second, the next probe is timed to split what is left in half
+int BmsRtcSync::verify(void)
+{
+    phase = PHASE_VERIFY;
+    int64_t now = now_us();
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        Station &s = stations[i];
+        s.steps = s.res.ok ? 0 : cfg.verifySteps;
+        s.lo = -BMS_RTC_SKEW_MAX_MS * 1000LL;
+        s.hi = BMS_RTC_SKEW_MAX_MS * 1000LL;
+        s.nextUs = now + i * 1000LL;
+    }
+    for (;;) {
+        Station *next = NULL;
+        Station *busy = NULL;
+        for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+            Station &s = stations[i];
+            if (s.pending) {
+                busy = &s;
+            } else if (s.steps < cfg.verifySteps && (next == NULL || s.nextUs < next->nextUs)) {
+                next = &s;
+            }
+        }
+        if (next == NULL && busy == NULL) {
+            break;
+        }
+        if (next == NULL || (busy != NULL && engine.useSop())) {
+            if (pump(0, busy) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (now_us() < next->nextUs) {
+            if (pump(next->nextUs, NULL) < 0) {
+                return -1;
+            }
+            continue;   //an answer may have moved a probe ahead of this one
+        }
+        if (sendField(*next, SYS_GET_TIME, BMS_RTC_SECOND, 0) < 0) {
+            return -1;
+        }
+        ++next->steps;
+        next->nextUs = next->txUs + US_PER_SEC;   //kept when the answer is lost
+    }
+    return 0;
+}
+
+int BmsRtcSync::sync(BmsRtcResult *res)
+{
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        Station &s = stations[i];
+        s = Station();
+        s.addr = cfg.addrs[i];
+        s.res.addr = s.addr;
+        s.res.rttUs = UINT32_MAX;
+        s.res.skewErrMs = 1000;
+    }
+    t.flush();
+    int live = measure();
+    if (live < 0) {
+        return -1;
+    }
+    Station *group[BMS_RTC_MAX_ADDR];
+    uint8_t cnt = 0;
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        if (stations[i].res.rttUs != UINT32_MAX) {
+            group[cnt++] = &stations[i];
+        }
+    }
+    int ok = 0;
+    if (engine.useSop()) {
+        for (uint8_t i=0; i<cnt; ++i) {
+            int ret = setClocks(&group[i], 1);
+            if (ret < 0) {
+                return -1;
+            }
+            ok += ret;
+        }
+    } else if (cnt > 0) {
+        ok = setClocks(group, cnt);
+        if (ok < 0) {
+            return -1;
+        }
+    }
+    if (cfg.verifySteps > 0 && verify() < 0) {
+        return -1;
+    }
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        Station &s = stations[i];
+        if (cfg.verifySteps > 0 && s.res.ok) {
+            s.res.skewMs = (int32_t)((s.lo + s.hi) / 2 / 1000);
+            s.res.skewErrMs = (uint32_t)((s.hi - s.lo) / 2000);
+        }
+        if (s.res.ok) {
+            LOG_INFO("pack %d rtc set, round trip %u us, skew %d +/- %u ms\n", s.addr, s.res.rttUs, s.res.skewMs, s.res.skewErrMs);
+        }
+        res[i] = s.res;
+    }
+    return ok;
+}
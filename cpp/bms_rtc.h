@@ -0,0 +1,89 @@
+#pragma once
+
+//RTC synchronisation of every pack on one bus with latency compensation
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include "transport.h"
+#include "dfu_engine.h"
+
+#define BMS_RTC_MAX_ADDR        64
+#define BMS_RTC_PROBES          4       //round trips measured per pack, the fastest one counts
+#define BMS_RTC_VERIFY_STEPS    8       //skew probes per pack, every one halves the uncertainty
+#define BMS_RTC_TIMEOUT_MS      200
+#define BMS_RTC_LEAD_MS         100     //margin before the second boundary the clocks are set on
+#define BMS_RTC_SKEW_MAX_MS     30000   //a pack further off is taken for a minute away
+
+//field of SYS_SET_TIME/SYS_GET_TIME, the year is 2 bytes
+#define BMS_RTC_YEAR            1
+#define BMS_RTC_MONTH           2
+#define BMS_RTC_DAY             3
+#define BMS_RTC_HOUR            4
+#define BMS_RTC_MINUTE          5
+#define BMS_RTC_SECOND          6
+
+//SYS_SET_TIME is answered with STA 0x43 and DATA = SYS_SET_TIME field,
+//SYS_GET_TIME with DATA = SYS_GET_TIME field value. Writing the second restarts the
+//sub-second count of the pack, so the clock is exact when that frame lands on a second boundary
+struct BmsRtcConfig {
+    uint8_t addrs[BMS_RTC_MAX_ADDR];
+    uint8_t addrCnt;
+    uint8_t probes;
+    uint8_t verifySteps;            //0 skips the skew check
+    uint32_t timeoutMs;
+    bool utc;                       //packs keep local time unless set
+};
+
+void bms_rtcDefaultConfig(BmsRtcConfig &cfg);
+
+struct BmsRtcResult {
+    uint8_t addr;
+    bool ok;                        //every field acknowledged
+    uint32_t rttUs;                 //fastest round trip of the query
+    int32_t skewMs;                 //pack clock minus host clock after the sync
+    uint32_t skewErrMs;             //skewMs is +/- this, 1000 when not checked
+};
+
+//on CAN every pack gets its fields in one burst and the seconds all land on the same boundary,
+//RS-485 has to wait for each answer so packs are set one after the other
+class BmsRtcSync {
+public:
+    explicit BmsRtcSync(DfuTransport &transport);
+
+    bool configure(const BmsRtcConfig &cfg);
+    //res holds addrCnt entries, returns the packs set, -1 on a transport error
+    int sync(BmsRtcResult *res);
+
+private:
+    struct Station {
+        uint8_t addr;
+        bool pending;               //query or field in flight
+        uint8_t acks;
+        uint8_t steps;
+        int64_t txUs;               //wall time the last frame went out
+        int64_t oneWayUs;
+        int64_t targetUs;           //second boundary the clock is set on
+        int64_t nextUs;             //wall time of the next skew probe
+        int64_t lo;                 //skew in us is in [lo, hi)
+        int64_t hi;
+        DfuDeadline deadline;
+        BmsRtcResult res;
+    };
+
+    int measure(void);
+    int setClocks(Station **group, uint8_t cnt);
+    int verify(void);
+    int sendField(Station &s, uint8_t sub, uint8_t field, uint16_t value);
+    //handles answers until the wall time untilUs or, when s is given, until s is answered
+    int pump(int64_t untilUs, Station *s);
+    void onFrame(const DfuFrame &f, int64_t rxUs);
+
+    DfuTransport &t;
+    DfuEngine engine;
+    BmsRtcConfig cfg;
+    Station stations[BMS_RTC_MAX_ADDR];
+    int8_t index[256];
+    uint8_t phase;
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+};
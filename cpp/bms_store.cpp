@@ -0,0 +1,412 @@
+//columnar time series of cell voltages and temperatures, kept in a memory mapped ring file
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "bms_store.h"
+#include "dfu_log.h"
+
+#define VARINT_MAX      10      //a 64 bit zigzag value
+#define SAMPLE_MAX      (VARINT_MAX + 5)    //time delta of delta and a 32 bit value delta
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, uint64_t &v)
+{
+    uint32_t shift = 0;
+    v = 0;
+    while (*p & 0x80) {
+        v |= (uint64_t)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    v |= (uint64_t)*p++ << shift;
+    return p;
+}
+
+static inline const uint8_t *next_sample(const uint8_t *p, uint64_t &t, int64_t &dt, int32_t &v)
+{
+    uint64_t u;
+    p = get_varint(p, u);
+    dt += unzigzag(u);
+    t += dt;
+    p = get_varint(p, u);
+    v = (int32_t)(v + unzigzag(u));
+    return p;
+}
+
+static size_t store_size(uint16_t signalCnt, uint32_t blocksPerSignal, uint16_t blockBytes)
+{
+    return sizeof(BmsStoreHdr) + (size_t)signalCnt * sizeof(BmsStoreSignal) +
+        (size_t)signalCnt * blocksPerSignal * (sizeof(BmsStoreBlock) + blockBytes);
+}
+
+BmsStore::BmsStore()
+    : hdr(NULL), sigs(NULL), blk(NULL), dat(NULL), mapSize(0)
+#ifdef _WIN32
+    , file(INVALID_HANDLE_VALUE), mapping(NULL)
+#else
+    , fd(-1)
+#endif
+{
+}
+
+BmsStore::~BmsStore()
+{
+    close();
+}
+
+bool BmsStore::map(const char *path, size_t size, bool create)
+{
+    void *p;
+#ifdef _WIN32
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (size == 0) {
+        LARGE_INTEGER n;
+        GetFileSizeEx(file, &n);
+        size = (size_t)n.QuadPart;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    p = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (p == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+#else
+    fd = ::open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (size == 0) {
+        struct stat st;
+        fstat(fd, &st);
+        size = (size_t)st.st_size;
+    } else if (ftruncate(fd, size) < 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+#endif
+    mapSize = size;
+    hdr = (BmsStoreHdr *)p;
+    return true;
+}
+
+void BmsStore::unmap(void)
+{
+#ifdef _WIN32
+    FlushViewOfFile(hdr, mapSize);
+    UnmapViewOfFile(hdr);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+#else
+    msync(hdr, mapSize, MS_SYNC);
+    munmap(hdr, mapSize);
+    ::close(fd);
+    fd = -1;
+#endif
+    hdr = NULL;
+    sigs = NULL;
+    blk = NULL;
+    dat = NULL;
+    mapSize = 0;
+}
+
+bool BmsStore::create(const char *path, const uint8_t *addrs, uint8_t packCnt, uint8_t cellCnt, uint32_t blocksPerSignal)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (hdr != NULL || packCnt == 0 || packCnt > BMS_TELEMETRY_MAX_ADDR || cellCnt == 0 || cellCnt > BMS_TELEMETRY_MAX_CELLS) {
+        LOG_ERR("could not create store of %d packs and %d cells\n", packCnt, cellCnt);
+        return false;
+    }
+    if (blocksPerSignal == 0) {
+        blocksPerSignal = BMS_STORE_DEFAULT_BLOCKS;
+    }
+    uint16_t signalCnt = (uint16_t)(packCnt * (cellCnt + BMS_STORE_TEMP_CNT));
+    if (!map(path, store_size(signalCnt, blocksPerSignal, BMS_STORE_BLOCK_BYTES), true)) {
+        LOG_ERR("could not map store file %s\n", path);
+        return false;
+    }
+    memset(hdr, 0x00, sizeof(BmsStoreHdr));
+    hdr->magic = BMS_STORE_MAGIC;
+    hdr->version = BMS_STORE_VERSION;
+    hdr->blockBytes = BMS_STORE_BLOCK_BYTES;
+    hdr->blocksPerSignal = blocksPerSignal;
+    hdr->signalCnt = signalCnt;
+    hdr->packCnt = packCnt;
+    hdr->cellCnt = cellCnt;
+    memcpy(hdr->addrs, addrs, packCnt);
+    sigs = (BmsStoreSignal *)(hdr + 1);
+    blk = (BmsStoreBlock *)(sigs + signalCnt);
+    dat = (uint8_t *)(blk + (size_t)signalCnt * blocksPerSignal);
+    for (uint16_t i=0; i<signalCnt; ++i) {
+        BmsStoreSignal &s = sigs[i];
+        uint8_t k = (uint8_t)(i % (cellCnt + BMS_STORE_TEMP_CNT));
+        memset(&s, 0x00, sizeof(s));
+        s.addr = addrs[i / (cellCnt + BMS_STORE_TEMP_CNT)];
+        s.kind = k < cellCnt ? BMS_SIG_VOLT : BMS_SIG_TEMP;
+        s.index = k < cellCnt ? k : (uint8_t)(k - cellCnt);
+    }
+    return true;
+}
+
+bool BmsStore::open(const char *path)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (hdr != NULL || !map(path, 0, false)) {
+        LOG_ERR("could not map store file %s\n", path);
+        return false;
+    }
+    if (mapSize < sizeof(BmsStoreHdr) || hdr->magic != BMS_STORE_MAGIC || hdr->version != BMS_STORE_VERSION ||
+        mapSize != store_size(hdr->signalCnt, hdr->blocksPerSignal, hdr->blockBytes)) {
+        LOG_ERR("%s is not a version %d store file\n", path, BMS_STORE_VERSION);
+        unmap();
+        return false;
+    }
+    sigs = (BmsStoreSignal *)(hdr + 1);
+    blk = (BmsStoreBlock *)(sigs + hdr->signalCnt);
+    dat = (uint8_t *)(blk + (size_t)hdr->signalCnt * hdr->blocksPerSignal);
+    return true;
+}
+
+void BmsStore::close(void)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (hdr != NULL) {
+        unmap();
+    }
+}
+
+BmsStoreBlock *BmsStore::blocks(int signal) const
+{
+    return blk + (size_t)signal * hdr->blocksPerSignal;
+}
+
+uint8_t *BmsStore::data(int signal, uint64_t block) const
+{
+    return dat + ((size_t)signal * hdr->blocksPerSignal + block % hdr->blocksPerSignal) * hdr->blockBytes;
+}
+
+int BmsStore::signalId(uint8_t addr, uint8_t kind, uint8_t index) const
+{
+    if (hdr == NULL || (kind == BMS_SIG_VOLT ? index >= hdr->cellCnt : index >= BMS_STORE_TEMP_CNT)) {
+        return -1;
+    }
+    for (uint8_t i=0; i<hdr->packCnt; ++i) {
+        if (hdr->addrs[i] == addr) {
+            return i * (hdr->cellCnt + BMS_STORE_TEMP_CNT) + (kind == BMS_SIG_VOLT ? index : hdr->cellCnt + index);
+        }
+    }
+    return -1;
+}
+
+//the first sample of a block is kept in its summary, the others as varint zigzag deltas
+bool BmsStore::append(int signal, uint64_t timeMs, int32_t value)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (hdr == NULL || signal < 0 || signal >= hdr->signalCnt) {
+        return false;
+    }
+    BmsStoreSignal &s = sigs[signal];
+    if (timeMs < s.lastT) {
+        timeMs = s.lastT;
+    }
+    BmsStoreBlock *b = s.head ? &blocks(signal)[(s.head - 1) % hdr->blocksPerSignal] : NULL;
+    if (b == NULL || b->count == UINT16_MAX || b->bytes + SAMPLE_MAX > hdr->blockBytes) {
+        b = &blocks(signal)[s.head % hdr->blocksPerSignal];     //oldest block of the ring is dropped
+        ++s.head;
+        b->t0 = timeMs;
+        b->t1 = timeMs;
+        b->v0 = value;
+        b->min = value;
+        b->max = value;
+        b->sum = value;
+        b->count = 1;
+        b->bytes = 0;
+        s.lastT = timeMs;
+        s.lastDt = 0;
+        s.lastV = value;
+        return true;
+    }
+    int64_t dt = (int64_t)(timeMs - s.lastT);
+    uint8_t *p = data(signal, s.head - 1) + b->bytes;
+    uint8_t *e = put_varint(p, zigzag(dt - s.lastDt));
+    e = put_varint(e, zigzag((int64_t)value - s.lastV));
+    b->bytes = (uint16_t)(b->bytes + (e - p));
+    b->t1 = timeMs;
+    b->min = value < b->min ? value : b->min;
+    b->max = value > b->max ? value : b->max;
+    b->sum += value;
+    ++b->count;
+    s.lastT = timeMs;
+    s.lastDt = dt;
+    s.lastV = value;
+    return true;
+}
+
+void BmsStore::record(const BmsSnapshot &snap)
+{
+    int base = signalId(snap.addr, BMS_SIG_VOLT, 0);
+    if (base < 0) {
+        return;
+    }
+    if (snap.valid & BMS_INFO_VOLT) {
+        uint8_t n = snap.volt.cellCnt < hdr->cellCnt ? snap.volt.cellCnt : hdr->cellCnt;
+        for (uint8_t i=0; i<n; ++i) {
+            append(base + i, snap.timeMs, snap.volt.cell[i]);
+        }
+    }
+    if (snap.valid & BMS_INFO_TEMP) {
+        int t = base + hdr->cellCnt;
+        append(t, snap.timeMs, snap.temp.cellMin);
+        append(t + 1, snap.timeMs, snap.temp.cellMax);
+        append(t + 2, snap.timeMs, snap.temp.mos);
+        append(t + 3, snap.timeMs, snap.temp.ambient);
+    }
+}
+
+//blocks of a signal are in time order, so the first one ending at or after fromMs is found by bisection
+uint64_t BmsStore::firstBlock(int signal, uint64_t fromMs) const
+{
+    const BmsStoreSignal &s = sigs[signal];
+    const BmsStoreBlock *b = blocks(signal);
+    uint64_t lo = s.head > hdr->blocksPerSignal ? s.head - hdr->blocksPerSignal : 0;
+    uint64_t hi = s.head;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (b[mid % hdr->blocksPerSignal].t1 < fromMs) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool BmsStore::query(int signal, uint64_t fromMs, uint64_t toMs, BmsStoreStat &st)
+{
+    std::lock_guard<std::mutex> g(lock);
+    memset(&st, 0x00, sizeof(st));
+    if (hdr == NULL || signal < 0 || signal >= hdr->signalCnt) {
+        return false;
+    }
+    const BmsStoreBlock *bs = blocks(signal);
+    int64_t sum = 0;
+    uint64_t cnt = 0;
+    for (uint64_t i=firstBlock(signal, fromMs); i<sigs[signal].head; ++i) {
+        const BmsStoreBlock &b = bs[i % hdr->blocksPerSignal];
+        if (b.t0 > toMs) {
+            break;
+        }
+        if (b.t0 >= fromMs && b.t1 <= toMs) {   //whole block from the summary
+            st.min = (cnt == 0 || b.min < st.min) ? b.min : st.min;
+            st.max = (cnt == 0 || b.max > st.max) ? b.max : st.max;
+            sum += b.sum;
+            cnt += b.count;
+            continue;
+        }
+        const uint8_t *p = data(signal, i);
+        uint64_t t = b.t0;
+        int64_t dt = 0;
+        int32_t v = b.v0;
+        for (uint16_t k=0; k<b.count; ++k) {
+            if (k != 0) {
+                p = next_sample(p, t, dt, v);
+            }
+            if (t > toMs) {
+                break;
+            }
+            if (t >= fromMs) {
+                st.min = (cnt == 0 || v < st.min) ? v : st.min;
+                st.max = (cnt == 0 || v > st.max) ? v : st.max;
+                sum += v;
+                ++cnt;
+            }
+        }
+    }
+    st.count = (uint32_t)cnt;
+    st.avg = cnt ? (double)sum / cnt : 0.0;
+    return cnt != 0;
+}
+
+int BmsStore::read(int signal, uint64_t fromMs, uint64_t toMs, uint64_t *timeMs, int32_t *value, int maxCnt)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (hdr == NULL || signal < 0 || signal >= hdr->signalCnt) {
+        return 0;
+    }
+    const BmsStoreBlock *bs = blocks(signal);
+    int n = 0;
+    for (uint64_t i=firstBlock(signal, fromMs); i<sigs[signal].head && n<maxCnt; ++i) {
+        const BmsStoreBlock &b = bs[i % hdr->blocksPerSignal];
+        if (b.t0 > toMs) {
+            break;
+        }
+        const uint8_t *p = data(signal, i);
+        uint64_t t = b.t0;
+        int64_t dt = 0;
+        int32_t v = b.v0;
+        for (uint16_t k=0; k<b.count && n<maxCnt; ++k) {
+            if (k != 0) {
+                p = next_sample(p, t, dt, v);
+            }
+            if (t > toMs) {
+                break;
+            }
+            if (t >= fromMs) {
+                timeMs[n] = t;
+                value[n] = v;
+                ++n;
+            }
+        }
+    }
+    return n;
+}
+
+void bms_storeSnapshot(const BmsSnapshot *snap, void *ctx)
+{
+    ((BmsStore *)ctx)->record(*snap);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+//columnar time series of cell voltages and temperatures, kept in a memory mapped ring file
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <mutex>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#include "bms_telemetry.h"
+
+#define BMS_STORE_MAGIC             0x53534D42  //"BMSS"
+#define BMS_STORE_VERSION           1
+#define BMS_STORE_BLOCK_BYTES       256         //~120 samples at 10Hz of slowly moving values
+#define BMS_STORE_DEFAULT_BLOCKS    1024
+#define BMS_STORE_TEMP_CNT          4           //cellMin, cellMax, mos, ambient of BmsTempInfo
+
+//signal kinds, every pack has cellCnt voltages followed by BMS_STORE_TEMP_CNT temperatures
+#define BMS_SIG_VOLT                0
+#define BMS_SIG_TEMP                1
+
+//summary of one compressed block, a scan reads these and decodes only the blocks cut by the window
+struct BmsStoreBlock {
+    uint64_t t0;            //ms of the first sample, its value is v0 and takes no bytes
+    uint64_t t1;            //ms of the last sample
+    int64_t sum;
+    int32_t v0;
+    int32_t min;
+    int32_t max;
+    uint16_t count;
+    uint16_t bytes;         //of delta data in the block
+};
+
+//append state, kept in the file so a reopened store goes on where it stopped
+struct BmsStoreSignal {
+    uint64_t head;          //blocks ever started, the ring keeps the last blocksPerSignal of them
+    uint64_t lastT;
+    int64_t lastDt;
+    int32_t lastV;
+    uint8_t addr;
+    uint8_t kind;
+    uint8_t index;          //cell or temperature of the pack
+    uint8_t rsv;
+};
+
+struct BmsStoreHdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t blockBytes;
+    uint32_t blocksPerSignal;
+    uint16_t signalCnt;
+    uint8_t packCnt;
+    uint8_t cellCnt;
+    uint8_t addrs[BMS_TELEMETRY_MAX_ADDR];
+};
+
+static_assert(sizeof(BmsStoreBlock) == 40, "store block layout changed");
+static_assert(sizeof(BmsStoreSignal) == 32, "store signal layout changed");
+static_assert(sizeof(BmsStoreHdr) == 80, "store header layout changed");
+
+struct BmsStoreStat {
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    double avg;
+};
+
+//one writer (the telemetry thread) and any number of readers, calls are serialized by a lock
+class BmsStore {
+public:
+    BmsStore();
+    ~BmsStore();
+
+    //a new file of packCnt * (cellCnt + 4) signals with blocksPerSignal blocks each, 0 takes the default
+    bool create(const char *path, const uint8_t *addrs, uint8_t packCnt, uint8_t cellCnt, uint32_t blocksPerSignal);
+    //an existing file, to go on recording or to read a finished soak test
+    bool open(const char *path);
+    void close(void);
+
+    //-1 when the pack or the signal is not in the store
+    int signalId(uint8_t addr, uint8_t kind, uint8_t index) const;
+    int signalCnt(void) const { return hdr ? hdr->signalCnt : 0; }
+    //times of one signal go forward, an older sample is taken as the last time
+    bool append(int signal, uint64_t timeMs, int32_t value);
+    //voltages and temperatures of one snapshot, the other parts are ignored
+    void record(const BmsSnapshot &snap);
+
+    //min/max/avg over [fromMs, toMs], false when no sample is in the window
+    bool query(int signal, uint64_t fromMs, uint64_t toMs, BmsStoreStat &st);
+    //samples in [fromMs, toMs] oldest first, returns how many were written
+    int read(int signal, uint64_t fromMs, uint64_t toMs, uint64_t *timeMs, int32_t *value, int maxCnt);
+    //bytes of the file, the store never takes more
+    size_t size(void) const { return mapSize; }
+
+private:
+    bool map(const char *path, size_t size, bool create);
+    void unmap(void);
+    BmsStoreBlock *blocks(int signal) const;
+    uint8_t *data(int signal, uint64_t block) const;
+    uint64_t firstBlock(int signal, uint64_t fromMs) const;
+
+    BmsStoreHdr *hdr;
+    BmsStoreSignal *sigs;
+    BmsStoreBlock *blk;
+    uint8_t *dat;
+    size_t mapSize;
+    std::mutex lock;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+//BmsTelemetryCb that records into the BmsStore passed as ctx
+void bms_storeSnapshot(const BmsSnapshot *snap, void *ctx);
@@ -0,0 +1,363 @@
+//round-robin polling of the application info commands over every pack on one bus
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <chrono>
+#include "bms_telemetry.h"
+#include "dfu_log.h"
+
+#define CAN_FRAME_BITS      135     //8 byte standard frame with worst case stuffing and the inter frame space
+#define UART_BYTE_BITS      10
+
+//index i is BMS_INFO bit i, 0 length is 2 bytes per cell
+static const uint8_t infoCmd[BMS_INFO_CNT] = {
+    DFU_GET_BATINFO, DFU_GET_CURINFO, DFU_GET_TEMPINFO, DFU_GET_VOLTINFO, DFU_GET_SOCINFO, DFU_GET_PCSINFO,
+};
+static const uint8_t infoLen[BMS_INFO_CNT] = { 12, 8, 8, 0, 12, 8 };
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void bms_decode(int info, const uint8_t *p, uint8_t cellCnt, BmsSnapshot &snap)
+{
+    switch (info) {
+    case 0:
+        snap.bat.voltage = rd16(p);
+        snap.bat.current = (int16_t)rd16(p + 2);
+        snap.bat.soc = rd16(p + 4);
+        snap.bat.soh = rd16(p + 6);
+        snap.bat.cycles = rd16(p + 8);
+        snap.bat.alarm = rd16(p + 10);
+        break;
+    case 1:
+        snap.cur.current = (int16_t)rd16(p);
+        snap.cur.chargeLimit = (int16_t)rd16(p + 2);
+        snap.cur.dischargeLimit = (int16_t)rd16(p + 4);
+        snap.cur.chargeVoltage = rd16(p + 6);
+        break;
+    case 2:
+        snap.temp.cellMin = (int16_t)rd16(p);
+        snap.temp.cellMax = (int16_t)rd16(p + 2);
+        snap.temp.mos = (int16_t)rd16(p + 4);
+        snap.temp.ambient = (int16_t)rd16(p + 6);
+        break;
+    case 3:
+        snap.volt.cellCnt = cellCnt;
+        for (uint8_t i=0; i<cellCnt; ++i) {
+            snap.volt.cell[i] = rd16(p + 2 * i);
+        }
+        break;
+    case 4:
+        snap.soc.soc = rd16(p);
+        snap.soc.soh = rd16(p + 2);
+        snap.soc.remainCap = rd32(p + 4);
+        snap.soc.fullCap = rd32(p + 8);
+        break;
+    case 5:
+        snap.pcs.chargeVoltage = rd16(p);
+        snap.pcs.chargeCurrent = (int16_t)rd16(p + 2);
+        snap.pcs.dischargeCurrent = (int16_t)rd16(p + 4);
+        snap.pcs.flags = rd16(p + 6);
+        break;
+    default:
+        break;
+    }
+}
+
+void bms_defaultConfig(BmsTelemetryConfig &cfg)
+{
+    memset(&cfg, 0x00, sizeof(cfg));
+    cfg.infoMask = BMS_INFO_ALL;
+    cfg.cellCnt = 16;
+    cfg.window = BMS_TELEMETRY_WINDOW;
+    cfg.refreshMs = BMS_TELEMETRY_REFRESH_MS;
+    cfg.timeoutMs = BMS_TELEMETRY_TIMEOUT_MS;
+    cfg.bitRate = 500000;
+    cfg.loadPct = BMS_TELEMETRY_LOAD_PCT;
+}
+
+BmsTelemetry::BmsTelemetry(DfuTransport &transport)
+    : t(transport), engine(transport), subCnt(0), inFlight(0), open(0), complete(0), round(0), running(false), overrun(0)
+{
+    bms_defaultConfig(cfg);
+    memset(index, -1, sizeof(index));
+}
+
+BmsTelemetry::~BmsTelemetry()
+{
+    stop();
+}
+
+bool BmsTelemetry::subscribe(BmsTelemetryCb cb, void *ctx)
+{
+    if (running.load() || subCnt >= BMS_TELEMETRY_MAX_SUBS) {
+        LOG_ERR("could not add telemetry subscriber\n");
+        return false;
+    }
+    subs[subCnt] = cb;
+    subCtx[subCnt] = ctx;
+    ++subCnt;
+    return true;
+}
+
+bool BmsTelemetry::configure(const BmsTelemetryConfig &c)
+{
+    if (running.load()) {
+        LOG_ERR("stop telemetry before changing its config\n");
+        return false;
+    }
+    if (c.addrCnt == 0 || c.addrCnt > BMS_TELEMETRY_MAX_ADDR || c.cellCnt == 0 ||
+        c.cellCnt > BMS_TELEMETRY_MAX_CELLS || (c.infoMask & BMS_INFO_ALL) == 0) {
+        LOG_ERR("illegal telemetry config, %d packs, %d cells, info mask 0x%02X\n", c.addrCnt, c.cellCnt, c.infoMask);
+        return false;
+    }
+    cfg = c;
+    cfg.infoMask &= BMS_INFO_ALL;
+    if (t.caps().link == DFU_LINK_SERIAL || cfg.window == 0) {
+        cfg.window = 1;     //RS-485 is half duplex, two packs answering at once collide
+    } else if (cfg.window > BMS_TELEMETRY_MAX_WINDOW) {
+        cfg.window = BMS_TELEMETRY_MAX_WINDOW;
+    }
+    if (cfg.loadPct == 0 || cfg.loadPct > 100) {
+        cfg.loadPct = 100;
+    }
+    memset(index, -1, sizeof(index));
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        index[cfg.addrs[i]] = (int8_t)i;
+        stations[i].addr = cfg.addrs[i];
+    }
+    if (cfg.bitRate != 0) {
+        uint64_t roundUs = 0;     //already stretched by loadPct
+        for (int i=0; i<BMS_INFO_CNT; ++i) {
+            if (cfg.infoMask & (1U << i)) {
+                roundUs += (uint64_t)queryAirUs(i) * cfg.addrCnt;
+            }
+        }
+        if (roundUs > (uint64_t)cfg.refreshMs * 1000) {
+            LOG_WARN("%d packs need %u ms per round at %d%% bus load, more than the %u ms refresh\n",
+                cfg.addrCnt, (uint32_t)(roundUs / 1000), cfg.loadPct, cfg.refreshMs);
+        }
+    }
+    return true;
+}
+
+uint16_t BmsTelemetry::payloadLen(int info) const
+{
+    return infoLen[info] != 0 ? infoLen[info] : (uint16_t)(cfg.cellCnt * 2);
+}
+
+//query and its answer on the wire, stretched by loadPct when queries are spaced
+uint32_t BmsTelemetry::queryAirUs(int info) const
+{
+    uint16_t len = payloadLen(info);
+    uint64_t bits;
+    if (t.caps().link == DFU_LINK_CAN) {
+        bits = (uint64_t)(1 + (len + 3) / 4) * CAN_FRAME_BITS;     //4 payload bytes after LEN ADR STA seq
+    } else {
+        uint16_t perFrame = (uint16_t)(t.caps().maxPayload - 9);    //SOP LEN ADR STA seq CRC CRC EOP
+        uint16_t frames = (uint16_t)((len + perFrame - 1) / perFrame);
+        bits = (uint64_t)(RS485_FRAME_LEN(bmsQueryCmd[CMD_LEN_OFFSET]) + len + frames * 8) * UART_BYTE_BITS;
+    }
+    return (uint32_t)(bits * 1000000 * 100 / ((uint64_t)cfg.bitRate * cfg.loadPct));
+}
+
+bool BmsTelemetry::issue(Station &s, DfuDeadline now)
+{
+    int info = 0;
+    while (!(s.pending & (1U << info))) {
+        ++info;
+    }
+    s.pending &= (uint8_t)~(1U << info);
+    dfu_loadCmd(cmd, bmsQueryCmd);
+    cmd[CMD_DAT_OFFSET] = infoCmd[info];
+    cmd[CMD_DAT_OFFSET + 1] = 0;
+    cmd[CMD_DAT_OFFSET + 2] = (uint8_t)(cfg.cellCnt - 1);
+    if (engine.sendCmd(cmd, s.addr) < 0) {
+        s.pending = 0;
+        return false;
+    }
+    s.info = (int8_t)info;
+    s.seq = 1;
+    s.got = 0;
+    s.deadline = now + std::chrono::milliseconds(cfg.timeoutMs);
+    ++inFlight;
+    if (cfg.bitRate != 0) {
+        nextSend = now + std::chrono::microseconds(queryAirUs(info));
+    }
+    return true;
+}
+
+void BmsTelemetry::publish(Station &s)
+{
+    s.snap.timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (s.snap.valid == cfg.infoMask) {
+        ++complete;
+    }
+    for (int i=0; i<subCnt; ++i) {
+        subs[i](&s.snap, subCtx[i]);
+    }
+}
+
+//a pack that missed one answer is not asked again in this round, a silent pack costs one timeout
+void BmsTelemetry::finish(Station &s, bool ok)
+{
+    if (ok) {
+        bms_decode(s.info, s.buf, cfg.cellCnt, s.snap);
+        s.snap.valid |= (uint8_t)(1U << s.info);
+    } else if (s.pending != 0) {
+        s.pending = 0;
+        --open;
+    }
+    s.info = -1;
+    --inFlight;
+    if (s.pending == 0) {
+        publish(s);
+    }
+}
+
+void BmsTelemetry::onFrame(const DfuFrame &f)
+{
+    const uint8_t *b = engine.body(f);
+    int8_t i = index[b[RSP_ADR_OFFSET - 1]];
+    if (i < 0 || stations[i].info < 0 || b[RSP_STA_OFFSET - 1] != DFU_BMS_QUERY + 0x40 || b[0] < 3) {
+        return;     //late answer of a timed out query or traffic of another tool
+    }
+    Station &s = stations[i];
+    const uint8_t *dat = b + RSP_DAT_OFFSET - 1;
+    uint8_t n = (uint8_t)(b[0] - 3);    //ADR STA seq
+    if (dat[0] != s.seq) {
+        LOG_WARN("pack %d info 0x%02X frame %d out of order, expected %d\n", s.addr, infoCmd[s.info], dat[0], s.seq);
+        finish(s, false);
+        return;
+    }
+    uint16_t len = payloadLen(s.info);
+    n = (uint8_t)(n > len - s.got ? len - s.got : n);
+    memcpy(s.buf + s.got, dat + 1, n);
+    s.got += n;
+    ++s.seq;
+    s.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(cfg.timeoutMs);
+    if (s.got >= len) {
+        finish(s, true);
+    }
+}
+
+int BmsTelemetry::poll(void)
+{
+    ++round;
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        Station &s = stations[i];
+        s.pending = cfg.infoMask;
+        s.info = -1;
+        memset(&s.snap, 0x00, sizeof(s.snap));
+        s.snap.addr = s.addr;
+        s.snap.round = round;
+    }
+    inFlight = 0;
+    complete = 0;
+    open = cfg.addrCnt;
+    nextSend = std::chrono::steady_clock::now();
+    //every pack gets one query in turn, so the window holds different packs and answers match by address
+    int rr = 0;
+    DfuFrame f;
+    while (open > 0 || inFlight > 0) {
+        auto now = std::chrono::steady_clock::now();
+        while (open > 0 && inFlight < cfg.window && now >= nextSend) {
+            int n = 0;
+            while (n < cfg.addrCnt && (stations[rr].info >= 0 || stations[rr].pending == 0)) {
+                rr = (rr + 1) % cfg.addrCnt;
+                ++n;
+            }
+            if (n == cfg.addrCnt) {
+                break;      //the packs left are all waiting for an answer
+            }
+            Station &s = stations[rr];
+            rr = (rr + 1) % cfg.addrCnt;
+            if (!issue(s, now)) {
+                publish(s);
+            }
+            if (s.pending == 0) {
+                --open;
+            }
+        }
+        DfuDeadline wake = now + std::chrono::milliseconds(cfg.timeoutMs);
+        for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+            if (stations[i].info >= 0 && stations[i].deadline < wake) {
+                wake = stations[i].deadline;
+            }
+        }
+        if (open > 0 && inFlight < cfg.window && nextSend > now && nextSend < wake) {
+            wake = nextSend;
+        }
+        int ret = t.receive(f, wake);
+        if (ret < 0) {
+            LOG_ERR("telemetry receive failed\n");
+            return -1;
+        }
+        if (ret == 1 && (engine.useSop() || f.id == CAN_RSP_ID)) {
+            onFrame(f);
+            continue;
+        }
+        now = std::chrono::steady_clock::now();
+        for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+            Station &s = stations[i];
+            if (s.info >= 0 && s.deadline <= now) {
+                LOG_DEBUG("pack %d info 0x%02X timeout\n", s.addr, infoCmd[s.info]);
+                finish(s, false);
+                if (engine.useSop()) {
+                    t.flush();      //a late answer would be taken for the next pack
+                }
+            }
+        }
+    }
+    return complete;
+}
+
+void BmsTelemetry::run(void)
+{
+    auto next = std::chrono::steady_clock::now();
+    while (running.load()) {
+        if (poll() < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(cfg.timeoutMs));
+        }
+        next += std::chrono::milliseconds(cfg.refreshMs);
+        auto now = std::chrono::steady_clock::now();
+        if (now > next) {
+            if (overrun++ == 0) {
+                LOG_WARN("telemetry round %u took longer than %u ms\n", round, cfg.refreshMs);
+            }
+            next = now;     //start the next round at once instead of catching up
+            continue;
+        }
+        while (running.load() && std::chrono::steady_clock::now() < next) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+bool BmsTelemetry::start(void)
+{
+    if (running.load() || cfg.addrCnt == 0) {
+        LOG_ERR("telemetry is running or not configured\n");
+        return false;
+    }
+    running.store(true);
+    worker = std::thread(&BmsTelemetry::run, this);
+    return true;
+}
+
+void BmsTelemetry::stop(void)
+{
+    running.store(false);
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
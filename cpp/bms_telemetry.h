@@ -0,0 +1,160 @@
+#pragma once
+
+//round-robin polling of the application info commands over every pack on one bus
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "transport.h"
+#include "dfu_engine.h"
+
+#define BMS_TELEMETRY_MAX_ADDR      64
+#define BMS_TELEMETRY_MAX_CELLS     32
+#define BMS_TELEMETRY_MAX_SUBS      8
+#define BMS_TELEMETRY_MAX_WINDOW    16
+#define BMS_TELEMETRY_WINDOW        8       //queries in flight on CAN, RS-485 always waits for the answer
+#define BMS_TELEMETRY_REFRESH_MS    500
+#define BMS_TELEMETRY_TIMEOUT_MS    200
+#define BMS_TELEMETRY_LOAD_PCT      50      //share of the bus the polling may take
+#define BMS_TELEMETRY_PAYLOAD_MAX   (BMS_TELEMETRY_MAX_CELLS * 2)
+
+//bits of BmsTelemetryConfig.infoMask and BmsSnapshot.valid
+#define BMS_INFO_BAT                0x01    //DFU_GET_BATINFO
+#define BMS_INFO_CUR                0x02    //DFU_GET_CURINFO
+#define BMS_INFO_TEMP               0x04    //DFU_GET_TEMPINFO
+#define BMS_INFO_VOLT               0x08    //DFU_GET_VOLTINFO
+#define BMS_INFO_SOC                0x10    //DFU_GET_SOCINFO
+#define BMS_INFO_PCS                0x20    //DFU_GET_PCSINFO
+#define BMS_INFO_ALL                0x3F
+#define BMS_INFO_CNT                6
+
+//DFU_BMS_QUERY is answered with STA 0xD8 and DATA = frame seq (from 1) + payload,
+//the payload is little endian in the field order below and split over as many frames as needed
+struct BmsBatInfo {                 //12 bytes
+    uint16_t voltage;               //10mV
+    int16_t current;                //10mA, charge is positive
+    uint16_t soc;                   //0.1%
+    uint16_t soh;                   //0.1%
+    uint16_t cycles;
+    uint16_t alarm;                 //alarm flags
+};
+
+struct BmsCurInfo {                 //8 bytes
+    int16_t current;                //10mA
+    int16_t chargeLimit;            //10mA
+    int16_t dischargeLimit;         //10mA
+    uint16_t chargeVoltage;         //10mV
+};
+
+struct BmsTempInfo {                //8 bytes
+    int16_t cellMin;                //0.1C
+    int16_t cellMax;                //0.1C
+    int16_t mos;                    //0.1C
+    int16_t ambient;                //0.1C
+};
+
+struct BmsVoltInfo {                //2 bytes per cell asked
+    uint8_t cellCnt;
+    uint16_t cell[BMS_TELEMETRY_MAX_CELLS];    //mV
+};
+
+struct BmsSocInfo {                 //12 bytes
+    uint16_t soc;                   //0.1%
+    uint16_t soh;                   //0.1%
+    uint32_t remainCap;             //mAh
+    uint32_t fullCap;               //mAh
+};
+
+struct BmsPcsInfo {                 //8 bytes
+    uint16_t chargeVoltage;         //10mV requested from the PCS
+    int16_t chargeCurrent;          //10mA requested from the PCS
+    int16_t dischargeCurrent;       //10mA allowed
+    uint16_t flags;
+};
+
+//one pack after one round, only the parts flagged in valid are current
+struct BmsSnapshot {
+    uint8_t addr;
+    uint8_t valid;
+    uint32_t round;
+    uint64_t timeMs;                //unix time when the last answer of the pack came in
+    BmsBatInfo bat;
+    BmsCurInfo cur;
+    BmsTempInfo temp;
+    BmsVoltInfo volt;
+    BmsSocInfo soc;
+    BmsPcsInfo pcs;
+};
+
+//runs on the polling thread, snap is only valid during the call
+typedef void (*BmsTelemetryCb)(const BmsSnapshot *snap, void *ctx);
+
+struct BmsTelemetryConfig {
+    uint8_t addrs[BMS_TELEMETRY_MAX_ADDR];
+    uint8_t addrCnt;
+    uint8_t infoMask;
+    uint8_t cellCnt;                //cells asked with DFU_GET_VOLTINFO
+    uint8_t window;                 //queries in flight, forced to 1 on RS-485
+    uint32_t refreshMs;             //start of one round to the start of the next
+    uint32_t timeoutMs;             //for the first frame and between frames of one answer
+    uint32_t bitRate;               //of the bus, 0 turns the pacing off
+    uint8_t loadPct;                //queries are spaced so the polling stays under this share of the bus
+};
+
+void bms_defaultConfig(BmsTelemetryConfig &cfg);
+
+//owns the transport while polling, upgrades have to wait for stop()
+class BmsTelemetry {
+public:
+    explicit BmsTelemetry(DfuTransport &transport);
+    ~BmsTelemetry();
+
+    //subscribers are added before start()
+    bool subscribe(BmsTelemetryCb cb, void *ctx);
+    bool configure(const BmsTelemetryConfig &cfg);
+    bool start(void);
+    void stop(void);
+    //one round over every pack on the calling thread, returns the packs that answered every query
+    int poll(void);
+    uint32_t overruns(void) const { return overrun; }
+
+private:
+    struct Station {
+        uint8_t addr;
+        uint8_t pending;            //info bits not asked yet in this round
+        int8_t info;                //index of the query in flight, -1 when none
+        uint8_t seq;                //frame seq expected next
+        uint16_t got;               //payload bytes collected
+        DfuDeadline deadline;
+        uint8_t buf[BMS_TELEMETRY_PAYLOAD_MAX];
+        BmsSnapshot snap;
+    };
+
+    bool issue(Station &s, DfuDeadline now);
+    void onFrame(const DfuFrame &f);
+    void finish(Station &s, bool ok);
+    void publish(Station &s);
+    uint16_t payloadLen(int info) const;
+    uint32_t queryAirUs(int info) const;
+    void run(void);
+
+    DfuTransport &t;
+    DfuEngine engine;
+    BmsTelemetryConfig cfg;
+    Station stations[BMS_TELEMETRY_MAX_ADDR];
+    int8_t index[256];              //address to station
+    BmsTelemetryCb subs[BMS_TELEMETRY_MAX_SUBS];
+    void *subCtx[BMS_TELEMETRY_MAX_SUBS];
+    int subCnt;
+    int inFlight;
+    int open;                       //packs with queries not sent yet
+    int complete;
+    uint32_t round;
+    DfuDeadline nextSend;
+    uint8_t cmd[16];
+    std::atomic<bool> running;
+    std::thread worker;
+    uint32_t overrun;
+};
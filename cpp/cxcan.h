@@ -5,6 +5,8 @@
 //Date : Dec 02, 2026
 
 #include <stdint.h>
+#include "transport.h"
+#include <atomic>
 
 //constants
 #define CAN_EFF_FLAG 0x80000000u    //EFF/SFF is set in the MSB
@@ -90,3 +92,16 @@ typedef uint32_t (__stdcall *can_transmit)(uint32_t DeviceType, uint32_t DeviceI
 typedef uint32_t (__stdcall *can_receive)(uint32_t DeviceType, uint32_t DeviceInd, uint32_t CANInd, VCI_CAN_OBJ *pReceive, uint32_t len, int wait_time);
 typedef uint32_t (__stdcall *can_setReference)(uint32_t DeviceType, uint32_t DeviceInd, uint32_t CANInd, uint32_t RefType, void *pData);
 typedef uint32_t (__stdcall *can_usbDeviceReset)(uint32_t DeviceType, uint32_t DeviceInd, uint32_t Reserved);
+
+//frames go straight to VCI_Transmit, responses come from the queue filled by can_rx_thread
+class CxTransport final : public DfuTransport {
+public:
+    CxTransport();
+    const DfuTransportCaps &caps(void) const override { return c; }
+    int send(const DfuFrame *frames, int cnt) override;
+    int receive(DfuFrame &frame, DfuDeadline deadline) override;
+    void flush(void) override;
+
+private:
+    DfuTransportCaps c;
+};
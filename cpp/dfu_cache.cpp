@@ -0,0 +1,325 @@
+//on-disk cache of the packet crc tables and dfu metadata, keyed by the hash of the image content
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include "dfu_cache.h"
+#include "dfu_image.h"
+#include "dfu_log.h"
+
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3   0x165667B19E3779F9ULL
+#define PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define PRIME64_5   0x27D4EB2F165667C5ULL
+
+//everything the container holds but the pointers into the image
+struct DfuCacheMeta {
+    uint32_t format;
+    uint8_t hwInfo[4];
+    uint32_t loadAddr;
+    uint32_t entryAddr;
+    uint8_t version[4];
+    uint32_t payloadCrc;
+    uint32_t payloadLen;
+    uint32_t sectionCnt;
+    DfuSection section[DFU_MAX_SECTIONS];
+};
+
+struct DfuCacheLen {
+    uint16_t packetLen;
+    uint16_t packetCnt;
+    uint32_t crcOffset;     //packetCnt crc16 from the start of the entry
+    uint32_t tailOffset;    //padded last packet, 0 when the image ends on a packet
+    uint16_t crc16;
+    uint16_t reserved;
+    uint32_t crc32;
+};
+
+//the entry holds no image, not even a padded one: only the crc tables and the 0xFF padded
+//last packet of every packet length follow this header, the payload is read from the .dfu itself
+struct DfuCacheHdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint32_t dataLen;       //of the image
+    uint32_t entryLen;      //of the whole entry file
+    DfuCacheMeta meta;
+    DfuCacheLen lens[DFU_CACHE_LENS];
+};
+
+static inline uint64_t rotl64(uint64_t v, int r)
+{
+    return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t rd64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t v)
+{
+    acc ^= hash_round(0, v);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+//XXH64, four independent lanes keep it at memory speed
+uint64_t dfu_hash64(const uint8_t *data, uint32_t len, uint64_t seed)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do {
+            v1 = hash_round(v1, rd64(p));
+            v2 = hash_round(v2, rd64(p + 8));
+            v3 = hash_round(v3, rd64(p + 16));
+            v4 = hash_round(v4, rd64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, rd64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        h ^= (uint64_t)w * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void meta_save(DfuCacheMeta &m, const DfuContainer &c)
+{
+    memset(&m, 0x00, sizeof(m));
+    m.format = c.format;
+    memcpy(m.hwInfo, c.hwInfo, sizeof(m.hwInfo));
+    m.loadAddr = c.loadAddr;
+    m.entryAddr = c.entryAddr;
+    memcpy(m.version, c.version, sizeof(m.version));
+    m.payloadCrc = c.payloadCrc;
+    m.payloadLen = c.payloadLen;
+    m.sectionCnt = c.sectionCnt;
+    memcpy(m.section, c.section, sizeof(m.section));
+}
+
+static void meta_load(DfuContainer &c, const DfuCacheMeta &m, const uint8_t *data)
+{
+    memset(&c, 0x00, sizeof(c));
+    c.format = m.format;
+    memcpy(c.hwInfo, m.hwInfo, sizeof(c.hwInfo));
+    c.loadAddr = m.loadAddr;
+    c.entryAddr = m.entryAddr;
+    memcpy(c.version, m.version, sizeof(c.version));
+    c.payloadCrc = m.payloadCrc;
+    c.sectionCnt = (uint8_t)m.sectionCnt;
+    memcpy(c.section, m.section, sizeof(c.section));
+    c.signature = data + DFU_SIG_OFFSET;
+    c.signatureLen = DFU_PAYLOAD_OFFSET - DFU_SIG_OFFSET;
+    c.payload = data + DFU_PAYLOAD_OFFSET;
+    c.payloadLen = m.payloadLen;
+}
+
+//false when dir is too long for the path
+static bool entry_path(char *out, size_t size, const char *dir, uint64_t hash)
+{
+    int n = snprintf(out, size, "%s/%016llx.dfc", dir, (unsigned long long)hash);
+    return n > 0 && (size_t)n < size;
+}
+
+//img gets the crcs of one packet length from a mapped entry, false when the entry does not fit the image
+static bool entry_load(DfuImage &img, DfuContainer &dfu, const uint8_t *e, uint32_t eLen,
+    uint64_t hash, const uint8_t *data, uint32_t len, uint16_t packetLen, uint8_t crcType)
+{
+    const DfuCacheHdr *h = (const DfuCacheHdr *)e;
+    if (eLen < sizeof(DfuCacheHdr) || h->magic != DFU_CACHE_MAGIC || h->version != DFU_CACHE_VERSION ||
+        h->hash != hash || h->dataLen != len || h->entryLen != eLen || h->meta.sectionCnt > DFU_MAX_SECTIONS) {
+        return false;
+    }
+    for (int i=0; i<DFU_CACHE_LENS; ++i) {
+        const DfuCacheLen &l = h->lens[i];
+        if (l.packetLen != packetLen) {
+            continue;
+        }
+        if (l.crcOffset + (uint64_t)l.packetCnt * 2 > eLen || l.packetCnt == 0 ||
+            (l.tailOffset != 0 && l.tailOffset + (uint64_t)packetLen > eLen)) {
+            return false;
+        }
+        img.data = data;
+        img.dataLen = len;
+        img.packetLen = packetLen;
+        img.packetCnt = l.packetCnt;
+        img.len = (uint32_t)l.packetCnt * packetLen;
+        img.packetCrc.resize(l.packetCnt);
+        memcpy(img.packetCrc.data(), e + l.crcOffset, l.packetCnt * 2);
+        img.tail.clear();
+        if (l.tailOffset != 0) {
+            img.tail.assign(e + l.tailOffset, e + l.tailOffset + packetLen);
+        }
+        img.crcType = crcType;
+        img.fileCrc = crcType == 0 ? l.crc16 : l.crc32;
+        meta_load(dfu, h->meta, data);
+        return true;
+    }
+    return false;
+}
+
+//written under a temporary name and renamed, so a reader never maps half an entry
+static void entry_store(const char *path, const DfuContainer &dfu, uint64_t hash, const uint8_t *data, uint32_t len)
+{
+    std::vector<uint8_t> e(sizeof(DfuCacheHdr), 0x00);
+    DfuCacheHdr h;
+    memset(&h, 0x00, sizeof(h));
+    h.magic = DFU_CACHE_MAGIC;
+    h.version = DFU_CACHE_VERSION;
+    h.hash = hash;
+    h.dataLen = len;
+    meta_save(h.meta, dfu);
+    DfuImage img;
+    for (int i=0; i<DFU_CACHE_LENS; ++i) {
+        uint16_t packetLen = (uint16_t)(8 << i);
+        DfuCacheLen &l = h.lens[i];
+        l.packetLen = packetLen;
+        if (dfu_prepareImage(img, data, len, packetLen, 0) < 0) {
+            l.packetCnt = 0;    //too many packets of this length
+            continue;
+        }
+        l.packetCnt = img.packetCnt;
+        l.crc16 = (uint16_t)img.fileCrc;
+        uint32_t full = len - len % packetLen;
+        l.crc32 = crc32((uint8_t *)data, full, 0);
+        l.crcOffset = (uint32_t)e.size();
+        e.insert(e.end(), (const uint8_t *)img.packetCrc.data(), (const uint8_t *)(img.packetCrc.data() + img.packetCnt));
+        e.resize((e.size() + 3) & ~(size_t)3, 0x00);
+        l.tailOffset = 0;
+        if (!img.tail.empty()) {
+            l.crc32 = crc32(img.tail.data(), packetLen, l.crc32);
+            l.tailOffset = (uint32_t)e.size();
+            e.insert(e.end(), img.tail.begin(), img.tail.end());
+        }
+    }
+    h.entryLen = (uint32_t)e.size();
+    memcpy(e.data(), &h, sizeof(h));
+    char tmp[512];
+#ifdef _WIN32
+    int n = snprintf(tmp, sizeof(tmp), "%s.%lu.tmp", path, (unsigned long)GetCurrentProcessId());
+#else
+    int n = snprintf(tmp, sizeof(tmp), "%s.%lu.tmp", path, (unsigned long)getpid());
+#endif
+    if (n <= 0 || (size_t)n >= sizeof(tmp)) {
+        LOG_WARN("image cache entry %s has too long a path, not stored\n", path);
+        return;     //a cut name could rename over another file
+    }
+    FILE *fd = fopen(tmp, "wb");
+    if (fd == NULL) {
+        LOG_WARN("cannot create image cache entry %s\n", tmp);
+        return;
+    }
+    bool ok = fwrite(e.data(), 1, e.size(), fd) == e.size();
+    ok = fclose(fd) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp, path) == 0;
+#endif
+    if (!ok) {
+        LOG_WARN("cannot write image cache entry %s\n", path);
+        remove(tmp);
+    }
+}
+
+int dfu_loadCachedImage(DfuImage &img, DfuContainer &dfu, const char *path, const char *dir,
+    uint16_t packetLen, uint8_t crcType)
+{
+    if (!dfu_validPacketLen(packetLen)) {
+        return -1;
+    }
+    const DfuImageFile *file = dfu_openImageFile(path);
+    if (file == NULL) {
+        return -1;
+    }
+    const uint8_t *data = dfu_imageFileData(file);
+    uint32_t len = dfu_imageFileLen(file);
+    uint64_t hash = dfu_hash64(data, len, 0);
+    char entry[512];
+    bool useCache = entry_path(entry, sizeof(entry), dir, hash);
+    if (!useCache) {
+        LOG_WARN("image cache dir %s is too long, the cache is not used\n", dir);
+    }
+    const DfuImageFile *cached = NULL;
+    FILE *probe = useCache ? fopen(entry, "rb") : NULL;     //a miss should not log an open error
+    if (probe != NULL) {
+        fclose(probe);
+        cached = dfu_openImageFile(entry);
+    }
+    if (cached != NULL) {
+        bool hit = entry_load(img, dfu, dfu_imageFileData(cached), dfu_imageFileLen(cached),
+            hash, data, len, packetLen, crcType);
+        dfu_closeImageFile(cached);
+        if (hit) {
+            LOG_DEBUG("image %s found in the cache as %016llx\n", path, (unsigned long long)hash);
+            img.file = file;
+            return img.packetCnt;
+        }
+        LOG_WARN("image cache entry %s is stale, rebuilding it\n", entry);
+    }
+    if (dfu_parseContainer(dfu, data, len) < 0) {
+        dfu_closeImageFile(file);
+        return -1;
+    }
+    if (useCache) {
+#ifdef _WIN32
+        CreateDirectoryA(dir, NULL);
+#else
+        mkdir(dir, 0755);
+#endif
+        entry_store(entry, dfu, hash, data, len);
+    }
+    if (dfu_prepareImage(img, data, len, packetLen, crcType) < 0) {
+        dfu_closeImageFile(file);
+        return -1;
+    }
+    img.file = file;
+    return img.packetCnt;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+//on-disk cache of the packet crc tables and dfu metadata, keyed by the hash of the image content
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include "dfu_engine.h"
+#include "dfu_container.h"
+
+#define DFU_CACHE_DIR           "dfu_cache"
+#define DFU_CACHE_MAGIC         0x43554644  //"DFUC"
+#define DFU_CACHE_VERSION       1
+#define DFU_CACHE_LENS          7           //packet lengths 8 ~ 512
+
+//one entry <hash>.dfc per image, mapped read-only on a hit. It holds for every packet length the
+//0xFF padded last packet, the packet crc table and both file crcs, plus the parsed container.
+//the image itself is the mapped .dfu file, the padding never needs more than the tail packet
+uint64_t dfu_hash64(const uint8_t *data, uint32_t len, uint64_t seed);
+
+//maps path, takes the crcs and the container from the cache in dir or builds and stores them on a miss.
+//returns img.packetCnt, -1 when the file can not be mapped or is not a valid container
+int dfu_loadCachedImage(DfuImage &img, DfuContainer &dfu, const char *path, const char *dir,
+    uint16_t packetLen, uint8_t crcType);
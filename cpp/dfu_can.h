@@ -5,10 +5,8 @@
 //Date : Dec 02, 2026
 
 #include <stdint.h>
-
-#define CAN_CMD_ID              0x300
-#define CAN_DAT_ID              0x4C0
-#define CAN_RSP_ID              0x370
+#include "transport.h"
+#include "dfu_common.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +14,7 @@ extern "C" {
 
 __declspec(dllexport) bool can_connect(int can_chan, int can_speed);
 __declspec(dllexport) bool can_disconnect(void);
+__declspec(dllexport) DfuTransport *can_createTransport(int can_chan, int can_speed);
 __declspec(dllexport) bool can_getDeviceInfo(char *sn);
 __declspec(dllexport) int can_prepareCmd(uint8_t addr, uint8_t *resp);
 __declspec(dllexport) int can_getBootloaderVerCmd(uint8_t addr, uint8_t *resp);
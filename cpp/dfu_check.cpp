@@ -0,0 +1,195 @@
+//pre-flight check of a directory of .dfu builds, every file on its own core
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+#include "dfu_check.h"
+#include "dfu_container.h"
+#include "dfu_image.h"
+#include "dfu_log.h"
+
+static bool has_ext(const char *name)
+{
+    size_t n = strlen(name);
+    size_t e = strlen(DFU_CHECK_EXT);
+    return n > e && strcmp(name + n - e, DFU_CHECK_EXT) == 0;
+}
+
+int dfu_listImages(const char *dir, std::vector<std::string> &paths)
+{
+    paths.clear();
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    std::string pattern = std::string(dir) + "\\*" DFU_CHECK_EXT;
+    HANDLE h = FindFirstFileA(pattern.c_str(), &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        //an empty directory also ends up here, only a missing one is an error
+        DWORD attr = GetFileAttributesA(dir);
+        if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+            LOG_ERR("open directory %s failed\n", dir);
+            return -1;
+        }
+        return 0;
+    }
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_ext(fd.cFileName)) {
+            paths.push_back(std::string(dir) + "\\" + fd.cFileName);
+        }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        LOG_ERR("open directory %s failed\n", dir);
+        return -1;
+    }
+    for (struct dirent *e = readdir(d); e != NULL; e = readdir(d)) {
+        if (e->d_type != DT_DIR && has_ext(e->d_name)) {
+            paths.push_back(std::string(dir) + "/" + e->d_name);
+        }
+    }
+    closedir(d);
+#endif
+    std::sort(paths.begin(), paths.end());
+    return (int)paths.size();
+}
+
+static void finding(DfuCheckResult &r, uint8_t status, const char *reason)
+{
+    if (status > r.status) {
+        r.status = status;
+        r.reason = reason;
+    }
+}
+
+//payload bytes in no section are never programmed, anything but 0xFF there is a stray link output
+static uint32_t gap_bytes(const DfuContainer &c)
+{
+    DfuSection s[DFU_MAX_SECTIONS];
+    memcpy(s, c.section, c.sectionCnt * sizeof(DfuSection));
+    for (uint8_t i=1; i<c.sectionCnt; ++i) {    //a handful of sections, insertion sort by address
+        DfuSection v = s[i];
+        uint8_t j = i;
+        for (; j > 0 && s[j - 1].addr > v.addr; --j) {
+            s[j] = s[j - 1];
+        }
+        s[j] = v;
+    }
+    uint32_t cnt = 0;
+    uint32_t at = 0;    //payload offset checked up to
+    for (uint8_t i=0; i<=c.sectionCnt; ++i) {
+        uint32_t end = c.payloadLen;
+        if (i < c.sectionCnt) {
+            end = s[i].addr < c.loadAddr ? 0 : s[i].addr - c.loadAddr;
+            end = end > c.payloadLen ? c.payloadLen : end;
+        }
+        for (; at < end; ++at) {
+            cnt += c.payload[at] != 0xFF;
+        }
+        if (i < c.sectionCnt && s[i].addr >= c.loadAddr) {
+            uint32_t next = s[i].addr - c.loadAddr + s[i].len;
+            at = next > at ? next : at;
+        }
+    }
+    return cnt;
+}
+
+void dfu_checkImage(DfuCheckResult &r, const DfuCheckOpts &opts)
+{
+    auto start = std::chrono::steady_clock::now();
+    r.status = DFU_CHECK_OK;
+    r.reason = "";
+    r.len = 0;
+    memset(r.version, 0x00, sizeof(r.version));
+    memset(r.hwInfo, 0x00, sizeof(r.hwInfo));
+    r.loadAddr = 0;
+    r.sectionCnt = 0;
+    r.gapBytes = 0;
+    memset(r.pad, 0x00, sizeof(r.pad));
+    memset(r.crc16, 0x00, sizeof(r.crc16));
+    memset(r.crc32, 0x00, sizeof(r.crc32));
+
+    const DfuImageFile *file = dfu_openImageFile(r.path.c_str());
+    if (file == NULL) {
+        finding(r, DFU_CHECK_FAIL, "open");
+    } else {
+        const uint8_t *data = dfu_imageFileData(file);
+        r.len = dfu_imageFileLen(file);
+        DfuContainer c;
+        //header crc, sizes, section table and payload crc, the reason is in the log
+        if (dfu_parseContainer(c, data, r.len) < 0) {
+            finding(r, DFU_CHECK_FAIL, "container");
+        } else {
+            memcpy(r.version, c.version, sizeof(r.version));
+            memcpy(r.hwInfo, c.hwInfo, sizeof(r.hwInfo));
+            r.loadAddr = c.loadAddr;
+            r.sectionCnt = c.sectionCnt;
+            if (opts.hwSet && memcmp(c.hwInfo, opts.hwInfo, sizeof(c.hwInfo)) != 0) {
+                LOG_ERR("%s is built for hw %02X%02X%02X%02X\n", r.path.c_str(), c.hwInfo[0], c.hwInfo[1], c.hwInfo[2], c.hwInfo[3]);
+                finding(r, DFU_CHECK_FAIL, "hwinfo");
+            }
+            r.gapBytes = gap_bytes(c);
+            if (r.gapBytes != 0) {
+                finding(r, DFU_CHECK_WARN, "gap data");
+            }
+            bool blank = true;
+            for (uint32_t i=1; i<c.signatureLen && blank; ++i) {
+                blank = c.signature[i] == c.signature[0];
+            }
+            if (blank) {
+                finding(r, DFU_CHECK_WARN, "unsigned");
+            }
+        }
+        //the file is read once, the 0xFF padding of every packet length continues the same crc
+        uint8_t ff[MAXIMUM_PKT_LEN];
+        memset(ff, 0xFF, sizeof(ff));
+        uint16_t c16 = crc16((uint8_t *)data, r.len, 0xFFFF);
+        uint32_t c32 = crc32((uint8_t *)data, r.len, 0);
+        for (int i=0; i<DFU_CHECK_LENS; ++i) {
+            uint16_t packetLen = (uint16_t)(8 << i);
+            r.pad[i] = (uint16_t)((packetLen - r.len % packetLen) % packetLen);
+            r.crc16[i] = crc16(ff, r.pad[i], c16);
+            r.crc32[i] = crc32(ff, r.pad[i], c32);
+        }
+        dfu_closeImageFile(file);
+    }
+    r.checkUs = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int dfu_checkImages(const std::vector<std::string> &paths, const DfuCheckOpts &opts, std::vector<DfuCheckResult> &results)
+{
+    results.assign(paths.size(), DfuCheckResult());
+    for (size_t i=0; i<paths.size(); ++i) {
+        results[i].path = paths[i];
+    }
+    size_t threads = opts.threads > 0 ? (size_t)opts.threads : std::thread::hardware_concurrency();
+    threads = threads == 0 ? 1 : threads;
+    threads = threads > paths.size() ? paths.size() : threads;
+    //files differ a lot in size, so workers pull the next one instead of taking a fixed share
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t t=0; t<threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < results.size(); i = next++) {
+                dfu_checkImage(results[i], opts);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    int failed = 0;
+    for (const DfuCheckResult &r : results) {
+        failed += r.status == DFU_CHECK_FAIL;
+    }
+    return failed;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+//pre-flight check of a directory of .dfu builds, every file on its own core
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define DFU_CHECK_EXT           ".dfu"
+#define DFU_CHECK_LENS          7       //packet lengths 8 ~ 512
+
+//status of one file, the worst finding wins
+#define DFU_CHECK_OK            0
+#define DFU_CHECK_WARN          1       //would upgrade, but looks like a wrong build
+#define DFU_CHECK_FAIL          2       //the engine refuses it or the BMS would
+
+struct DfuCheckOpts {
+    int threads;            //0 for one per core
+    bool hwSet;             //hwInfo has to match when set
+    uint8_t hwInfo[4];
+};
+
+struct DfuCheckResult {
+    std::string path;
+    uint8_t status;
+    const char *reason;     //first finding, "" when the file is clean
+    uint32_t len;
+    uint8_t version[4];
+    uint8_t hwInfo[4];
+    uint32_t loadAddr;
+    uint8_t sectionCnt;
+    uint32_t gapBytes;      //payload bytes outside every section that are not erased
+    uint16_t pad[DFU_CHECK_LENS];       //0xFF bytes the engine appends for packet length 8 << i
+    uint16_t crc16[DFU_CHECK_LENS];     //file crc of DFU_VERIFY_ALLDAT at every packet length
+    uint32_t crc32[DFU_CHECK_LENS];
+    uint32_t checkUs;
+};
+
+//*.dfu in dir sorted by name, returns the count or -1 when dir can not be read
+int dfu_listImages(const char *dir, std::vector<std::string> &paths);
+//r.path has to be set, everything else is filled in
+void dfu_checkImage(DfuCheckResult &r, const DfuCheckOpts &opts);
+//results come back in the order of paths, returns how many failed
+int dfu_checkImages(const std::vector<std::string> &paths, const DfuCheckOpts &opts, std::vector<DfuCheckResult> &results);
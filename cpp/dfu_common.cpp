@@ -3,7 +3,7 @@
 //Date : Dec 02, 2026
 
 #include "dfu_common.h"
-#include "printf.h"
+#include "dfu_log.h"
 
 //global variable
 uint8_t prepareCmd[] = {
@@ -144,6 +144,30 @@ uint8_t setPacketAddrCmd[] = {
     DFU_CMD_EOP,
 };
 
+uint8_t setPacketSeqLzCmd[] = {
+    DFU_CMD_SOP,
+    0x06,
+    0x00,
+    DFU_SET_PKTNUM_LZ,
+    0x00,           //seq - lsb
+    0x00,           //seq - msb
+    0x00,           //block length - lsb
+    0x00,           //block length - msb
+    0x00,           //CRC-LSB, only for RS485
+    0x00,           //CRC-MSB, only for RS485
+    DFU_CMD_EOP,
+};
+
+uint8_t getCapsCmd[] = {
+    DFU_CMD_SOP,
+    0x02,
+    0x00,
+    DFU_GET_CAPS,
+    0x00,           //CRC-LSB, only for RS485
+    0x00,           //CRC-MSB, only for RS485
+    DFU_CMD_EOP,
+};
+
 uint8_t verifyPacketDataCmd[] = {
     DFU_CMD_SOP,
     0x04,
@@ -351,8 +375,8 @@ uint8_t bmsQueryCmd[] = {
     APP_CMD_SOP,
     0x05,
     0x00,
-    0x98,
-    0x01,
+    DFU_BMS_QUERY,
+    0x01,           //info type
     0x00,           //start cell
     0x00,           //end cell
     0x00,           //CRC-LSB, only for RS485
@@ -360,30 +384,119 @@ uint8_t bmsQueryCmd[] = {
     DFU_CMD_EOP,
 };
 
+//NVM addresses are 24 bits so every command still fits in one CAN frame
+uint8_t enableNvmCmd[] = {
+    APP_CMD_SOP,
+    0x03,
+    0x00,
+    DFU_ENABLE_NVM,
+    0x00,           //0 - disable, 1 - enable
+    0x00,           //CRC-LSB, only for RS485
+    0x00,           //CRC-MSB, only for RS485
+    DFU_CMD_EOP,
+};
+
+uint8_t readNvmCmd[] = {
+    APP_CMD_SOP,
+    0x07,
+    0x00,
+    DFU_READ_NVM,
+    0x00,           //address, LSB first
+    0x00,
+    0x00,
+    0x00,           //length, LSB first
+    0x00,
+    0x00,           //CRC-LSB, only for RS485
+    0x00,           //CRC-MSB, only for RS485
+    DFU_CMD_EOP,
+};
+
+uint8_t eraseNvmCmd[] = {
+    APP_CMD_SOP,
+    0x06,
+    0x00,
+    DFU_ERASE_NVM,
+    0x00,           //sector address, LSB first
+    0x00,
+    0x00,
+    0x01,           //sectors
+    0x00,           //CRC-LSB, only for RS485
+    0x00,           //CRC-MSB, only for RS485
+    DFU_CMD_EOP,
+};
+
+uint8_t writeNvmCmd[] = {
+    APP_CMD_SOP,
+    0x07,
+    0x00,
+    DFU_WRITE_NVM,
+    0x00,           //address, LSB first
+    0x00,
+    0x00,
+    0x00,           //length, LSB first, the data follows as packet data
+    0x00,
+    0x00,           //CRC-LSB, only for RS485
+    0x00,           //CRC-MSB, only for RS485
+    DFU_CMD_EOP,
+};
+
+//reflected tables, t[k][b] is the crc of byte b followed by k zero bytes, so 8 bytes go per step
+struct CrcTables {
+    uint16_t t16[8][256];
+    uint32_t t32[8][256];
+    CrcTables()
+    {
+        for (uint32_t b=0; b<256; ++b) {
+            uint16_t c16 = (uint16_t)b;
+            uint32_t c32 = b;
+            for (int i = 0; i < 8; ++i) {
+                c16 = (c16 & 0x01) ? (c16 >> 1) ^ 0xA001 : (c16 >> 1); //crc polynomial: x^16 + x^15 + x^2 + 1
+                c32 = (c32 >> 1) ^ (0xEDB88320U & ((c32 & 1) ? 0xFFFFFFFF : 0));
+            }
+            t16[0][b] = c16;
+            t32[0][b] = c32;
+        }
+        for (int k=1; k<8; ++k) {
+            for (int b=0; b<256; ++b) {
+                t16[k][b] = (t16[k - 1][b] >> 8) ^ t16[0][t16[k - 1][b] & 0xFF];
+                t32[k][b] = (t32[k - 1][b] >> 8) ^ t32[0][t32[k - 1][b] & 0xFF];
+            }
+        }
+    }
+};
+
+static const CrcTables &crc_tables(void)
+{
+    static const CrcTables tables;
+    return tables;
+}
+
 uint16_t crc16(uint8_t *buffer, uint32_t len, uint16_t start)
 {
+    const CrcTables &c = crc_tables();
     uint16_t crc = start;
+    for (; len >= 8; len -= 8, buffer += 8) {
+        uint16_t v = crc ^ (buffer[0] | (buffer[1] << 8));
+        crc = c.t16[7][v & 0xFF] ^ c.t16[6][v >> 8] ^ c.t16[5][buffer[2]] ^ c.t16[4][buffer[3]] ^
+            c.t16[3][buffer[4]] ^ c.t16[2][buffer[5]] ^ c.t16[1][buffer[6]] ^ c.t16[0][buffer[7]];
+    }
     while (len--) {
-        crc ^= *buffer++;
-        for (int i = 0; i < 8; ++i) {
-            if (crc & 0x01) {
-                crc = (crc >> 1) ^ 0xA001; //crc polynomial: x^16 + x^15 + x^2 + 1
-            } else {
-                crc = (crc >> 1);
-            }
-        }
+        crc = (crc >> 8) ^ c.t16[0][(crc ^ *buffer++) & 0xFF];
     }
     return crc;
 }
 
 uint32_t crc32(uint8_t *buffer, uint32_t len, uint32_t start)
 {
+    const CrcTables &c = crc_tables();
     uint32_t crc = ~start;
-    for (uint32_t i=0; i<len; i++) {
-        crc = crc ^ buffer[i];
-        for (uint32_t j = 8; j > 0; j--) {
-            crc = (crc >> 1) ^ (0xEDB88320U & ((crc & 1) ? 0xFFFFFFFF : 0));
-        }
+    for (; len >= 8; len -= 8, buffer += 8) {
+        uint32_t v = crc ^ (buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+        crc = c.t32[7][v & 0xFF] ^ c.t32[6][(v >> 8) & 0xFF] ^ c.t32[5][(v >> 16) & 0xFF] ^ c.t32[4][v >> 24] ^
+            c.t32[3][buffer[4]] ^ c.t32[2][buffer[5]] ^ c.t32[1][buffer[6]] ^ c.t32[0][buffer[7]];
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ c.t32[0][(crc ^ *buffer++) & 0xFF];
     }
     return ~crc;
 }
@@ -393,11 +506,11 @@ static bool verifyCrcEop(uint8_t *dat, int len)
     uint16_t crc = dat[RSP_CRC_OFFSET(len)] | (dat[RSP_CRC_OFFSET(len) + 1] << 8);
     uint16_t expected_crc = crc16(&dat[RSP_ADR_OFFSET], len, 0xffff);
     if (expected_crc != crc) {
-        printf_("response error: crc received 0x%04X, expected 0x%04X\n", crc, expected_crc);
+        LOG_ERR("response error: crc received 0x%04X, expected 0x%04X\n", crc, expected_crc);
         return false;
     }
-    if (dat[RSP_EOP_OFFSET(len)] != DFU_CMD_SOP) {
-        printf_("response error: SOP received %d, expected 0x5B\n", dat[RSP_EOP_OFFSET(len)]);
+    if (dat[RSP_EOP_OFFSET(len)] != DFU_CMD_EOP) {
+        LOG_ERR("response error: EOP received %d, expected 0x18\n", dat[RSP_EOP_OFFSET(len)]);
         return false;
     }
     return true;
@@ -412,20 +525,20 @@ bool verifyPrepare(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("prepare response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("prepare response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x05) {
-        printf_("prepare response error: length received %d, expected 0x05\n", len);
+        LOG_ERR("prepare response error: length received %d, expected 0x05\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_PREPARE + 0x40) {
-        printf_("prepare response error: command received %d, expected 0x50\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("prepare response error: command received %d, expected 0x50\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != 0xCC || dat[RSP_DAT_OFFSET + 1 - offset] != 0xFE) {
-        printf_("prepare response error: data received 0x%02X 0x%02X, expected 0xCC 0xFE\n", dat[RSP_DAT_OFFSET-offset],  dat[RSP_DAT_OFFSET + 1 - offset]);
+        LOG_ERR("prepare response error: data received 0x%02X 0x%02X, expected 0xCC 0xFE\n", dat[RSP_DAT_OFFSET-offset],  dat[RSP_DAT_OFFSET + 1 - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -443,16 +556,16 @@ bool verifyGetBootloaderVer(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("getBootloaderVer response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("getBootloaderVer response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x07) {
-        printf_("getBootloaderVer response error: length received %d, expected 0x07\n", len);
+        LOG_ERR("getBootloaderVer response error: length received %d, expected 0x07\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_GET_BOOTVER + 0x40) {
-        printf_("getBootloaderVer response error: command received %d, expected 0x50\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("getBootloaderVer response error: command received %d, expected 0x50\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -470,16 +583,16 @@ bool verifyGetHardwareInfo(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("getHardwareInfo response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("getHardwareInfo response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x07) {
-        printf_("getHardwareInfo response error: length received %d, expected 0x07\n", len);
+        LOG_ERR("getHardwareInfo response error: length received %d, expected 0x07\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_GET_HWINFO + 0x40) {
-        printf_("getHardwareInfo response error: command received %d, expected 0x61\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("getHardwareInfo response error: command received %d, expected 0x61\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -497,16 +610,16 @@ bool verifyGetHardwareType(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("getHardwareType response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("getHardwareType response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x07) {
-        printf_("getHardwareType response error: length received %d, expected 0x07\n", len);
+        LOG_ERR("getHardwareType response error: length received %d, expected 0x07\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_GET_HWTYPE + 0x40) {
-        printf_("getHardwareType response error: command received %d, expected 0x62\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("getHardwareType response error: command received %d, expected 0x62\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -524,16 +637,16 @@ bool verifyGetApplicationVer(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("getApplicationVer response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("getApplicationVer response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x07) {
-        printf_("getApplicationVer response error: length received %d, expected 0x07\n", len);
+        LOG_ERR("getApplicationVer response error: length received %d, expected 0x07\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_GET_APPVER + 0x40) {
-        printf_("getApplicationVer response error: command received %d, expected 0x63\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("getApplicationVer response error: command received %d, expected 0x63\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -551,16 +664,16 @@ bool verifyGetPacketLen(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("getPacketLen response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("getPacketLen response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x06) {
-        printf_("getPacketLen response error: length received %d, expected 0x06\n", len);
+        LOG_ERR("getPacketLen response error: length received %d, expected 0x06\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_GET_PKTLEN + 0x40) {
-        printf_("getPacketLen response error: command received %d, expected 0x68\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("getPacketLen response error: command received %d, expected 0x68\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -578,20 +691,20 @@ bool verifySetPacketLen(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("setPacketLen response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("setPacketLen response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x03) {
-        printf_("setPacketLen response error: length received %d, expected 0x03\n", len);
+        LOG_ERR("setPacketLen response error: length received %d, expected 0x03\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_SET_PKTLEN + 0x40) {
-        printf_("setPacketLen response error: command received %d, expected 0x69\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("setPacketLen response error: command received %d, expected 0x69\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != SET_PKTLEN_OK) {
-        printf_("setPacketSeq response error: ack received %d, expected 0xA1\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("setPacketSeq response error: ack received %d, expected 0xA1\n", dat[RSP_DAT_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -609,20 +722,20 @@ bool verifySetApplicationLen(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("setApplicationLen response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("setApplicationLen response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x07) {
-        printf_("setApplicationLen response error: length received %d, expected 0x07\n", len);
+        LOG_ERR("setApplicationLen response error: length received %d, expected 0x07\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_SET_APPLEN + 0x40) {
-        printf_("setApplicationLen response error: command received %d, expected 0x70\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("setApplicationLen response error: command received %d, expected 0x70\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != APP_LENGTH_OK) {
-        printf_("setApplicationLen response error: ack received %d, expected 0xA1\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("setApplicationLen response error: ack received %d, expected 0xA1\n", dat[RSP_DAT_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -640,20 +753,20 @@ bool verifySetPacketSeq(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("setPacketSeq response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("setPacketSeq response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x05) {
-        printf_("setPacketSeq response error: length received %d, expected 0x05\n", len);
+        LOG_ERR("setPacketSeq response error: length received %d, expected 0x05\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_SET_PKTNUM + 0x40) {
-        printf_("setPacketSeq response error: command received %d, expected 0x80\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("setPacketSeq response error: command received %d, expected 0x80\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != SET_PKTNUM_OK) {
-        printf_("setPacketSeq response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("setPacketSeq response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -671,20 +784,78 @@ bool verifySetPacketAddr(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("setPacketAddr response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("setPacketAddr response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x07) {
-        printf_("setPacketAddr response error: length received %d, expected 0x07\n", len);
+        LOG_ERR("setPacketAddr response error: length received %d, expected 0x07\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_SET_PKTNUM + 0x40) {
-        printf_("setPacketAddr response error: command received %d, expected 0x80\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("setPacketAddr response error: command received %d, expected 0x80\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != SET_PKTNUM_OK) {
-        printf_("setPacketAddr response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("setPacketAddr response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
+        return false;
+    }
+    if (useSop && !verifyCrcEop(dat, len)) {
+        return false;
+    }
+    return true;
+}
+
+bool verifySetPacketSeqLz(uint8_t *dat, bool useSop)
+{
+    uint8_t offset;
+    if (useSop) {  //RS485
+        offset = 0;
+    } else {
+        offset = 1;
+    }
+    if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
+        LOG_ERR("setPacketSeqLz response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        return false;
+    }
+    int len = dat[RSP_LEN_OFFSET - offset];
+    if (len != 0x07) {
+        LOG_ERR("setPacketSeqLz response error: length received %d, expected 0x07\n", len);
+        return false;
+    }
+    if (dat[RSP_STA_OFFSET - offset] != DFU_SET_PKTNUM_LZ + 0x40) {
+        LOG_ERR("setPacketSeqLz response error: command received %d, expected 0x81\n", dat[RSP_STA_OFFSET - offset]);
+        return false;
+    }
+    if (dat[RSP_DAT_OFFSET - offset] != SET_PKTNUM_OK) {
+        LOG_ERR("setPacketSeqLz response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
+        return false;
+    }
+    if (useSop && !verifyCrcEop(dat, len)) {
+        return false;
+    }
+    return true;
+}
+
+bool verifyGetCaps(uint8_t *dat, bool useSop)
+{
+    uint8_t offset;
+    if (useSop) {  //RS485
+        offset = 0;
+    } else {
+        offset = 1;
+    }
+    if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
+        LOG_ERR("getCaps response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        return false;
+    }
+    int len = dat[RSP_LEN_OFFSET - offset];
+    if (len != 0x06) {
+        LOG_ERR("getCaps response error: length received %d, expected 0x06\n", len);
+        return false;
+    }
+    if (dat[RSP_STA_OFFSET - offset] != DFU_GET_CAPS + 0x40) {
+        LOG_ERR("getCaps response error: command received %d, expected 0x6B\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -702,20 +873,20 @@ bool verifySendPacketData(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_DAT_SOP)) {
-        printf_("setPacketAddr response error: SOP received %d, expected 0x5C\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("setPacketAddr response error: SOP received %d, expected 0x5C\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x03) {
-        printf_("setPacketAddr response error: length received %d, expected 0x03\n", len);
+        LOG_ERR("setPacketAddr response error: length received %d, expected 0x03\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != 0x8C) {
-        printf_("setPacketAddr response error: command received %d, expected 0x8C\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("setPacketAddr response error: command received %d, expected 0x8C\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != XFER_DATA_OK) {
-        printf_("setPacketAddr response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("setPacketAddr response error: ack received %d, expected 0xA2\n", dat[RSP_DAT_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -733,20 +904,20 @@ bool verifyPacketData(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("verifyPacketData response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("verifyPacketData response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x03) {
-        printf_("verifyPacketData response error: length received %d, expected 0x03\n", len);
+        LOG_ERR("verifyPacketData response error: length received %d, expected 0x03\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_VERIFY_PKTDAT + 0x40) {
-        printf_("verifyPacketData response error: command received %d, expected 0x85\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("verifyPacketData response error: command received %d, expected 0x85\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != VERIFY_DATA_OK) {
-        printf_("verifyPacketData response error: ack received %d, expected 0xA3\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("verifyPacketData response error: ack received %d, expected 0xA3\n", dat[RSP_DAT_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -764,20 +935,20 @@ bool verifyAllData(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("verifyAllData response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("verifyAllData response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x03) {
-        printf_("verifyAllData response error: length received %d, expected 0x03\n", len);
+        LOG_ERR("verifyAllData response error: length received %d, expected 0x03\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_VERIFY_ALLDAT + 0x40) {
-        printf_("verifyAllData response error: command received %d, expected 0x85\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("verifyAllData response error: command received %d, expected 0x85\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (dat[RSP_DAT_OFFSET - offset] != VERIFY_ALL_OK) {
-        printf_("verifyAllData response error: ack received %d, expected 0xA4\n", dat[RSP_DAT_OFFSET - offset]);
+        LOG_ERR("verifyAllData response error: ack received %d, expected 0xA4\n", dat[RSP_DAT_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
@@ -795,16 +966,16 @@ bool verifyGetUpdateStatus(uint8_t *dat, bool useSop)
         offset = 1;
     }
     if (useSop && (dat[RSP_SOP_OFFSET] != DFU_CMD_SOP)) {
-        printf_("getUpdateStatus response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
+        LOG_ERR("getUpdateStatus response error: SOP received %d, expected 0x5B\n", dat[CMD_SOP_OFFSET]);
         return false;
     }
     int len = dat[RSP_LEN_OFFSET - offset];
     if (len != 0x05) {
-        printf_("getUpdateStatus response error: length received %d, expected 0x05\n", len);
+        LOG_ERR("getUpdateStatus response error: length received %d, expected 0x05\n", len);
         return false;
     }
     if (dat[RSP_STA_OFFSET - offset] != DFU_GET_STATUS + 0x40) {
-        printf_("getUpdateStatus response error: command received %d, expected 0x85\n", dat[RSP_STA_OFFSET - offset]);
+        LOG_ERR("getUpdateStatus response error: command received %d, expected 0x85\n", dat[RSP_STA_OFFSET - offset]);
         return false;
     }
     if (useSop && !verifyCrcEop(dat, len)) {
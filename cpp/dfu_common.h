@@ -20,6 +20,8 @@
 #define SET_PKTNUM_OK               0xA2
 #define SET_PKTNUM_NG               0x01
 
+#define DFU_CAP_LZ                  0x01    //LZ4 block decoder for packet data, DFU_SET_PKTNUM_LZ
+
 #define XFER_DATA_OK                0xA2
 #define XFER_DATA_NG                0x01
 
@@ -33,6 +35,9 @@
 #define VERIFY_ALL_NG               0x08
 #define SETTINGS_SAVE_NG            0x06
 
+#define NVM_ACCESS_OK               0xA5
+#define NVM_ACCESS_NG               0x01
+
 #define CMD_SOP_OFFSET              0
 #define CMD_LEN_OFFSET              1
 #define CMD_ADR_OFFSET              2
@@ -49,12 +54,21 @@
 #define RSP_CRC_OFFSET(len)         (len+2)
 #define RSP_EOP_OFFSET(len)         (len+4)
 
+#define RS485_FRAME_LEN(len)        ((len) + 5)     //SOP, LEN, CRC_L, CRC_H, EOP around LEN bytes
+#define RS485_CMD_MAX_LEN           16
+
+#define CAN_CMD_ID                  0x300
+#define CAN_DAT_ID                  0x4C0
+#define CAN_RSP_ID                  0x370
+#define CAN_DATA_GAP_US             5000    //5 ms for FW to process every data frame
+
 #define DFU_CMD_SOP                 0x5B    //only used for RS-485
 #define DFU_DAT_SOP                 0x5C    //only used for RS-485
 #define DFU_CMD_EOP                 0x18    //only used for RS-485
 #define APP_CMD_SOP                 0x5D    //only used for RS-485
 
 
+#define APP_SYS_CMD                 0x03    //DATA[0] is one of SYS_*, answered with STA 0x43
 #define SYS_HEART_BEAT              0x00
 #define SYS_ENTER_SLEEP             0x01
 #define SYS_SET_TIME                0x02
@@ -75,8 +89,10 @@
 #define DFU_GET_PKTLEN              0x28
 #define DFU_SET_PKTLEN              0x29
 #define DFU_GET_PKTLEN_MAX          0x2A
+#define DFU_GET_CAPS                0x2B   //DFU_CAP_* bits, older bootloaders do not answer
 #define DFU_SET_APPLEN              0x30
 #define DFU_SET_PKTNUM              0x40   //set packet length or set packet start address   
+#define DFU_SET_PKTNUM_LZ           0x41   //packet seq and LZ4 block length of the data that follows
 #define DFU_VERIFY_PKTDAT           0x45
 #define DFU_VERIFY_ALLDAT           0x50
 #define DFU_UPDATE                  0x60 
@@ -96,6 +112,7 @@
 #define DFU_GET_SERIAL              0x42
 #define DFU_GET_PCSINFO             0x44
 #define DFU_GET_FWVER               0x33
+#define DFU_BMS_QUERY               0x98   //info type, start cell, end cell
 #define DFU_REQ_UPGRADE             0x80
 #define DFU_SET_TOTALPKT            0x88
 #define DFU_XFER_PKTDAT             0x89
@@ -114,11 +131,22 @@ extern uint8_t setPacketLenCmd[];
 extern uint8_t setApplicationLenCmd[];
 extern uint8_t setPacketSeqCmd[];
 extern uint8_t setPacketAddrCmd[];
+extern uint8_t setPacketSeqLzCmd[];
+extern uint8_t getCapsCmd[];
 extern uint8_t verifyPacketDataCmd[];
 extern uint8_t verifyAllDataCrc16Cmd[];
 extern uint8_t verifyAllDataCrc32Cmd[];
 extern uint8_t updateStationCmd[];
 extern uint8_t getUpdateStatusCmd[];
+extern uint8_t setRtcYearCmd[];
+extern uint8_t setRtcTimeCmd[];
+extern uint8_t getRtcYearCmd[];
+extern uint8_t getRtcTimeCmd[];
+extern uint8_t bmsQueryCmd[];
+extern uint8_t enableNvmCmd[];
+extern uint8_t readNvmCmd[];
+extern uint8_t eraseNvmCmd[];
+extern uint8_t writeNvmCmd[];
 
 //functions
 bool verifyPrepare(uint8_t *dat, bool useSop);
@@ -131,6 +159,8 @@ bool verifySetPacketLen(uint8_t *dat, bool useSop);
 bool verifySetApplicationLen(uint8_t *dat, bool useSop);
 bool verifySetPacketSeq(uint8_t *dat, bool useSop);
 bool verifySetPacketAddr(uint8_t *dat, bool useSop);
+bool verifySetPacketSeqLz(uint8_t *dat, bool useSop);
+bool verifyGetCaps(uint8_t *dat, bool useSop);
 bool verifySendPacketData(uint8_t *dat, bool useSop);
 bool verifyPacketData(uint8_t *dat, bool useSop);
 bool verifyAllData(uint8_t *dat, bool useSop);
@@ -0,0 +1,108 @@
+//index of the .dfu container: header fields, section table, signature and payload
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include "dfu_container.h"
+#include "dfu_log.h"
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int dfu_parseContainer(DfuContainer &c, const uint8_t *data, uint32_t len)
+{
+    memset(&c, 0x00, sizeof(c));
+    if (data == NULL || len <= DFU_PAYLOAD_OFFSET) {
+        LOG_ERR("dfu file of %u bytes has no payload after the %d bytes header\n", len, DFU_PAYLOAD_OFFSET);
+        return -1;
+    }
+    uint16_t crc = (data[DFU_HDR_CRC16_OFFSET] << 8) | data[DFU_HDR_CRC16_OFFSET + 1];
+    uint16_t expected = crc16((uint8_t *)data, DFU_HDR_CRC16_OFFSET, 0xFFFF);
+    if (crc != expected) {
+        LOG_ERR("dfu header crc is 0x%04X, expected 0x%04X\n", crc, expected);
+        return -1;
+    }
+    c.format = rd32(data + DFU_HDR_FORMAT_OFFSET);
+    memcpy(c.hwInfo, data + DFU_HDR_HWINFO_OFFSET, sizeof(c.hwInfo));
+    c.loadAddr = rd32(data + DFU_HDR_LOAD_OFFSET);
+    c.entryAddr = rd32(data + DFU_HDR_ENTRY_OFFSET);
+    memcpy(c.version, data + DFU_HDR_VERSION_OFFSET, sizeof(c.version));
+    c.payloadCrc = rd32(data + DFU_HDR_CRC32_OFFSET);
+    c.signature = data + DFU_SIG_OFFSET;
+    c.signatureLen = DFU_PAYLOAD_OFFSET - DFU_SIG_OFFSET;
+    c.payload = data + DFU_PAYLOAD_OFFSET;
+    c.payloadLen = rd32(data + DFU_HDR_SIZE_OFFSET);
+    if (c.payloadLen == 0 || c.payloadLen != len - DFU_PAYLOAD_OFFSET) {
+        LOG_ERR("dfu header has %u payload bytes, the file %u\n", c.payloadLen, len - DFU_PAYLOAD_OFFSET);
+        return -1;
+    }
+    uint32_t cnt = rd32(data + DFU_HDR_SECTIONS_OFFSET);
+    if (cnt == 0 || cnt > DFU_MAX_SECTIONS) {
+        LOG_ERR("dfu header has %u sections, 1 ~ %d are supported\n", cnt, (int)DFU_MAX_SECTIONS);
+        return -1;
+    }
+    c.sectionCnt = (uint8_t)cnt;
+    bool loadFound = false;
+    for (uint8_t i=0; i<c.sectionCnt; ++i) {
+        const uint8_t *p = data + DFU_HDR_TABLE_OFFSET + i * DFU_SECTION_ENTRY_LEN;
+        DfuSection &s = c.section[i];
+        s.addr = rd32(p);
+        s.len = rd32(p + 4);
+        s.attr = rd32(p + 8);
+        if (s.len == 0 || s.len > c.payloadLen || s.addr + s.len < s.addr) {
+            LOG_ERR("dfu section %d at 0x%08X with %u bytes is out of range\n", i, s.addr, s.len);
+            return -1;
+        }
+        for (uint8_t k=0; k<i; ++k) {
+            const DfuSection &o = c.section[k];
+            if (s.addr < o.addr + o.len && o.addr < s.addr + s.len) {
+                LOG_ERR("dfu sections %d and %d overlap at 0x%08X\n", k, i, s.addr > o.addr ? s.addr : o.addr);
+                return -1;
+            }
+        }
+        loadFound |= s.addr == c.loadAddr;
+    }
+    if (!loadFound) {
+        LOG_ERR("dfu load address 0x%08X starts no section\n", c.loadAddr);
+        return -1;
+    }
+    int sec = dfu_containerSection(c, c.entryAddr);
+    if (sec < 0) {
+        LOG_ERR("dfu entry address 0x%08X is outside every section\n", c.entryAddr);
+        return -1;
+    }
+    uint32_t payloadCrc = crc32((uint8_t *)c.payload, c.payloadLen, 0);
+    if (payloadCrc != c.payloadCrc) {
+        LOG_ERR("dfu payload crc is 0x%08X, expected 0x%08X\n", payloadCrc, c.payloadCrc);
+        return -1;
+    }
+    LOG_INFO("dfu version %d.%d.%d.%d, %u bytes at 0x%08X, %d sections\n", c.version[0], c.version[1],
+        c.version[2], c.version[3], c.payloadLen, c.loadAddr, c.sectionCnt);
+    return 0;
+}
+
+uint32_t dfu_containerAddr(const DfuContainer &c, uint32_t offset)
+{
+    if (offset < DFU_PAYLOAD_OFFSET || offset - DFU_PAYLOAD_OFFSET >= c.payloadLen) {
+        return 0;
+    }
+    return c.loadAddr + (offset - DFU_PAYLOAD_OFFSET);
+}
+
+int dfu_containerSection(const DfuContainer &c, uint32_t addr)
+{
+    for (uint8_t i=0; i<c.sectionCnt; ++i) {
+        if (addr >= c.section[i].addr && addr - c.section[i].addr < c.section[i].len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool dfu_containerInstalled(const DfuContainer &c, const uint8_t *appVer)
+{
+    uint16_t build = appVer[0] | (appVer[1] << 8);
+    return appVer[4] == c.version[0] && appVer[3] == c.version[1] && appVer[2] == c.version[2] && build == c.version[3];
+}
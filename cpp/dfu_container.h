@@ -0,0 +1,56 @@
+#pragma once
+
+//index of the .dfu container: header fields, section table, signature and payload
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include "dfu_common.h"
+
+//the header and the signature take the first SIGNATURE_MAX_SIZE bytes, the payload follows.
+//the whole file is still what goes to the BMS, the FW checks the signature over it
+#define DFU_HDR_FORMAT_OFFSET       0x00
+#define DFU_HDR_SECTIONS_OFFSET     0x04
+#define DFU_HDR_HWINFO_OFFSET       0x08
+#define DFU_HDR_LOAD_OFFSET         0x0C
+#define DFU_HDR_SIZE_OFFSET         0x10
+#define DFU_HDR_ENTRY_OFFSET        0x14
+#define DFU_HDR_VERSION_OFFSET      0x30    //major, minor, patch, build
+#define DFU_HDR_CRC32_OFFSET        0x34    //crc32 of the payload
+#define DFU_HDR_TABLE_OFFSET        0xA0    //address, length, attribute of every section
+#define DFU_HDR_CRC16_OFFSET        0xFE    //crc16 of everything before it, big endian
+#define DFU_SIG_OFFSET              0x100
+#define DFU_PAYLOAD_OFFSET          SIGNATURE_MAX_SIZE
+#define DFU_SECTION_ENTRY_LEN       12
+#define DFU_MAX_SECTIONS            ((DFU_HDR_CRC16_OFFSET - DFU_HDR_TABLE_OFFSET) / DFU_SECTION_ENTRY_LEN)
+
+struct DfuSection {
+    uint32_t addr;          //target flash address
+    uint32_t len;
+    uint32_t attr;
+};
+
+//pointers go into the parsed data, which has to outlive the container
+struct DfuContainer {
+    uint32_t format;
+    uint8_t hwInfo[4];
+    uint32_t loadAddr;
+    uint32_t entryAddr;
+    uint8_t version[4];
+    uint32_t payloadCrc;
+    uint8_t sectionCnt;
+    DfuSection section[DFU_MAX_SECTIONS];
+    const uint8_t *signature;
+    uint32_t signatureLen;
+    const uint8_t *payload;
+    uint32_t payloadLen;
+};
+
+//checks both crcs, the sizes and the section table once, returns 0 or -1 with the reason logged
+int dfu_parseContainer(DfuContainer &c, const uint8_t *data, uint32_t len);
+//target address of a file offset, 0 for the header and the signature
+uint32_t dfu_containerAddr(const DfuContainer &c, uint32_t offset);
+//section holding a target address, -1 when it falls into a gap
+int dfu_containerSection(const DfuContainer &c, uint32_t addr);
+//appVer as getApplicationVerCmd returns it: build LSB, build MSB, patch, minor, major
+bool dfu_containerInstalled(const DfuContainer &c, const uint8_t *appVer);
@@ -0,0 +1,119 @@
+//DFU command sequence, written once against DfuTransport
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdlib.h>
+#include <string.h>
+#include "dfu_engine.h"
+#include "dfu_log.h"
+
+bool dfu_validPacketLen(uint16_t packetLen)
+{
+    if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
+        packetLen != 128 && packetLen != 256 && packetLen != 512) {
+        LOG_ERR("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
+        return false;
+    }
+    return true;
+}
+
+bool dfu_parseAddrs(const char *arg, std::vector<uint8_t> &addrs)
+{
+    addrs.clear();
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) {
+            return false;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) {
+                return false;
+            }
+        }
+        if (first < 0 || last > 0xFF || first > last) {
+            return false;
+        }
+        for (long a=first; a<=last; ++a) {
+            addrs.push_back((uint8_t)a);
+        }
+        if (*end != ',' && *end != 0) {
+            return false;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return !addrs.empty();
+}
+
+//templates in dfu_common.cpp are shared, every command patches its own copy
+void dfu_loadCmd(uint8_t *cmd, const uint8_t *tmpl)
+{
+    memcpy(cmd, tmpl, RS485_FRAME_LEN(tmpl[CMD_LEN_OFFSET]));
+}
+
+void dfu_encodeCmd(DfuFrame &f, uint8_t *cmd, uint8_t addr, bool sop)
+{
+    uint8_t len = cmd[CMD_LEN_OFFSET];
+    cmd[CMD_ADR_OFFSET] = addr;
+    if (sop) {
+        //upgrade protocol Rev 0.17, 1 communication format: SOP, LEN and EOP are not part of the crc
+        uint16_t crc = crc16(&cmd[CMD_ADR_OFFSET], len, 0xffff);    //crc covers address, command and data
+        cmd[CMD_CRC_OFFSET(len)] = crc & 0xFF;
+        cmd[CMD_CRC_OFFSET(len) + 1] = (crc >> 8) & 0xFF;
+        cmd[CMD_EOP_OFFSET(len)] = DFU_CMD_EOP;
+        f.id = 0;
+        f.len = RS485_FRAME_LEN(len);
+        memcpy(f.data, cmd, f.len);
+    } else {
+        f.id = CAN_CMD_ID;
+        f.len = 8;  //always 8 bytes
+        memset(f.data, 0x00, 8);    //padding with 0x00
+        memcpy(f.data, cmd + CMD_LEN_OFFSET, len + 1);
+    }
+}
+
+int dfu_prepareImage(DfuImage &img, const uint8_t *data, uint32_t len, uint16_t packetLen, uint8_t crcType)
+{
+    if (!dfu_validPacketLen(packetLen)) {
+        return -1;
+    }
+    if (len == 0 || (len + packetLen - 1) / packetLen > 0xFFFF) {
+        LOG_ERR("image length %u should be 1 ~ 65535 packets of %d bytes\n", len, packetLen);
+        return -1;
+    }
+    uint32_t full = len - len % packetLen;
+    img.data = data;
+    img.dataLen = len;
+    img.len = full == len ? len : full + packetLen;
+    img.packetLen = packetLen;
+    img.packetCnt = img.len / packetLen;
+    img.tail.clear();
+    if (full != len) {
+        img.tail.assign(packetLen, 0xFF);   //padding with 0xFF
+        memcpy(img.tail.data(), data + full, len - full);
+    }
+    img.packetCrc.resize(img.packetCnt);
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        img.packetCrc[i] = crc16((uint8_t *)dfu_imagePacket(img, i), packetLen, 0xFFFF);
+    }
+    img.crcType = crcType;
+    if (crcType == 0) {
+        img.fileCrc = crc16((uint8_t *)data, full, 0xFFFF);
+        if (!img.tail.empty()) {
+            img.fileCrc = crc16(img.tail.data(), packetLen, (uint16_t)img.fileCrc);
+        }
+    } else {
+        img.fileCrc = crc32((uint8_t *)data, full, 0);
+        if (!img.tail.empty()) {
+            img.fileCrc = crc32(img.tail.data(), packetLen, img.fileCrc);
+        }
+    }
+    return img.packetCnt;
+}
+
+//the virtual transport path used by the dlls and the dynamic build
+template class DfuEngineT<DfuTransport>;
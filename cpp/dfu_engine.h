@@ -0,0 +1,169 @@
+#pragma once
+
+//DFU command sequence, written once against DfuTransport
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <vector>
+#include "transport.h"
+#include "dfu_common.h"
+#include "dfu_plan.h"
+
+#define DFU_RSP_TIMEOUT_MS          3000
+#define DFU_VERIFY_PKT_TIMEOUT_MS   5000
+#define DFU_VERIFY_ALL_TIMEOUT_MS   10000
+#define DFU_NEXT_FRAME_TIMEOUT_MS   100     //gap between the frames of one multi-frame response
+#define DFU_UPDATE_WAIT_MS          15000   //BMS copies the app before it answers again
+#define DFU_CAPS_TIMEOUT_MS         300     //older bootloaders never answer the query
+#define DFU_MAX_BATCH               64
+#define DFU_POLL_WINDOW             256     //a whole address range in flight on CAN, sent in batches
+#define DFU_POLL_TIMEOUT_MS         500     //a station that misses it is not skipped, only queried again
+#define DFU_SCAN_TIMEOUT_MS         100     //silent addresses cost this once per scan round
+#define DFU_BCAST_REPAIR_ROUNDS     3       //passes over the packets stations missed in a broadcast
+#define DFU_BCAST_DROP_MISSES       3       //packets missed in a row before a station leaves the broadcast
+
+struct DfuImageFile;
+
+//answer of one station to a polled command
+struct DfuPollRsp {
+    bool ok;
+    uint8_t data[8];        //DATA after STA, the bytes the single station calls return
+};
+
+//one station found by a scan, versions in the layout of the single station calls
+struct DfuStation {
+    uint8_t addr;
+    bool boot;              //answered DFU_GET_BOOTVER, only the bootloader does
+    bool hwKnown;
+    uint8_t appVer[5];
+    uint8_t bootVer[5];
+    uint8_t hwType[5];
+    uint8_t cellNum;        //from DFU_PREPARE, 0 in app mode where it is not sent
+};
+
+//asked right before DFU_UPDATE, below 0 keeps the old app on the station
+typedef int (*DfuUpdateGate)(void *ctx);
+
+//upgrade file with every crc calculated once, engines only read it
+struct DfuImage {
+    const uint8_t *data;
+    uint32_t dataLen;       //bytes in data, the rest up to len reads as 0xFF
+    uint32_t len;           //multiple of packetLen
+    uint16_t packetLen;
+    uint16_t packetCnt;
+    std::vector<uint16_t> packetCrc;
+    std::vector<uint8_t> tail;      //last packet padded with 0xFF when data ends inside it
+    uint8_t crcType;        //0: crc16, 1: crc32
+    uint32_t fileCrc;
+    const DfuImageFile *file = NULL;    //mapping data points into, NULL when the caller owns data
+    std::vector<uint8_t> lz;            //LZ4 blocks of the packets, empty when nothing is compressed
+    std::vector<uint32_t> lzOffset;     //packetCnt + 1 offsets into lz, an empty block goes uncompressed
+};
+
+//len does not have to be a multiple of packetLen, the padding is not copied into data
+int dfu_prepareImage(DfuImage &img, const uint8_t *data, uint32_t len, uint16_t packetLen, uint8_t crcType);
+
+//packet idx (from 0) as packetLen bytes
+inline const uint8_t *dfu_imagePacket(const DfuImage &img, uint32_t idx)
+{
+    uint32_t at = idx * img.packetLen;
+    return at + img.packetLen <= img.dataLen ? img.data + at : img.tail.data();
+}
+//bytes packet idx takes on the link, packetLen when it goes uncompressed
+inline uint16_t dfu_imageLzLen(const DfuImage &img, uint32_t idx)
+{
+    if (img.lzOffset.empty() || img.lzOffset[idx + 1] == img.lzOffset[idx]) {
+        return img.packetLen;
+    }
+    return (uint16_t)(img.lzOffset[idx + 1] - img.lzOffset[idx]);
+}
+bool dfu_validPacketLen(uint16_t packetLen);
+//station list of -a: "7", "0-15" or "1,4,6-9", false for anything else
+bool dfu_parseAddrs(const char *arg, std::vector<uint8_t> &addrs);
+void dfu_loadCmd(uint8_t *cmd, const uint8_t *tmpl);
+//command frame as it goes on the link, cmd gets ADR and on serial CRC and EOP
+void dfu_encodeCmd(DfuFrame &f, uint8_t *cmd, uint8_t addr, bool sop);
+
+//Transport is DfuTransport for the runtime chosen link, or a final transport class
+//when the link is fixed at compile time so that every call is direct and can be inlined
+template <class Transport>
+class DfuEngineT {
+public:
+    explicit DfuEngineT(Transport &transport);
+
+    int prepareCmd(uint8_t addr, uint8_t *resp);
+    int getBootloaderVerCmd(uint8_t addr, uint8_t *resp);
+    int getBatterySN(uint8_t addr, uint8_t *resp);
+    int getHardwareInfoCmd(uint8_t addr, uint8_t *resp);
+    int getHardwareTypeCmd(uint8_t addr, uint8_t *resp);
+    int getApplicationVerCmd(uint8_t addr, uint8_t *resp);
+    int getPacketLenCmd(uint8_t addr, uint8_t *resp);
+    int setPacketLenCmd(uint8_t addr, uint16_t packetLen);
+    int setApplicationLenCmd(uint8_t addr, uint32_t applicationLen, uint8_t *resp);
+    int setPacketSeqCmd(uint8_t addr, uint16_t packetSeq, uint8_t *resp);
+    int setPacketAddrCmd(uint8_t addr, uint32_t packetAddr, uint8_t *resp);
+    int setPacketSeqLzCmd(uint8_t addr, uint16_t packetSeq, uint16_t lzLen, uint8_t *resp);
+    int getCapsCmd(uint8_t addr, uint8_t *resp);
+    int sendPacketData(uint16_t packetLen, const uint8_t *data);
+    int verifyPacketDataCmd(uint8_t addr, uint16_t packetCrc);
+    int verifyAllDataCmd(uint8_t addr, uint8_t crcType, uint32_t fileCrc);
+    int updateStationCmd(uint8_t addr, bool all);
+    int getUpdateStatusCmd(uint8_t addr, uint8_t *resp);
+    //DFU_PREPARE, DFU_GET_BOOTVER, DFU_GET_HWTYPE or DFU_GET_APPVER to every station of addrs
+    //with several requests in flight, answers are matched back by ADR. serial keeps one in
+    //flight since answers on a shared RS-485 line would collide. returns how many answered
+    int pollStations(uint8_t cmd, const uint8_t *addrs, int cnt, DfuPollRsp *rsp, uint32_t timeoutMs);
+    //inventory of the stations among addrs, every address is asked once for its app version and
+    //only the ones that answered get the other queries. returns the count found or -1
+    int scanStations(const uint8_t *addrs, int cnt, std::vector<DfuStation> &found);
+
+    //whole upgrade of one station, mode 0 - current station, 1 - all stations
+    int upgrade(uint8_t addr, const DfuImage &img, uint8_t mode, volatile int *running);
+    //the same upgrade walking a compiled plan, the image is not needed any more
+    int upgrade(uint8_t addr, const DfuPlan &plan, uint8_t mode, volatile int *running);
+    //one transfer for every station of addrs on CAN, the data frames carry no address so all armed
+    //stations take them at once. results[i] is 0 when addrs[i] was upgraded, returns the count or -1
+    int upgradeBroadcast(const uint8_t *addrs, int cnt, const DfuImage &img, uint8_t mode, volatile int *running,
+        int *results);
+
+    //cmd is a patched copy of a template, rsp gets the frame as it came from the link
+    int request(uint8_t *cmd, uint8_t addr, DfuFrame &rsp, uint32_t timeoutMs);
+    int sendCmd(uint8_t *cmd, uint8_t addr);
+    int waitResponse(DfuFrame &rsp, uint32_t timeoutMs);
+    //LEN ADR STA DATA of a response, the same layout on every link
+    const uint8_t *body(const DfuFrame &rsp) const { return sop ? rsp.data + 1 : rsp.data; }
+    bool useSop(void) const { return sop; }
+    void setUpdateGate(DfuUpdateGate gate, void *ctx) { updateGate = gate; gateCtx = ctx; }
+    //pause after DFU_UPDATE, a simulated pack copies at once and needs no DFU_UPDATE_WAIT_MS
+    void setUpdateWait(uint32_t ms) { updateWaitMs = ms; }
+
+private:
+    int upgradeStages(uint8_t addr, const DfuImage &img, uint8_t mode, volatile int *running);
+    int setupStages(uint8_t addr, const DfuImage &img);
+    int queryStages(uint8_t addr);
+    bool decodesLz(uint8_t addr);
+    int updateStages(uint8_t addr, uint8_t mode, volatile int *running);
+    int waitUpdated(uint8_t addr, volatile int *running);
+    int pollCmd(const uint8_t *cmd, bool (*verify)(uint8_t *dat, bool useSop), const uint8_t *addrs, int cnt,
+        DfuPollRsp *rsp, uint32_t timeoutMs);
+    int broadcastPacket(const std::vector<uint8_t> &to, const DfuImage &img, uint16_t seq, std::vector<uint8_t> &missed);
+    int broadcastStages(const uint8_t *addrs, int cnt, const DfuImage &img, uint8_t mode, volatile int *running,
+        int *results);
+    int runPlan(uint8_t addr, const DfuPlan &plan, volatile int *running);
+    int sendData(uint16_t len, const uint8_t *data);
+
+    Transport &t;
+    bool sop;
+    uint16_t traceSeq;      //packet seq stamped on trace records
+    DfuUpdateGate updateGate;
+    void *gateCtx;
+    uint32_t updateWaitMs;
+    DfuFrame rx;
+    std::vector<DfuFrame> tx;
+};
+
+#include "dfu_engine_impl.h"
+
+extern template class DfuEngineT<DfuTransport>;
+typedef DfuEngineT<DfuTransport> DfuEngine;
@@ -0,0 +1,1093 @@
+#pragma once
+
+//DfuEngineT member functions, included by dfu_engine.h only
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <deque>
+#include <map>
+#include <thread>
+#include <chrono>
+#include "dfu_log.h"
+#include "dfu_trace.h"
+
+template <class Transport>
+DfuEngineT<Transport>::DfuEngineT(Transport &transport)
+    : t(transport), sop(transport.caps().link == DFU_LINK_SERIAL), traceSeq(0),
+      updateGate(NULL), gateCtx(NULL), updateWaitMs(DFU_UPDATE_WAIT_MS)
+{
+    uint16_t batch = transport.caps().maxBatch;
+    tx.resize(batch == 0 ? 1 : (batch > DFU_MAX_BATCH ? DFU_MAX_BATCH : batch));
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::sendCmd(uint8_t *cmd, uint8_t addr)
+{
+    DfuFrame &f = tx[0];
+    dfu_encodeCmd(f, cmd, addr, sop);
+    if (t.send(&f, 1) != 1) {
+        LOG_ERR("send command 0x%02X failed\n", cmd[CMD_CMD_OFFSET]);
+        return -1;
+    }
+    dfu_trace(DFU_TRACE_CMD, t.caps().link, addr, cmd[CMD_CMD_OFFSET], traceSeq, 0, 0, 0);
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::waitResponse(DfuFrame &rsp, uint32_t timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        int ret = t.receive(rsp, deadline);
+        if (ret <= 0) {
+            return ret;
+        }
+        if (sop || rsp.id == CAN_RSP_ID) {
+            return 1;
+        }
+    }
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::request(uint8_t *cmd, uint8_t addr, DfuFrame &rsp, uint32_t timeoutMs)
+{
+    uint64_t start = dfu_traceNowUs();
+    if (sendCmd(cmd, addr) < 0) {
+        return -1;
+    }
+    if (waitResponse(rsp, timeoutMs) != 1) {
+        dfu_trace(DFU_TRACE_TIMEOUT, t.caps().link, addr, cmd[CMD_CMD_OFFSET], traceSeq, 1, start, timeoutMs);
+        LOG_ERR("wait response of command 0x%02X timeout\n", cmd[CMD_CMD_OFFSET]);
+        return -1;
+    }
+    dfu_trace(DFU_TRACE_RSP, t.caps().link, addr, cmd[CMD_CMD_OFFSET], traceSeq, 0, start, body(rsp)[RSP_STA_OFFSET - 1]);
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::prepareCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::prepareCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyPrepare(rx.data, sop)) {
+        return -1;
+    }
+    resp[0] = body(rx)[5];    //get the cell num
+    return 1;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getBootloaderVerCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getBootloaderVerCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyGetBootloaderVer(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET - 1, 5);
+    return 5;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getBatterySN(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getBatterySNCmd);
+    if (sendCmd(cmd, addr) < 0) {
+        return -1;
+    }
+    int seq = 1;
+    int idx = 0;
+    uint32_t timeoutMs = DFU_RSP_TIMEOUT_MS;
+    while (waitResponse(rx, timeoutMs) == 1) {
+        const uint8_t *p = body(rx);
+        if (p[RSP_STA_OFFSET - 1] != DFU_GET_HWINFO + 0x40) {
+            LOG_ERR("getBatterySN response error: command received %d, expected 0x61\n", p[RSP_STA_OFFSET - 1]);
+            return -1;
+        }
+        if (p[RSP_DAT_OFFSET - 1] != seq) {
+            LOG_ERR("getBatterySN response error: seq received %d, expected %d\n", p[RSP_DAT_OFFSET - 1], seq);
+            return -1;
+        }
+        int len = p[RSP_LEN_OFFSET - 1] - 3;
+        memcpy(resp + idx, &p[RSP_DAT_OFFSET], len);
+        idx += len;
+        ++seq;
+        timeoutMs = DFU_NEXT_FRAME_TIMEOUT_MS;  //no remaining packet once the frames stop
+    }
+    return idx;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getHardwareInfoCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getHardwareInfoCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyGetHardwareInfo(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET - 1, 5);
+    return 5;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getHardwareTypeCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getHardwareTypeCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyGetHardwareType(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET - 1, 5);
+    return 5;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getApplicationVerCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getApplicationVerCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyGetApplicationVer(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET - 1, 5);
+    return 5;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getPacketLenCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getPacketLenCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyGetPacketLen(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET - 1, 4);
+    return 4;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::setPacketLenCmd(uint8_t addr, uint16_t packetLen)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    if (!dfu_validPacketLen(packetLen)) {
+        return -1;
+    }
+    dfu_loadCmd(cmd, ::setPacketLenCmd);
+    cmd[CMD_DAT_OFFSET] = packetLen & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (packetLen >> 8) & 0xFF;
+    cmd[CMD_DAT_OFFSET + 2] = 0x00;
+    cmd[CMD_DAT_OFFSET + 3] = 0x00;
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifySetPacketLen(rx.data, sop)) {
+        return -1;
+    }
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::setApplicationLenCmd(uint8_t addr, uint32_t applicationLen, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::setApplicationLenCmd);
+    cmd[CMD_DAT_OFFSET] = applicationLen & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (applicationLen >> 8) & 0xFF;
+    cmd[CMD_DAT_OFFSET + 2] = (applicationLen >> 16) & 0xFF;
+    cmd[CMD_DAT_OFFSET + 3] = (applicationLen >> 24) & 0xFF;
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifySetApplicationLen(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET, 4);
+    return 4;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::setPacketSeqCmd(uint8_t addr, uint16_t packetSeq, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::setPacketSeqCmd);
+    cmd[CMD_DAT_OFFSET] = packetSeq & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (packetSeq >> 8) & 0xFF;
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifySetPacketSeq(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET, 2);
+    return 2;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::setPacketAddrCmd(uint8_t addr, uint32_t packetAddr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::setPacketAddrCmd);
+    cmd[CMD_DAT_OFFSET] = packetAddr & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (packetAddr >> 8) & 0xFF;
+    cmd[CMD_DAT_OFFSET + 2] = (packetAddr >> 16) & 0xFF;
+    cmd[CMD_DAT_OFFSET + 3] = (packetAddr >> 24) & 0xFF;
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifySetPacketAddr(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET, 4);
+    return 4;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::setPacketSeqLzCmd(uint8_t addr, uint16_t packetSeq, uint16_t lzLen, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::setPacketSeqLzCmd);
+    cmd[CMD_DAT_OFFSET] = packetSeq & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (packetSeq >> 8) & 0xFF;
+    cmd[CMD_DAT_OFFSET + 2] = lzLen & 0xFF;
+    cmd[CMD_DAT_OFFSET + 3] = (lzLen >> 8) & 0xFF;
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifySetPacketSeqLz(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET, 4);
+    return 4;
+}
+
+//a bootloader without the query stays silent, that is no error here
+template <class Transport>
+int DfuEngineT<Transport>::getCapsCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getCapsCmd);
+    if (sendCmd(cmd, addr) < 0) {
+        return -1;
+    }
+    if (waitResponse(rx, DFU_CAPS_TIMEOUT_MS) != 1) {
+        return 0;
+    }
+    if (!verifyGetCaps(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET - 1, 4);
+    return 4;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::sendPacketData(uint16_t packetLen, const uint8_t *data)
+{
+    if (!dfu_validPacketLen(packetLen)) {
+        return -1;
+    }
+    return sendData(packetLen, data);
+}
+
+//CAN splits the data into 8 bytes frames, the last one padded with 0x00, serial sends it as one data frame
+template <class Transport>
+int DfuEngineT<Transport>::sendData(uint16_t len, const uint8_t *data)
+{
+    const DfuTransportCaps &caps = t.caps();
+    if (sop) {
+        DfuFrame &f = tx[0];
+        f.id = 0;
+        f.len = len + 4;
+        //data packet has no length or address, only SOP, data, crc and EOP (Rev 0.17, 2.10 send data)
+        f.data[CMD_SOP_OFFSET] = DFU_DAT_SOP;
+        memcpy(f.data + 1, data, len);
+        uint16_t crc = crc16((uint8_t *)data, len, 0xffff);
+        f.data[len + 1] = crc & 0xFF;
+        f.data[len + 2] = (crc >> 8) & 0xFF;
+        f.data[len + 3] = DFU_CMD_EOP;
+        if (t.send(&f, 1) != 1) {
+            LOG_ERR("send packet data command failed\n");
+            return -1;
+        }
+        if (caps.dataGapUs) {
+            std::this_thread::sleep_for(std::chrono::microseconds(caps.dataGapUs));   //FW writes the packet into flash
+        }
+        return 0;
+    }
+    size_t step = caps.dataGapUs ? 1 : tx.size();     //FW that needs a gap gets one frame at a time
+    uint16_t offset = 0;
+    while (offset < len) {
+        int n = 0;
+        for (; n < (int)step && offset < len; ++n, offset += 8) {
+            tx[n].id = CAN_DAT_ID;
+            tx[n].len = 8;  //always 8 bytes
+            if (len - offset < 8) {
+                memset(tx[n].data, 0x00, 8);
+                memcpy(tx[n].data, data + offset, len - offset);
+            } else {
+                memcpy(tx[n].data, data + offset, 8);
+            }
+        }
+        if (t.send(tx.data(), n) != n) {
+            LOG_ERR("send packet data command failed\n");
+            return -1;
+        }
+        if (caps.dataGapUs) {
+            std::this_thread::sleep_for(std::chrono::microseconds(caps.dataGapUs));   //for FW to process the data
+        }
+    }
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::verifyPacketDataCmd(uint8_t addr, uint16_t packetCrc)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::verifyPacketDataCmd);
+    cmd[CMD_DAT_OFFSET] = packetCrc & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (packetCrc >> 8) & 0xFF;
+    if (request(cmd, addr, rx, DFU_VERIFY_PKT_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyPacketData(rx.data, sop)) {
+        return -1;
+    }
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::verifyAllDataCmd(uint8_t addr, uint8_t crcType, uint32_t fileCrc)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    if (crcType != 0 && crcType != 1) {
+        LOG_ERR("crc type should be 0 - crc16 or 1 - crc32\n");
+        return -1;
+    }
+    if (crcType == 0) {
+        dfu_loadCmd(cmd, verifyAllDataCrc16Cmd);
+        cmd[CMD_DAT_OFFSET + 1] = fileCrc & 0xFF;
+        cmd[CMD_DAT_OFFSET + 2] = (fileCrc >> 8) & 0xFF;
+    } else {
+        dfu_loadCmd(cmd, verifyAllDataCrc32Cmd);
+        cmd[CMD_DAT_OFFSET + 1] = fileCrc & 0xFF;
+        cmd[CMD_DAT_OFFSET + 2] = (fileCrc >> 8) & 0xFF;
+        cmd[CMD_DAT_OFFSET + 3] = (fileCrc >> 16) & 0xFF;
+        cmd[CMD_DAT_OFFSET + 4] = (fileCrc >> 24) & 0xFF;
+    }
+    if (request(cmd, addr, rx, DFU_VERIFY_ALL_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyAllData(rx.data, sop)) {
+        return -1;
+    }
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::updateStationCmd(uint8_t addr, bool all)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::updateStationCmd);
+    if (all) {
+        cmd[CMD_DAT_OFFSET] = 0x52;
+        addr = 0x00;
+    } else {
+        cmd[CMD_DAT_OFFSET] = 0x51;
+    }
+    return sendCmd(cmd, addr);  //no response
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::getUpdateStatusCmd(uint8_t addr, uint8_t *resp)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(cmd, ::getUpdateStatusCmd);
+    if (request(cmd, addr, rx, DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    if (!verifyGetUpdateStatus(rx.data, sop)) {
+        return -1;
+    }
+    memcpy(resp, body(rx) + RSP_DAT_OFFSET, 3);
+    return 3;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::pollStations(uint8_t cmd, const uint8_t *addrs, int cnt, DfuPollRsp *rsp, uint32_t timeoutMs)
+{
+    const uint8_t *tmpl;
+    bool (*verify)(uint8_t *dat, bool useSop);
+    switch (cmd) {
+    case DFU_PREPARE:
+        tmpl = ::prepareCmd;
+        verify = verifyPrepare;
+        break;
+    case DFU_GET_BOOTVER:
+        tmpl = ::getBootloaderVerCmd;
+        verify = verifyGetBootloaderVer;
+        break;
+    case DFU_GET_HWTYPE:
+        tmpl = ::getHardwareTypeCmd;
+        verify = verifyGetHardwareType;
+        break;
+    case DFU_GET_APPVER:
+        tmpl = ::getApplicationVerCmd;
+        verify = verifyGetApplicationVer;
+        break;
+    default:
+        LOG_ERR("command 0x%02X can not be polled\n", cmd);
+        return -1;
+    }
+    uint8_t buf[RS485_CMD_MAX_LEN];
+    dfu_loadCmd(buf, tmpl);
+    return pollCmd(buf, verify, addrs, cnt, rsp, timeoutMs);
+}
+
+//cmd goes to every address with only ADR patched, verify decides which answers count
+template <class Transport>
+int DfuEngineT<Transport>::pollCmd(const uint8_t *cmd, bool (*verify)(uint8_t *dat, bool useSop), const uint8_t *addrs,
+    int cnt, DfuPollRsp *rsp, uint32_t timeoutMs)
+{
+    struct Pending {
+        int idx;
+        DfuDeadline deadline;
+        uint64_t startUs;
+    };
+    std::deque<Pending> pending;    //in send order, the first one always expires first
+    int window = sop ? 1 : DFU_POLL_WINDOW;
+    int next = 0;
+    int answered = 0;
+    uint8_t code = cmd[CMD_CMD_OFFSET];
+    uint8_t buf[RS485_CMD_MAX_LEN];
+    for (int i=0; i<cnt; ++i) {
+        rsp[i].ok = false;
+        memset(rsp[i].data, 0x00, sizeof(rsp[i].data));
+    }
+    while (next < cnt || !pending.empty()) {
+        //the window is filled in batches of tx before anything is read back
+        while ((int)pending.size() < window && next < cnt) {
+            int n = 0;
+            while ((int)pending.size() + n < window && next + n < cnt && n < (int)tx.size()) {
+                memcpy(buf, cmd, RS485_CMD_MAX_LEN);
+                dfu_encodeCmd(tx[n], buf, addrs[next + n], sop);
+                ++n;
+            }
+            if (t.send(tx.data(), n) != n) {
+                LOG_ERR("send command 0x%02X failed\n", code);
+                return -1;
+            }
+            DfuDeadline deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+            uint64_t startUs = dfu_traceNowUs();
+            for (int k=0; k<n; ++k) {
+                pending.push_back({ next + k, deadline, startUs });
+                dfu_trace(DFU_TRACE_CMD, t.caps().link, addrs[next + k], code, traceSeq, 0, 0, 0);
+            }
+            next += n;
+        }
+        int ret = t.receive(rx, pending.front().deadline);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            const Pending &p = pending.front();
+            dfu_trace(DFU_TRACE_TIMEOUT, t.caps().link, addrs[p.idx], code, traceSeq, 1, p.startUs, timeoutMs);
+            pending.pop_front();
+            continue;
+        }
+        const uint8_t *b = body(rx);
+        if ((!sop && rx.id != CAN_RSP_ID) || b[RSP_STA_OFFSET - 1] != code + 0x40) {
+            continue;   //another frame on the bus or a late answer to an earlier command
+        }
+        auto it = pending.begin();
+        while (it != pending.end() && addrs[it->idx] != b[RSP_ADR_OFFSET - 1]) {
+            ++it;
+        }
+        if (it == pending.end()) {
+            continue;
+        }
+        if (verify(rx.data, sop)) {
+            DfuPollRsp &r = rsp[it->idx];
+            uint8_t len = b[RSP_LEN_OFFSET - 1] < 2 ? 0 : b[RSP_LEN_OFFSET - 1] - 2;
+            r.ok = true;
+            memcpy(r.data, b + RSP_DAT_OFFSET - 1, len < sizeof(r.data) ? len : sizeof(r.data));
+            ++answered;
+            dfu_trace(DFU_TRACE_RSP, t.caps().link, addrs[it->idx], code, traceSeq, 0, it->startUs, code + 0x40);
+        }
+        pending.erase(it);
+    }
+    return answered;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::scanStations(const uint8_t *addrs, int cnt, std::vector<DfuStation> &found)
+{
+    found.clear();
+    std::vector<DfuPollRsp> rsp(cnt);
+    if (pollStations(DFU_GET_APPVER, addrs, cnt, rsp.data(), DFU_SCAN_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    std::vector<uint8_t> alive;
+    for (int i=0; i<cnt; ++i) {
+        if (rsp[i].ok) {
+            DfuStation st;
+            memset(&st, 0x00, sizeof(st));
+            st.addr = addrs[i];
+            memcpy(st.appVer, rsp[i].data, sizeof(st.appVer));
+            found.push_back(st);
+            alive.push_back(addrs[i]);
+        }
+    }
+    int n = (int)alive.size();
+    if (n == 0) {
+        return 0;
+    }
+    //the rest only waits for a timeout when a station in app mode does not know the command
+    if (pollStations(DFU_GET_BOOTVER, alive.data(), n, rsp.data(), DFU_SCAN_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    std::vector<uint8_t> boot;
+    for (int i=0; i<n; ++i) {
+        found[i].boot = rsp[i].ok;
+        memcpy(found[i].bootVer, rsp[i].data, sizeof(found[i].bootVer));
+        if (rsp[i].ok) {
+            boot.push_back(alive[i]);
+        }
+    }
+    if (pollStations(DFU_GET_HWTYPE, alive.data(), n, rsp.data(), DFU_SCAN_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    for (int i=0; i<n; ++i) {
+        found[i].hwKnown = rsp[i].ok;
+        memcpy(found[i].hwType, rsp[i].data, sizeof(found[i].hwType));
+    }
+    if (!boot.empty()) {
+        if (pollStations(DFU_PREPARE, boot.data(), (int)boot.size(), rsp.data(), DFU_SCAN_TIMEOUT_MS) < 0) {
+            return -1;
+        }
+        for (size_t k=0, i=0; k<boot.size(); ++k) {
+            while (found[i].addr != boot[k]) {
+                ++i;
+            }
+            found[i].cellNum = rsp[k].ok ? rsp[k].data[2] : 0;    //CC FE cellNum
+        }
+    }
+    return n;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::upgrade(uint8_t addr, const DfuImage &img, uint8_t mode, volatile int *running)
+{
+    uint64_t start = dfu_traceNowUs();
+    dfu_trace(DFU_TRACE_SESSION_BEGIN, t.caps().link, addr, 0, 0, 0, 0, img.len);
+    int ret = upgradeStages(addr, img, mode, running);
+    traceSeq = 0;
+    dfu_trace(DFU_TRACE_SESSION_END, t.caps().link, addr, 0, 0, (uint8_t)ret, start, img.len);
+    return ret;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::upgradeStages(uint8_t addr, const DfuImage &img, uint8_t mode, volatile int *running)
+{
+    uint8_t resp[8];
+    uint16_t seq = 0x01;
+    if (queryStages(addr) < 0) {
+        return -1;
+    }
+    bool lz = !img.lzOffset.empty() && decodesLz(addr);
+    int ret = setupStages(addr, img);
+    if (ret < 0) {
+        return ret;
+    }
+    while (seq <= img.packetCnt) {
+        if (running != NULL && !*running) {
+            LOG_WARN("upgrade aborted at packet seq %d\n", seq);
+            return -1;
+        }
+        uint64_t packetStart = dfu_traceNowUs();
+        traceSeq = seq;
+        uint16_t lzLen = lz ? dfu_imageLzLen(img, seq - 1) : img.packetLen;
+        uint64_t dataStart;
+        if (lzLen < img.packetLen) {
+            if (setPacketSeqLzCmd(addr, seq, lzLen, resp) < 0 || (resp[0] | (resp[1] << 8)) != seq) {
+                LOG_ERR("try to set packet sequence num %d failed\n", seq);
+                return -1;
+            }
+            dataStart = dfu_traceNowUs();
+            ret = sendData(lzLen, img.lz.data() + img.lzOffset[seq - 1]);
+        } else {
+            if (setPacketSeqCmd(addr, seq, resp) < 0 || (resp[0] | (resp[1] << 8)) != seq) {
+                LOG_ERR("try to set packet sequence num %d failed\n", seq);
+                return -1;
+            }
+            dataStart = dfu_traceNowUs();
+            ret = sendPacketData(img.packetLen, dfu_imagePacket(img, seq - 1));
+        }
+        if (ret < 0) {
+            LOG_ERR("try to send packet data for seq %d failed\n", seq);
+            return -1;
+        }
+        dfu_trace(DFU_TRACE_DATA, t.caps().link, addr, 0, seq, 0, dataStart, lzLen);
+        if (verifyPacketDataCmd(addr, img.packetCrc[seq-1]) < 0) {
+            LOG_ERR("try to verify packet crc for seq %d failed\n", seq);
+            return -1;
+        }
+        LOG_DEBUG("packet seq %d 's crc is 0x%04X\n", seq, img.packetCrc[seq-1]);
+        dfu_trace(DFU_TRACE_PACKET, t.caps().link, addr, DFU_VERIFY_PKTDAT, seq, 0, packetStart, img.packetLen);
+        ++seq;
+    }
+    traceSeq = 0;
+    if (verifyAllDataCmd(addr, img.crcType, img.fileCrc) < 0) {
+        LOG_ERR("try to set verify application failed\n");
+        return -1;
+    }
+    if (img.crcType == 0) {
+        LOG_INFO("whole file length is %u, crc uses crc16 : 0x%04x\n", img.len, img.fileCrc);
+    } else {
+        LOG_INFO("whole file length is %u, crc uses crc32 : 0x%08x\n", img.len, img.fileCrc);
+    }
+    return updateStages(addr, mode, running);
+}
+
+//packet and application length, the station answers with what it took
+template <class Transport>
+int DfuEngineT<Transport>::setupStages(uint8_t addr, const DfuImage &img)
+{
+    uint8_t resp[8];
+    if (img.packetLen != DEFAULT_PKT_LEN) {
+        if (setPacketLenCmd(addr, img.packetLen) < 0) {
+            LOG_ERR("try to set packet length %d failed\n", img.packetLen);
+            return -1;
+        }
+        if (getPacketLenCmd(addr, resp) < 0) {
+            LOG_ERR("try to get packet length failed\n");
+            return -1;
+        }
+        uint32_t newPacketLen = resp[0] | (resp[1] << 8) | (resp[2] << 16) | ((uint32_t)resp[3] << 24);
+        if (newPacketLen != img.packetLen) {
+            LOG_ERR("packetLen are not equal, %u is set\n", newPacketLen);
+            return -2;
+        }
+    }
+    if (setApplicationLenCmd(addr, img.len, resp) < 0 ||
+        (resp[0] | (resp[1] << 8) | (resp[2] << 16) | ((uint32_t)resp[3] << 24)) != img.len) {
+        LOG_ERR("try to set application length %u failed\n", img.len);
+        return -1;
+    }
+    return 0;
+}
+
+//versions and prepare, answered with values of the station
+template <class Transport>
+int DfuEngineT<Transport>::queryStages(uint8_t addr)
+{
+    uint8_t resp[8];
+    if (getBootloaderVerCmd(addr, resp) < 0) {
+        LOG_ERR("could not fetch LV BMS bootloader's version, is the board fw in the dfu mode?\n");
+        return -1;
+    }
+    LOG_INFO("LV BMS FW bootloader's version is %d.%d.%d, build is %d, HW is %d\n",
+        resp[3], resp[2], resp[1], resp[0], resp[4]);
+    if (getApplicationVerCmd(addr, resp) < 0) {
+        LOG_ERR("could not fetch LV BMS app's version\n");
+        return -1;
+    }
+    LOG_INFO("LV BMS FW application's version is %d.%d.%d, build is %d\n",
+        resp[4], resp[3], resp[2], (resp[1] << 8) | resp[0]);
+    if (prepareCmd(addr, resp) < 0) {
+        LOG_ERR("could not prepare dfu upgrade\n");
+        return -1;
+    }
+    LOG_INFO("LV BMS' battery cell num is %d\n", resp[0]);
+    return 0;
+}
+
+template <class Transport>
+bool DfuEngineT<Transport>::decodesLz(uint8_t addr)
+{
+    uint8_t resp[4];
+    if (getCapsCmd(addr, resp) == 4 && (resp[0] & DFU_CAP_LZ) != 0) {
+        LOG_INFO("bootloader decodes LZ4, compressed packets are sent\n");
+        return true;
+    }
+    LOG_INFO("bootloader has no LZ4 decoder, packets are sent as they are\n");
+    return false;
+}
+
+//the station copies the app, mode 1 waits until every station reports the result
+template <class Transport>
+int DfuEngineT<Transport>::updateStages(uint8_t addr, uint8_t mode, volatile int *running)
+{
+    if (updateGate != NULL && updateGate(gateCtx) < 0) {
+        LOG_ERR("image was not accepted, station 0x%02X keeps its app\n", addr);
+        return -1;
+    }
+    if (updateStationCmd(addr, mode == 1) < 0) {
+        LOG_ERR("try to update station failed\n");
+        return -1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(updateWaitMs));
+    if (mode == 0) {
+        return 0;
+    }
+    return waitUpdated(addr, running);
+}
+
+//status polls until the station copied the app to all its stations
+template <class Transport>
+int DfuEngineT<Transport>::waitUpdated(uint8_t addr, volatile int *running)
+{
+    uint8_t resp[8];
+    while (running == NULL || *running) {
+        if (getUpdateStatusCmd(addr, resp) < 0) {
+            LOG_ERR("try to get update status failed\n");
+            return -1;
+        }
+        if (resp[0] == 0xAA) {
+            LOG_INFO("update bms app successfully\n");
+            return 0;
+        } else if (resp[0] == 0x0C) {
+            LOG_INFO("progressing: transfer bms app internal data\n");
+        } else if (resp[0] == 0x0D) {
+            LOG_INFO("progressing: verify bms internal crc\n");
+        } else {
+            LOG_ERR("update bms app failed, error code is %d\n", resp[0]);
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));   //10ms
+    }
+    return -1;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::upgradeBroadcast(const uint8_t *addrs, int cnt, const DfuImage &img, uint8_t mode,
+    volatile int *running, int *results)
+{
+    if (sop) {
+        LOG_ERR("broadcast needs CAN, serial stations are upgraded one by one\n");
+        return -1;
+    }
+    uint64_t start = dfu_traceNowUs();
+    dfu_trace(DFU_TRACE_SESSION_BEGIN, t.caps().link, 0x00, 0, 0, 0, 0, img.len);
+    int ret = broadcastStages(addrs, cnt, img, mode, running, results);
+    traceSeq = 0;
+    dfu_trace(DFU_TRACE_SESSION_END, t.caps().link, 0x00, 0, 0, (uint8_t)ret, start, img.len);
+    return ret;
+}
+
+//every station of to is armed with seq, the data goes once and each one verifies its copy.
+//stations that refused, stayed silent or got a bad copy end up in missed
+template <class Transport>
+int DfuEngineT<Transport>::broadcastPacket(const std::vector<uint8_t> &to, const DfuImage &img, uint16_t seq,
+    std::vector<uint8_t> &missed)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    std::vector<DfuPollRsp> rsp(to.size());
+    std::vector<uint8_t> armed;
+    missed.clear();
+    traceSeq = seq;
+    dfu_loadCmd(cmd, ::setPacketSeqCmd);
+    cmd[CMD_DAT_OFFSET] = seq & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (seq >> 8) & 0xFF;
+    if (pollCmd(cmd, verifySetPacketSeq, to.data(), (int)to.size(), rsp.data(), DFU_RSP_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    for (size_t i=0; i<to.size(); ++i) {
+        if (rsp[i].ok) {
+            armed.push_back(to[i]);
+        } else {
+            missed.push_back(to[i]);
+        }
+    }
+    if (armed.empty()) {
+        return 0;
+    }
+    //always plain, an LZ block decodes against the flash of the station so one lost packet would spoil the rest
+    uint64_t dataStart = dfu_traceNowUs();
+    if (sendData(img.packetLen, dfu_imagePacket(img, seq - 1)) < 0) {
+        LOG_ERR("try to send packet data for seq %d failed\n", seq);
+        return -1;
+    }
+    dfu_trace(DFU_TRACE_DATA, t.caps().link, 0x00, 0, seq, 0, dataStart, img.packetLen);
+    dfu_loadCmd(cmd, ::verifyPacketDataCmd);
+    cmd[CMD_DAT_OFFSET] = img.packetCrc[seq - 1] & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (img.packetCrc[seq - 1] >> 8) & 0xFF;
+    if (pollCmd(cmd, verifyPacketData, armed.data(), (int)armed.size(), rsp.data(), DFU_VERIFY_PKT_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    for (size_t i=0; i<armed.size(); ++i) {
+        if (!rsp[i].ok) {
+            missed.push_back(armed[i]);
+        }
+    }
+    return 0;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::broadcastStages(const uint8_t *addrs, int cnt, const DfuImage &img, uint8_t mode,
+    volatile int *running, int *results)
+{
+    int slot[0x100];    //index into addrs of every address
+    memset(slot, 0xFF, sizeof(slot));
+    for (int i=0; i<cnt; ++i) {
+        if (slot[addrs[i]] >= 0) {
+            LOG_ERR("station %d is listed twice\n", addrs[i]);
+            return -1;
+        }
+        slot[addrs[i]] = i;
+        results[i] = -1;
+    }
+    std::vector<uint8_t> live;
+    for (int i=0; i<cnt; ++i) {
+        if (queryStages(addrs[i]) < 0 || setupStages(addrs[i], img) < 0) {
+            LOG_ERR("station %d could not be set up, left out of the broadcast\n", addrs[i]);
+            continue;
+        }
+        live.push_back(addrs[i]);
+    }
+    std::vector<std::vector<uint16_t>> missing(cnt);
+    std::vector<uint16_t> lastMiss(cnt, 0);
+    std::vector<uint8_t> inRow(cnt, 0);     //packets missed one after another
+    std::vector<uint8_t> missed;
+    for (uint16_t seq=1; seq<=img.packetCnt && !live.empty(); ++seq) {
+        if (running != NULL && !*running) {
+            LOG_WARN("broadcast aborted at packet seq %d\n", seq);
+            return -1;
+        }
+        uint64_t packetStart = dfu_traceNowUs();
+        if (broadcastPacket(live, img, seq, missed) < 0) {
+            return -1;
+        }
+        for (uint8_t a : missed) {
+            int i = slot[a];
+            missing[i].push_back(seq);
+            inRow[i] = lastMiss[i] == seq - 1 ? inRow[i] + 1 : 1;
+            lastMiss[i] = seq;
+        }
+        //a station that is gone would cost the answer timeouts on every packet
+        for (size_t k=0; k<live.size(); ) {
+            if (inRow[slot[live[k]]] >= DFU_BCAST_DROP_MISSES) {
+                LOG_ERR("station %d missed %d packets in a row, dropped from the broadcast\n", live[k], DFU_BCAST_DROP_MISSES);
+                live.erase(live.begin() + k);
+            } else {
+                ++k;
+            }
+        }
+        dfu_trace(DFU_TRACE_PACKET, t.caps().link, 0x00, DFU_VERIFY_PKTDAT, seq, 0, packetStart, img.packetLen);
+    }
+    //repairs go to the stations that miss a packet, one packet at a time for all of them
+    for (int round=0; round<DFU_BCAST_REPAIR_ROUNDS; ++round) {
+        std::map<uint16_t, std::vector<uint8_t>> repair;
+        for (uint8_t a : live) {
+            for (uint16_t seq : missing[slot[a]]) {
+                repair[seq].push_back(a);
+            }
+            missing[slot[a]].clear();
+        }
+        if (repair.empty()) {
+            break;
+        }
+        LOG_WARN("repair round %d, %zu packets\n", round + 1, repair.size());
+        for (auto &it : repair) {
+            if (running != NULL && !*running) {
+                LOG_WARN("broadcast aborted at repair of packet seq %d\n", it.first);
+                return -1;
+            }
+            if (broadcastPacket(it.second, img, it.first, missed) < 0) {
+                return -1;
+            }
+            for (uint8_t a : missed) {
+                missing[slot[a]].push_back(it.first);
+            }
+        }
+    }
+    traceSeq = 0;
+    std::vector<uint8_t> complete;
+    for (uint8_t a : live) {
+        if (missing[slot[a]].empty()) {
+            complete.push_back(a);
+        } else {
+            LOG_ERR("station %d still misses %zu packets\n", a, missing[slot[a]].size());
+        }
+    }
+    if (complete.empty()) {
+        return 0;
+    }
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    if (img.crcType == 0) {
+        dfu_loadCmd(cmd, verifyAllDataCrc16Cmd);
+        cmd[CMD_DAT_OFFSET + 1] = img.fileCrc & 0xFF;
+        cmd[CMD_DAT_OFFSET + 2] = (img.fileCrc >> 8) & 0xFF;
+    } else {
+        dfu_loadCmd(cmd, verifyAllDataCrc32Cmd);
+        cmd[CMD_DAT_OFFSET + 1] = img.fileCrc & 0xFF;
+        cmd[CMD_DAT_OFFSET + 2] = (img.fileCrc >> 8) & 0xFF;
+        cmd[CMD_DAT_OFFSET + 3] = (img.fileCrc >> 16) & 0xFF;
+        cmd[CMD_DAT_OFFSET + 4] = (img.fileCrc >> 24) & 0xFF;
+    }
+    std::vector<DfuPollRsp> rsp(complete.size());
+    if (pollCmd(cmd, verifyAllData, complete.data(), (int)complete.size(), rsp.data(), DFU_VERIFY_ALL_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    std::vector<uint8_t> verified;
+    for (size_t i=0; i<complete.size(); ++i) {
+        if (rsp[i].ok) {
+            verified.push_back(complete[i]);
+        } else {
+            LOG_ERR("station %d did not verify the whole file\n", complete[i]);
+        }
+    }
+    if (verified.empty()) {
+        return 0;
+    }
+    if (updateGate != NULL && updateGate(gateCtx) < 0) {
+        LOG_ERR("image was not accepted, every station keeps its app\n");
+        return -1;
+    }
+    //the all stations update goes out once, a station that did not verify refuses it
+    if (mode == 1) {
+        if (updateStationCmd(0x00, true) < 0) {
+            LOG_ERR("try to update station failed\n");
+            return -1;
+        }
+    } else {
+        for (uint8_t a : verified) {
+            if (updateStationCmd(a, false) < 0) {
+                LOG_ERR("try to update station failed\n");
+                return -1;
+            }
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(updateWaitMs));
+    int upgraded = 0;
+    for (uint8_t a : verified) {
+        if (mode == 0 || waitUpdated(a, running) == 0) {
+            results[slot[a]] = 0;
+            ++upgraded;
+        }
+    }
+    return upgraded;
+}
+
+template <class Transport>
+int DfuEngineT<Transport>::upgrade(uint8_t addr, const DfuPlan &plan, uint8_t mode, volatile int *running)
+{
+    uint64_t start = dfu_traceNowUs();
+    dfu_trace(DFU_TRACE_SESSION_BEGIN, t.caps().link, addr, 0, 0, 0, 0, plan.len);
+    int ret = -1;
+    if (plan.link != t.caps().link) {
+        LOG_ERR("plan is compiled for link %d, the transport is link %d\n", plan.link, t.caps().link);
+    } else if (queryStages(addr) == 0) {
+        ret = runPlan(addr, plan, running);
+        if (ret == 0) {
+            ret = updateStages(addr, mode, running);
+        }
+    }
+    traceSeq = 0;
+    dfu_trace(DFU_TRACE_SESSION_END, t.caps().link, addr, 0, 0, (uint8_t)ret, start, plan.len);
+    return ret;
+}
+
+//frames are copied out of the plan with only ADR and the command crc patched, answers are compared whole
+template <class Transport>
+int DfuEngineT<Transport>::runPlan(uint8_t addr, const DfuPlan &plan, volatile int *running)
+{
+    const DfuTransportCaps &caps = t.caps();
+    uint16_t delta[RS485_CMD_MAX_LEN];
+    uint8_t expect[RS485_FRAME_LEN(RS485_CMD_MAX_LEN)];
+    uint8_t skip = DFU_PLAN_OP_LZ;
+    if ((plan.flags & DFU_PLAN_HAS_LZ) && decodesLz(addr)) {
+        skip = DFU_PLAN_OP_PLAIN;
+    }
+    dfu_planCrcDelta(delta, addr);
+    uint64_t packetStart = 0;
+    for (size_t i=0; i<plan.ops.size(); ++i) {
+        const DfuPlanOp &op = plan.ops[i];
+        if (op.flags & skip) {
+            continue;
+        }
+        if (running != NULL && !*running) {
+            LOG_WARN("upgrade aborted at packet seq %d\n", op.seq);
+            return -1;
+        }
+        traceSeq = op.seq;
+        uint64_t opStart = dfu_traceNowUs();
+        if (op.cmd == DFU_SET_PKTNUM || op.cmd == DFU_SET_PKTNUM_LZ) {
+            packetStart = opStart;
+        }
+        //commands are single frames, data goes in batches like sendData
+        size_t step = op.cmd != 0 || caps.dataGapUs ? 1 : tx.size();
+        uint32_t bytes = 0;
+        for (uint32_t k=0; k<op.frameCnt; ) {
+            int n = 0;
+            for (; n < (int)step && k < op.frameCnt; ++n, ++k) {
+                const DfuPlanFrame &pf = plan.frames[op.frame + k];
+                tx[n].id = pf.id;
+                tx[n].len = pf.len;
+                memcpy(tx[n].data, &plan.bytes[pf.offset], pf.len);
+                bytes += pf.len;
+                if (op.cmd != 0) {
+                    dfu_planPatch(tx[n].data, addr, delta, sop);
+                }
+            }
+            if (t.send(tx.data(), n) != n) {
+                LOG_ERR("send planned frames of command 0x%02X, seq %d failed\n", op.cmd, op.seq);
+                return -1;
+            }
+            if (op.cmd == 0 && caps.dataGapUs) {
+                std::this_thread::sleep_for(std::chrono::microseconds(caps.dataGapUs));   //for FW to process the data
+            }
+        }
+        if (op.cmd == 0) {
+            dfu_trace(DFU_TRACE_DATA, caps.link, addr, 0, op.seq, 0, opStart, bytes);
+        } else {
+            dfu_trace(DFU_TRACE_CMD, caps.link, addr, op.cmd, op.seq, 0, 0, 0);
+        }
+        if (op.rspLen == 0) {
+            continue;
+        }
+        if (waitResponse(rx, op.timeoutMs) != 1) {
+            dfu_trace(DFU_TRACE_TIMEOUT, caps.link, addr, op.cmd, op.seq, 1, opStart, op.timeoutMs);
+            LOG_ERR("wait response of command 0x%02X, seq %d timeout\n", op.cmd, op.seq);
+            return -1;
+        }
+        dfu_trace(DFU_TRACE_RSP, caps.link, addr, op.cmd, op.seq, 0, opStart, body(rx)[RSP_STA_OFFSET - 1]);
+        memcpy(expect, &plan.bytes[op.rsp], op.rspLen);
+        dfu_planPatch(expect, addr, delta, sop);
+        //CAN pads the 8 bytes behind DATA with anything
+        if ((sop ? rx.len != op.rspLen : rx.len < op.rspLen) || memcmp(rx.data, expect, op.rspLen) != 0) {
+            const uint8_t *p = body(rx);
+            LOG_ERR("command 0x%02X, seq %d answered with STA 0x%02X, DATA 0x%02X, not as planned\n",
+                op.cmd, op.seq, p[RSP_STA_OFFSET - 1], p[RSP_DAT_OFFSET - 1]);
+            return -1;
+        }
+        if (op.cmd == DFU_VERIFY_PKTDAT) {
+            dfu_trace(DFU_TRACE_PACKET, caps.link, addr, DFU_VERIFY_PKTDAT, op.seq, 0, packetStart, plan.packetLen);
+        }
+    }
+    traceSeq = 0;
+    if (plan.crcType == 0) {
+        LOG_INFO("whole file length is %u, crc uses crc16 : 0x%04x\n", plan.len, plan.fileCrc);
+    } else {
+        LOG_INFO("whole file length is %u, crc uses crc32 : 0x%08x\n", plan.len, plan.fileCrc);
+    }
+    return 0;
+}
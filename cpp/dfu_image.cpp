@@ -0,0 +1,179 @@
+//upgrade images memory mapped read-only, one mapping per file shared by every session
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <mutex>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "dfu_image.h"
+#include "dfu_log.h"
+
+struct DfuImageFile {
+    uint64_t dev;           //volume serial or st_dev
+    uint64_t ino;           //file index or st_ino
+    const uint8_t *data;
+    uint32_t len;
+    int refs;
+};
+
+//files are told apart by identity, not by path, so relative and absolute names share too
+static std::mutex imageLock;
+static std::vector<DfuImageFile *> imageFiles;
+
+static DfuImageFile *find_file(uint64_t dev, uint64_t ino)
+{
+    for (DfuImageFile *f : imageFiles) {
+        if (f->dev == dev && f->ino == ino) {
+            ++f->refs;
+            return f;
+        }
+    }
+    return NULL;
+}
+
+const DfuImageFile *dfu_openImageFile(const char *path)
+{
+    uint64_t dev, ino, size;
+    const void *p;
+    std::lock_guard<std::mutex> lock(imageLock);
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_ERR("cannot open image %s\n", path);
+        return NULL;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info)) {
+        CloseHandle(file);
+        return NULL;
+    }
+    dev = info.dwVolumeSerialNumber;
+    ino = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    DfuImageFile *f = find_file(dev, ino);
+    if (f != NULL) {
+        CloseHandle(file);
+        return f;
+    }
+    if (size == 0 || size > 0xFFFFFFFFULL) {
+        LOG_ERR("image %s has %llu bytes\n", path, (unsigned long long)size);
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    p = mapping == NULL ? NULL : MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    //the view keeps the mapping and the file open
+    if (mapping != NULL) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    if (p == NULL) {
+        LOG_ERR("cannot map image %s\n", path);
+        return NULL;
+    }
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERR("cannot open image %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return NULL;
+    }
+    dev = (uint64_t)st.st_dev;
+    ino = (uint64_t)st.st_ino;
+    size = (uint64_t)st.st_size;
+    DfuImageFile *f = find_file(dev, ino);
+    if (f != NULL) {
+        ::close(fd);
+        return f;
+    }
+    if (size == 0 || size > 0xFFFFFFFFULL) {
+        LOG_ERR("image %s has %llu bytes\n", path, (unsigned long long)size);
+        ::close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        LOG_ERR("cannot map image %s\n", path);
+        return NULL;
+    }
+#endif
+    f = new DfuImageFile;
+    f->dev = dev;
+    f->ino = ino;
+    f->data = (const uint8_t *)p;
+    f->len = (uint32_t)size;
+    f->refs = 1;
+    imageFiles.push_back(f);
+    return f;
+}
+
+void dfu_closeImageFile(const DfuImageFile *file)
+{
+    if (file == NULL) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(imageLock);
+    for (size_t i=0; i<imageFiles.size(); ++i) {
+        DfuImageFile *f = imageFiles[i];
+        if (f != file) {
+            continue;
+        }
+        if (--f->refs > 0) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(f->data);
+#else
+        munmap((void *)f->data, f->len);
+#endif
+        imageFiles.erase(imageFiles.begin() + i);
+        delete f;
+        return;
+    }
+}
+
+const uint8_t *dfu_imageFileData(const DfuImageFile *file)
+{
+    return file->data;
+}
+
+uint32_t dfu_imageFileLen(const DfuImageFile *file)
+{
+    return file->len;
+}
+
+int dfu_loadImage(DfuImage &img, const char *path, uint16_t packetLen, uint8_t crcType)
+{
+    const DfuImageFile *file = dfu_openImageFile(path);
+    if (file == NULL) {
+        return -1;
+    }
+    int ret = dfu_prepareImage(img, file->data, file->len, packetLen, crcType);
+    if (ret < 0) {
+        dfu_closeImageFile(file);
+        return -1;
+    }
+    img.file = file;
+    return ret;
+}
+
+void dfu_unloadImage(DfuImage &img)
+{
+    dfu_closeImageFile(img.file);
+    img.file = NULL;
+    img.data = NULL;
+    img.dataLen = 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+//upgrade images memory mapped read-only, one mapping per file shared by every session
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include "dfu_engine.h"
+
+//maps path, or takes one more reference on the mapping when the same file is already mapped.
+//returns NULL when the file can not be opened or is empty
+const DfuImageFile *dfu_openImageFile(const char *path);
+void dfu_closeImageFile(const DfuImageFile *file);
+const uint8_t *dfu_imageFileData(const DfuImageFile *file);
+uint32_t dfu_imageFileLen(const DfuImageFile *file);
+
+//maps path and prepares img on the mapping, the 0xFF padding only exists in img.tail
+int dfu_loadImage(DfuImage &img, const char *path, uint16_t packetLen, uint8_t crcType);
+void dfu_unloadImage(DfuImage &img);
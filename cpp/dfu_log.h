@@ -0,0 +1,246 @@
+#pragma once
+
+//leveled logging over printf_, formats are checked and split into tokens at compile time
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include "printf.h"
+
+#define DFU_LOG_LEVEL_NONE      0
+#define DFU_LOG_LEVEL_ERR       1
+#define DFU_LOG_LEVEL_WARN      2
+#define DFU_LOG_LEVEL_INFO      3
+#define DFU_LOG_LEVEL_DEBUG     4
+
+//lines above this level are not compiled in, the release build drops the per packet lines
+#ifndef DFU_LOG_LEVEL
+#define DFU_LOG_LEVEL           DFU_LOG_LEVEL_INFO
+#endif
+
+//argument a conversion takes
+#define LOG_ARG_NONE            0
+#define LOG_ARG_INT             1
+#define LOG_ARG_LONG            2
+#define LOG_ARG_LLONG           3
+#define LOG_ARG_DOUBLE          4
+#define LOG_ARG_STR             5
+#define LOG_ARG_PTR             6
+#define LOG_ARG_BAD             7   //specifier printf_ does not know
+
+template <size_t N>
+struct LogFmt {
+    printf_tok tok[N];
+};
+
+constexpr bool log_isDigit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+//same grammar as _vsnprintf: %[flags][width][.precision][length]specifier, f points after the '%'
+constexpr const char *log_parseSpec(const char *f, printf_tok &t)
+{
+    t.flags = 0U;
+    t.width = 0U;
+    t.precision = 0U;
+    for (bool more = true; more; ) {
+        switch (*f) {
+        case '0': t.flags |= FLAGS_ZEROPAD; ++f; break;
+        case '-': t.flags |= FLAGS_LEFT; ++f; break;
+        case '+': t.flags |= FLAGS_PLUS; ++f; break;
+        case ' ': t.flags |= FLAGS_SPACE; ++f; break;
+        case '#': t.flags |= FLAGS_HASH; ++f; break;
+        default: more = false; break;
+        }
+    }
+    if (*f == '*') {
+        t.flags |= FLAGS_WIDTH_ARG;
+        ++f;
+    }
+    while (log_isDigit(*f)) {
+        t.width = t.width * 10U + (uint32_t)(*f++ - '0');
+    }
+    if (*f == '.') {
+        t.flags |= FLAGS_PRECISION;
+        ++f;
+        if (*f == '*') {
+            t.flags |= FLAGS_PREC_ARG;
+            ++f;
+        }
+        while (log_isDigit(*f)) {
+            t.precision = t.precision * 10U + (uint32_t)(*f++ - '0');
+        }
+    }
+    switch (*f) {
+    case 'l':
+        t.flags |= FLAGS_LONG;
+        if (*++f == 'l') {
+            t.flags |= FLAGS_LONG_LONG;
+            ++f;
+        }
+        break;
+    case 'h':
+        t.flags |= FLAGS_SHORT;
+        if (*++f == 'h') {
+            t.flags |= FLAGS_CHAR;
+            ++f;
+        }
+        break;
+    case 't':
+        t.flags |= (sizeof(ptrdiff_t) == sizeof(long) ? FLAGS_LONG : FLAGS_LONG_LONG);
+        ++f;
+        break;
+    case 'j':
+        t.flags |= (sizeof(intmax_t) == sizeof(long) ? FLAGS_LONG : FLAGS_LONG_LONG);
+        ++f;
+        break;
+    case 'z':
+        t.flags |= (sizeof(size_t) == sizeof(long) ? FLAGS_LONG : FLAGS_LONG_LONG);
+        ++f;
+        break;
+    default:
+        break;
+    }
+    t.spec = *f;
+    return *f ? f + 1 : f;
+}
+
+constexpr size_t log_tokCount(const char *f)
+{
+    size_t n = 1U;      //literal after the last conversion
+    while (*f) {
+        if (*f++ == '%') {
+            printf_tok t = {};
+            f = log_parseSpec(f, t);
+            ++n;
+        }
+    }
+    return n;
+}
+
+template <size_t N>
+constexpr LogFmt<N> log_tokenize(const char *f)
+{
+    LogFmt<N> r = {};
+    size_t i = 0U;
+    const char *lit = f;
+    while (*f) {
+        if (*f != '%') {
+            ++f;
+            continue;
+        }
+        r.tok[i].lit = lit;
+        r.tok[i].litLen = (uint32_t)(f - lit);
+        f = log_parseSpec(f + 1, r.tok[i]);
+        lit = f;
+        ++i;
+    }
+    r.tok[i].lit = lit;
+    r.tok[i].litLen = (uint32_t)(f - lit);
+    r.tok[i].spec = '\0';
+    return r;
+}
+
+constexpr int log_specArg(const printf_tok &t)
+{
+    switch (t.spec) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'b':
+        return (t.flags & FLAGS_LONG_LONG) ? LOG_ARG_LLONG : ((t.flags & FLAGS_LONG) ? LOG_ARG_LONG : LOG_ARG_INT);
+    case 'c':
+        return LOG_ARG_INT;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        return LOG_ARG_DOUBLE;
+    case 's':
+        return LOG_ARG_STR;
+    case 'p':
+        return LOG_ARG_PTR;
+    case '%':
+        return LOG_ARG_NONE;
+    default:
+        return LOG_ARG_BAD;
+    }
+}
+
+//the conversions an argument of type T can be passed to, integers go by size as va_arg reads them
+template <class T>
+constexpr uint32_t log_argMask(void)
+{
+    typedef typename std::decay<T>::type U;
+    if constexpr (std::is_floating_point<U>::value) {
+        return 1U << LOG_ARG_DOUBLE;
+    } else if constexpr (std::is_pointer<U>::value) {
+        typedef typename std::remove_cv<typename std::remove_pointer<U>::type>::type P;
+        return (1U << LOG_ARG_PTR) | ((std::is_same<P, char>::value || std::is_same<P, uint8_t>::value) ? (1U << LOG_ARG_STR) : 0U);
+    } else if constexpr (std::is_null_pointer<U>::value) {
+        return 1U << LOG_ARG_PTR;
+    } else if constexpr (std::is_integral<U>::value || std::is_enum<U>::value) {
+        return (sizeof(U) <= sizeof(int) ? (1U << LOG_ARG_INT) : 0U) |
+            (sizeof(U) == sizeof(long) || (sizeof(U) <= sizeof(int) && sizeof(long) == sizeof(int)) ? (1U << LOG_ARG_LONG) : 0U) |
+            (sizeof(U) == sizeof(long long) ? (1U << LOG_ARG_LLONG) : 0U);
+    } else {
+        return 0U;      //classes can not go through ...
+    }
+}
+
+template <class... Args>
+constexpr bool log_check(const char *f)
+{
+    const uint32_t mask[] = { log_argMask<Args>()..., 0U };
+    const size_t cnt = sizeof...(Args);
+    size_t n = 0U;
+    while (*f) {
+        if (*f++ != '%') {
+            continue;
+        }
+        printf_tok t = {};
+        f = log_parseSpec(f, t);
+        if ((t.flags & FLAGS_WIDTH_ARG) && (n >= cnt || !(mask[n++] & (1U << LOG_ARG_INT)))) {
+            return false;
+        }
+        if ((t.flags & FLAGS_PREC_ARG) && (n >= cnt || !(mask[n++] & (1U << LOG_ARG_INT)))) {
+            return false;
+        }
+        const int arg = log_specArg(t);
+        if (arg == LOG_ARG_BAD) {
+            return false;
+        }
+        if (arg != LOG_ARG_NONE && (n >= cnt || !(mask[n++] & (1U << arg)))) {
+            return false;
+        }
+    }
+    return n == cnt;
+}
+
+template <bool ok>
+struct LogFmtCheck {
+    static_assert(ok, "log format does not match its arguments");
+};
+
+//only named in sizeof, so the check runs for every level without generating code
+template <class Fmt, class... Args>
+LogFmtCheck<log_check<Args...>(Fmt::s())> log_verify(Args... args);
+
+//Fmt::s() returns the literal, the tokens live in read only data and printf_ never parses the text
+template <class Fmt, class... Args>
+inline void log_emit(Args... args)
+{
+    static constexpr LogFmt<log_tokCount(Fmt::s())> fmt = log_tokenize<log_tokCount(Fmt::s())>(Fmt::s());
+    printf_tok_(fmt.tok, log_tokCount(Fmt::s()), args...);
+}
+
+#define DFU_LOG(level, fmt, ...) \
+    do { \
+        struct LogFmtStr { static constexpr const char *s(void) { return fmt; } }; \
+        (void)sizeof(log_verify<LogFmtStr>(__VA_ARGS__)); \
+        if constexpr ((level) <= DFU_LOG_LEVEL) { \
+            log_emit<LogFmtStr>(__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_ERR(fmt, ...)       DFU_LOG(DFU_LOG_LEVEL_ERR, fmt, __VA_ARGS__)
+#define LOG_WARN(fmt, ...)      DFU_LOG(DFU_LOG_LEVEL_WARN, fmt, __VA_ARGS__)
+#define LOG_INFO(fmt, ...)      DFU_LOG(DFU_LOG_LEVEL_INFO, fmt, __VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)     DFU_LOG(DFU_LOG_LEVEL_DEBUG, fmt, __VA_ARGS__)
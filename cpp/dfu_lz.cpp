@@ -0,0 +1,192 @@
+//LZ4 block coding of packet data, the host compresses and the bootloader decodes
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_lz.h"
+#include "dfu_log.h"
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+    return (rd32(p) * 2654435761U) >> (32 - DFU_LZ_HASH_BITS);
+}
+
+//length above 15 goes on in bytes of 255, false when it does not fit before end
+static inline bool put_len(uint8_t *&op, const uint8_t *end, uint32_t n)
+{
+    for (; n >= 255; n -= 255) {
+        if (op >= end) {
+            return false;
+        }
+        *op++ = 255;
+    }
+    if (op >= end) {
+        return false;
+    }
+    *op++ = (uint8_t)n;
+    return true;
+}
+
+static bool put_sequence(uint8_t *&op, const uint8_t *end, const uint8_t *lit, uint32_t litLen,
+    uint32_t offset, uint32_t matchLen)
+{
+    if (op >= end) {
+        return false;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((litLen >= 15 ? 15 : litLen) << 4);
+    if (litLen >= 15 && !put_len(op, end, litLen - 15)) {
+        return false;
+    }
+    if (op + litLen > end) {
+        return false;
+    }
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if (matchLen == 0) {
+        return true;    //last sequence, literals only
+    }
+    if (op + 2 > end) {
+        return false;
+    }
+    *op++ = offset & 0xFF;
+    *op++ = (offset >> 8) & 0xFF;
+    matchLen -= DFU_LZ_MIN_MATCH;
+    *token |= matchLen >= 15 ? 15 : matchLen;
+    return matchLen < 15 || put_len(op, end, matchLen - 15);
+}
+
+//greedy single probe matcher, table keeps the last position + 1 of every hash across packets
+static uint32_t compress_packet(const uint8_t *buf, uint32_t start, uint32_t len, uint32_t *table,
+    uint8_t *dst, uint32_t cap)
+{
+    uint32_t end = start + len;
+    uint32_t ip = start;
+    uint32_t anchor = start;
+    uint8_t *op = dst;
+    const uint8_t *opEnd = dst + cap;
+    bool fits = true;
+    while (fits && ip + DFU_LZ_MF_LIMIT <= end) {
+        uint32_t h = lz_hash(buf + ip);
+        uint32_t ref = table[h];
+        table[h] = ip + 1;
+        if (ref == 0 || ip - (ref - 1) > DFU_LZ_WINDOW || rd32(buf + ref - 1) != rd32(buf + ip)) {
+            ++ip;
+            continue;
+        }
+        uint32_t r = ref - 1;
+        uint32_t n = DFU_LZ_MIN_MATCH;
+        while (ip + n < end - DFU_LZ_LAST_LITERALS && buf[r + n] == buf[ip + n]) {
+            ++n;
+        }
+        while (ip > anchor && r > 0 && buf[ip - 1] == buf[r - 1]) {
+            --ip;
+            --r;
+            ++n;
+        }
+        fits = put_sequence(op, opEnd, buf + anchor, ip - anchor, ip - r, n);
+        for (uint32_t k=ip+1; k<ip+n; ++k) {
+            table[lz_hash(buf + k)] = k + 1;
+        }
+        ip += n;
+        anchor = ip;
+    }
+    //the tail of the packet is still dictionary for the next one
+    for (uint32_t k=ip; k+4<=end; ++k) {
+        table[lz_hash(buf + k)] = k + 1;
+    }
+    if (!fits || !put_sequence(op, opEnd, buf + anchor, end - anchor, 0, 0)) {
+        return 0;
+    }
+    return (uint32_t)(op - dst);
+}
+
+int dfu_compressImage(DfuImage &img)
+{
+    img.lz.clear();
+    img.lzOffset.assign(img.packetCnt + 1, 0);
+    //the bootloader sees the padded image, so the tail is matched as it is programmed
+    std::vector<uint8_t> flat(img.len);
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        memcpy(flat.data() + i * img.packetLen, dfu_imagePacket(img, i), img.packetLen);
+    }
+    std::vector<uint32_t> table(1 << DFU_LZ_HASH_BITS, 0);
+    uint8_t out[MAXIMUM_PKT_LEN];
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        uint32_t n = compress_packet(flat.data(), i * img.packetLen, img.packetLen, table.data(), out, img.packetLen - 1);
+        img.lz.insert(img.lz.end(), out, out + n);
+        img.lzOffset[i + 1] = (uint32_t)img.lz.size();
+    }
+    uint32_t sent = 0;
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        sent += dfu_imageLzLen(img, i);
+    }
+    LOG_INFO("image compressed from %u to %u bytes on the link, %.1f%%\n", img.len, sent, sent * 100.0 / img.len);
+    return (int)img.lz.size();
+}
+
+int dfu_lzDecompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen,
+    const uint8_t *dict, uint32_t dictLen)
+{
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    while (ip < srcLen) {
+        uint8_t token = src[ip++];
+        uint32_t n = token >> 4;
+        if (n == 15) {
+            uint8_t b;
+            do {
+                if (ip >= srcLen) {
+                    return -1;
+                }
+                b = src[ip++];
+                n += b;
+            } while (b == 255);
+        }
+        if (n > srcLen - ip || n > dstLen - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, n);
+        ip += n;
+        op += n;
+        if (ip == srcLen) {
+            break;
+        }
+        if (srcLen - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op + dictLen) {
+            return -1;
+        }
+        n = token & 0x0F;
+        if (n == 15) {
+            uint8_t b;
+            do {
+                if (ip >= srcLen) {
+                    return -1;
+                }
+                b = src[ip++];
+                n += b;
+            } while (b == 255);
+        }
+        n += DFU_LZ_MIN_MATCH;
+        if (n > dstLen - op) {
+            return -1;
+        }
+        //byte by byte, a match may overlap what it writes
+        for (uint32_t k=0; k<n; ++k, ++op) {
+            dst[op] = offset > op ? dict[dictLen - (offset - op)] : dst[op - offset];
+        }
+    }
+    return op == dstLen ? (int)dstLen : -1;
+}
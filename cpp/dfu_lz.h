@@ -0,0 +1,23 @@
+#pragma once
+
+//LZ4 block coding of packet data, the host compresses and the bootloader decodes
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include "dfu_engine.h"
+
+#define DFU_LZ_WINDOW           65535   //matches reach back into the app programmed so far
+#define DFU_LZ_MIN_MATCH        4
+#define DFU_LZ_LAST_LITERALS    5       //plain LZ4 block rules, so stock decoders take it too
+#define DFU_LZ_MF_LIMIT         12
+#define DFU_LZ_HASH_BITS        12
+
+//every packet becomes one block, dictionary is the padded image before it.
+//packets that do not get smaller are left out and go as they are, returns the bytes of img.lz
+int dfu_compressImage(DfuImage &img);
+
+//decodes one block into dstLen bytes at dst, dict holds the dictLen bytes right before dst.
+//returns dstLen, -1 for a broken block or one that does not fill dst exactly
+int dfu_lzDecompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen,
+    const uint8_t *dict, uint32_t dictLen);
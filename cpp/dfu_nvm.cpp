@@ -0,0 +1,274 @@
+//bulk read, erase and write of the BMS NVM with the application NVM commands
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include "dfu_nvm.h"
+#include "dfu_log.h"
+
+#define NVM_CAN_FRAME_DATA      4       //LEN ADR STA seq + 4 bytes
+#define NVM_MAX_FRAMES          255     //seq is one byte
+
+static inline void put24(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+}
+
+static bool all_erased(const uint8_t *p, uint32_t len)
+{
+    for (uint32_t i=0; i<len; ++i) {
+        if (p[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+DfuNvm::DfuNvm(DfuTransport &transport)
+    : t(transport), engine(transport)
+{
+    cfg.size = DFU_NVM_SIZE;
+    cfg.sectorSize = DFU_NVM_SECTOR;
+    cfg.window = DFU_NVM_WINDOW;
+    memset(&st, 0x00, sizeof(st));
+}
+
+void DfuNvm::configure(const DfuNvmConfig &c)
+{
+    cfg = c;
+    if (cfg.sectorSize < 8 || (cfg.sectorSize & (cfg.sectorSize - 1)) != 0) {
+        LOG_WARN("NVM sector size %u is not a power of 2, using %u\n", cfg.sectorSize, DFU_NVM_SECTOR);
+        cfg.sectorSize = DFU_NVM_SECTOR;
+    }
+    cfg.window = cfg.window == 0 ? 1 : cfg.window;
+}
+
+//the most one answer can hold: 255 frames of 4 bytes on CAN, the FW buffer on RS-485
+uint16_t DfuNvm::readChunk(void) const
+{
+    uint32_t n = DFU_NVM_MAX_READ;
+    if (t.caps().link == DFU_LINK_CAN && n + 2 > NVM_MAX_FRAMES * NVM_CAN_FRAME_DATA) {
+        n = (NVM_MAX_FRAMES * NVM_CAN_FRAME_DATA - 2) & ~7U;
+    }
+    return (uint16_t)n;
+}
+
+//let the answers in flight pass, then drop them
+void DfuNvm::drain(void)
+{
+    while (engine.waitResponse(rx, DFU_NEXT_FRAME_TIMEOUT_MS) == 1) {
+    }
+    t.flush();
+}
+
+int DfuNvm::waitResult(uint8_t sta, uint32_t timeoutMs, const uint8_t **dat)
+{
+    if (engine.waitResponse(rx, timeoutMs) != 1) {
+        LOG_ERR("wait response of command 0x%02X timeout\n", sta - 0x40);
+        return -1;
+    }
+    ++st.frames;
+    const uint8_t *p = engine.body(rx);
+    if (p[RSP_STA_OFFSET - 1] != sta || p[RSP_DAT_OFFSET - 1] != NVM_ACCESS_OK) {
+        LOG_ERR("command 0x%02X response error: 0x%02X 0x%02X\n", sta - 0x40, p[RSP_STA_OFFSET - 1], p[RSP_DAT_OFFSET - 1]);
+        return -1;
+    }
+    if (dat != NULL) {
+        *dat = p + RSP_DAT_OFFSET;
+    }
+    return 0;
+}
+
+int DfuNvm::enable(uint8_t addr, bool on)
+{
+    dfu_loadCmd(cmd, enableNvmCmd);
+    cmd[CMD_DAT_OFFSET] = on ? 1 : 0;
+    if (engine.sendCmd(cmd, addr) < 0) {
+        return -1;
+    }
+    ++st.cmds;
+    return waitResult(DFU_ENABLE_NVM + 0x40, DFU_RSP_TIMEOUT_MS, NULL);
+}
+
+int DfuNvm::sendRead(uint8_t addr, uint32_t start, uint16_t len)
+{
+    dfu_loadCmd(cmd, readNvmCmd);
+    put24(&cmd[CMD_DAT_OFFSET], start);
+    cmd[CMD_DAT_OFFSET + 3] = len & 0xFF;
+    cmd[CMD_DAT_OFFSET + 4] = (len >> 8) & 0xFF;
+    ++st.cmds;
+    return engine.sendCmd(cmd, addr);
+}
+
+//the FW answers reads in order, so the frames of one chunk all come before the next chunk
+int DfuNvm::receiveRead(uint8_t *out, uint16_t len)
+{
+    uint8_t seq = 1;
+    uint16_t got = 0;
+    uint32_t timeoutMs = DFU_RSP_TIMEOUT_MS;
+    while (got < len + 2) {
+        if (engine.waitResponse(rx, timeoutMs) != 1) {
+            LOG_WARN("NVM read timeout after %d of %d bytes\n", got, len);
+            return -1;
+        }
+        ++st.frames;
+        const uint8_t *p = engine.body(rx);
+        if (p[RSP_STA_OFFSET - 1] != DFU_READ_NVM + 0x40 || p[RSP_DAT_OFFSET - 1] != seq || p[RSP_LEN_OFFSET - 1] < 4) {
+            LOG_WARN("NVM read response error: 0x%02X seq %d, expected %d\n", p[RSP_STA_OFFSET - 1], p[RSP_DAT_OFFSET - 1], seq);
+            return -1;
+        }
+        uint16_t n = (uint16_t)(p[RSP_LEN_OFFSET - 1] - 3);
+        n = n > len + 2 - got ? (uint16_t)(len + 2 - got) : n;
+        memcpy(buf + got, p + RSP_DAT_OFFSET, n);
+        got += n;
+        ++seq;
+        timeoutMs = DFU_NEXT_FRAME_TIMEOUT_MS;
+    }
+    uint16_t crc = buf[len] | (buf[len + 1] << 8);
+    if (crc16(buf, len, 0xffff) != crc) {
+        LOG_WARN("NVM read crc error, received 0x%04X\n", crc);
+        return -1;
+    }
+    memcpy(out, buf, len);
+    return 0;
+}
+
+//up to window reads are sent ahead, a broken chunk drops the ones behind it and is asked again
+int DfuNvm::read(uint8_t addr, uint32_t start, uint32_t len, uint8_t *out)
+{
+    const uint16_t chunk = readChunk();
+    const uint32_t cnt = (len + chunk - 1) / chunk;
+    const uint32_t window = t.caps().link == DFU_LINK_SERIAL ? 1 : cfg.window;
+    uint32_t next = 0;
+    uint32_t done = 0;
+    int retries = 0;
+    while (done < cnt) {
+        while (next < cnt && next - done < window) {
+            uint32_t at = next * chunk;
+            if (sendRead(addr, start + at, (uint16_t)(len - at < chunk ? len - at : chunk)) < 0) {
+                return -1;
+            }
+            ++next;
+        }
+        uint32_t at = done * chunk;
+        if (receiveRead(out + at, (uint16_t)(len - at < chunk ? len - at : chunk)) == 0) {
+            ++done;
+            retries = 0;
+            continue;
+        }
+        if (++retries > DFU_NVM_RETRIES) {
+            LOG_ERR("NVM read of 0x%06X failed\n", start + at);
+            return -1;
+        }
+        ++st.retries;
+        drain();
+        next = done;
+    }
+    return (int)len;
+}
+
+int DfuNvm::erase(uint8_t addr, uint32_t start, uint8_t sectors)
+{
+    dfu_loadCmd(cmd, eraseNvmCmd);
+    put24(&cmd[CMD_DAT_OFFSET], start);
+    cmd[CMD_DAT_OFFSET + 3] = sectors;
+    if (engine.sendCmd(cmd, addr) < 0) {
+        return -1;
+    }
+    ++st.cmds;
+    return waitResult(DFU_ERASE_NVM + 0x40, DFU_VERIFY_PKT_TIMEOUT_MS, NULL);
+}
+
+//chunks are at most MAXIMUM_PKT_LEN and never cross a sector, the last one is padded with 0xFF
+//to a packet length, programming 0xFF leaves the bytes as they are
+int DfuNvm::write(uint8_t addr, uint32_t start, uint32_t len, const uint8_t *data)
+{
+    uint8_t packet[MAXIMUM_PKT_LEN];
+    uint32_t at = 0;
+    while (at < len) {
+        uint32_t pos = start + at;
+        uint32_t n = cfg.sectorSize - (pos & (cfg.sectorSize - 1));
+        n = n > MAXIMUM_PKT_LEN ? MAXIMUM_PKT_LEN : n;
+        n = n > len - at ? len - at : n;
+        uint16_t packetLen = 8;
+        while (packetLen < n) {
+            packetLen <<= 1;
+        }
+        memset(packet, 0xFF, packetLen);
+        memcpy(packet, data + at, n);
+        uint16_t crc = crc16(packet, n, 0xffff);
+        int tries = 0;
+        for (;;) {
+            dfu_loadCmd(cmd, writeNvmCmd);
+            put24(&cmd[CMD_DAT_OFFSET], pos);
+            cmd[CMD_DAT_OFFSET + 3] = n & 0xFF;
+            cmd[CMD_DAT_OFFSET + 4] = (n >> 8) & 0xFF;
+            ++st.cmds;
+            const uint8_t *dat = NULL;
+            if (engine.sendCmd(cmd, addr) == 0 && engine.sendPacketData(packetLen, packet) == 0 &&
+                waitResult(DFU_WRITE_NVM + 0x40, DFU_VERIFY_PKT_TIMEOUT_MS, &dat) == 0) {
+                if ((dat[0] | (dat[1] << 8)) == crc) {
+                    break;
+                }
+                //a second write can only clear more bits, the sector has to be erased again
+                LOG_ERR("NVM write of 0x%06X crc error, programmed 0x%04X expected 0x%04X\n", pos, dat[0] | (dat[1] << 8), crc);
+                return -1;
+            }
+            if (++tries > DFU_NVM_RETRIES) {
+                LOG_ERR("NVM write of 0x%06X failed\n", pos);
+                return -1;
+            }
+            ++st.retries;
+            drain();
+        }
+        at += n;
+    }
+    return (int)len;
+}
+
+int DfuNvm::backup(uint8_t addr, std::vector<uint8_t> &out)
+{
+    out.resize(cfg.size);
+    return read(addr, 0, cfg.size, out.data());
+}
+
+int DfuNvm::restore(uint8_t addr, const uint8_t *image, const uint8_t *current)
+{
+    std::vector<uint8_t> now;
+    if (current == NULL) {
+        if (backup(addr, now) < 0) {
+            return -1;
+        }
+        current = now.data();
+    }
+    st.sectors = 0;
+    if (enable(addr, true) < 0) {
+        return -1;
+    }
+    int ret = 0;
+    for (uint32_t s=0; s<cfg.size && ret==0; s+=cfg.sectorSize) {
+        uint32_t n = cfg.size - s < cfg.sectorSize ? cfg.size - s : cfg.sectorSize;
+        if (memcmp(image + s, current + s, n) == 0) {
+            continue;
+        }
+        LOG_INFO("NVM sector 0x%06X differs, writing it back\n", s);
+        if (erase(addr, s, 1) < 0) {
+            ret = -1;
+            break;
+        }
+        //only the runs that are not blank after the erase go on the bus
+        for (uint32_t k=0; k<n && ret==0; k+=MAXIMUM_PKT_LEN) {
+            uint32_t m = n - k < MAXIMUM_PKT_LEN ? n - k : MAXIMUM_PKT_LEN;
+            if (!all_erased(image + s + k, m) && write(addr, s + k, m, image + s + k) < 0) {
+                ret = -1;
+            }
+        }
+        ++st.sectors;
+    }
+    if (enable(addr, false) < 0) {
+        return -1;
+    }
+    return ret < 0 ? -1 : (int)st.sectors;
+}
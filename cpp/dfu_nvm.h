@@ -0,0 +1,67 @@
+#pragma once
+
+//bulk read, erase and write of the BMS NVM with the application NVM commands
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <vector>
+#include "transport.h"
+#include "dfu_engine.h"
+
+#define DFU_NVM_SIZE                0x2000      //calibration and config area
+#define DFU_NVM_SECTOR              0x800       //erase unit
+#define DFU_NVM_MAX_READ            1024        //bytes the FW returns for one read
+#define DFU_NVM_WINDOW              4           //reads in flight on CAN, RS-485 waits for every answer
+#define DFU_NVM_RETRIES             3
+
+//READ_NVM is answered with frames of seq (from 1) + data, the last 2 bytes are the crc16 of the data.
+//WRITE_NVM is followed by the data as packet data and answered with NVM_ACCESS_OK and the crc16
+//of what was programmed, ERASE_NVM and ENABLE_NVM with NVM_ACCESS_OK
+struct DfuNvmConfig {
+    uint32_t size;
+    uint32_t sectorSize;            //power of 2, writes never cross it
+    uint8_t window;
+};
+
+struct DfuNvmStat {
+    uint32_t sectors;               //sectors of a restore that differed and were written back
+    uint32_t cmds;                  //commands sent
+    uint32_t frames;                //response frames received
+    uint32_t retries;
+};
+
+class DfuNvm {
+public:
+    explicit DfuNvm(DfuTransport &transport);
+
+    void configure(const DfuNvmConfig &cfg);
+    int enable(uint8_t addr, bool on);
+    //returns len, -1 on error
+    int read(uint8_t addr, uint32_t start, uint32_t len, uint8_t *out);
+    int erase(uint8_t addr, uint32_t start, uint8_t sectors);
+    //the range has to be erased, returns len, -1 on error
+    int write(uint8_t addr, uint32_t start, uint32_t len, const uint8_t *data);
+
+    //whole NVM into out
+    int backup(uint8_t addr, std::vector<uint8_t> &out);
+    //erases and writes only the sectors where image and current differ, current NULL reads the NVM first.
+    //returns the sectors written, -1 on error
+    int restore(uint8_t addr, const uint8_t *image, const uint8_t *current);
+    const DfuNvmStat &stat(void) const { return st; }
+
+private:
+    int sendRead(uint8_t addr, uint32_t start, uint16_t len);
+    int receiveRead(uint8_t *out, uint16_t len);
+    int waitResult(uint8_t sta, uint32_t timeoutMs, const uint8_t **dat);
+    void drain(void);
+    uint16_t readChunk(void) const;
+
+    DfuTransport &t;
+    DfuEngine engine;
+    DfuNvmConfig cfg;
+    DfuNvmStat st;
+    DfuFrame rx;
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    uint8_t buf[DFU_NVM_MAX_READ + 2];
+};
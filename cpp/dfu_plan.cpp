@@ -0,0 +1,348 @@
+//transfer plan: every frame of the transfer and every expected answer encoded ahead of time
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include "dfu_plan.h"
+#include "dfu_engine.h"
+#include "dfu_cache.h"
+#include "dfu_log.h"
+
+//file layout: header, ops, frames, bytes, all little endian as in memory
+struct DfuPlanHdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t imageHash;
+    uint32_t len;
+    uint32_t fileCrc;
+    uint16_t packetLen;
+    uint16_t packetCnt;
+    uint8_t link;
+    uint8_t crcType;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t opCnt;
+    uint32_t frameCnt;
+    uint32_t byteCnt;
+};
+
+static void add_op(DfuPlan &plan, uint8_t cmd, uint16_t seq, uint16_t timeoutMs, uint8_t flags)
+{
+    DfuPlanOp op;
+    memset(&op, 0x00, sizeof(op));
+    op.frame = (uint32_t)plan.frames.size();
+    op.seq = seq;
+    op.timeoutMs = timeoutMs;
+    op.cmd = cmd;
+    op.flags = flags;
+    plan.ops.push_back(op);
+}
+
+static void add_frame(DfuPlan &plan, uint32_t id, const uint8_t *data, uint16_t len)
+{
+    DfuPlanFrame f;
+    f.id = id;
+    f.offset = (uint32_t)plan.bytes.size();
+    f.len = len;
+    f.reserved = 0;
+    plan.bytes.insert(plan.bytes.end(), data, data + len);
+    plan.frames.push_back(f);
+    ++plan.ops.back().frameCnt;
+}
+
+//cmd is a patched copy of a template, encoded for address 0
+static void add_cmd(DfuPlan &plan, uint8_t *cmd, bool sop, uint16_t seq, uint16_t timeoutMs, uint8_t flags)
+{
+    DfuFrame f;
+    dfu_encodeCmd(f, cmd, 0x00, sop);
+    add_op(plan, cmd[CMD_CMD_OFFSET], seq, timeoutMs, flags);
+    add_frame(plan, f.id, f.data, f.len);
+}
+
+//the answer of the last op as the link delivers it, dat holds the DATA after STA
+static void set_rsp(DfuPlan &plan, bool sop, const uint8_t *dat, uint8_t n)
+{
+    uint8_t buf[RS485_FRAME_LEN(RS485_CMD_MAX_LEN)];
+    DfuPlanOp &op = plan.ops.back();
+    uint8_t *p = sop ? buf + 1 : buf;
+    p[0] = n + 2;
+    p[1] = 0x00;
+    p[2] = op.cmd + 0x40;
+    memcpy(p + 3, dat, n);
+    uint8_t len = n + 3;
+    if (sop) {
+        uint16_t crc = crc16(&buf[RSP_ADR_OFFSET], n + 2, 0xffff);
+        buf[RSP_SOP_OFFSET] = DFU_CMD_SOP;
+        buf[RSP_CRC_OFFSET(n + 2)] = crc & 0xFF;
+        buf[RSP_CRC_OFFSET(n + 2) + 1] = (crc >> 8) & 0xFF;
+        buf[RSP_EOP_OFFSET(n + 2)] = DFU_CMD_EOP;
+        len = RS485_FRAME_LEN(n + 2);
+    }
+    op.rsp = (uint32_t)plan.bytes.size();
+    op.rspLen = len;
+    plan.bytes.insert(plan.bytes.end(), buf, buf + len);
+}
+
+//set seq, data and verify of one packet, data is an LZ4 block when lzLen is below packetLen
+static void add_packet(DfuPlan &plan, bool sop, uint16_t seq, const uint8_t *data, uint16_t len,
+    uint16_t packetLen, uint16_t packetCrc, uint8_t flags)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    uint8_t out[8];
+    bool lz = len < packetLen;
+    dfu_loadCmd(cmd, lz ? setPacketSeqLzCmd : setPacketSeqCmd);
+    cmd[CMD_DAT_OFFSET] = seq & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (seq >> 8) & 0xFF;
+    out[0] = SET_PKTNUM_OK;
+    out[1] = seq & 0xFF;
+    out[2] = (seq >> 8) & 0xFF;
+    if (lz) {
+        cmd[CMD_DAT_OFFSET + 2] = len & 0xFF;
+        cmd[CMD_DAT_OFFSET + 3] = (len >> 8) & 0xFF;
+        out[3] = len & 0xFF;
+        out[4] = (len >> 8) & 0xFF;
+    }
+    add_cmd(plan, cmd, sop, seq, DFU_RSP_TIMEOUT_MS, flags);
+    set_rsp(plan, sop, out, lz ? 5 : 3);
+
+    add_op(plan, 0, seq, 0, flags);
+    uint8_t frame[DFU_FRAME_MAX_LEN];
+    if (sop) {
+        uint16_t crc = crc16((uint8_t *)data, len, 0xffff);
+        frame[CMD_SOP_OFFSET] = DFU_DAT_SOP;
+        memcpy(frame + 1, data, len);
+        frame[len + 1] = crc & 0xFF;
+        frame[len + 2] = (crc >> 8) & 0xFF;
+        frame[len + 3] = DFU_CMD_EOP;
+        add_frame(plan, 0, frame, len + 4);
+    } else {
+        for (uint16_t k=0; k<len; k+=8) {
+            memset(frame, 0x00, 8);     //padding with 0x00
+            memcpy(frame, data + k, len - k < 8 ? len - k : 8);
+            add_frame(plan, CAN_DAT_ID, frame, 8);
+        }
+    }
+
+    dfu_loadCmd(cmd, verifyPacketDataCmd);
+    cmd[CMD_DAT_OFFSET] = packetCrc & 0xFF;
+    cmd[CMD_DAT_OFFSET + 1] = (packetCrc >> 8) & 0xFF;
+    add_cmd(plan, cmd, sop, seq, DFU_VERIFY_PKT_TIMEOUT_MS, flags);
+    out[0] = VERIFY_DATA_OK;
+    set_rsp(plan, sop, out, 1);
+}
+
+int dfu_compilePlan(DfuPlan &plan, const DfuImage &img, uint8_t link, bool lz)
+{
+    uint8_t cmd[RS485_CMD_MAX_LEN];
+    uint8_t out[8];
+    bool sop = link == DFU_LINK_SERIAL;
+    lz = lz && !img.lzOffset.empty();
+    plan.imageHash = dfu_hash64(img.data, img.dataLen, 0);
+    plan.len = img.len;
+    plan.packetLen = img.packetLen;
+    plan.packetCnt = img.packetCnt;
+    plan.link = link;
+    plan.crcType = img.crcType;
+    plan.flags = lz ? DFU_PLAN_HAS_LZ : 0;
+    plan.fileCrc = img.fileCrc;
+    plan.ops.clear();
+    plan.frames.clear();
+    plan.bytes.clear();
+    //CAN takes 8 bytes frames, so the data is 1/8 of the frames
+    plan.ops.reserve(img.packetCnt * (lz ? 6 : 3) + 4);
+    plan.frames.reserve(img.packetCnt * (sop ? 3 : img.packetLen / 8 + 2) + 4);
+    if (img.packetLen != DEFAULT_PKT_LEN) {
+        dfu_loadCmd(cmd, setPacketLenCmd);
+        cmd[CMD_DAT_OFFSET] = img.packetLen & 0xFF;
+        cmd[CMD_DAT_OFFSET + 1] = (img.packetLen >> 8) & 0xFF;
+        cmd[CMD_DAT_OFFSET + 2] = 0x00;
+        cmd[CMD_DAT_OFFSET + 3] = 0x00;
+        add_cmd(plan, cmd, sop, 0, DFU_RSP_TIMEOUT_MS, 0);
+        out[0] = SET_PKTLEN_OK;
+        set_rsp(plan, sop, out, 1);
+        dfu_loadCmd(cmd, getPacketLenCmd);
+        add_cmd(plan, cmd, sop, 0, DFU_RSP_TIMEOUT_MS, 0);
+        out[0] = img.packetLen & 0xFF;
+        out[1] = (img.packetLen >> 8) & 0xFF;
+        out[2] = 0x00;
+        out[3] = 0x00;
+        set_rsp(plan, sop, out, 4);
+    }
+    dfu_loadCmd(cmd, setApplicationLenCmd);
+    out[0] = APP_LENGTH_OK;
+    for (int i=0; i<4; ++i) {
+        cmd[CMD_DAT_OFFSET + i] = (img.len >> (8 * i)) & 0xFF;
+        out[1 + i] = (img.len >> (8 * i)) & 0xFF;
+    }
+    add_cmd(plan, cmd, sop, 0, DFU_RSP_TIMEOUT_MS, 0);
+    set_rsp(plan, sop, out, 5);
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        uint16_t seq = (uint16_t)(i + 1);
+        uint16_t n = lz ? dfu_imageLzLen(img, i) : img.packetLen;
+        if (n < img.packetLen) {
+            add_packet(plan, sop, seq, img.lz.data() + img.lzOffset[i], n, img.packetLen, img.packetCrc[i], DFU_PLAN_OP_LZ);
+            add_packet(plan, sop, seq, dfu_imagePacket(img, i), img.packetLen, img.packetLen, img.packetCrc[i], DFU_PLAN_OP_PLAIN);
+        } else {
+            add_packet(plan, sop, seq, dfu_imagePacket(img, i), img.packetLen, img.packetLen, img.packetCrc[i], 0);
+        }
+    }
+    if (img.crcType == 0) {
+        dfu_loadCmd(cmd, verifyAllDataCrc16Cmd);
+    } else {
+        dfu_loadCmd(cmd, verifyAllDataCrc32Cmd);
+        cmd[CMD_DAT_OFFSET + 3] = (img.fileCrc >> 16) & 0xFF;
+        cmd[CMD_DAT_OFFSET + 4] = (img.fileCrc >> 24) & 0xFF;
+    }
+    cmd[CMD_DAT_OFFSET + 1] = img.fileCrc & 0xFF;
+    cmd[CMD_DAT_OFFSET + 2] = (img.fileCrc >> 8) & 0xFF;
+    add_cmd(plan, cmd, sop, 0, DFU_VERIFY_ALL_TIMEOUT_MS, 0);
+    out[0] = VERIFY_ALL_OK;
+    set_rsp(plan, sop, out, 1);
+    LOG_INFO("plan of %d ops, %d frames and %d bytes for %d packets\n", (int)plan.ops.size(),
+        (int)plan.frames.size(), (int)plan.bytes.size(), img.packetCnt);
+    return (int)plan.ops.size();
+}
+
+int dfu_savePlan(const DfuPlan &plan, const char *path)
+{
+    DfuPlanHdr h;
+    memset(&h, 0x00, sizeof(h));
+    h.magic = DFU_PLAN_MAGIC;
+    h.version = DFU_PLAN_VERSION;
+    h.imageHash = plan.imageHash;
+    h.len = plan.len;
+    h.fileCrc = plan.fileCrc;
+    h.packetLen = plan.packetLen;
+    h.packetCnt = plan.packetCnt;
+    h.link = plan.link;
+    h.crcType = plan.crcType;
+    h.flags = plan.flags;
+    h.opCnt = (uint32_t)plan.ops.size();
+    h.frameCnt = (uint32_t)plan.frames.size();
+    h.byteCnt = (uint32_t)plan.bytes.size();
+    FILE *fd = fopen(path, "wb");
+    if (fd == NULL) {
+        LOG_ERR("cannot create plan %s\n", path);
+        return -1;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, fd) == 1 &&
+        fwrite(plan.ops.data(), sizeof(DfuPlanOp), h.opCnt, fd) == h.opCnt &&
+        fwrite(plan.frames.data(), sizeof(DfuPlanFrame), h.frameCnt, fd) == h.frameCnt &&
+        fwrite(plan.bytes.data(), 1, h.byteCnt, fd) == h.byteCnt;
+    ok = fclose(fd) == 0 && ok;
+    if (!ok) {
+        LOG_ERR("cannot write plan %s\n", path);
+        remove(path);
+        return -1;
+    }
+    return 0;
+}
+
+//addressed frames have to hold the LEN they claim, the runner patches the crc behind it
+static bool addressed_valid(const uint8_t *p, uint32_t len, bool sop)
+{
+    if (sop) {
+        return len >= RS485_FRAME_LEN(0) && p[CMD_LEN_OFFSET] < RS485_CMD_MAX_LEN &&
+            len == (uint32_t)RS485_FRAME_LEN(p[CMD_LEN_OFFSET]);
+    }
+    return len <= 8 && len >= 3;
+}
+
+static bool plan_valid(const DfuPlan &plan)
+{
+    bool sop = plan.link == DFU_LINK_SERIAL;
+    for (const DfuPlanFrame &f : plan.frames) {
+        if (f.len > DFU_FRAME_MAX_LEN || (uint64_t)f.offset + f.len > plan.bytes.size()) {
+            return false;
+        }
+    }
+    for (const DfuPlanOp &op : plan.ops) {
+        if ((uint64_t)op.frame + op.frameCnt > plan.frames.size() || (uint64_t)op.rsp + op.rspLen > plan.bytes.size()) {
+            return false;
+        }
+        if (op.rspLen != 0 && !addressed_valid(&plan.bytes[op.rsp], op.rspLen, sop)) {
+            return false;
+        }
+        for (uint32_t k=0; op.cmd != 0 && k<op.frameCnt; ++k) {
+            const DfuPlanFrame &f = plan.frames[op.frame + k];
+            if (!addressed_valid(&plan.bytes[f.offset], f.len, sop)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int dfu_loadPlan(DfuPlan &plan, const char *path)
+{
+    DfuPlanHdr h;
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL) {
+        LOG_ERR("cannot open plan %s\n", path);
+        return -1;
+    }
+    bool ok = fread(&h, sizeof(h), 1, fd) == 1 && h.magic == DFU_PLAN_MAGIC && h.version == DFU_PLAN_VERSION &&
+        (h.link == DFU_LINK_CAN || h.link == DFU_LINK_SERIAL) && dfu_validPacketLen(h.packetLen);
+    if (ok) {
+        //the counts decide how much is allocated, so they have to add up to the file before anything is
+        uint64_t need = sizeof(h) + (uint64_t)h.opCnt * sizeof(DfuPlanOp) + (uint64_t)h.frameCnt * sizeof(DfuPlanFrame) +
+            h.byteCnt;
+        long size = fseek(fd, 0, SEEK_END) == 0 ? ftell(fd) : -1;
+        ok = size >= 0 && (uint64_t)size == need && fseek(fd, sizeof(h), SEEK_SET) == 0;
+        if (!ok) {
+            LOG_ERR("plan %s is %ld bytes, its header counts %llu\n", path, size, (unsigned long long)need);
+        }
+    }
+    if (ok) {
+        plan.imageHash = h.imageHash;
+        plan.len = h.len;
+        plan.packetLen = h.packetLen;
+        plan.packetCnt = h.packetCnt;
+        plan.link = h.link;
+        plan.crcType = h.crcType;
+        plan.flags = h.flags;
+        plan.fileCrc = h.fileCrc;
+        plan.ops.resize(h.opCnt);
+        plan.frames.resize(h.frameCnt);
+        plan.bytes.resize(h.byteCnt);
+        ok = fread(plan.ops.data(), sizeof(DfuPlanOp), h.opCnt, fd) == h.opCnt &&
+            fread(plan.frames.data(), sizeof(DfuPlanFrame), h.frameCnt, fd) == h.frameCnt &&
+            fread(plan.bytes.data(), 1, h.byteCnt, fd) == h.byteCnt;
+    }
+    fclose(fd);
+    if (!ok || !plan_valid(plan)) {
+        LOG_ERR("%s is not a valid transfer plan\n", path);
+        return -1;
+    }
+    LOG_INFO("plan of image %016llx, %u bytes in %d packets of %d bytes\n", (unsigned long long)plan.imageHash,
+        plan.len, plan.packetCnt, plan.packetLen);
+    return (int)plan.ops.size();
+}
+
+void dfu_planCrcDelta(uint16_t *delta, uint8_t addr)
+{
+    uint8_t zero[RS485_CMD_MAX_LEN];
+    uint8_t msg[RS485_CMD_MAX_LEN];
+    memset(zero, 0x00, sizeof(zero));
+    memset(msg, 0x00, sizeof(msg));
+    msg[0] = addr;
+    delta[0] = 0;
+    for (int len=1; len<RS485_CMD_MAX_LEN; ++len) {
+        delta[len] = crc16(msg, len, 0xffff) ^ crc16(zero, len, 0xffff);
+    }
+}
+
+void dfu_planPatch(uint8_t *frame, uint8_t addr, const uint16_t *delta, bool sop)
+{
+    if (!sop) {
+        frame[CMD_ADR_OFFSET - 1] = addr;
+        return;
+    }
+    uint8_t len = frame[CMD_LEN_OFFSET];
+    uint16_t crc = frame[CMD_CRC_OFFSET(len)] | (frame[CMD_CRC_OFFSET(len) + 1] << 8);
+    crc ^= delta[len];
+    frame[CMD_ADR_OFFSET] = addr;
+    frame[CMD_CRC_OFFSET(len)] = crc & 0xFF;
+    frame[CMD_CRC_OFFSET(len) + 1] = (crc >> 8) & 0xFF;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+//transfer plan: every frame of the transfer and every expected answer encoded ahead of time
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <vector>
+#include "transport.h"
+
+#define DFU_PLAN_MAGIC          0x50554644  //"DFUP"
+#define DFU_PLAN_VERSION        1
+#define DFU_PLAN_EXT            ".dfp"
+
+//plan flags
+#define DFU_PLAN_HAS_LZ         0x01    //compressed packets are in, plain ones next to them
+
+//op flags, a packet that compresses is planned both ways and the runner takes one
+#define DFU_PLAN_OP_LZ          0x01    //only when the bootloader decodes LZ4
+#define DFU_PLAN_OP_PLAIN       0x02    //only when it does not
+
+struct DfuImage;
+
+//frames are encoded for address 0, the runner patches ADR and on serial the command crc
+struct DfuPlanFrame {
+    uint32_t id;            //CAN id, 0 on serial
+    uint32_t offset;        //into DfuPlan.bytes
+    uint16_t len;
+    uint16_t reserved;
+};
+
+//one exchange: frames sent back to back, then at most one answer
+struct DfuPlanOp {
+    uint32_t frame;         //first of frameCnt frames in DfuPlan.frames
+    uint32_t rsp;           //expected answer in DfuPlan.bytes, as the link delivers it
+    uint16_t frameCnt;
+    uint16_t seq;           //packet seq, 0 outside the packet loop
+    uint16_t timeoutMs;
+    uint8_t rspLen;         //0 when nothing comes back
+    uint8_t cmd;            //0 for packet data
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+
+//covers everything from the packet length to the whole file verify, the version queries
+//before it and the update after it are answered with values that can not be planned
+struct DfuPlan {
+    uint64_t imageHash;
+    uint32_t len;
+    uint16_t packetLen;
+    uint16_t packetCnt;
+    uint8_t link;
+    uint8_t crcType;
+    uint8_t flags;
+    uint32_t fileCrc;
+    std::vector<DfuPlanOp> ops;
+    std::vector<DfuPlanFrame> frames;
+    std::vector<uint8_t> bytes;
+};
+
+//lz plans the compressed packets of img.lz too, returns the op count or -1
+int dfu_compilePlan(DfuPlan &plan, const DfuImage &img, uint8_t link, bool lz);
+int dfu_savePlan(const DfuPlan &plan, const char *path);
+int dfu_loadPlan(DfuPlan &plan, const char *path);
+
+//crc16 changes of a command of every LEN when ADR goes from 0 to addr, crc is linear in the message
+void dfu_planCrcDelta(uint16_t *delta, uint8_t addr);
+//frame holds SOP LEN ADR ... on serial or LEN ADR ... on CAN, encoded for address 0
+void dfu_planPatch(uint8_t *frame, uint8_t addr, const uint16_t *delta, bool sop);
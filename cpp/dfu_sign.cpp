@@ -0,0 +1,414 @@
+//RSA signature of the .dfu file, checked on a worker while the packets are on the bus
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "dfu_sign.h"
+#include "dfu_log.h"
+
+#define DFU_SIGN_WORDS          (DFU_SIGN_MAX_BYTES / 4)
+#define DFU_SIGN_KEY_MAX_FILE   2048
+
+static const uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+//DigestInfo of SHA-256 that goes in front of the hash, RFC 8017 9.2
+static const uint8_t sha256_info[19] = {
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20,
+};
+
+struct Sha256 {
+    uint32_t h[8];
+    uint8_t buf[64];
+    uint32_t used;
+    uint64_t total;
+};
+
+static inline uint32_t ror(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha_block(Sha256 &s, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i=0; i<16; ++i) {
+        w[i] = (p[4 * i] << 24) | (p[4 * i + 1] << 16) | (p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for (int i=16; i<64; ++i) {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = s.h[0], b = s.h[1], c = s.h[2], d = s.h[3];
+    uint32_t e = s.h[4], f = s.h[5], g = s.h[6], h = s.h[7];
+    for (int i=0; i<64; ++i) {
+        uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+        uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s.h[0] += a; s.h[1] += b; s.h[2] += c; s.h[3] += d;
+    s.h[4] += e; s.h[5] += f; s.h[6] += g; s.h[7] += h;
+}
+
+static void sha_init(Sha256 &s)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s.h, iv, sizeof(iv));
+    s.used = 0;
+    s.total = 0;
+}
+
+static void sha_update(Sha256 &s, const uint8_t *p, uint32_t len)
+{
+    s.total += len;
+    if (s.used) {
+        uint32_t n = 64 - s.used < len ? 64 - s.used : len;
+        memcpy(s.buf + s.used, p, n);
+        s.used += n;
+        p += n;
+        len -= n;
+        if (s.used < 64) {
+            return;
+        }
+        sha_block(s, s.buf);
+        s.used = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        sha_block(s, p);
+    }
+    memcpy(s.buf, p, len);
+    s.used = len;
+}
+
+static void sha_final(Sha256 &s, uint8_t *digest)
+{
+    uint64_t bits = s.total * 8;
+    uint8_t pad[72] = {0x80};
+    uint32_t n = (s.used < 56 ? 56 : 120) - s.used;
+    for (int i=0; i<8; ++i) {
+        pad[n + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha_update(s, pad, n + 8);
+    for (int i=0; i<8; ++i) {
+        digest[4 * i] = s.h[i] >> 24;
+        digest[4 * i + 1] = (s.h[i] >> 16) & 0xFF;
+        digest[4 * i + 2] = (s.h[i] >> 8) & 0xFF;
+        digest[4 * i + 3] = s.h[i] & 0xFF;
+    }
+}
+
+void dfu_sha256(const uint8_t *a, uint32_t aLen, const uint8_t *b, uint32_t bLen, uint8_t *digest)
+{
+    Sha256 s;
+    sha_init(s);
+    sha_update(s, a, aLen);
+    sha_update(s, b, bLen);
+    sha_final(s, digest);
+}
+
+//montgomery product a * b / 2^(32*k) mod n, CIOS with k words, r may not alias a or b
+static void mont_mul(uint32_t *r, const uint32_t *a, const uint32_t *b, const uint32_t *n, uint32_t n0inv, int k)
+{
+    uint32_t t[DFU_SIGN_WORDS + 2] = {0};
+    for (int i=0; i<k; ++i) {
+        uint64_t c = 0;
+        for (int j=0; j<k; ++j) {
+            c += t[j] + (uint64_t)a[j] * b[i];
+            t[j] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[k];
+        t[k] = (uint32_t)c;
+        t[k + 1] = (uint32_t)(c >> 32);
+        uint32_t m = t[0] * n0inv;
+        c = (t[0] + (uint64_t)m * n[0]) >> 32;
+        for (int j=1; j<k; ++j) {
+            c += t[j] + (uint64_t)m * n[j];
+            t[j - 1] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[k];
+        t[k - 1] = (uint32_t)c;
+        t[k] = t[k + 1] + (uint32_t)(c >> 32);
+    }
+    //t < 2n, one subtraction brings it below n
+    bool ge = t[k] != 0;
+    if (!ge) {
+        ge = true;
+        for (int j=k-1; j>=0; --j) {
+            if (t[j] != n[j]) {
+                ge = t[j] > n[j];
+                break;
+            }
+        }
+    }
+    int64_t borrow = 0;
+    for (int j=0; j<k; ++j) {
+        int64_t d = (int64_t)t[j] - (ge ? n[j] : 0) + borrow;
+        r[j] = (uint32_t)d;
+        borrow = d < 0 ? -1 : 0;
+    }
+}
+
+//r = s^e mod n, all k words little endian, s below n
+static void mod_exp(uint32_t *r, const uint32_t *s, uint32_t e, const uint32_t *n, int k)
+{
+    //-n^-1 mod 2^32 by newton, every step doubles the good bits
+    uint32_t inv = 1;
+    for (int i=0; i<5; ++i) {
+        inv *= 2 - n[0] * inv;
+    }
+    uint32_t n0inv = 0 - inv;
+
+    //2^(64*k) mod n by doubling 1, that is R^2 to enter the montgomery domain
+    uint32_t rr[DFU_SIGN_WORDS] = {1};
+    for (int bit=0; bit<64*k; ++bit) {
+        uint32_t carry = 0;
+        for (int j=0; j<k; ++j) {
+            uint32_t v = rr[j];
+            rr[j] = (v << 1) | carry;
+            carry = v >> 31;
+        }
+        bool ge = carry != 0;
+        if (!ge) {
+            ge = true;
+            for (int j=k-1; j>=0; --j) {
+                if (rr[j] != n[j]) {
+                    ge = rr[j] > n[j];
+                    break;
+                }
+            }
+        }
+        if (ge) {
+            int64_t borrow = 0;
+            for (int j=0; j<k; ++j) {
+                int64_t d = (int64_t)rr[j] - n[j] + borrow;
+                rr[j] = (uint32_t)d;
+                borrow = d < 0 ? -1 : 0;
+            }
+        }
+    }
+
+    uint32_t x[DFU_SIGN_WORDS];
+    uint32_t acc[DFU_SIGN_WORDS];
+    uint32_t tmp[DFU_SIGN_WORDS];
+    mont_mul(x, s, rr, n, n0inv, k);
+    memcpy(acc, x, k * 4);
+    int top = 31;
+    while (top > 0 && !(e >> top & 1)) {
+        --top;
+    }
+    for (int bit=top-1; bit>=0; --bit) {
+        mont_mul(tmp, acc, acc, n, n0inv, k);
+        if (e >> bit & 1) {
+            mont_mul(acc, tmp, x, n, n0inv, k);
+        } else {
+            memcpy(acc, tmp, k * 4);
+        }
+    }
+    uint32_t one[DFU_SIGN_WORDS] = {1};
+    mont_mul(r, acc, one, n, n0inv, k);
+}
+
+static void words_from_be(uint32_t *w, const uint8_t *p, uint32_t len)
+{
+    memset(w, 0, DFU_SIGN_WORDS * 4);
+    for (uint32_t i=0; i<len; ++i) {
+        w[i / 4] |= (uint32_t)p[len - 1 - i] << (8 * (i % 4));
+    }
+}
+
+int dfu_verifySignature(const DfuPublicKey &key, const uint8_t *data, uint32_t len)
+{
+    if (len <= DFU_PAYLOAD_OFFSET) {
+        LOG_ERR("%u bytes hold no signed payload\n", len);
+        return -1;
+    }
+    const uint8_t *sig = data + DFU_SIG_OFFSET;
+    int k = (key.bytes + 3) / 4;
+    uint32_t s[DFU_SIGN_WORDS];
+    words_from_be(s, sig, key.bytes);
+    for (int j=k-1; j>=0; --j) {
+        if (s[j] != key.n[j]) {
+            if (s[j] > key.n[j]) {
+                LOG_ERR("signature is not below the modulus\n");
+                return -1;
+            }
+            break;
+        }
+    }
+    uint32_t m[DFU_SIGN_WORDS];
+    mod_exp(m, s, key.e, key.n, k);
+
+    //EM = 00 01 FF .. FF 00 DigestInfo hash, compared as a whole so a short pad can not pass
+    uint8_t expect[DFU_SIGN_MAX_BYTES];
+    uint32_t tail = sizeof(sha256_info) + 32;
+    memset(expect, 0xFF, key.bytes);
+    expect[0] = 0x00;
+    expect[1] = 0x01;
+    expect[key.bytes - tail - 1] = 0x00;
+    memcpy(expect + key.bytes - tail, sha256_info, sizeof(sha256_info));
+    dfu_sha256(data, DFU_SIG_OFFSET, data + DFU_PAYLOAD_OFFSET, len - DFU_PAYLOAD_OFFSET, expect + key.bytes - 32);
+    uint32_t diff = 0;
+    for (uint32_t i=0; i<key.bytes; ++i) {
+        diff |= expect[i] ^ ((m[(key.bytes - 1 - i) / 4] >> (8 * ((key.bytes - 1 - i) % 4))) & 0xFF);
+    }
+    if (diff) {
+        LOG_ERR("signature does not match the image\n");
+        return -1;
+    }
+    return 0;
+}
+
+//one TLV of the expected tag, short and long length forms, p moves past it
+static bool der_take(const uint8_t *&p, const uint8_t *end, uint8_t tag, const uint8_t *&body, uint32_t &len)
+{
+    if (end - p < 2 || *p++ != tag) {
+        return false;
+    }
+    uint32_t n = *p++;
+    if (n & 0x80) {
+        int cnt = n & 0x7F;
+        if (cnt == 0 || cnt > 3 || end - p < cnt) {
+            return false;
+        }
+        for (n = 0; cnt; --cnt) {
+            n = (n << 8) | *p++;
+        }
+    }
+    if ((uint32_t)(end - p) < n) {
+        return false;
+    }
+    body = p;
+    len = n;
+    p += n;
+    return true;
+}
+
+//SEQUENCE { INTEGER n, INTEGER e }
+static int parse_rsa_key(DfuPublicKey &key, const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *seq, *n, *e;
+    uint32_t seqLen, nLen, eLen;
+    if (!der_take(p, end, 0x30, seq, seqLen)) {
+        return -1;
+    }
+    end = seq + seqLen;
+    if (!der_take(seq, end, 0x02, n, nLen) || !der_take(seq, end, 0x02, e, eLen)) {
+        return -1;
+    }
+    for (; nLen && *n == 0; ++n, --nLen);
+    for (; eLen && *e == 0; ++e, --eLen);
+    if (nLen < DFU_SIGN_MIN_BYTES || nLen > DFU_SIGN_MAX_BYTES || !(n[nLen - 1] & 1)) {
+        LOG_ERR("RSA modulus of %u bytes is not supported\n", nLen);
+        return -1;
+    }
+    if (eLen == 0 || eLen > 4) {
+        LOG_ERR("RSA exponent of %u bytes is not supported\n", eLen);
+        return -1;
+    }
+    words_from_be(key.n, n, nLen);
+    key.bytes = (uint16_t)nLen;
+    key.e = 0;
+    for (uint32_t i=0; i<eLen; ++i) {
+        key.e = (key.e << 8) | e[i];
+    }
+    return 0;
+}
+
+int dfu_parsePublicKey(DfuPublicKey &key, const uint8_t *der, uint32_t len)
+{
+    const uint8_t *p = der;
+    const uint8_t *end = der + len;
+    const uint8_t *seq;
+    uint32_t seqLen;
+    if (!der_take(p, end, 0x30, seq, seqLen)) {
+        LOG_ERR("public key is not DER\n");
+        return -1;
+    }
+    int ret;
+    if (seqLen && seq[0] == 0x30) {
+        //SubjectPublicKeyInfo: AlgorithmIdentifier, then the RSA key inside a BIT STRING
+        const uint8_t *alg, *bits;
+        uint32_t algLen, bitsLen;
+        const uint8_t *seqEnd = seq + seqLen;
+        if (!der_take(seq, seqEnd, 0x30, alg, algLen) || !der_take(seq, seqEnd, 0x03, bits, bitsLen) ||
+            bitsLen < 1 || bits[0] != 0) {
+            LOG_ERR("public key has no RSA key inside\n");
+            return -1;
+        }
+        ret = parse_rsa_key(key, bits + 1, bits + bitsLen);
+    } else {
+        ret = parse_rsa_key(key, der, end);
+    }
+    if (ret < 0) {
+        LOG_ERR("public key is not an RSA key\n");
+    }
+    return ret;
+}
+
+int dfu_loadPublicKey(DfuPublicKey &key, const char *path)
+{
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL) {
+        LOG_ERR("open %s failed\n", path);
+        return -1;
+    }
+    std::vector<uint8_t> der(DFU_SIGN_KEY_MAX_FILE);
+    size_t n = fread(der.data(), 1, der.size(), fd);
+    fclose(fd);
+    if (n == 0 || n == der.size()) {
+        LOG_ERR("%s is no DER public key\n", path);
+        return -1;
+    }
+    if (dfu_parsePublicKey(key, der.data(), (uint32_t)n) < 0) {
+        return -1;
+    }
+    LOG_INFO("RSA-%u public key loaded from %s\n", key.bytes * 8, path);
+    return 0;
+}
+
+void DfuSignCheck::start(const DfuPublicKey &key, const uint8_t *data, uint32_t len, volatile int *running)
+{
+    wait();
+    result = -1;
+    //the key is copied, the caller's may go out of scope while the worker runs
+    worker = std::thread([this, key, data, len, running]() {
+        int ret = dfu_verifySignature(key, data, len);
+        if (ret < 0) {
+            *running = 0;   //no point sending the rest of a file that will not be updated
+        } else {
+            LOG_INFO("signature of the image verified\n");
+        }
+        result = ret;
+    });
+}
+
+int DfuSignCheck::wait(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (worker.joinable()) {
+        worker.join();
+    }
+    return result;
+}
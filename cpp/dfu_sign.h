@@ -0,0 +1,48 @@
+#pragma once
+
+//RSA signature of the .dfu file, checked on a worker while the packets are on the bus
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <mutex>
+#include <thread>
+#include "dfu_container.h"
+
+#define DFU_SIGN_MAX_BYTES      (DFU_PAYLOAD_OFFSET - DFU_SIG_OFFSET)   //RSA-2048 fills the signature area
+#define DFU_SIGN_MIN_BYTES      128
+
+//RSASSA-PKCS1-v1_5 with SHA-256 over the header before DFU_SIG_OFFSET and the payload,
+//the signature starts at DFU_SIG_OFFSET and is as long as the modulus
+struct DfuPublicKey {
+    uint32_t n[DFU_SIGN_MAX_BYTES / 4];     //little endian words
+    uint32_t e;
+    uint16_t bytes;                         //modulus length
+};
+
+//DER of a SubjectPublicKeyInfo or of a PKCS#1 RSAPublicKey, as openssl rsa -pubout -outform DER writes it
+int dfu_loadPublicKey(DfuPublicKey &key, const char *path);
+int dfu_parsePublicKey(DfuPublicKey &key, const uint8_t *der, uint32_t len);
+//0 when the signature matches, -1 with the reason logged
+int dfu_verifySignature(const DfuPublicKey &key, const uint8_t *data, uint32_t len);
+
+void dfu_sha256(const uint8_t *a, uint32_t aLen, const uint8_t *b, uint32_t bLen, uint8_t *digest);
+
+//one check per file, every session of it waits on the same result before DFU_UPDATE
+class DfuSignCheck {
+public:
+    DfuSignCheck() : result(-1) {}
+    ~DfuSignCheck() { wait(); }
+
+    //data has to stay mapped until wait returns, a bad signature clears *running to stop the transfer
+    void start(const DfuPublicKey &key, const uint8_t *data, uint32_t len, volatile int *running);
+    //0 when the signature is good, blocks while the worker still runs
+    int wait(void);
+    //DfuUpdateGate of the engine, ctx is the DfuSignCheck
+    static int gate(void *ctx) { return ((DfuSignCheck *)ctx)->wait(); }
+
+private:
+    std::thread worker;
+    std::mutex lock;
+    int result;
+};
@@ -0,0 +1,575 @@
+//software model of the LV BMS bootloader behind a DfuTransport
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <thread>
+#include "dfu_sim.h"
+#include "dfu_common.h"
+#include "dfu_lz.h"
+
+DfuSimTransport::DfuSimTransport(uint8_t link, uint8_t addr)
+    : address(addr), packetLen(DEFAULT_PKT_LEN), appLen(0), seq(0), lzLen(0), features(DFU_CAP_LZ), received(0),
+      image(DFU_SIM_FLASH_SIZE, 0xFF), status(0x00), statusPolls(0),
+      nvm(DFU_SIM_NVM_SIZE, 0xFF), nvmOn(false), nvmAddr(0), nvmLen(0),
+      rtcSet(std::chrono::steady_clock::now()), latencyUs(0), lossEvery(0), dataFrames(0)
+{
+    //the pack clock starts off by a bit more than an hour
+    rtcUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() + DFU_SIM_RTC_OFFSET_US;
+    static const uint8_t ver[5] = { 1, 0, 1, 1, 0 };
+    memcpy(appVer, ver, sizeof(appVer));
+    c.link = link;
+    if (link == DFU_LINK_CAN) {
+        c.maxPayload = 8;
+        c.maxBatch = 64;
+    } else {
+        c.maxPayload = DFU_FRAME_MAX_LEN;
+        c.maxBatch = 1;
+    }
+    c.dataGapUs = 0;    //the model keeps up with any rate
+}
+
+int DfuSimTransport::send(const DfuFrame *frames, int cnt)
+{
+    for (int i=0; i<cnt; ++i) {
+        const DfuFrame &f = frames[i];
+        if (c.link == DFU_LINK_CAN) {
+            if (f.id == CAN_CMD_ID) {
+                onCommand(f.data);
+            } else if (f.id == CAN_DAT_ID && (lossEvery == 0 || ++dataFrames % lossEvery != 0)) {
+                onData(f.data, f.len);
+            }
+            continue;
+        }
+        if (f.data[CMD_SOP_OFFSET] == DFU_DAT_SOP) {
+            if (f.len < 4 || f.data[f.len - 1] != DFU_CMD_EOP) {
+                continue;   //FW drops a broken frame silently
+            }
+            if (lossEvery != 0 && ++dataFrames % lossEvery == 0) {
+                continue;
+            }
+            uint16_t crc = f.data[f.len - 3] | (f.data[f.len - 2] << 8);
+            if (crc16((uint8_t *)f.data + 1, f.len - 4, 0xffff) != crc) {
+                continue;
+            }
+            onData(f.data + 1, f.len - 4);
+        } else if (f.data[CMD_SOP_OFFSET] == DFU_CMD_SOP || f.data[CMD_SOP_OFFSET] == APP_CMD_SOP) {
+            uint8_t len = f.data[CMD_LEN_OFFSET];
+            if (f.len != RS485_FRAME_LEN(len) || f.data[CMD_EOP_OFFSET(len)] != DFU_CMD_EOP) {
+                continue;
+            }
+            uint16_t crc = f.data[CMD_CRC_OFFSET(len)] | (f.data[CMD_CRC_OFFSET(len) + 1] << 8);
+            if (crc16((uint8_t *)&f.data[CMD_ADR_OFFSET], len, 0xffff) != crc) {
+                continue;
+            }
+            onCommand(f.data + 1);
+        }
+    }
+    return cnt;
+}
+
+int DfuSimTransport::receive(DfuFrame &frame, DfuDeadline deadline)
+{
+    //responses are queued synchronously, without latency waiting can not produce more
+    if (rsp.empty() || rspAt.front() > deadline) {
+        if (latencyUs != 0) {
+            std::this_thread::sleep_until(deadline);
+        }
+        return 0;
+    }
+    std::this_thread::sleep_until(rspAt.front());
+    frame = rsp.front();
+    rsp.pop_front();
+    rspAt.pop_front();
+    return 1;
+}
+
+//dat holds STA and DATA, LEN and ADR are added here
+void DfuSimTransport::reply(uint8_t sta, const uint8_t *dat, uint8_t len)
+{
+    DfuFrame f;
+    uint8_t *p;
+    memset(&f, 0x00, sizeof(f));
+    if (c.link == DFU_LINK_CAN) {
+        f.id = CAN_RSP_ID;
+        f.len = 8;
+        p = f.data;
+    } else {
+        f.data[RSP_SOP_OFFSET] = DFU_CMD_SOP;
+        f.len = RS485_FRAME_LEN(len + 2);
+        p = f.data + 1;
+    }
+    p[0] = len + 2;     //ADR and STA are counted in LEN
+    p[1] = address;
+    p[2] = sta;
+    memcpy(p + 3, dat, len);
+    if (c.link == DFU_LINK_SERIAL) {
+        uint16_t crc = crc16(&f.data[RSP_ADR_OFFSET], len + 2, 0xffff);
+        f.data[RSP_CRC_OFFSET(len + 2)] = crc & 0xFF;
+        f.data[RSP_CRC_OFFSET(len + 2) + 1] = (crc >> 8) & 0xFF;
+        f.data[RSP_EOP_OFFSET(len + 2)] = DFU_CMD_EOP;
+    }
+    rsp.push_back(f);
+    rspAt.push_back(std::chrono::steady_clock::now() + std::chrono::microseconds(2 * latencyUs));
+}
+
+void DfuSimTransport::onData(const uint8_t *dat, uint16_t len)
+{
+    if (packet.size() + len > MAXIMUM_PKT_LEN) {
+        return;
+    }
+    packet.insert(packet.end(), dat, dat + len);
+    received += len;
+    if (nvmLen != 0) {
+        programNvm();
+    }
+}
+
+void DfuSimTransport::onCommand(const uint8_t *body)
+{
+    uint8_t len = body[0];
+    uint8_t adr = body[1];
+    uint8_t cmd = body[2];
+    const uint8_t *dat = body + 3;
+    uint8_t out[8];
+    if (adr != address && !(cmd == DFU_UPDATE && adr == 0x00)) {
+        return;     //another station on the bus
+    }
+    switch (cmd) {
+    case DFU_PREPARE:
+        out[0] = 0xCC;
+        out[1] = 0xFE;
+        out[2] = DFU_SIM_CELL_NUM;
+        reply(DFU_PREPARE + 0x40, out, 3);
+        break;
+    case DFU_GET_APPVER:
+        reply(cmd + 0x40, appVer, sizeof(appVer));
+        break;
+    case DFU_GET_BOOTVER:
+    case DFU_GET_HWTYPE:
+        out[0] = 1;     //build
+        out[1] = 0;     //patch
+        out[2] = 1;     //minor
+        out[3] = 1;     //major
+        out[4] = 0;     //hw
+        reply(cmd + 0x40, out, 5);
+        break;
+    case DFU_GET_HWINFO:
+        if (len >= 4 && dat[1] == 0xBE) {   //battery SN, split over several frames
+            static const char sn[] = "SIMBMS0000000001";
+            uint8_t chunk = (c.link == DFU_LINK_CAN) ? 4 : 8;
+            for (uint8_t i=0; i*chunk < sizeof(sn)-1; ++i) {
+                uint8_t n = (uint8_t)(sizeof(sn)-1 - i*chunk);
+                n = n > chunk ? chunk : n;
+                out[0] = i + 1;
+                memcpy(out + 1, sn + i*chunk, n);
+                reply(DFU_GET_HWINFO + 0x40, out, n + 1);
+            }
+        } else {
+            memset(out, 0x00, 5);
+            reply(DFU_GET_HWINFO + 0x40, out, 5);
+        }
+        break;
+    case DFU_GET_PKTLEN:
+        out[0] = packetLen & 0xFF;
+        out[1] = (packetLen >> 8) & 0xFF;
+        out[2] = 0x00;
+        out[3] = 0x00;
+        reply(DFU_GET_PKTLEN + 0x40, out, 4);
+        break;
+    case DFU_SET_PKTLEN: {
+        uint16_t n = dat[0] | (dat[1] << 8);
+        if (n >= 8 && n <= MAXIMUM_PKT_LEN && (n & (n - 1)) == 0) {
+            packetLen = n;
+            out[0] = SET_PKTLEN_OK;
+        } else {
+            out[0] = SET_PKTLEN_NG;
+        }
+        reply(DFU_SET_PKTLEN + 0x40, out, 1);
+        break;
+    }
+    case DFU_SET_APPLEN: {
+        uint32_t n = dat[0] | (dat[1] << 8) | (dat[2] << 16) | ((uint32_t)dat[3] << 24);
+        out[0] = (n <= DFU_SIM_FLASH_SIZE) ? APP_LENGTH_OK : APP_LENGTH_NG;
+        if (n <= DFU_SIM_FLASH_SIZE) {
+            appLen = n;
+        }
+        memcpy(out + 1, dat, 4);
+        reply(DFU_SET_APPLEN + 0x40, out, 5);
+        break;
+    }
+    case DFU_SET_PKTNUM:
+        if (len == 6) {     //packet start address
+            uint32_t a = dat[0] | (dat[1] << 8) | (dat[2] << 16) | ((uint32_t)dat[3] << 24);
+            seq = (uint16_t)(a / packetLen + 1);
+            out[0] = SET_PKTNUM_OK;
+            memcpy(out + 1, dat, 4);
+            reply(DFU_SET_PKTNUM + 0x40, out, 5);
+        } else {
+            seq = dat[0] | (dat[1] << 8);
+            out[0] = SET_PKTNUM_OK;
+            memcpy(out + 1, dat, 2);
+            reply(DFU_SET_PKTNUM + 0x40, out, 3);
+        }
+        lzLen = 0;
+        packet.clear();
+        break;
+    case DFU_SET_PKTNUM_LZ:
+        if (!(features & DFU_CAP_LZ)) {
+            break;  //unknown command to an older bootloader
+        }
+        seq = dat[0] | (dat[1] << 8);
+        lzLen = dat[2] | (dat[3] << 8);
+        out[0] = (lzLen != 0 && lzLen < packetLen) ? SET_PKTNUM_OK : SET_PKTNUM_NG;
+        memcpy(out + 1, dat, 4);
+        reply(DFU_SET_PKTNUM_LZ + 0x40, out, 5);
+        packet.clear();
+        break;
+    case DFU_GET_CAPS:
+        if (features == 0) {
+            break;
+        }
+        out[0] = features;
+        out[1] = out[2] = out[3] = 0x00;
+        reply(DFU_GET_CAPS + 0x40, out, 4);
+        break;
+    case DFU_VERIFY_PKTDAT: {
+        uint16_t crc = dat[0] | (dat[1] << 8);
+        uint32_t at = (uint32_t)(seq - 1) * packetLen;
+        if (seq != 0 && lzLen != 0 && !decodePacket(at)) {
+            packet.clear();
+        }
+        if (seq == 0 || packet.size() != packetLen || at + packetLen > appLen) {
+            out[0] = VERIFY_SIZE_NG;
+        } else if (crc16(packet.data(), packetLen, 0xffff) != crc) {
+            out[0] = VERIFY_CRC_NG;
+        } else {
+            memcpy(&image[at], packet.data(), packetLen);
+            out[0] = VERIFY_DATA_OK;
+        }
+        packet.clear();
+        reply(DFU_VERIFY_PKTDAT + 0x40, out, 1);
+        break;
+    }
+    case DFU_VERIFY_ALLDAT: {
+        uint32_t crc;
+        bool ok;
+        if (dat[0] == 0) {
+            crc = dat[1] | (dat[2] << 8);
+            ok = crc16(image.data(), appLen, 0xffff) == crc;
+        } else {
+            crc = dat[1] | (dat[2] << 8) | (dat[3] << 16) | ((uint32_t)dat[4] << 24);
+            ok = crc32(image.data(), appLen, 0) == crc;
+        }
+        out[0] = ok ? VERIFY_ALL_OK : VERIFY_ALL_NG;
+        status = ok ? 0x0C : VERIFY_ALL_NG;
+        reply(DFU_VERIFY_ALLDAT + 0x40, out, 1);
+        break;
+    }
+    case DFU_UPDATE:
+        statusPolls = 0;    //no response, the FW starts to copy the app
+        break;
+    case DFU_BMS_QUERY:
+        onQuery(dat[0], dat[2]);
+        break;
+    case DFU_ENABLE_NVM:
+    case DFU_READ_NVM:
+    case DFU_ERASE_NVM:
+    case DFU_WRITE_NVM:
+        onNvm(cmd, dat);
+        break;
+    case APP_SYS_CMD:
+        if (dat[0] == SYS_SET_TIME || dat[0] == SYS_GET_TIME) {
+            onRtc(dat, std::chrono::steady_clock::now() + std::chrono::microseconds(latencyUs));
+        }
+        break;
+    case DFU_GET_STATUS:
+        if (status == 0x0C || status == 0x0D) {
+            status = (++statusPolls < 2) ? 0x0C : (statusPolls < 4 ? 0x0D : 0xAA);
+        }
+        out[0] = 0xA1;
+        out[1] = status;
+        out[2] = 0x00;
+        reply(DFU_GET_STATUS + 0x40, out, 3);
+        break;
+    default:
+        break;
+    }
+}
+
+//the block decodes against the app programmed before the packet, as the FW reads it back from flash
+bool DfuSimTransport::decodePacket(uint32_t at)
+{
+    uint16_t n = lzLen;
+    lzLen = 0;
+    if (packet.size() < n || at + packetLen > appLen) {
+        return false;
+    }
+    std::vector<uint8_t> out(packetLen);
+    uint32_t win = at < DFU_LZ_WINDOW ? at : DFU_LZ_WINDOW;
+    if (dfu_lzDecompress(packet.data(), n, out.data(), packetLen, image.data() + at - win, win) < 0) {
+        return false;
+    }
+    packet.swap(out);
+    return true;
+}
+
+//application info answered with made up values, long payloads are split like the battery SN
+void DfuSimTransport::onQuery(uint8_t info, uint8_t endCell)
+{
+    uint8_t pay[DFU_SIM_CELL_NUM * 2];
+    uint8_t n;
+    uint16_t v[6];
+    switch (info) {
+    case DFU_GET_BATINFO:
+        v[0] = 5120; v[1] = 250; v[2] = 875; v[3] = 990; v[4] = 12; v[5] = 0;
+        n = 12;
+        break;
+    case DFU_GET_CURINFO:
+        v[0] = 250; v[1] = 10000; v[2] = 20000; v[3] = 5680;
+        n = 8;
+        break;
+    case DFU_GET_TEMPINFO:
+        v[0] = 251; v[1] = 263; v[2] = 301; v[3] = 240;
+        n = 8;
+        break;
+    case DFU_GET_SOCINFO:
+        v[0] = 875; v[1] = 990; v[2] = 0x5F90; v[3] = 0x0001; v[4] = 0x86A0; v[5] = 0x0001;  //90000mAh of 100000mAh
+        n = 12;
+        break;
+    case DFU_GET_PCSINFO:
+        v[0] = 5680; v[1] = 5000; v[2] = 10000; v[3] = 0;
+        n = 8;
+        break;
+    case DFU_GET_VOLTINFO:
+        n = (uint8_t)((endCell < DFU_SIM_CELL_NUM ? endCell + 1 : DFU_SIM_CELL_NUM) * 2);
+        for (uint8_t i=0; i<n/2; ++i) {
+            pay[2*i] = (3300 + address + i) & 0xFF;
+            pay[2*i + 1] = ((3300 + address + i) >> 8) & 0xFF;
+        }
+        break;
+    default:
+        return;
+    }
+    if (info != DFU_GET_VOLTINFO) {
+        for (uint8_t i=0; i<n/2; ++i) {
+            pay[2*i] = v[i] & 0xFF;
+            pay[2*i + 1] = (v[i] >> 8) & 0xFF;
+        }
+    }
+    uint8_t out[40];
+    uint8_t chunk = (c.link == DFU_LINK_CAN) ? 4 : 32;
+    for (uint8_t i=0; i*chunk < n; ++i) {
+        uint8_t m = (uint8_t)(n - i*chunk);
+        m = m > chunk ? chunk : m;
+        out[0] = i + 1;
+        memcpy(out + 1, pay + i*chunk, m);
+        reply(DFU_BMS_QUERY + 0x40, out, m + 1);
+    }
+}
+
+//NVM behaves like flash: erase sets a sector to 0xFF, programming can only clear bits
+void DfuSimTransport::onNvm(uint8_t cmd, const uint8_t *dat)
+{
+    uint8_t out[40];
+    uint32_t at = dat[0] | (dat[1] << 8) | (dat[2] << 16);
+    uint16_t len = dat[3] | (dat[4] << 8);
+    switch (cmd) {
+    case DFU_ENABLE_NVM:
+        nvmOn = dat[0] != 0;
+        out[0] = NVM_ACCESS_OK;
+        reply(cmd + 0x40, out, 1);
+        break;
+    case DFU_READ_NVM: {
+        if (at + len > nvm.size()) {
+            out[0] = 1;
+            out[1] = NVM_ACCESS_NG;
+            reply(cmd + 0x40, out, 2);
+            break;
+        }
+        std::vector<uint8_t> pay(nvm.begin() + at, nvm.begin() + at + len);
+        uint16_t crc = crc16(pay.data(), len, 0xffff);
+        pay.push_back(crc & 0xFF);
+        pay.push_back((crc >> 8) & 0xFF);
+        uint32_t chunk = (c.link == DFU_LINK_CAN) ? 4 : 32;
+        for (uint32_t i=0; i*chunk < pay.size(); ++i) {
+            uint32_t m = (uint32_t)pay.size() - i*chunk;
+            m = m > chunk ? chunk : m;
+            out[0] = (uint8_t)(i + 1);
+            memcpy(out + 1, pay.data() + i*chunk, m);
+            reply(cmd + 0x40, out, (uint8_t)(m + 1));
+        }
+        break;
+    }
+    case DFU_ERASE_NVM: {
+        uint32_t n = dat[3] * DFU_SIM_NVM_SECTOR;
+        at &= ~(DFU_SIM_NVM_SECTOR - 1);
+        out[0] = (nvmOn && at + n <= nvm.size()) ? NVM_ACCESS_OK : NVM_ACCESS_NG;
+        if (out[0] == NVM_ACCESS_OK) {
+            memset(nvm.data() + at, 0xFF, n);
+        }
+        reply(cmd + 0x40, out, 1);
+        break;
+    }
+    case DFU_WRITE_NVM:
+        packet.clear();
+        nvmAddr = at;
+        nvmLen = len;
+        break;
+    default:
+        break;
+    }
+}
+
+//the data of a write came in, as many bytes as the power of 2 packet holding it
+void DfuSimTransport::programNvm(void)
+{
+    uint16_t need = 8;
+    while (need < nvmLen) {
+        need <<= 1;
+    }
+    if (packet.size() < need) {
+        return;
+    }
+    uint8_t out[3];
+    out[0] = NVM_ACCESS_NG;
+    out[1] = out[2] = 0;
+    if (nvmOn && nvmAddr + nvmLen <= nvm.size()) {
+        for (uint16_t i=0; i<nvmLen; ++i) {
+            nvm[nvmAddr + i] &= packet[i];
+        }
+        uint16_t crc = crc16(&nvm[nvmAddr], nvmLen, 0xffff);
+        out[0] = NVM_ACCESS_OK;
+        out[1] = crc & 0xFF;
+        out[2] = (crc >> 8) & 0xFF;
+    }
+    packet.clear();
+    nvmLen = 0;
+    reply(DFU_WRITE_NVM + 0x40, out, 3);
+}
+
+//days since 1970-01-01 of a civil date and back
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t &y, unsigned &m, unsigned &d)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = (int64_t)yoe + era * 400 + (m <= 2);
+}
+
+int64_t DfuSimTransport::rtcAt(DfuDeadline at) const
+{
+    return rtcUs + std::chrono::duration_cast<std::chrono::microseconds>(at - rtcSet).count();
+}
+
+//the clock runs from the moment a field is written, writing the second restarts the sub-second count
+void DfuSimTransport::onRtc(const uint8_t *dat, DfuDeadline arrival)
+{
+    int64_t now = rtcAt(arrival);
+    int64_t days = now / 86400000000LL;
+    int64_t us = now % 86400000000LL;
+    int64_t y;
+    unsigned m, d;
+    civil_from_days(days, y, m, d);
+    int64_t v[7] = { 0, y, m, d, us / 3600000000LL, us / 60000000 % 60, us / 1000000 % 60 };
+    int64_t sub = us % 1000000;
+    uint8_t field = dat[1];
+    uint8_t out[5];
+    out[0] = dat[0];
+    out[1] = field;
+    if (field < 1 || field > 6) {
+        return;
+    }
+    if (dat[0] == SYS_GET_TIME) {
+        out[2] = v[field] & 0xFF;
+        out[3] = (v[field] >> 8) & 0xFF;
+        reply(APP_SYS_CMD + 0x40, out, field == 1 ? 4 : 3);
+        return;
+    }
+    v[field] = field == 1 ? (dat[2] | (dat[3] << 8)) : dat[2];
+    if (field == 6) {
+        sub = 0;
+    }
+    rtcUs = days_from_civil(v[1], (unsigned)v[2], (unsigned)v[3]) * 86400000000LL +
+            ((v[4] * 60 + v[5]) * 60 + v[6]) * 1000000LL + sub;
+    rtcSet = arrival;
+    reply(APP_SYS_CMD + 0x40, out, 2);
+}
+
+DfuSimBus::DfuSimBus(uint8_t link, const std::vector<uint8_t> &addrs)
+    : latencyUs(0), sent(0), sentData(0)
+{
+    for (uint8_t a : addrs) {
+        packs.push_back(new DfuSimTransport(link, a));
+    }
+    if (packs.empty()) {
+        packs.push_back(new DfuSimTransport(link, 0x00));
+    }
+}
+
+DfuSimBus::~DfuSimBus()
+{
+    for (DfuSimTransport *p : packs) {
+        delete p;
+    }
+}
+
+void DfuSimBus::setLatency(uint32_t us)
+{
+    latencyUs = us;
+    for (DfuSimTransport *p : packs) {
+        p->setLatency(us);
+    }
+}
+
+int DfuSimBus::send(const DfuFrame *frames, int cnt)
+{
+    for (int i=0; i<cnt; ++i) {
+        sentData += caps().link == DFU_LINK_CAN ? frames[i].id == CAN_DAT_ID : frames[i].data[CMD_SOP_OFFSET] == DFU_DAT_SOP;
+    }
+    sent += cnt;
+    for (DfuSimTransport *p : packs) {
+        p->send(frames, cnt);   //each pack drops what is not for its address
+    }
+    return cnt;
+}
+
+int DfuSimBus::receive(DfuFrame &frame, DfuDeadline deadline)
+{
+    DfuSimTransport *first = NULL;
+    for (DfuSimTransport *p : packs) {
+        if (!p->rsp.empty() && (first == NULL || p->rspAt.front() < first->rspAt.front())) {
+            first = p;
+        }
+    }
+    if (first == NULL || first->rspAt.front() > deadline) {
+        if (latencyUs != 0) {
+            std::this_thread::sleep_until(deadline);
+        }
+        return 0;
+    }
+    return first->receive(frame, deadline);
+}
+
+void DfuSimBus::flush(void)
+{
+    for (DfuSimTransport *p : packs) {
+        p->flush();
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+//software model of the LV BMS bootloader behind a DfuTransport
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "transport.h"
+
+#define DFU_SIM_FLASH_SIZE      0x80000
+#define DFU_SIM_CELL_NUM        16
+#define DFU_SIM_NVM_SIZE        0x2000
+#define DFU_SIM_NVM_SECTOR      0x800
+#define DFU_SIM_RTC_OFFSET_US   3723417000LL
+
+//frames are handled in send(), responses wait in a queue until received
+class DfuSimTransport final : public DfuTransport {
+public:
+    DfuSimTransport(uint8_t link, uint8_t addr);
+
+    const DfuTransportCaps &caps(void) const override { return c; }
+    int send(const DfuFrame *frames, int cnt) override;
+    int receive(DfuFrame &frame, DfuDeadline deadline) override;
+    void flush(void) override { rsp.clear(); rspAt.clear(); }
+
+    //state for tools and checks
+    const std::vector<uint8_t> &flash(void) const { return image; }
+    uint32_t applicationLen(void) const { return appLen; }
+    uint8_t updateStatus(void) const { return status; }
+    std::vector<uint8_t> &nvmData(void) { return nvm; }
+    //unix time in us the pack clock shows, fields are taken as UTC
+    int64_t rtcNow(void) const { return rtcAt(std::chrono::steady_clock::now()); }
+    //one way delay of every frame, answers are held back for the round trip
+    void setLatency(uint32_t us) { latencyUs = us; }
+    //DFU_CAP_* the bootloader reports, 0 models one that does not know DFU_GET_CAPS
+    void setCaps(uint8_t caps) { features = caps; }
+    //packet data bytes that came over the link
+    uint64_t dataBytes(void) const { return received; }
+    //DFU_GET_APPVER answer: build LSB, build MSB, patch, minor, major
+    void setAppVersion(const uint8_t *ver) { memcpy(appVer, ver, sizeof(appVer)); }
+    //every n-th data frame is lost on the way in, 0 keeps them all
+    void setDataLoss(uint32_t n) { lossEvery = n; }
+
+private:
+    void onCommand(const uint8_t *body);    //LEN ADR CMD DATA
+    void onData(const uint8_t *dat, uint16_t len);
+    void onQuery(uint8_t info, uint8_t endCell);
+    void onNvm(uint8_t cmd, const uint8_t *dat);
+    void programNvm(void);
+    void onRtc(const uint8_t *dat, DfuDeadline arrival);
+    bool decodePacket(uint32_t at);
+    int64_t rtcAt(DfuDeadline at) const;
+    void reply(uint8_t sta, const uint8_t *dat, uint8_t len);
+
+    DfuTransportCaps c;
+    uint8_t address;
+    uint16_t packetLen;
+    uint32_t appLen;
+    uint16_t seq;
+    uint16_t lzLen;             //LZ4 block length of the packet, 0 when it comes as it is
+    uint8_t features;
+    uint8_t appVer[5];
+    uint64_t received;
+    std::vector<uint8_t> packet;
+    std::vector<uint8_t> image;
+    uint8_t status;
+    int statusPolls;
+    std::vector<uint8_t> nvm;
+    bool nvmOn;
+    uint32_t nvmAddr;
+    uint16_t nvmLen;            //bytes of a write waiting for its packet data, 0 none
+    int64_t rtcUs;              //pack clock at rtcSet
+    DfuDeadline rtcSet;
+    uint32_t latencyUs;
+    uint32_t lossEvery;
+    uint32_t dataFrames;
+    std::deque<DfuFrame> rsp;
+    std::deque<DfuDeadline> rspAt;  //when each answer is back at the host
+
+    friend class DfuSimBus;
+};
+
+//several packs on one bus, every frame reaches all of them and their answers come back in time order
+class DfuSimBus final : public DfuTransport {
+public:
+    DfuSimBus(uint8_t link, const std::vector<uint8_t> &addrs);
+    ~DfuSimBus();
+
+    const DfuTransportCaps &caps(void) const override { return packs[0]->caps(); }
+    int send(const DfuFrame *frames, int cnt) override;
+    int receive(DfuFrame &frame, DfuDeadline deadline) override;
+    void flush(void) override;
+
+    size_t packCnt(void) const { return packs.size(); }
+    DfuSimTransport &pack(size_t i) { return *packs[i]; }
+    void setLatency(uint32_t us);
+    //frames the host put on the bus, data frames among them
+    uint64_t frames(void) const { return sent; }
+    uint64_t dataFrames(void) const { return sentData; }
+
+private:
+    std::vector<DfuSimTransport *> packs;
+    uint32_t latencyUs;
+    uint64_t sent;
+    uint64_t sentData;
+};
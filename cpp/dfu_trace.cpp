@@ -0,0 +1,178 @@
+//binary event log of upgrade sessions, kept in a memory mapped ring file
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <chrono>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "dfu_trace.h"
+#include "dfu_log.h"
+
+//global variable
+static std::atomic<DfuTraceHdr *> trace(nullptr);
+static DfuTraceRec *traceRecs = NULL;
+static size_t traceSize = 0;
+static std::chrono::steady_clock::time_point traceStart;
+#ifdef _WIN32
+static HANDLE traceFile = INVALID_HANDLE_VALUE;
+static HANDLE traceMap = NULL;
+#else
+static int traceFd = -1;
+#endif
+
+static void *trace_map(const char *path, size_t size)
+{
+#ifdef _WIN32
+    traceFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (traceFile == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    traceMap = CreateFileMappingA(traceFile, NULL, PAGE_READWRITE, 0, (DWORD)size, NULL);
+    if (traceMap == NULL) {
+        CloseHandle(traceFile);
+        traceFile = INVALID_HANDLE_VALUE;
+        return NULL;
+    }
+    void *p = MapViewOfFile(traceMap, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (p == NULL) {
+        CloseHandle(traceMap);
+        CloseHandle(traceFile);
+        traceMap = NULL;
+        traceFile = INVALID_HANDLE_VALUE;
+    }
+    return p;
+#else
+    traceFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (traceFd < 0) {
+        return NULL;
+    }
+    if (ftruncate(traceFd, size) < 0) {
+        close(traceFd);
+        traceFd = -1;
+        return NULL;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, traceFd, 0);
+    if (p == MAP_FAILED) {
+        close(traceFd);
+        traceFd = -1;
+        return NULL;
+    }
+    return p;
+#endif
+}
+
+static void trace_unmap(void *p, size_t size)
+{
+#ifdef _WIN32
+    FlushViewOfFile(p, size);
+    UnmapViewOfFile(p);
+    CloseHandle(traceMap);
+    CloseHandle(traceFile);
+    traceMap = NULL;
+    traceFile = INVALID_HANDLE_VALUE;
+#else
+    msync(p, size, MS_SYNC);
+    munmap(p, size);
+    close(traceFd);
+    traceFd = -1;
+#endif
+}
+
+bool dfu_traceOpen(const char *path, uint32_t capacity)
+{
+    if (trace.load() != nullptr) {
+        LOG_ERR("trace file is already opened\n");
+        return false;
+    }
+    if (capacity == 0) {
+        capacity = DFU_TRACE_DEFAULT_RECS;
+    }
+    traceSize = sizeof(DfuTraceHdr) + (size_t)capacity * sizeof(DfuTraceRec);
+    DfuTraceHdr *hdr = (DfuTraceHdr *)trace_map(path, traceSize);
+    if (hdr == NULL) {
+        LOG_ERR("could not map trace file %s\n", path);
+        return false;
+    }
+    memset((void *)hdr, 0x00, sizeof(DfuTraceHdr));
+    hdr->magic = DFU_TRACE_MAGIC;
+    hdr->version = DFU_TRACE_VERSION;
+    hdr->recSize = sizeof(DfuTraceRec);
+    hdr->capacity = capacity;
+    hdr->startUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    hdr->head.store(0);
+    traceRecs = (DfuTraceRec *)(hdr + 1);
+    traceStart = std::chrono::steady_clock::now();
+    trace.store(hdr, std::memory_order_release);
+    return true;
+}
+
+//the caller stops its upgrade threads first, records being written are not waited for
+void dfu_traceClose(void)
+{
+    DfuTraceHdr *hdr = trace.exchange(nullptr);
+    if (hdr != NULL) {
+        trace_unmap(hdr, traceSize);
+        traceRecs = NULL;
+    }
+}
+
+uint64_t dfu_traceNowUs(void)
+{
+    if (trace.load(std::memory_order_relaxed) == nullptr) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - traceStart).count() + 1;
+}
+
+void dfu_trace(uint8_t event, uint8_t link, uint8_t addr, uint8_t cmd, uint16_t seq, uint8_t result, uint64_t startUs, uint32_t value)
+{
+    DfuTraceHdr *hdr = trace.load(std::memory_order_acquire);
+    if (hdr == NULL) {
+        return;
+    }
+    uint64_t now = dfu_traceNowUs();
+    uint64_t pos = hdr->head.fetch_add(1, std::memory_order_relaxed);
+    DfuTraceRec &r = traceRecs[pos % hdr->capacity];
+    //lap is the last byte of the record and goes last, a reader of the file never takes a half written one
+    r.lap = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    r.tsUs = now;
+    r.latencyUs = (startUs != 0 && now > startUs) ? (uint32_t)(now - startUs) : 0;
+    r.value = value;
+    r.seq = seq;
+    r.event = event;
+    r.link = link;
+    r.addr = addr;
+    r.cmd = cmd;
+    r.result = result;
+    std::atomic_thread_fence(std::memory_order_release);
+    r.lap = dfu_traceLap(pos, hdr->capacity);
+}
+
+size_t dfu_traceRecords(const DfuTraceHdr &hdr, const DfuTraceRec *ring, size_t cnt, std::vector<DfuTraceRec> &recs)
+{
+    uint64_t head = hdr.head.load();
+    uint64_t first = head > hdr.capacity ? head - hdr.capacity : 0;
+    size_t skipped = 0;
+    recs.clear();
+    for (uint64_t pos=first; pos<head; ++pos) {
+        size_t slot = (size_t)(pos % hdr.capacity);
+        if (slot >= cnt) {
+            continue;   //file cut short
+        }
+        const DfuTraceRec &r = ring[slot];
+        if (r.event == 0 || r.lap != dfu_traceLap(pos, hdr.capacity)) {
+            ++skipped;
+            continue;
+        }
+        recs.push_back(r);
+    }
+    return skipped;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+//binary event log of upgrade sessions, kept in a memory mapped ring file
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define DFU_TRACE_MAGIC             0x54554644  //"DFUT"
+#define DFU_TRACE_VERSION           2           //2: records carry their lap
+#define DFU_TRACE_DEFAULT_RECS      0x10000     //1.5MB, a 512KB image at 128 bytes packets is ~25k records
+
+enum DfuTraceEvent {
+    DFU_TRACE_SESSION_BEGIN = 1,    //value is the image length
+    DFU_TRACE_SESSION_END   = 2,    //result is the upgrade return code, latency is the whole session
+    DFU_TRACE_CMD           = 3,    //command frame sent
+    DFU_TRACE_RSP           = 4,    //response received, latency from the command
+    DFU_TRACE_TIMEOUT       = 5,    //no response, latency is the time waited
+    DFU_TRACE_DATA          = 6,    //packet data sent, value is the bytes on the link
+    DFU_TRACE_PACKET        = 7,    //packet verified, latency from set seq to verify response
+};
+
+//24 bytes, the decoder reads the file with the same layout
+struct DfuTraceRec {
+    uint64_t tsUs;          //since DfuTraceHdr.startUs
+    uint32_t latencyUs;
+    uint32_t value;
+    uint16_t seq;           //packet seq, 0 outside the packet loop
+    uint8_t event;
+    uint8_t link;           //DFU_LINK_CAN or DFU_LINK_SERIAL
+    uint8_t addr;
+    uint8_t cmd;
+    uint8_t result;         //0 ok
+    uint8_t lap;            //dfu_traceLap of the position, stored last, 0 while the record is written
+};
+
+//head counts every record ever written, the ring keeps the last capacity of them
+struct DfuTraceHdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recSize;
+    uint32_t capacity;
+    uint32_t rsv;
+    uint64_t startUs;       //unix time in us when the file was opened
+    std::atomic<uint64_t> head;
+    uint8_t pad[32];
+};
+
+static_assert(sizeof(DfuTraceRec) == 24, "trace record layout changed");
+static_assert(sizeof(DfuTraceHdr) == 64, "trace header layout changed");
+
+//1 ~ 255 for the pass of the ring a position is in, a slot still holding an older pass does not match
+inline uint8_t dfu_traceLap(uint64_t pos, uint32_t capacity)
+{
+    return (uint8_t)((pos / capacity) % 255 + 1);
+}
+
+bool dfu_traceOpen(const char *path, uint32_t capacity);
+void dfu_traceClose(void);
+//0 when tracing is off, so the caller pays only for the check
+uint64_t dfu_traceNowUs(void);
+//startUs from dfu_traceNowUs gives the latency, 0 means none
+void dfu_trace(uint8_t event, uint8_t link, uint8_t addr, uint8_t cmd, uint16_t seq, uint8_t result, uint64_t startUs, uint32_t value);
+//records of a ring read from a trace file, oldest first. cnt is how many ring slots were read,
+//a record whose lap does not match its position was being written and is skipped
+size_t dfu_traceRecords(const DfuTraceHdr &hdr, const DfuTraceRec *ring, size_t cnt, std::vector<DfuTraceRec> &recs);
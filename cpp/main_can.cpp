@@ -7,62 +7,55 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <atomic>
 #include <thread>
 #include <chrono>
+#include <vector>
 #include <Windows.h>
+#include "dfu_engine.h"
+#include "dfu_image.h"
+#include "dfu_cache.h"
+#include "dfu_lz.h"
+#include "dfu_plan.h"
+#include "dfu_sign.h"
+#include "dfu_sim.h"
+#include "printf.h"
+#include "dfu_trace.h"
+#include "bms_telemetry.h"
+#include "bms_store.h"
+#include "bms_analytics.h"
+#include "bms_export.h"
+#include "dfu_nvm.h"
+#include "bms_rtc.h"
 
 #define USED_CAN_CHN        0       //check which CAN channel is connected
 #define USED_CAN_SPEED      500000  //500kbps
 
-typedef void (*out_fct_type)(char character, void *buffer, size_t idx, size_t maxlen);
-typedef void (*RegisterInternalPutchar)(out_fct_type custom_putchar);
-typedef uint16_t (*Crc16)(uint8_t *buffer, uint32_t len, uint16_t start);
-typedef uint32_t (*Crc32)(uint8_t *buffer, uint32_t len, uint32_t start);
-typedef bool (*CanConnect)(int can_chan, int can_speed);
+#ifdef DFU_STATIC_LINK
+//transport and engine are linked in, the transport type is fixed at compile time
+#include "dfu_can.h"
+#ifdef DFU_TRANSPORT_CX
+#include "cxcan.h"
+typedef CxTransport CanTransport;
+#else
+#include "zlgcan.h"
+typedef ZlgTransport CanTransport;
+#endif
+#else
+typedef void (*RegisterInternalSink)(out_sink_type sink, void *ctx);
+typedef DfuTransport *(*CanCreateTransport)(int can_chan, int can_speed);
 typedef bool (*CanDisconnect)(void);
 typedef bool (*CanGetDeviceInfo)(char *sn);
-typedef int (*CanPrepareCmd)(uint8_t addr, uint8_t *resp);
-typedef int (*CanGetBootloaderVerCmd)(uint8_t addr, uint8_t *resp);
-typedef int (*CanGetBatterySN)(uint8_t addr, uint8_t *resp);
-typedef int (*CanGetHardwareInfoCmd)(uint8_t addr, uint8_t *resp);
-typedef int (*CanGetHardwareTypeCmd)(uint8_t addr, uint8_t *resp);
-typedef int (*CanGetApplicationVerCmd)(uint8_t addr, uint8_t *resp);
-typedef int (*CanGetPacketLenCmd)(uint8_t addr, uint8_t *resp);
-typedef int (*CanSetPacketLenCmd)(uint8_t addr, uint16_t packetLen);
-typedef int (*CanSetApplicationLenCmd)(uint8_t addr, uint32_t applicationLen, uint8_t *resp);
-typedef int (*CanSetPacketSeqCmd)(uint8_t addr, uint16_t packetSeq, uint8_t *resp);
-typedef int (*CanSetPacketAddrCmd)(uint8_t addr, uint32_t packetAddr, uint8_t *resp);
-typedef int (*CanSendPacketData)(uint16_t packetLen, uint8_t *data);
-typedef int (*CanVerifyPacketDataCmd)(uint8_t addr, uint16_t packetCrc);
-typedef int (*CanVerifyAllDataCmd)(uint8_t addr, uint8_t crcType, uint32_t fileCrc);
-typedef int (*CanUpdateStationCmd)(uint8_t addr, bool all);
-typedef int (*CanGetUpdateStatusCmd)(uint8_t addr, uint8_t *resp);
-typedef void (*CanRxThread)(volatile int *running);
 
-static RegisterInternalPutchar register_internal_putchar = NULL;
-static Crc16 crc16 = NULL;
-static Crc32 crc32 = NULL;
-static CanConnect can_connect = NULL;
+//the engine runs in this exe, the dll only moves the frames
+static RegisterInternalSink dll_register_internal_sink = NULL;
+static CanCreateTransport can_createTransport = NULL;
 static CanDisconnect can_disconnect = NULL;
 static CanGetDeviceInfo can_getDeviceInfo = NULL;
-static CanPrepareCmd can_prepareCmd = NULL;
-static CanGetBootloaderVerCmd can_getBootloaderVerCmd = NULL;
-static CanGetBatterySN can_getBatterySN = NULL;
-static CanGetHardwareInfoCmd can_getHardwareInfoCmd = NULL;
-static CanGetHardwareTypeCmd can_getHardwareTypeCmd = NULL;
-static CanGetApplicationVerCmd can_getApplicationVerCmd = NULL;
-static CanGetPacketLenCmd can_getPacketLenCmd = NULL;
-static CanSetPacketLenCmd can_setPacketLenCmd = NULL;
-static CanSetApplicationLenCmd can_setApplicationLenCmd = NULL;
-static CanSetPacketSeqCmd can_setPacketSeqCmd = NULL;
-static CanSetPacketAddrCmd can_setPacketAddrCmd = NULL;
-static CanSendPacketData can_sendPacketData = NULL;
-static CanVerifyPacketDataCmd can_verifyPacketDataCmd = NULL;
-static CanVerifyAllDataCmd can_verifyAllDataCmd = NULL;
-static CanUpdateStationCmd can_updateStationCmd = NULL;
-static CanGetUpdateStatusCmd can_getUpdateStatusCmd = NULL;
-static CanRxThread can_rx_thread = NULL;
+typedef DfuTransport CanTransport;
+#endif
 volatile int running = 0;
 
 void SignalHandler(int signal) 
@@ -73,83 +66,474 @@ void SignalHandler(int signal)
     }
 }
 
-inline void putchar_(char character, void* buffer, size_t idx, size_t maxlen)
+inline void puts_(const char *buf, size_t len, void *ctx)
 {
-    putchar(character);
+    fwrite(buf, 1, len, (FILE *)ctx);
 }
 
 inline void print_usage(void)
 {
-    printf("Usage: can_update_app.exe -a <addr> -p <packetLen> -m <updateMode> -c <crcType> -f <dfuFile>\n");
-    printf("addr : battery addresss start from 0\n");
+    printf("Usage: can_update_app.exe [-s] [-z] [-n] [-b] -a <addrs> -p <packetLen> -m <updateMode> -c <crcType> -f <dfuFile> | -r <planFile> [-o <planFile>] [-t <traceFile>] [-k <cacheDir>] [-v <keyFile>]\n");
+    printf("       can_update_app.exe [-s [-a <addrs>]] -d <addrs>\n");
+    printf("       can_update_app.exe [-s] -a <addrs> -q <rounds> [-g <storeFile>] [-e <exportFile>]\n");
+    printf("       can_update_app.exe [-s] -a <addr> -x <nvmFile> | -w <nvmFile>\n");
+    printf("       can_update_app.exe [-s] -a <addrs> -y\n");
+    printf("-s : run against a bus of simulated bootloaders at addrs instead of USBCAN\n");
+    printf("-z : send packets LZ4 compressed when the bootloader can decode them\n");
+    printf("-b : send the packets once for all stations of addrs on the bus, the ones that miss a packet get it again\n");
+    printf("-n : flash every station, also the ones whose app version already matches dfuFile\n");
+    printf("addrs : battery addresses start from 0, etc 3 or 0-15 or 1,4,6-9\n");
     printf("packetLen : packet length, should be 8, 16, 32, 64, 128, 256 or 512\n");
     printf("updateMode : 0 - only update current station, 1 - update all stations\n");
     printf("crcType : 0 - crc16 for app file, 1 - crc32 for app file\n");
+    printf("-o : write the transfer plan of dfuFile to planFile for -r and exit\n");
+    printf("-r : upgrade from a transfer plan written by -o, packetLen and crcType come from the plan\n");
+    printf("traceFile : binary event log of the upgrade, decoded by dfu_trace_app.exe\n");
+    printf("cacheDir : where the crcs of a file are kept for the next run, default " DFU_CACHE_DIR "\n");
+    printf("keyFile : DER RSA public key, the signature of dfuFile is checked while it is sent and DFU_UPDATE is only sent when it holds\n");
+    printf("-d : list the stations that answer among its addrs and exit, no dfuFile needed. -s simulates the packs of -a\n");
+    printf("-q : poll the application info of addrs every %d ms and print it, rounds 0 polls until CTRL+C\n", BMS_TELEMETRY_REFRESH_MS);
+    printf("     every complete round is checked for cell imbalance, outliers and voltage or temperature limits\n");
+    printf("storeFile : cell voltages and temperatures of -q are recorded there, an existing store goes on\n");
+    printf("exportFile : every snapshot of -q is written there as a row, .parquet for parquet, csv otherwise\n");
+    printf("-x : save the %d bytes NVM of the station at addr to nvmFile\n", DFU_NVM_SIZE);
+    printf("-w : write nvmFile back to the NVM of the station at addr, only the sectors that differ are erased and written\n");
+    printf("-y : set the clock of addrs to the local time of this PC, the bus delay is measured and taken off, and print the skew left per pack\n");
+}
+
+static void print_stations(const std::vector<DfuStation> &found)
+{
+    printf("%4s %-5s %-16s %-12s %-10s %5s\n", "addr", "mode", "app", "bootloader", "hw", "cells");
+    for (const DfuStation &st : found) {
+        char app[24];
+        char boot[16] = "-";
+        char hw[16] = "-";
+        char cells[8] = "-";
+        snprintf(app, sizeof(app), "%d.%d.%d build %d", st.appVer[4], st.appVer[3], st.appVer[2],
+            st.appVer[0] | (st.appVer[1] << 8));
+        if (st.boot) {
+            snprintf(boot, sizeof(boot), "%d.%d.%d.%d", st.bootVer[3], st.bootVer[2], st.bootVer[1], st.bootVer[0]);
+            snprintf(cells, sizeof(cells), "%d", st.cellNum);
+        }
+        if (st.hwKnown) {
+            snprintf(hw, sizeof(hw), "%02X%02X%02X%02X%02X", st.hwType[0], st.hwType[1], st.hwType[2], st.hwType[3],
+                st.hwType[4]);
+        }
+        printf("%4d %-5s %-16s %-12s %-10s %5s\n", st.addr, st.boot ? "boot" : "app", app, boot, hw, cells);
+    }
+}
+
+template <class Transport>
+static int run_scan(Transport &transport, const std::vector<uint8_t> &addrs)
+{
+    DfuEngineT<Transport> engine(transport);
+    std::vector<DfuStation> found;
+    auto start = std::chrono::steady_clock::now();
+    int ret = engine.scanStations(addrs.data(), (int)addrs.size(), found);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if (ret < 0) {
+        printf("scan failed\n");
+        return -1;
+    }
+    print_stations(found);
+    printf("%d of %zu addresses answered in %lld ms\n", ret, addrs.size(), (long long)ms);
+    return 0;
+}
+
+//runs on the polling thread, ctx counts the snapshots
+static void print_snapshot(const BmsSnapshot *snap, void *ctx)
+{
+    char line[160];
+    int n = snprintf(line, sizeof(line), "pack %3d round %4u :", snap->addr, snap->round);
+    if (snap->valid & BMS_INFO_BAT) {
+        n += snprintf(line + n, sizeof(line) - n, " %u.%02uV %dmA soc %u.%u%%", snap->bat.voltage / 100,
+            snap->bat.voltage % 100, snap->bat.current * 10, snap->bat.soc / 10, snap->bat.soc % 10);
+    }
+    if ((snap->valid & BMS_INFO_VOLT) && snap->volt.cellCnt != 0) {
+        uint16_t lo = 0xFFFF;
+        uint16_t hi = 0;
+        for (uint8_t i=0; i<snap->volt.cellCnt; ++i) {
+            lo = snap->volt.cell[i] < lo ? snap->volt.cell[i] : lo;
+            hi = snap->volt.cell[i] > hi ? snap->volt.cell[i] : hi;
+        }
+        n += snprintf(line + n, sizeof(line) - n, " cells %u~%u mV", lo, hi);
+    }
+    if (snap->valid & BMS_INFO_TEMP) {
+        n += snprintf(line + n, sizeof(line) - n, " %d.%d~%d.%d C", snap->temp.cellMin / 10, abs(snap->temp.cellMin % 10),
+            snap->temp.cellMax / 10, abs(snap->temp.cellMax % 10));
+    }
+    if (snap->valid == 0) {
+        snprintf(line + n, sizeof(line) - n, " no answer");
+    }
+    printf("%s\n", line);
+    ++*(std::atomic<uint32_t> *)ctx;
+}
+
+//runs on the polling thread when a round is complete, ctx counts the flagged packs
+static void print_anomaly(const BmsCellStats *st, void *ctx)
+{
+    static const char *const names[] = { "imbalance", "outlier", "overvolt", "undervolt", "overtemp", "temp spread" };
+    char line[160];
+    int n = snprintf(line, sizeof(line), "pack %3d round %4u : cells %u~%u mV mean %.1f sigma %.1f,", st->addr, st->round,
+        st->min, st->max, st->mean, st->stddev);
+    for (int i=0; i<6; ++i) {
+        if (st->flags & (1 << i)) {
+            n += snprintf(line + n, sizeof(line) - n, " %s", names[i]);
+        }
+    }
+    if (st->flags & BMS_ANOM_OUTLIER) {
+        snprintf(line + n, sizeof(line) - n, " cell %d", st->outlierCell);
+    }
+    printf("%s\n", line);
+    ++*(std::atomic<uint32_t> *)ctx;
+}
+
+//the options of the tools that run without a dfu file
+struct ServiceArgs {
+    std::vector<uint8_t> addrs;
+    std::vector<uint8_t> scanAddrs;
+    uint32_t rounds;
+    const char *storeFile;
+    const char *exportFile;
+    const char *nvmFile;
+};
+
+static bool open_store(BmsStore &store, const char *path, const BmsTelemetryConfig &cfg)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return store.create(path, cfg.addrs, cfg.addrCnt, cfg.cellCnt, 0);
+    }
+    fclose(f);
+    if (!store.open(path)) {
+        return false;
+    }
+    //a store of other packs would take nothing of this run
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        if (store.signalId(cfg.addrs[i], BMS_SIG_VOLT, cfg.cellCnt - 1) < 0) {
+            printf("store %s does not hold %d cells of pack %d\n", path, cfg.cellCnt, cfg.addrs[i]);
+            store.close();
+            return false;
+        }
+    }
+    return true;
+}
+
+//min/max/avg of every pack since fromMs, read back from the store
+static void print_store(BmsStore &store, const BmsTelemetryConfig &cfg, uint64_t fromMs)
+{
+    for (uint8_t i=0; i<cfg.addrCnt; ++i) {
+        BmsStoreStat volt = {0, INT32_MAX, INT32_MIN, 0.0};
+        BmsStoreStat st;
+        double sum = 0.0;
+        for (uint8_t c=0; c<cfg.cellCnt; ++c) {
+            if (!store.query(store.signalId(cfg.addrs[i], BMS_SIG_VOLT, c), fromMs, UINT64_MAX, st)) {
+                continue;
+            }
+            volt.min = st.min < volt.min ? st.min : volt.min;
+            volt.max = st.max > volt.max ? st.max : volt.max;
+            volt.count += st.count;
+            sum += st.avg * st.count;
+        }
+        if (volt.count == 0) {
+            printf("pack %3d : nothing recorded\n", cfg.addrs[i]);
+            continue;
+        }
+        BmsStoreStat lo;
+        BmsStoreStat hi;
+        char temp[48] = "";
+        if (store.query(store.signalId(cfg.addrs[i], BMS_SIG_TEMP, 0), fromMs, UINT64_MAX, lo) &&
+            store.query(store.signalId(cfg.addrs[i], BMS_SIG_TEMP, 1), fromMs, UINT64_MAX, hi)) {
+            snprintf(temp, sizeof(temp), ", cells %.1f~%.1f C", lo.min / 10.0, hi.max / 10.0);
+        }
+        printf("pack %3d : %u samples, cells %d~%d mV avg %.1f%s\n", cfg.addrs[i], volt.count, volt.min, volt.max,
+            sum / volt.count, temp);
+    }
+}
+
+static int run_monitor(DfuTransport &transport, const ServiceArgs &args)
+{
+    if (args.addrs.size() > BMS_TELEMETRY_MAX_ADDR) {
+        printf("at most %d packs can be polled\n", BMS_TELEMETRY_MAX_ADDR);
+        return -1;
+    }
+    BmsTelemetryConfig cfg;
+    bms_defaultConfig(cfg);
+    memcpy(cfg.addrs, args.addrs.data(), args.addrs.size());
+    cfg.addrCnt = (uint8_t)args.addrs.size();
+    BmsTelemetry telemetry(transport);
+    BmsStore store;
+    BmsExport exporter;
+    BmsAnalytics analytics;
+    BmsAnalyticsConfig limits;
+    std::atomic<uint32_t> snaps(0);
+    std::atomic<uint32_t> anomalies(0);
+    bms_defaultAnalyticsConfig(limits);
+    if (!analytics.configure(cfg.addrs, cfg.addrCnt, cfg.cellCnt, limits)) {
+        return -1;
+    }
+    analytics.onAnomaly(print_anomaly, &anomalies);
+    if (args.storeFile != NULL && !open_store(store, args.storeFile, cfg)) {
+        printf("could not record into store %s\n", args.storeFile);
+        return -1;
+    }
+    if (args.exportFile != NULL && !exporter.open(args.exportFile, cfg.cellCnt)) {
+        printf("could not export into %s\n", args.exportFile);
+        return -1;
+    }
+    if (!telemetry.configure(cfg) || !telemetry.subscribe(print_snapshot, &snaps) ||
+        !telemetry.subscribe(bms_analyticsSnapshot, &analytics) ||
+        (args.storeFile != NULL && !telemetry.subscribe(bms_storeSnapshot, &store)) ||
+        (args.exportFile != NULL && !telemetry.subscribe(bms_exportSnapshot, &exporter))) {
+        return -1;
+    }
+    uint64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!telemetry.start()) {
+        return -1;
+    }
+    //every pack is published once per round, answered or not
+    while (running && (args.rounds == 0 || snaps.load() < args.rounds * cfg.addrCnt)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    telemetry.stop();
+    analytics.flush();      //a round cut by CTRL+C
+    printf("%u snapshots, %u rounds took longer than %u ms\n", snaps.load(), telemetry.overruns(), cfg.refreshMs);
+    printf("%u packs flagged by the %s cell checks\n", anomalies.load(), bms_cellStatsKernel());
+    if (args.storeFile != NULL) {
+        print_store(store, cfg, startMs);
+        printf("store %s takes %zu bytes\n", args.storeFile, store.size());
+    }
+    if (args.exportFile != NULL) {
+        exporter.close();   //the footer of a parquet file is only written here
+        printf("%llu rows exported to %s, %u dropped\n", (unsigned long long)exporter.rows(), args.exportFile,
+            exporter.dropped());
+    }
+    return 0;
+}
+
+//backup (x) or restore (w) of the calibration and config NVM of one station
+static int run_nvm(DfuTransport &transport, char service, const ServiceArgs &args)
+{
+    if (args.addrs.size() != 1) {
+        printf("the NVM of one station at a time, -a takes one address\n");
+        return -1;
+    }
+    uint8_t addr = args.addrs[0];
+    DfuNvm nvm(transport);
+    std::vector<uint8_t> image;
+    auto start = std::chrono::steady_clock::now();
+    if (service == 'x') {
+        if (nvm.backup(addr, image) < 0) {
+            printf("could not read the NVM of station %d\n", addr);
+            return -1;
+        }
+        FILE *fd = fopen(args.nvmFile, "wb");
+        size_t n = fd != NULL ? fwrite(image.data(), 1, image.size(), fd) : 0;
+        if (fd == NULL || fclose(fd) != 0 || n != image.size()) {
+            printf("could not write %s\n", args.nvmFile);
+            return -1;
+        }
+        printf("%zu bytes of station %d NVM saved to %s\n", image.size(), addr, args.nvmFile);
+    } else {
+        //one more byte is asked so a longer file is caught
+        image.resize(DFU_NVM_SIZE + 1);
+        FILE *fd = fopen(args.nvmFile, "rb");
+        size_t n = fd != NULL ? fread(image.data(), 1, image.size(), fd) : 0;
+        if (fd != NULL) {
+            fclose(fd);
+        }
+        if (n != DFU_NVM_SIZE) {
+            printf("%s is not a %d bytes NVM backup\n", args.nvmFile, DFU_NVM_SIZE);
+            return -1;
+        }
+        int sectors = nvm.restore(addr, image.data(), NULL);
+        if (sectors < 0) {
+            printf("could not write the NVM of station %d back\n", addr);
+            return -1;
+        }
+        printf("%d of %d sectors of station %d NVM written back from %s\n", sectors, DFU_NVM_SIZE / DFU_NVM_SECTOR, addr,
+            args.nvmFile);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    const DfuNvmStat &st = nvm.stat();
+    printf("%u commands, %u answer frames, %u retries in %lld ms\n", st.cmds, st.frames, st.retries, (long long)ms);
+    return 0;
+}
+
+//every pack of addrs is set in one go, what is left is checked against the host clock
+static int run_rtc(DfuTransport &transport, const ServiceArgs &args)
+{
+    if (args.addrs.size() > BMS_RTC_MAX_ADDR) {
+        printf("at most %d packs can be set\n", BMS_RTC_MAX_ADDR);
+        return -1;
+    }
+    BmsRtcConfig cfg;
+    bms_rtcDefaultConfig(cfg);
+    memcpy(cfg.addrs, args.addrs.data(), args.addrs.size());
+    cfg.addrCnt = (uint8_t)args.addrs.size();
+    BmsRtcSync rtc(transport);
+    std::vector<BmsRtcResult> res(cfg.addrCnt);
+    if (!rtc.configure(cfg)) {
+        return -1;
+    }
+    int set = rtc.sync(res.data());
+    if (set < 0) {
+        printf("rtc sync failed\n");
+        return -1;
+    }
+    printf("%4s %10s %16s\n", "addr", "rtt us", "skew ms");
+    for (const BmsRtcResult &r : res) {
+        if (r.rttUs == UINT32_MAX) {
+            printf("%4d %10s %16s\n", r.addr, "-", "no answer");
+        } else if (!r.ok) {
+            printf("%4d %10u %16s\n", r.addr, r.rttUs, "not set");
+        } else {
+            char skew[24];
+            snprintf(skew, sizeof(skew), "%+d +/- %u", r.skewMs, r.skewErrMs);
+            printf("%4d %10u %16s\n", r.addr, r.rttUs, skew);
+        }
+    }
+    printf("%d of %d packs set\n", set, cfg.addrCnt);
+    return set == cfg.addrCnt ? 0 : -1;
+}
+
+//the tools that run without a dfu file
+template <class Transport>
+static int run_service(Transport &transport, char service, const ServiceArgs &args)
+{
+    switch (service) {
+    case 'd':
+        return run_scan(transport, args.scanAddrs);
+    case 'q':
+        return run_monitor(transport, args);
+    case 'x':
+    case 'w':
+        return run_nvm(transport, service, args);
+    case 'y':
+        return run_rtc(transport, args);
+    default:
+        return -1;
+    }
+}
+
+//dfu is NULL when nothing is known about the file, every station is flashed then
+//img is only set for a broadcast, which sends plain packets and needs no plan
+template <class Transport>
+static int run_upgrade(Transport &transport, const std::vector<uint8_t> &addrs, const DfuPlan &plan, const DfuImage *img,
+    uint8_t mode, DfuSignCheck *sign, const DfuContainer *dfu)
+{
+    DfuEngineT<Transport> engine(transport);
+    if (sign != NULL) {
+        engine.setUpdateGate(DfuSignCheck::gate, sign);
+    }
+    std::vector<uint8_t> todo = addrs;
+    int skipped = 0;
+    if (dfu != NULL) {
+        //one round over the whole bus, a rack that is mostly current is done here
+        std::vector<DfuPollRsp> ver(addrs.size());
+        engine.pollStations(DFU_GET_APPVER, addrs.data(), (int)addrs.size(), ver.data(), DFU_POLL_TIMEOUT_MS);
+        todo.clear();
+        for (size_t i=0; i<addrs.size(); ++i) {
+            if (ver[i].ok && dfu_containerInstalled(*dfu, ver[i].data)) {
+                printf("station %d already runs %d.%d.%d build %d, skipped\n", addrs[i], ver[i].data[4], ver[i].data[3],
+                    ver[i].data[2], ver[i].data[0] | (ver[i].data[1] << 8));
+                ++skipped;
+            } else {
+                todo.push_back(addrs[i]);   //no answer is left to the upgrade, which reports why
+            }
+        }
+    }
+    int failed = 0;
+    if (img != NULL && !todo.empty()) {
+        std::vector<int> results(todo.size(), -1);
+        if (engine.upgradeBroadcast(todo.data(), (int)todo.size(), *img, mode, &running, results.data()) < 0) {
+            printf("broadcast failed\n");
+        }
+        for (size_t i=0; i<todo.size(); ++i) {
+            if (results[i] < 0) {
+                printf("station %d upgrade failed\n", todo[i]);
+                ++failed;
+            }
+        }
+    }
+    for (size_t i=0; i<todo.size() && running && img == NULL; ++i) {
+        if (engine.upgrade(todo[i], plan, mode, &running) < 0) {
+            printf("station %d upgrade failed\n", todo[i]);
+            ++failed;
+        }
+    }
+    if (addrs.size() > 1 || skipped != 0) {
+        printf("%zu stations: %zu flashed, %d skipped, %d failed\n", addrs.size(), todo.size() - failed, skipped, failed);
+    }
+    return failed == 0 && running ? 0 : -1;
 }
 
 int main(int argc, char **argv)
 {
     char sn[20];
     uint16_t packetLen = 0x80;  //8, 16, 32, 64, 128, 256, 512
-    uint8_t addr = 0x00;
+    std::vector<uint8_t> addrs(1, 0x00);
+    bool force = false;
+    char service = 0;       //d scan, q telemetry, x nvm backup, w nvm restore, y rtc sync
+    ServiceArgs svc = {};
+    bool broadcast = false;
     uint8_t mode = 0;
     uint8_t crcType = 0;    //0: crc16, 1:crc32
-    uint16_t seq = 0x01;
-    uint16_t crc = 0;
-    uint32_t fileCrc = 0;
-    uint8_t resp[8];
-    char batterySN[33] = { '\0' };
-    uint32_t newPacketLen;
-    uint8_t status;
+    bool simulate = false;
+    bool compress = false;
+    DfuSimBus *sim = NULL;
+    CanTransport *transport = NULL;
+    DfuImage img;
+    DfuContainer dfu;
+    DfuPlan plan;
+    const char *planOut = NULL;
+    const char *planIn = NULL;
     int retCode = 0;
-
-    //load library
-    HINSTANCE handle = LoadLibraryA("cx_can_update.dll");
-    if (handle == NULL) {
-        handle = LoadLibraryA("zlg_can_update.dll");
-        if (handle ==NULL) {
-            printf("could not load cx_can_update.dll or zlg_can_update.dll\n");
-            return false;
-        }
-    }
-    register_internal_putchar = (RegisterInternalPutchar)GetProcAddress(handle, "register_internal_putchar");
-    crc16 = (Crc16)GetProcAddress(handle, "crc16");
-    crc32 = (Crc32)GetProcAddress(handle, "crc32");
-    can_connect = (CanConnect)GetProcAddress(handle, "can_connect");
-    can_disconnect = (CanDisconnect)GetProcAddress(handle, "can_disconnect");
-    can_getDeviceInfo = (CanGetDeviceInfo)GetProcAddress(handle, "can_getDeviceInfo");
-    can_prepareCmd = (CanPrepareCmd)GetProcAddress(handle, "can_prepareCmd");
-    can_getBootloaderVerCmd = (CanGetBootloaderVerCmd)GetProcAddress(handle, "can_getBootloaderVerCmd");
-    can_getBatterySN = (CanGetBatterySN)GetProcAddress(handle, "can_getBatterySN");
-    can_getHardwareInfoCmd = (CanGetHardwareInfoCmd)GetProcAddress(handle, "can_getHardwareInfoCmd");
-    can_getHardwareTypeCmd = (CanGetHardwareTypeCmd)GetProcAddress(handle, "can_getHardwareTypeCmd");
-    can_getApplicationVerCmd = (CanGetApplicationVerCmd)GetProcAddress(handle, "can_getApplicationVerCmd");
-    can_getPacketLenCmd = (CanGetPacketLenCmd)GetProcAddress(handle, "can_getPacketLenCmd");
-    can_setPacketLenCmd = (CanSetPacketLenCmd)GetProcAddress(handle, "can_setPacketLenCmd");
-    can_setApplicationLenCmd = (CanSetApplicationLenCmd)GetProcAddress(handle, "can_setApplicationLenCmd");
-    can_setPacketSeqCmd = (CanSetPacketSeqCmd)GetProcAddress(handle, "can_setPacketSeqCmd");
-    can_setPacketAddrCmd = (CanSetPacketAddrCmd)GetProcAddress(handle, "can_setPacketAddrCmd");
-    can_sendPacketData = (CanSendPacketData)GetProcAddress(handle, "can_sendPacketData");
-    can_verifyPacketDataCmd = (CanVerifyPacketDataCmd)GetProcAddress(handle, "can_verifyPacketDataCmd");
-    can_verifyAllDataCmd = (CanVerifyAllDataCmd)GetProcAddress(handle, "can_verifyAllDataCmd");
-    can_updateStationCmd = (CanUpdateStationCmd)GetProcAddress(handle, "can_updateStationCmd");
-    can_getUpdateStatusCmd = (CanGetUpdateStatusCmd)GetProcAddress(handle, "can_getUpdateStatusCmd");
-    can_rx_thread = (CanRxThread)GetProcAddress(handle, "can_rx_thread");
+    const char *traceFile = NULL;
+    const char *cacheDir = DFU_CACHE_DIR;
+    const char *keyFile = NULL;
+    DfuPublicKey key;
+    DfuSignCheck sign;
 
     fflush(stdout);
-    if (argc != 3 && argc !=5 && argc != 7 && argc != 9 && argc != 11) {
-        print_usage();
-        return -1;
-    }
     int i=1;
     int filePos = 1;
     while (i<argc) {
         if (argv[i][0] == '-') {
             char ch = argv[i][1];
             switch (ch) {
+            case 's':
+                simulate = true;
+                break;
+            case 'z':
+                compress = true;
+                break;
+            case 'n':
+                force = true;
+                break;
+            case 'b':
+                broadcast = true;
+                break;
+            case 'q':
+                ++i;
+                svc.rounds = (uint32_t)strtoul(argv[i], nullptr, 10);
+                service = 'q';
+                break;
             case 'a':
                 ++i;
-                addr = (uint8_t)strtol(argv[i], nullptr, 10);
+                if (!dfu_parseAddrs(argv[i], addrs)) {
+                    printf("addrs should be like 3, 0-15 or 1,4,6-9 within 0 ~ 255\n");
+                    return -1;
+                }
+                break;
+            case 'd':
+                ++i;
+                if (!dfu_parseAddrs(argv[i], svc.scanAddrs)) {
+                    printf("addrs should be like 3, 0-15 or 1,4,6-9 within 0 ~ 255\n");
+                    return -1;
+                }
+                service = 'd';
                 break;
             case 'p':
                 ++i;
@@ -180,216 +564,188 @@ int main(int argc, char **argv)
                 ++i;
                 filePos = i;
                 break;
+            case 't':
+                ++i;
+                traceFile = argv[i];
+                break;
+            case 'k':
+                ++i;
+                cacheDir = argv[i];
+                break;
+            case 'o':
+                ++i;
+                planOut = argv[i];
+                break;
+            case 'r':
+                ++i;
+                planIn = argv[i];
+                break;
+            case 'v':
+                ++i;
+                keyFile = argv[i];
+                break;
+            case 'g':
+                ++i;
+                svc.storeFile = argv[i];
+                break;
+            case 'e':
+                ++i;
+                svc.exportFile = argv[i];
+                break;
+            case 'y':
+                service = 'y';
+                break;
+            case 'x':
+            case 'w':
+                ++i;
+                svc.nvmFile = argv[i];
+                service = ch;
+                break;
             default:
-                printf("illegal arguments, only supports a, p, c and f\n");
+                printf("illegal arguments, only supports s, z, n, b, a, d, q, g, e, x, w, y, p, m, c, f, t, k, o, r and v\n");
                 print_usage();
                 return -1;
             }
-            ++i;
-        }
-    }
-    printf("target address is %d, packet length is %d, mode is %d, and crc type is %d\n", addr, packetLen, mode, crcType);
-    register_internal_putchar(putchar_);
-
-    FILE* fd = fopen(argv[filePos], "rb");
-    if (fd == nullptr) {
-        printf("Cannot open file %s\n", argv[filePos]);
-        return -1;
-    }
-    fseek(fd, 0, SEEK_END);
-    uint32_t fileLen = ftell(fd);
-    rewind(fd);
-    uint32_t newFileLen = fileLen;
-    if ((fileLen & (packetLen - 1)) != 0) {
-        printf("file length is not multiple of packetLen, need padding");
-        newFileLen = fileLen + packetLen - (fileLen & (packetLen - 1));
-    }
-    uint8_t* buffer = (uint8_t*)malloc(newFileLen * sizeof(uint8_t));
-    if (buffer == nullptr) {
-        printf("Could not allocate buffer\n");
-        fclose(fd);
-        return -1;
-    }
-    fread(buffer, sizeof(uint8_t), fileLen, fd);
-    if (fileLen != newFileLen) {
-        for (int i=fileLen; i<newFileLen; ++i) {
-            buffer[i] = 0xFF;   //padding with 0xFF
         }
-        fileLen = newFileLen;
+        ++i;
     }
-    fclose(fd);
-    if (!can_connect(USED_CAN_CHN, USED_CAN_SPEED)) {
-        printf("USBCAN connection failed");
-        free(buffer);
+    if ((filePos >= argc || filePos == 1) && planIn == NULL && service == 0) {
+        print_usage();
         return -1;
     }
-    if (!can_getDeviceInfo(sn)) {
-        printf("could not fetch USBCAN serial number\n");
-        retCode = -1;
-        can_disconnect();
-        free(buffer);
+    printf("%zu target addresses from %d, packet length is %d, mode is %d, and crc type is %d\n", addrs.size(), addrs[0],
+        packetLen, mode, crcType);
+    register_internal_sink(puts_, stdout);
+    if (keyFile != NULL && dfu_loadPublicKey(key, keyFile) < 0) {
+        printf("Cannot load public key %s\n", keyFile);
         return -1;
     }
-    printf("connected USBCAN's serial number is %s\n", sn);
-
-    running = 1;    //start the receiving thread
-    signal(SIGINT, SignalHandler);
-    std::thread receive_thread(can_rx_thread, &running);
-    
-    if (can_getBootloaderVerCmd(addr, resp) < 0) {
-        printf("could not fetch LV BMS bootloader's version\n");
-        printf("Are you sure the board fw is in the dfu mode?\n");
-        retCode = -1;
-        goto bailout;
-    }
-    printf("LV BMS FW bootloader's version is %d.%d.%d, build is %d, HW is %d\n",
-        resp[3], resp[2], resp[1], resp[0], resp[4]);
 
-    if (can_getApplicationVerCmd(addr, resp) < 0) {
-        printf("could not fetch LV BMS app's version\n");
-        retCode = -1;
-        goto bailout;
-    }
-    printf("LV BMS FW application's version is %d.%d.%d, build is %d\n",
-        resp[4], resp[3], resp[2], (resp[1] << 8) | resp[0]);
-    memset(resp, '\0', 8);
-    if (can_getHardwareTypeCmd(addr, resp) < 0) {
-        printf("could not get hardware type\n");
-        retCode = -1;
-        goto bailout;
-    }
-#if 0
-    printf("LV BMS's hardware type is %s\n", resp);
-    if (can_getHardwareInfoCmd(addr, resp) < 0) {
-        printf("could not get hardware info\n");
-        retCode = -1;
-        goto bailout;
-    }
-    printf("LV BMS's hardware build date is year:20%02d, month:%02d, day:%02d, batch no: %04d\n",
-        resp[0], resp[1], resp[2], (resp[4] << 8) | resp[3]);
-
-    if (can_getBatterySN(addr, (uint8_t *)batterySN) < 0) {
-        printf("could not get battery sn\n");
-        retCode = -1;
-        goto bailout;
-    }
-    printf("LV BMS's battery sn is %s\n", batterySN);
-#endif 
-    if (can_prepareCmd(addr, resp) < 0) {
-        printf("could not prepare dfu upgrade\n");
-        retCode = -1;
-        goto bailout;
-    }
-    printf("LV BMS' battery cell num is %d\n", resp[0]);
-    if (packetLen != 0x80) {
-        if (can_setPacketLenCmd(addr, packetLen) < 0) {
-            printf("try to set packet length %d failed\n", packetLen);
-            retCode = -1;
-            goto bailout;
+    if (service != 0) {
+        //no dfu file is sent, the file and key are not needed
+    } else if (planIn != NULL) {
+        if (dfu_loadPlan(plan, planIn) < 0 || plan.link != DFU_LINK_CAN) {
+            printf("Cannot load CAN transfer plan %s\n", planIn);
+            return -1;
         }
-        if (can_getPacketLenCmd(addr, resp) < 0) {
-            printf("try to get packet length failed\n");
-            retCode = -1;
-            goto bailout;
+        if (keyFile != NULL) {
+            printf("a plan holds no signature, check it with -v when it is written by -o\n");
+            keyFile = NULL;
         }
-        else {
-            newPacketLen = *(uint32_t*)resp;
-            printf("new packet length %u\n", newPacketLen);
+        if (broadcast) {
+            printf("a broadcast sends the dfu file, it can not run from a plan\n");
+            return -1;
         }
-        if (newPacketLen != packetLen) {
-            printf("packetLen are not equal\n");
-            retCode = -2;
-            goto bailout;
+    } else {
+        //header, sections and crcs are checked before any station is touched, and only once per file
+        if (dfu_loadCachedImage(img, dfu, argv[filePos], cacheDir, packetLen, crcType) < 0) {
+            printf("Cannot load dfu file %s\n", argv[filePos]);
+            return -1;
         }
-    }
-    if (can_setApplicationLenCmd(addr, fileLen, resp) < 0 || *(uint32_t *)resp != fileLen) {
-        printf("try to set application length %u failed\n", fileLen);
-        retCode = -1;
-        goto bailout;
-    }
-    
-    while (seq <= fileLen/packetLen) {
-        if (can_setPacketSeqCmd(addr, seq, resp) < 0 || *(uint16_t*)resp != seq) {
-            printf("try to set packet sequence num %d failed\n", seq);
-            retCode = -1;
-            goto bailout;
+        if (img.dataLen != img.len) {
+            printf("file length is not multiple of packetLen, padded with 0xFF\n");
         }
-        if (can_sendPacketData(packetLen, buffer + (seq-1) * packetLen) < 0) {
-            printf("try to send packet data for seq %d failed\n", seq);
-            retCode = -1;
-            goto bailout;
+        if (compress && broadcast) {
+            printf("a broadcast sends plain packets, a station that missed one would decode the rest wrong\n");
+        } else if (compress) {
+            dfu_compressImage(img);
         }
-        crc = crc16(buffer + (seq-1) * packetLen, packetLen, 0xFFFF);
-        printf("packet seq %d 's crc is 0x%04x\n", seq, crc);
-        if (can_verifyPacketDataCmd(addr, crc) < 0) {
-            printf("try to verify packet crc for seq %d failed\n", seq);
-            retCode = -1;
-            goto bailout;
+        //every frame and answer of the transfer is encoded here, the upgrade only patches the address
+        dfu_compilePlan(plan, img, DFU_LINK_CAN, compress);
+        if (planOut != NULL) {
+            //nothing is sent, so the check runs here and a bad file never becomes a plan
+            if (keyFile != NULL && dfu_verifySignature(key, img.data, img.dataLen) < 0) {
+                printf("signature of %s does not hold, no plan written\n", argv[filePos]);
+                dfu_unloadImage(img);
+                return -1;
+            }
+            retCode = dfu_savePlan(plan, planOut);
+            if (retCode == 0) {
+                printf("transfer plan written to %s\n", planOut);
+            }
+            dfu_unloadImage(img);
+            return retCode;
         }
-        ++seq;
-    }
-    if (crcType == 0) {
-        fileCrc = crc16(buffer, fileLen, 0xFFFF);
-    } else {    //crcType == 1
-        fileCrc = crc32(buffer, fileLen, 0);
     }
-    if (can_verifyAllDataCmd(addr, crcType, fileCrc) < 0) {
-        printf("try to set verify application failed\n");
-        retCode = -1;
-        goto bailout;
+
+    if (simulate) {
+        sim = new DfuSimBus(DFU_LINK_CAN, addrs);
     } else {
-        if (crcType == 0) {
-            printf("whole file length is %u, crc uses crc16 : 0x%04x\n", fileLen, fileCrc);
-        } else {
-            printf("whole file length is %u, crc uses crc32 : 0x%08x\n", fileLen, fileCrc);
-        }
-    }
-    if (mode == 0) {
-        if (can_updateStationCmd(addr, false) < 0) {
-            printf("try to update current station failed\n");
-            retCode = -1;
-            goto bailout;
+#ifndef DFU_STATIC_LINK
+        //load library
+        HINSTANCE handle = LoadLibraryA("cx_can_update.dll");
+        if (handle == NULL) {
+            handle = LoadLibraryA("zlg_can_update.dll");
+            if (handle ==NULL) {
+                printf("could not load cx_can_update.dll or zlg_can_update.dll\n");
+                dfu_unloadImage(img);
+                return -1;
+            }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(15000));
-    } else {  //mode == 1  
-        if (can_updateStationCmd(0, true) < 0) {
-            printf("try to update all stations failed\n");
-            retCode = -1;
-            goto bailout;
+        dll_register_internal_sink = (RegisterInternalSink)GetProcAddress(handle, "register_internal_sink");
+        can_createTransport = (CanCreateTransport)GetProcAddress(handle, "can_createTransport");
+        can_disconnect = (CanDisconnect)GetProcAddress(handle, "can_disconnect");
+        can_getDeviceInfo = (CanGetDeviceInfo)GetProcAddress(handle, "can_getDeviceInfo");
+        dll_register_internal_sink(puts_, stdout);
+#endif
+        transport = static_cast<CanTransport *>(can_createTransport(USED_CAN_CHN, USED_CAN_SPEED));
+        if (transport == NULL) {
+            printf("USBCAN connection failed");
+            dfu_unloadImage(img);
+            return -1;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(15000));
-        while (true) {
-            if (can_getUpdateStatusCmd(addr, resp) < 0) {
-                printf("try to get update status failed\n");
-                retCode = -1;
-                goto bailout;
-            }
-            status = *resp;
-            if (status == 0xAA) {
-                printf("update bms app successfully\n");
-                retCode = 0;
-                break;
-            } else if (status == 0x0C) {
-                printf("progressing: transfer bms app internal data\n");
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));   //10ms
-            } else if (status == 0x0D) {
-                printf("progressing: verify bms internal crc\n");
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));   //10ms
-            } else {
-                printf("update bms app failed, error code is %hhu\n", status);
-                retCode = -1;
-                goto bailout;
-            }
+        if (!can_getDeviceInfo(sn)) {
+            printf("could not fetch USBCAN serial number\n");
+            can_disconnect();
+            dfu_unloadImage(img);
+            return -1;
         }
+        printf("connected USBCAN's serial number is %s\n", sn);
     }
 
-bailout:
+    if (service != 0) {
+        svc.addrs = addrs;
+        running = 1;
+        signal(SIGINT, SignalHandler);
+        if (simulate) {
+            retCode = run_service(*sim, service, svc);
+            delete sim;
+        } else {
+            retCode = run_service(*transport, service, svc);
+            can_disconnect();
+        }
+        running = 0;
+        return retCode;
+    }
+    //a plan carries no version, so -r flashes every station
+    const DfuContainer *check = force || planIn != NULL ? NULL : &dfu;
+    running = 1;
+    signal(SIGINT, SignalHandler);
+    if (keyFile != NULL) {
+        //RSA runs next to the transfer, a bad signature stops it and DFU_UPDATE waits for the result
+        sign.start(key, img.data, img.dataLen, &running);
+    }
+    if (traceFile != NULL && !dfu_traceOpen(traceFile, DFU_TRACE_DEFAULT_RECS)) {
+        printf("trace file %s could not be created, upgrade without it\n", traceFile);
+    }
+    printf_setAsync(true);     //engine logs are formatted off the upgrade thread
+    if (simulate) {
+        retCode = run_upgrade(*sim, addrs, plan, broadcast ? &img : NULL, mode, keyFile != NULL ? &sign : NULL, check);
+    } else {
+        retCode = run_upgrade(*transport, addrs, plan, broadcast ? &img : NULL, mode, keyFile != NULL ? &sign : NULL, check);
+    }
+    sign.wait();    //an upgrade that failed early never asked, the worker still reads the image
+    printf_setAsync(false);
+    dfu_traceClose();
     running = 0;
-    if (receive_thread.joinable()) {
-        receive_thread.join();
+    if (simulate) {
+        printf("%llu frames on the bus, %llu of them data\n", (unsigned long long)sim->frames(),
+            (unsigned long long)sim->dataFrames());
+        delete sim;
+    } else {
+        can_disconnect();   //the transport belongs to the transport module
+        printf("USBCAN disconnect successfully\n");
     }
-    can_disconnect();
-    printf("USBCAN disconnect successfully\n");
-    free(buffer);
+    dfu_unloadImage(img);
 	return retCode;
 }
@@ -0,0 +1,206 @@
+//batch pre-flight check of a release directory of .dfu builds, table on stdout and a csv/json report
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include "dfu_check.h"
+#include "printf.h"
+
+inline void puts_(const char *buf, size_t len, void *ctx)
+{
+    fwrite(buf, 1, len, (FILE *)ctx);
+}
+
+inline void print_usage(void)
+{
+    printf("Usage: dfu_check_app.exe -d <dfuDir> [-o <outFile>] [-p <packetLen>] [-w <hwInfo>] [-j <threads>]\n");
+    printf("dfuDir : directory whose *.dfu files are checked\n");
+    printf("outFile : one record per file as .csv or .json, the extension selects the format\n");
+    printf("packetLen : packet length of the table columns, default 128, the report has all of them\n");
+    printf("hwInfo : 8 hex digits every file has to be built for, etc 01000000\n");
+    printf("threads : files checked at once, default one per core\n");
+}
+
+static const char *status_name(uint8_t status)
+{
+    switch (status) {
+    case DFU_CHECK_OK: return "ok";
+    case DFU_CHECK_WARN: return "warn";
+    default: return "fail";
+    }
+}
+
+static const char *base_name(const std::string &path)
+{
+    const char *p = path.c_str();
+    for (const char *s = p; *s; ++s) {
+        if (*s == '/' || *s == '\\') {
+            p = s + 1;
+        }
+    }
+    return p;
+}
+
+static void dump_csv(FILE *fd, const std::vector<DfuCheckResult> &results)
+{
+    fprintf(fd, "path,status,reason,len,version,hw_info,load_addr,sections,gap_bytes,check_us");
+    for (int i=0; i<DFU_CHECK_LENS; ++i) {
+        fprintf(fd, ",pad_%d,crc16_%d,crc32_%d", 8 << i, 8 << i, 8 << i);
+    }
+    fprintf(fd, "\n");
+    for (const DfuCheckResult &r : results) {
+        fprintf(fd, "%s,%s,%s,%u,%d.%d.%d.%d,%02X%02X%02X%02X,0x%08X,%u,%u,%u", r.path.c_str(), status_name(r.status),
+            r.reason, r.len, r.version[0], r.version[1], r.version[2], r.version[3], r.hwInfo[0], r.hwInfo[1],
+            r.hwInfo[2], r.hwInfo[3], r.loadAddr, r.sectionCnt, r.gapBytes, r.checkUs);
+        for (int i=0; i<DFU_CHECK_LENS; ++i) {
+            fprintf(fd, ",%u,0x%04X,0x%08X", r.pad[i], r.crc16[i], r.crc32[i]);
+        }
+        fprintf(fd, "\n");
+    }
+}
+
+static void dump_json(FILE *fd, const std::vector<DfuCheckResult> &results)
+{
+    fprintf(fd, "[\n");
+    for (size_t k=0; k<results.size(); ++k) {
+        const DfuCheckResult &r = results[k];
+        std::string path;
+        for (const char *s = r.path.c_str(); *s; ++s) {
+            if (*s == '\\' || *s == '"') {
+                path += '\\';
+            }
+            path += *s;
+        }
+        fprintf(fd, "  {\"path\": \"%s\", \"status\": \"%s\", \"reason\": \"%s\", \"len\": %u, \"version\": \"%d.%d.%d.%d\", "
+            "\"hw_info\": \"%02X%02X%02X%02X\", \"load_addr\": %u, \"sections\": %u, \"gap_bytes\": %u, \"check_us\": %u, \"packets\": [",
+            path.c_str(), status_name(r.status), r.reason, r.len, r.version[0], r.version[1], r.version[2], r.version[3],
+            r.hwInfo[0], r.hwInfo[1], r.hwInfo[2], r.hwInfo[3], r.loadAddr, r.sectionCnt, r.gapBytes, r.checkUs);
+        for (int i=0; i<DFU_CHECK_LENS; ++i) {
+            fprintf(fd, "{\"len\": %d, \"pad\": %u, \"crc16\": %u, \"crc32\": %u}%s", 8 << i, r.pad[i], r.crc16[i],
+                r.crc32[i], i + 1 < DFU_CHECK_LENS ? ", " : "");
+        }
+        fprintf(fd, "]}%s\n", k + 1 < results.size() ? "," : "");
+    }
+    fprintf(fd, "]\n");
+}
+
+static void print_table(const std::vector<DfuCheckResult> &results, int lenIdx)
+{
+    printf("%-32s %-11s %-8s %9s %5s %6s %10s %8s  %s\n", "file", "version", "hw", "bytes", "pad", "crc16", "crc32", "ms", "status");
+    for (const DfuCheckResult &r : results) {
+        char version[16];
+        snprintf(version, sizeof(version), "%d.%d.%d.%d", r.version[0], r.version[1], r.version[2], r.version[3]);
+        printf("%-32s %-11s %02X%02X%02X%02X %9u %5u 0x%04X 0x%08X %8.2f  %s%s%s\n", base_name(r.path), version,
+            r.hwInfo[0], r.hwInfo[1], r.hwInfo[2], r.hwInfo[3], r.len, r.pad[lenIdx], r.crc16[lenIdx], r.crc32[lenIdx],
+            r.checkUs / 1000.0, status_name(r.status), r.reason[0] ? " : " : "", r.reason);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL;
+    const char *outFile = NULL;
+    uint16_t packetLen = 0x80;
+    DfuCheckOpts opts;
+    memset(&opts, 0x00, sizeof(opts));
+    int i = 1;
+    while (i < argc) {
+        if (argv[i][0] == '-' && i + 1 < argc) {
+            switch (argv[i][1]) {
+            case 'd':
+                dir = argv[++i];
+                break;
+            case 'o':
+                outFile = argv[++i];
+                break;
+            case 'p':
+                packetLen = (uint16_t)strtol(argv[++i], nullptr, 10);
+                if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
+                    packetLen != 128 && packetLen != 256 && packetLen != 512) {
+                    printf("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
+                    return -1;
+                }
+                break;
+            case 'w': {
+                const char *hw = argv[++i];
+                if (strlen(hw) != 8) {
+                    printf("hwInfo should be 8 hex digits\n");
+                    return -1;
+                }
+                for (int k=0; k<4; ++k) {
+                    char byte[3] = { hw[2 * k], hw[2 * k + 1], 0 };
+                    opts.hwInfo[k] = (uint8_t)strtol(byte, nullptr, 16);
+                }
+                opts.hwSet = true;
+                break;
+            }
+            case 'j':
+                opts.threads = (int)strtol(argv[++i], nullptr, 10);
+                break;
+            default:
+                printf("illegal arguments, only supports d, o, p, w and j\n");
+                print_usage();
+                return -1;
+            }
+        }
+        ++i;
+    }
+    if (dir == NULL) {
+        print_usage();
+        return -1;
+    }
+    register_internal_sink(puts_, stdout);
+    std::vector<std::string> paths;
+    if (dfu_listImages(dir, paths) < 0) {
+        printf("Cannot read directory %s\n", dir);
+        return -1;
+    }
+    if (paths.empty()) {
+        printf("no %s file in %s\n", DFU_CHECK_EXT, dir);
+        return -1;
+    }
+    printf_setAsync(true);     //parse errors are formatted off the check threads
+    auto start = std::chrono::steady_clock::now();
+    std::vector<DfuCheckResult> results;
+    int failed = dfu_checkImages(paths, opts, results);
+    auto totalMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    printf_setAsync(false);
+
+    int lenIdx = 0;
+    while ((8 << lenIdx) != packetLen) {
+        ++lenIdx;
+    }
+    print_table(results, lenIdx);
+    uint64_t bytes = 0;
+    int warned = 0;
+    for (const DfuCheckResult &r : results) {
+        bytes += r.len;
+        warned += r.status == DFU_CHECK_WARN;
+    }
+    printf("%zu files, %d ok, %d warn, %d fail, %.1f MB in %lld ms, %.1f MB/s\n", results.size(),
+        (int)results.size() - warned - failed, warned, failed, bytes / 1048576.0, (long long)totalMs,
+        bytes / 1048576.0 * 1000.0 / (totalMs ? totalMs : 1));
+    if (outFile != NULL) {
+        FILE *out = fopen(outFile, "w");
+        if (out == nullptr) {
+            printf("Cannot open file %s\n", outFile);
+            return -1;
+        }
+        size_t n = strlen(outFile);
+        if (n > 5 && strcmp(outFile + n - 5, ".json") == 0) {
+            dump_json(out, results);
+        } else {
+            dump_csv(out, results);
+        }
+        fclose(out);
+    }
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,204 @@
+//decoder of the binary upgrade trace, dumps csv/json and per stage latency histograms
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "transport.h"
+#include "dfu_common.h"
+#include "dfu_trace.h"
+
+#define HIST_BUCKETS    20      //64us << 19 is ~33s
+
+struct Stage {
+    std::vector<uint32_t> latencyUs;
+    uint64_t totalUs;
+};
+
+inline void print_usage(void)
+{
+    printf("Usage: dfu_trace_app.exe -f <traceFile> [-o <outFile>]\n");
+    printf("traceFile : ring file written with -t by can_update_app or uart_update_app\n");
+    printf("outFile : records as .csv or .json, the extension selects the format\n");
+}
+
+static const char *event_name(uint8_t event)
+{
+    switch (event) {
+    case DFU_TRACE_SESSION_BEGIN: return "begin";
+    case DFU_TRACE_SESSION_END: return "end";
+    case DFU_TRACE_CMD: return "cmd";
+    case DFU_TRACE_RSP: return "rsp";
+    case DFU_TRACE_TIMEOUT: return "timeout";
+    case DFU_TRACE_DATA: return "data";
+    case DFU_TRACE_PACKET: return "packet";
+    default: return "unknown";
+    }
+}
+
+static const char *cmd_name(uint8_t cmd)
+{
+    switch (cmd) {
+    case DFU_PREPARE: return "prepare";
+    case DFU_GET_BOOTVER: return "getBootloaderVer";
+    case DFU_GET_HWINFO: return "getHardwareInfo";
+    case DFU_GET_HWTYPE: return "getHardwareType";
+    case DFU_GET_APPVER: return "getApplicationVer";
+    case DFU_GET_PKTLEN: return "getPacketLen";
+    case DFU_SET_PKTLEN: return "setPacketLen";
+    case DFU_SET_APPLEN: return "setApplicationLen";
+    case DFU_SET_PKTNUM: return "setPacketSeq";
+    case DFU_VERIFY_PKTDAT: return "verifyPacketData";
+    case DFU_VERIFY_ALLDAT: return "verifyAllData";
+    case DFU_UPDATE: return "updateStation";
+    case DFU_GET_STATUS: return "getUpdateStatus";
+    default: return "";
+    }
+}
+
+static void dump_csv(FILE *fd, const std::vector<DfuTraceRec> &recs)
+{
+    fprintf(fd, "ts_us,event,link,addr,cmd,name,seq,result,latency_us,value\n");
+    for (const DfuTraceRec &r : recs) {
+        fprintf(fd, "%llu,%s,%s,%u,0x%02X,%s,%u,%u,%u,%u\n", (unsigned long long)r.tsUs, event_name(r.event),
+            r.link == DFU_LINK_CAN ? "can" : "serial", r.addr, r.cmd, cmd_name(r.cmd), r.seq, r.result, r.latencyUs, r.value);
+    }
+}
+
+static void dump_json(FILE *fd, const std::vector<DfuTraceRec> &recs)
+{
+    fprintf(fd, "[\n");
+    for (size_t i=0; i<recs.size(); ++i) {
+        const DfuTraceRec &r = recs[i];
+        fprintf(fd, "  {\"ts_us\": %llu, \"event\": \"%s\", \"link\": \"%s\", \"addr\": %u, \"cmd\": %u, \"name\": \"%s\", "
+            "\"seq\": %u, \"result\": %u, \"latency_us\": %u, \"value\": %u}%s\n", (unsigned long long)r.tsUs, event_name(r.event),
+            r.link == DFU_LINK_CAN ? "can" : "serial", r.addr, r.cmd, cmd_name(r.cmd), r.seq, r.result, r.latencyUs, r.value,
+            i + 1 < recs.size() ? "," : "");
+    }
+    fprintf(fd, "]\n");
+}
+
+//command responses are split by command, the rest by event
+static void print_histograms(const std::vector<DfuTraceRec> &recs)
+{
+    std::map<std::string, Stage> stages;
+    uint64_t sessionUs = 0;
+    for (const DfuTraceRec &r : recs) {
+        std::string key;
+        if (r.event == DFU_TRACE_RSP || r.event == DFU_TRACE_TIMEOUT) {
+            key = std::string(event_name(r.event)) + " " + cmd_name(r.cmd);
+        } else if (r.event == DFU_TRACE_DATA || r.event == DFU_TRACE_PACKET || r.event == DFU_TRACE_SESSION_END) {
+            key = event_name(r.event);
+        } else {
+            continue;
+        }
+        Stage &s = stages[key];
+        s.latencyUs.push_back(r.latencyUs);
+        s.totalUs += r.latencyUs;
+        if (r.event == DFU_TRACE_SESSION_END) {
+            sessionUs += r.latencyUs;
+        }
+    }
+    printf("%-26s %7s %10s %6s %9s %9s %9s %9s\n", "stage", "count", "total ms", "share", "min us", "p50 us", "p99 us", "max us");
+    for (auto &it : stages) {
+        Stage &s = it.second;
+        std::sort(s.latencyUs.begin(), s.latencyUs.end());
+        size_t n = s.latencyUs.size();
+        printf("%-26s %7zu %10.1f %5.1f%% %9u %9u %9u %9u\n", it.first.c_str(), n, s.totalUs / 1000.0,
+            sessionUs ? 100.0 * s.totalUs / sessionUs : 0.0, s.latencyUs[0], s.latencyUs[n / 2],
+            s.latencyUs[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1], s.latencyUs[n - 1]);
+        uint32_t hist[HIST_BUCKETS] = { 0 };
+        for (uint32_t us : s.latencyUs) {
+            int b = 0;
+            while (b < HIST_BUCKETS - 1 && us > (64u << b)) {
+                ++b;
+            }
+            ++hist[b];
+        }
+        printf("   ");
+        for (int b=0; b<HIST_BUCKETS; ++b) {
+            if (hist[b] != 0) {
+                printf(" <=%uus:%u", 64u << b, hist[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *traceFile = NULL;
+    const char *outFile = NULL;
+    int i = 1;
+    while (i < argc) {
+        if (argv[i][0] == '-' && i + 1 < argc) {
+            switch (argv[i][1]) {
+            case 'f':
+                traceFile = argv[++i];
+                break;
+            case 'o':
+                outFile = argv[++i];
+                break;
+            default:
+                printf("illegal arguments, only supports f and o\n");
+                print_usage();
+                return -1;
+            }
+        }
+        ++i;
+    }
+    if (traceFile == NULL) {
+        print_usage();
+        return -1;
+    }
+    FILE *fd = fopen(traceFile, "rb");
+    if (fd == nullptr) {
+        printf("Cannot open file %s\n", traceFile);
+        return -1;
+    }
+    DfuTraceHdr hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fd) != 1 || hdr.magic != DFU_TRACE_MAGIC ||
+        hdr.version != DFU_TRACE_VERSION || hdr.recSize != sizeof(DfuTraceRec)) {
+        printf("%s is not a version %d trace file\n", traceFile, DFU_TRACE_VERSION);
+        fclose(fd);
+        return -1;
+    }
+    std::vector<DfuTraceRec> ring(hdr.capacity);
+    size_t cnt = fread(ring.data(), sizeof(DfuTraceRec), hdr.capacity, fd);
+    fclose(fd);
+    uint64_t head = hdr.head.load();
+    //oldest record first, the ring wrapped when head passed the capacity
+    std::vector<DfuTraceRec> recs;
+    size_t torn = dfu_traceRecords(hdr, ring.data(), cnt, recs);
+    printf("%zu records of %llu, started at unix time %llu us\n", recs.size(), (unsigned long long)head,
+        (unsigned long long)hdr.startUs);
+    if (torn != 0) {
+        printf("%zu records were being written and are skipped\n", torn);
+    }
+    if (outFile != NULL) {
+        FILE *out = fopen(outFile, "w");
+        if (out == nullptr) {
+            printf("Cannot open file %s\n", outFile);
+            return -1;
+        }
+        size_t n = strlen(outFile);
+        if (n > 5 && strcmp(outFile + n - 5, ".json") == 0) {
+            dump_json(out, recs);
+        } else {
+            dump_csv(out, recs);
+        }
+        fclose(out);
+    }
+    if (!recs.empty()) {
+        print_histograms(recs);
+    }
+    return 0;
+}
@@ -7,8 +7,378 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <thread>
 #include <chrono>
+#include <vector>
 #include <Windows.h>
+#include "dfu_engine.h"
+#include "dfu_image.h"
+#include "dfu_cache.h"
+#include "dfu_lz.h"
+#include "dfu_sign.h"
+#include "printf.h"
+#include "dfu_trace.h"
 
+#define UART_RS485_BAUDRATE 9600
+#define UART_RS485_TURNAROUND_US    10000   //RS485_TURNAROUND_US of uart.h
+#define UART_RS485_DATA_PROCESS_US  5000    //RS485_DATA_PROCESS_US of uart.h
+#define MAXIMUM_PORT_CNT    32
+
+typedef void (*RegisterInternalSink)(out_sink_type sink, void *ctx);
+typedef struct UartSession UartSession;
+typedef UartSession *(*UartConnect)(const char *port, uint32_t baud_rate);
+typedef bool (*UartDisconnect)(UartSession *s);
+typedef DfuTransport *(*UartGetTransport)(UartSession *s);
+typedef bool (*UartSetRs485Timing)(UartSession *s, uint32_t turnaroundUs, uint32_t dataProcessUs);
+
+//the engine runs in this exe, the dll only moves the frames
+static RegisterInternalSink dll_register_internal_sink = NULL;
+static UartConnect uart_connect = NULL;
+static UartDisconnect uart_disconnect = NULL;
+static UartGetTransport uart_getTransport = NULL;
+static UartSetRs485Timing uart_setRs485Timing = NULL;
+
+volatile int running = 0;
+
+struct PortJob {
+    char port[0x10];
+    UartSession *session;
+    int retCode;
+    uint32_t elapsedMs;
+    bool skipped;           //the app version already matched the file
+    std::vector<DfuStation> found;  //-d only
+};
+
+void SignalHandler(int signal)
+{
+    if (signal == SIGINT) {
+        printf("Capture CTRL+C signal. Try to abort\n");
+        running = 0;
+    }
+}
+
+inline void puts_(const char *buf, size_t len, void *ctx)
+{
+    fwrite(buf, 1, len, (FILE *)ctx);
+}
+
+inline void print_usage(void)
+{
+    printf("Usage: uart_update_app.exe -p <ports> -a <addr> -l <packetLen> -m <updateMode> -c <crcType> -f <dfuFile> [-t <traceFile>] [-k <cacheDir>] [-z <compress>] [-v <keyFile>] [-n <force>] [-g <timing>]\n");
+    printf("       uart_update_app.exe -p <ports> -d <addrs>\n");
+    printf("ports : RS485 port names separated by comma, etc \"COM3,COM4,COM5\", one target per port\n");
+    printf("addr : battery addresss on every port, start from 0\n");
+    printf("packetLen : packet length, should be 8, 16, 32, 64, 128, 256 or 512\n");
+    printf("updateMode : 0 - only update current station, 1 - update all stations\n");
+    printf("crcType : 0 - crc16 for app file, 1 - crc32 for app file\n");
+    printf("traceFile : binary event log of the upgrade, decoded by dfu_trace_app.exe\n");
+    printf("cacheDir : where the crcs of a file are kept for the next run, default " DFU_CACHE_DIR "\n");
+    printf("compress : 1 - send packets LZ4 compressed when the bootloader can decode them, 0 - as they are\n");
+    printf("force : 1 - flash also the targets whose app version already matches dfuFile, 0 - skip them\n");
+    printf("keyFile : DER RSA public key, the signature of dfuFile is checked while it is sent and DFU_UPDATE is only sent when it holds\n");
+    printf("timing : <turnaroundUs>,<dataProcessUs> of the bus, default %d,%d, the protocol asks for more than 10 ms turnaround\n",
+        UART_RS485_TURNAROUND_US, UART_RS485_DATA_PROCESS_US);
+    printf("addrs of -d : list the stations that answer on every port and exit, etc 3 or 0-15 or 1,4,6-9\n");
+}
+
+//ports are scanned at once, on one port the probes go one by one as answers would collide
+static void scan_thread(PortJob *job, const std::vector<uint8_t> *addrs)
+{
+    DfuEngine engine(*uart_getTransport(job->session));
+    auto start = std::chrono::high_resolution_clock::now();
+    job->retCode = engine.scanStations(addrs->data(), (int)addrs->size(), job->found);
+    job->elapsedMs = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void print_stations(const PortJob &job)
+{
+    for (const DfuStation &st : job.found) {
+        char boot[16] = "-";
+        char hw[16] = "-";
+        char cells[8] = "-";
+        if (st.boot) {
+            snprintf(boot, sizeof(boot), "%d.%d.%d.%d", st.bootVer[3], st.bootVer[2], st.bootVer[1], st.bootVer[0]);
+            snprintf(cells, sizeof(cells), "%d", st.cellNum);
+        }
+        if (st.hwKnown) {
+            snprintf(hw, sizeof(hw), "%02X%02X%02X%02X%02X", st.hwType[0], st.hwType[1], st.hwType[2], st.hwType[3],
+                st.hwType[4]);
+        }
+        printf("%-8s %4d %-5s %d.%d.%d build %-5d %-12s %-10s %5s\n", job.port, st.addr, st.boot ? "boot" : "app",
+            st.appVer[4], st.appVer[3], st.appVer[2], st.appVer[0] | (st.appVer[1] << 8), boot, hw, cells);
+    }
+}
+
+//dfu is NULL when every target is flashed whatever it runs
+static int upgrade_port(PortJob *job, const DfuImage *img, uint8_t addr, uint8_t mode, DfuSignCheck *sign,
+    const DfuContainer *dfu)
+{
+    DfuEngine engine(*uart_getTransport(job->session));
+    if (sign != NULL) {
+        engine.setUpdateGate(DfuSignCheck::gate, sign);     //every port waits on the one check
+    }
+    DfuPollRsp ver;
+    if (dfu != NULL && engine.pollStations(DFU_GET_APPVER, &addr, 1, &ver, DFU_POLL_TIMEOUT_MS) == 1 &&
+        dfu_containerInstalled(*dfu, ver.data)) {
+        job->skipped = true;
+        return 0;
+    }
+    return engine.upgrade(addr, *img, mode, &running);
+}
+
+static void port_thread(PortJob *job, const DfuImage *img, uint8_t addr, uint8_t mode, DfuSignCheck *sign,
+    const DfuContainer *dfu)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    job->retCode = upgrade_port(job, img, addr, mode, sign, dfu);
+    job->elapsedMs = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    char portList[0x200] = "COM1";
+    PortJob jobs[MAXIMUM_PORT_CNT];
+    int portCnt = 0;
+    DfuImage img;
+    DfuContainer dfu;
+    uint16_t packetLen = 0x80;  //8, 16, 32, 64, 128, 256, 512
+    uint8_t crcType = 0;    //0: crc16, 1:crc32
+    uint8_t compress = 0;
+    uint8_t addr = 0x00;
+    uint8_t mode = 0;
+    uint8_t force = 0;
+    std::vector<uint8_t> scanAddrs;
+    uint32_t turnaroundUs = UART_RS485_TURNAROUND_US;
+    uint32_t dataProcessUs = UART_RS485_DATA_PROCESS_US;
+    int retCode = 0;
+    const char *traceFile = NULL;
+    const char *cacheDir = DFU_CACHE_DIR;
+    const char *keyFile = NULL;
+    DfuPublicKey key;
+    DfuSignCheck sign;
+
+    //load library
+    HINSTANCE handle = LoadLibraryA("uart_update.dll");
+    if (handle == NULL) {
+        printf("could not load uart_update.dll\n");
+        return false;
+    }
+    dll_register_internal_sink = (RegisterInternalSink)GetProcAddress(handle, "register_internal_sink");
+    uart_connect = (UartConnect)GetProcAddress(handle, "uart_connect");
+    uart_disconnect = (UartDisconnect)GetProcAddress(handle, "uart_disconnect");
+    uart_getTransport = (UartGetTransport)GetProcAddress(handle, "uart_getTransport");
+    uart_setRs485Timing = (UartSetRs485Timing)GetProcAddress(handle, "uart_setRs485Timing");
+
+    fflush(stdout);
+    if (argc < 3 || (argc & 1) == 0) {
+        print_usage();
+        return -1;
+    }
+    int i = 1;
+    int filePos = 1;
+    while (i < argc) {
+        if (argv[i][0] == '-') {
+            char ch = argv[i][1];
+            switch (ch) {
+            case 'p':
+                ++i;
+                strncpy(portList, argv[i], sizeof(portList) - 1);
+                break;
+            case 'a':
+                ++i;
+                addr = (uint8_t)strtol(argv[i], nullptr, 10);
+                break;
+            case 'l':
+                ++i;
+                packetLen = (uint16_t)strtol(argv[i], nullptr, 10);
+                if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
+                    packetLen != 128 && packetLen != 256 && packetLen != 512) {
+                    printf("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
+                    return -1;
+                }
+                break;
+            case 'm':
+                ++i;
+                mode = (uint8_t)strtol(argv[i], nullptr, 10);
+                if (mode != 0 && mode != 1) {
+                    printf("mode should be 0: current or 1: all\n");
+                    return -1;
+                }
+                break;
+            case 'c':
+                ++i;
+                crcType = (uint8_t)strtol(argv[i], nullptr, 10);
+                if (crcType != 0 && crcType != 1) {
+                    printf("crcType should be 0: crc16 or 1: crc32\n");
+                    return -1;
+                }
+                break;
+            case 'f':
+                ++i;
+                filePos = i;
+                break;
+            case 't':
+                ++i;
+                traceFile = argv[i];
+                break;
+            case 'k':
+                ++i;
+                cacheDir = argv[i];
+                break;
+            case 'z':
+                ++i;
+                compress = (uint8_t)strtol(argv[i], nullptr, 10);
+                break;
+            case 'v':
+                ++i;
+                keyFile = argv[i];
+                break;
+            case 'n':
+                ++i;
+                force = (uint8_t)strtol(argv[i], nullptr, 10);
+                break;
+            case 'd':
+                ++i;
+                if (!dfu_parseAddrs(argv[i], scanAddrs)) {
+                    printf("addrs should be like 3, 0-15 or 1,4,6-9 within 0 ~ 255\n");
+                    return -1;
+                }
+                break;
+            case 'g':
+                ++i;
+                if (sscanf(argv[i], "%u,%u", &turnaroundUs, &dataProcessUs) != 2) {
+                    printf("timing should be like 10000,5000 in us\n");
+                    return -1;
+                }
+                break;
+            default:
+                printf("illegal arguments, only supports p, a, l, m, c, f, t, k, z, v, n, d and g\n");
+                print_usage();
+                return -1;
+            }
+            ++i;
+        } else {
+            ++i;
+        }
+    }
+    for (char *tok = strtok(portList, ","); tok != nullptr && portCnt < MAXIMUM_PORT_CNT; tok = strtok(nullptr, ",")) {
+        snprintf(jobs[portCnt].port, sizeof(jobs[portCnt].port), "%s", tok);
+        jobs[portCnt].session = NULL;
+        jobs[portCnt].retCode = -1;
+        jobs[portCnt].elapsedMs = 0;
+        jobs[portCnt].skipped = false;
+        ++portCnt;
+    }
+    if (!scanAddrs.empty()) {
+        dll_register_internal_sink(puts_, stdout);
+        register_internal_sink(puts_, stdout);
+        std::vector<std::thread> workers;
+        for (i = 0; i < portCnt; ++i) {
+            jobs[i].session = uart_connect(jobs[i].port, UART_RS485_BAUDRATE);
+            if (jobs[i].session == NULL) {
+                printf("Cannot connect to uart port %s\n", jobs[i].port);
+                continue;
+            }
+            uart_setRs485Timing(jobs[i].session, turnaroundUs, dataProcessUs);
+            workers.emplace_back(scan_thread, &jobs[i], &scanAddrs);
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        printf("%-8s %4s %-5s %-16s %-12s %-10s %5s\n", "port", "addr", "mode", "app", "bootloader", "hw", "cells");
+        for (i = 0; i < portCnt; ++i) {
+            print_stations(jobs[i]);
+        }
+        for (i = 0; i < portCnt; ++i) {
+            if (jobs[i].session != NULL) {
+                uart_disconnect(jobs[i].session);
+            }
+            if (jobs[i].retCode < 0) {
+                retCode = -1;
+                printf("%s : scan failed\n", jobs[i].port);
+            } else {
+                printf("%s : %d of %zu addresses answered in %u ms\n", jobs[i].port, jobs[i].retCode, scanAddrs.size(),
+                    jobs[i].elapsedMs);
+            }
+        }
+        return retCode;
+    }
+    printf("%d ports, target address is %d, packet length is %d, mode is %d, and crc type is %d\n",
+        portCnt, addr, packetLen, mode, crcType);
+    dll_register_internal_sink(puts_, stdout);
+    register_internal_sink(puts_, stdout);
+    if (keyFile != NULL && dfu_loadPublicKey(key, keyFile) < 0) {
+        printf("Cannot load public key %s\n", keyFile);
+        return -1;
+    }
+    //packet and file crc are the same for every port, calculate them only once
+    //header, sections and crcs are checked before any station is touched, and only once per file
+    if (dfu_loadCachedImage(img, dfu, argv[filePos], cacheDir, packetLen, crcType) < 0) {
+        printf("Cannot load dfu file %s\n", argv[filePos]);
+        return -1;
+    }
+    if (img.dataLen != img.len) {
+        printf("file length is not multiple of packetLen, padded with 0xFF\n");
+    }
+    if (compress) {
+        dfu_compressImage(img);     //shared by every port like the crcs
+    }
+    for (i = 0; i < portCnt; ++i) {
+        jobs[i].session = uart_connect(jobs[i].port, UART_RS485_BAUDRATE);
+        if (jobs[i].session == NULL) {
+            printf("Cannot connect to uart port %s\n", jobs[i].port);
+        } else {
+            uart_setRs485Timing(jobs[i].session, turnaroundUs, dataProcessUs);
+        }
+    }
+    running = 1;
+    signal(SIGINT, SignalHandler);
+    if (keyFile != NULL) {
+        //RSA runs next to the transfer, a bad signature stops every port and no DFU_UPDATE goes out
+        sign.start(key, img.data, img.dataLen, &running);
+    }
+    if (traceFile != NULL && !dfu_traceOpen(traceFile, DFU_TRACE_DEFAULT_RECS)) {
+        printf("trace file %s could not be created, upgrade without it\n", traceFile);
+    }
+    printf_setAsync(true);     //engine logs are formatted off the port threads
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> workers;
+    for (i = 0; i < portCnt; ++i) {
+        if (jobs[i].session != NULL) {
+            workers.emplace_back(port_thread, &jobs[i], &img, addr, mode, keyFile != NULL ? &sign : NULL,
+                force ? NULL : &dfu);
+        }
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    sign.wait();    //ports that failed early never asked, the worker still reads the image
+    printf_setAsync(false);
+    dfu_traceClose();
+    auto totalMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    running = 0;
+    int passed = 0;
+    int flashed = 0;
+    for (i = 0; i < portCnt; ++i) {
+        if (jobs[i].session != NULL) {
+            uart_disconnect(jobs[i].session);
+        }
+        if (jobs[i].retCode == 0) {
+            ++passed;
+            flashed += !jobs[i].skipped;
+        } else {
+            retCode = -1;
+        }
+        if (jobs[i].skipped) {
+            printf("%s : already current, skipped in %u ms\n", jobs[i].port, jobs[i].elapsedMs);
+        } else {
+            printf("%s : %s in %u ms\n", jobs[i].port, jobs[i].retCode == 0 ? "passed" : "failed", jobs[i].elapsedMs);
+        }
+    }
+    printf("%d of %d ports upgraded in %lld ms, %.1f KB/s aggregate\n", passed, portCnt, (long long)totalMs,
+        (double)flashed * img.len / (totalMs ? totalMs : 1));
+    dfu_unloadImage(img);
+    return retCode;
+}
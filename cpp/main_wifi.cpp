@@ -15,18 +15,21 @@
 #define UART_LOW_BAUDRATE 9600
 #define UART_HIGH_BAUDRATE 115200
 
-typedef void (*out_fct_type)(char character, void* buffer, size_t idx, size_t maxlen);
-typedef void (*RegisterInternalPutchar)(out_fct_type custom_putchar);
-typedef bool (*UartConnect)(const char* port, uint32_t baud_rate);
-typedef bool (*UartDisconnect)(void);
-typedef bool (*UartChangeHostBaud)(uint32_t baud_rate);
-typedef bool (*UartRequestSlaveBaud)(bool to_high);
-typedef bool (*UartRequestUpgrade)(void);
-typedef bool (*UartSendFrameCount)(uint16_t cnt);
-typedef int (*UartSendFrameData)(uint16_t seq, uint16_t len, uint8_t* dat);
-typedef bool (*UartRequestComplete)(void);
+typedef void (*out_sink_type)(const char *buf, size_t len, void *ctx);
+typedef void (*RegisterInternalSink)(out_sink_type sink, void *ctx);
+typedef struct UartSession UartSession;
+typedef UartSession *(*UartConnect)(const char* port, uint32_t baud_rate);
+typedef bool (*UartDisconnect)(UartSession *s);
+typedef bool (*UartChangeHostBaud)(UartSession *s, uint32_t baud_rate);
+typedef bool (*UartRequestSlaveBaud)(UartSession *s, bool to_high);
+typedef bool (*UartRequestUpgrade)(UartSession *s);
+typedef bool (*UartSendFrameCount)(UartSession *s, uint16_t cnt);
+typedef int (*UartSendFrameData)(UartSession *s, uint16_t seq, uint16_t len, uint8_t* dat);
+typedef bool (*UartRequestComplete)(UartSession *s);
+typedef int (*UartLoadFrameImageFile)(UartSession *s, const char *path);
+typedef int (*UartSendImageFrame)(UartSession *s, uint16_t seq);
 
-static RegisterInternalPutchar register_internal_putchar = NULL;
+static RegisterInternalSink register_internal_sink = NULL;
 static UartConnect uart_connect = NULL;
 static UartDisconnect uart_disconnect = NULL;
 static UartChangeHostBaud uart_changeHostBaud = NULL;
@@ -35,10 +38,12 @@ static UartRequestUpgrade uart_requestUpgrade = NULL;
 static UartSendFrameCount uart_sendFrameCount = NULL;
 static UartSendFrameData uart_sendFrameData = NULL;
 static UartRequestComplete uart_requestComplete = NULL;
+static UartLoadFrameImageFile uart_loadFrameImageFile = NULL;
+static UartSendImageFrame uart_sendImageFrame = NULL;
 
-inline void putchar_(char character, void* buffer, size_t idx, size_t maxlen)
+inline void puts_(const char *buf, size_t len, void *ctx)
 {
-    putchar(character);
+    fwrite(buf, 1, len, (FILE *)ctx);
 }
 
 inline void print_usage(void)
@@ -50,7 +55,6 @@ inline void print_usage(void)
 int main(int argc, char** argv)
 {
     char portName[0x08] = "COM1";
-    uint16_t packetLen = 0x200; //wifi upgrading only supports 512 bytes packet
     uint16_t packetCnt = 0;
     uint16_t seq = 0x01;
     int retCode = 0;
@@ -61,7 +65,7 @@ int main(int argc, char** argv)
         printf("could not load uart_update.dll\n");
         return false;
     }
-    register_internal_putchar = (RegisterInternalPutchar)GetProcAddress(handle, "register_internal_putchar");
+    register_internal_sink = (RegisterInternalSink)GetProcAddress(handle, "register_internal_sink");
     uart_connect = (UartConnect)GetProcAddress(handle, "uart_connect");
     uart_disconnect = (UartDisconnect)GetProcAddress(handle, "uart_disconnect");
     uart_changeHostBaud = (UartChangeHostBaud)GetProcAddress(handle, "uart_changeHostBaud");
@@ -70,6 +74,8 @@ int main(int argc, char** argv)
     uart_sendFrameCount = (UartSendFrameCount)GetProcAddress(handle, "uart_sendFrameCount");
     uart_sendFrameData = (UartSendFrameData)GetProcAddress(handle, "uart_sendFrameData");
     uart_requestComplete = (UartRequestComplete)GetProcAddress(handle, "uart_requestComplete");
+    uart_loadFrameImageFile = (UartLoadFrameImageFile)GetProcAddress(handle, "uart_loadFrameImageFile");
+    uart_sendImageFrame = (UartSendImageFrame)GetProcAddress(handle, "uart_sendImageFrame");
 
     fflush(stdout);
     if (argc != 3 && argc != 5) {
@@ -99,84 +105,68 @@ int main(int argc, char** argv)
         }
     }
     printf("packet length for wifi upgrading is fixed to 512\n");
-    register_internal_putchar(putchar_);
-    FILE* fd = fopen(argv[filePos], "rb");
-    if (fd == nullptr) {
-        printf("Cannot open file %s\n", argv[filePos]);
-        return -1;
-    }
-    fseek(fd, 0, SEEK_END);
-    uint32_t fileLen = ftell(fd);
-    rewind(fd);
-    uint32_t newFileLen = fileLen;
-    if ((fileLen & (packetLen - 1)) != 0) {
-        printf("file length is not multiple of packetLen, need padding");
-        newFileLen = fileLen + packetLen - (fileLen & (packetLen - 1));
-    }
-    uint8_t* buffer = (uint8_t*)malloc(newFileLen * sizeof(uint8_t));
-    if (buffer == nullptr) {
-        printf("Could not allocate buffer\n");
-        fclose(fd);
+    register_internal_sink(puts_, stdout);
+    UartSession *session = uart_connect(portName, UART_LOW_BAUDRATE);
+    if (session == NULL) {
+        printf("Cannot connect to uart port %s\n", portName);
         return -1;
     }
-    fread(buffer, sizeof(uint8_t), fileLen, fd);
-    if (fileLen != newFileLen) {
-        for (int i = fileLen; i < newFileLen; ++i) {
-            buffer[i] = 0xFF;   //padding with 0xFF
-        }
-        fileLen = newFileLen;
-    }
-    fclose(fd);
-    packetCnt = fileLen / packetLen;
-    if (!uart_connect(portName, UART_LOW_BAUDRATE)) {
-        printf("Cannot connect to uart port %s\n", portName);
-        free(buffer);
+    auto encodeStart = std::chrono::high_resolution_clock::now();
+    //the image is mapped, the last frame is padded with 0xFF without copying the file
+    int frameCnt = uart_loadFrameImageFile(session, argv[filePos]);
+    if (frameCnt <= 0) {
+        printf("could not encode the frames of %s\n", argv[filePos]);
+        uart_disconnect(session);
         return -1;
     }
+    packetCnt = (uint16_t)frameCnt;
+    auto encodeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - encodeStart).count();
+    printf("encoded %d frames in %lld us, %.0f frames/s\n", packetCnt, (long long)encodeUs, packetCnt * 1e6 / (encodeUs ? encodeUs : 1));
     auto start = std::chrono::high_resolution_clock::now();
     auto deadline = start + std::chrono::milliseconds(5000);   //3s retrying
     while (true) {
-        if (!uart_requestSlaveBaud(true)) { //request slave high baud rate
+        if (!uart_requestSlaveBaud(session, true)) { //request slave high baud rate
             printf("send high baudrate command to slave device failed\n");
-            free(buffer);
+            uart_disconnect(session);
             return -1;
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        if (!uart_changeHostBaud(UART_HIGH_BAUDRATE)) {
+        if (!uart_changeHostBaud(session, UART_HIGH_BAUDRATE)) {
             printf("swtiching host side's baudrate to %d bps failed\n", UART_HIGH_BAUDRATE);
-            free(buffer);
+            uart_disconnect(session);
             return -1;
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        if (uart_requestUpgrade()) {
+        if (uart_requestUpgrade(session)) {
             break;  //successfully switching to high baud rate and have response 
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        if (!uart_changeHostBaud(UART_LOW_BAUDRATE)) {
+        if (!uart_changeHostBaud(session, UART_LOW_BAUDRATE)) {
             printf("swtiching host side's baudrate to %d bps failed\n", UART_LOW_BAUDRATE);
-            free(buffer);
+            uart_disconnect(session);
             return -1;
         }
         if (std::chrono::high_resolution_clock::now() < deadline) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         } else {
             printf("Slave device has no response, timeout...\n");
-            free(buffer);
+            uart_disconnect(session);
             return -1;
         }
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(5));
-    if (!uart_sendFrameCount(packetCnt)) {
+    if (!uart_sendFrameCount(session, packetCnt)) {
         printf("send framecount %d command failed\n", packetCnt);
-        free(buffer);
+        uart_disconnect(session);
         return -1;
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    auto sendStart = std::chrono::high_resolution_clock::now();
     while (seq <= packetCnt) {
-        int ret = uart_sendFrameData(seq, packetLen, buffer + (seq-1) * packetLen);
+        int ret = uart_sendImageFrame(session, seq);
         if (ret < 0) {
             printf("send frame %d 's data failed\n", seq);
-            free(buffer);
+            uart_disconnect(session);
             return -1;
         } else if (ret ==0) {
             printf("slave request repeating\n");
@@ -185,19 +175,21 @@ int main(int argc, char** argv)
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
     }
-    if (!uart_requestComplete()) {
+    auto sendMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - sendStart).count();
+    printf("sent %d frames in %lld ms, %.1f frames/s\n", packetCnt, (long long)sendMs, packetCnt * 1e3 / (sendMs ? sendMs : 1));
+    if (!uart_requestComplete(session)) {
         printf("send request upgrade complete command failed\n");
-        free(buffer);
+        uart_disconnect(session);
         return -1;
     }
-    if (!uart_requestSlaveBaud(false)) {    //request slave low baud
+    if (!uart_requestSlaveBaud(session, false)) {    //request slave low baud
         printf("send low baudrate command to slave device failed\n");
-        free(buffer);
+        uart_disconnect(session);
         return -1;
     }
-    if (!uart_disconnect()) {
+    if (!uart_disconnect(session)) {
         printf("try to disconnect uart %s failed\n", portName);
-        free(buffer);
+        uart_disconnect(session);
         return -1;
     }
     return 0;
@@ -3,10 +3,52 @@
 
 #include <stdint.h>
 #include <float.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include "printf.h"
 
+//one captured printf_ call, formatted later by the writer thread
+union _log_arg {
+    uint64_t u;             //integers are sign extended, strings are offsets into str
+    double d;
+    const void *p;
+};
+
+struct _log_cap {
+    _log_arg arg[PRINTF_ASYNC_MAX_ARGS];
+    char str[PRINTF_ASYNC_STR_SIZE];
+};
+
+struct _log_rec {
+    std::atomic<size_t> seq;
+    const printf_tok *tok;  //NULL when the line was formatted in place into text
+    uint32_t tokCnt;
+    union {
+        _log_cap cap;
+        char text[PRINTF_ASYNC_LINE_SIZE];
+    };
+};
+
+//a line collected for the buffer sink
+struct _line_buf {
+    char buf[PRINTF_LINE_BUF_SIZE];
+    size_t n;
+};
+
 //global variable
 static out_fct_type _out_char = NULL;
+static out_sink_type _out_sink = NULL;
+static void *_out_ctx = NULL;
+static std::atomic<bool> _async_on(false);
+static std::atomic<bool> _async_run(false);
+static std::atomic<uint32_t> _async_busy(0);   //producers between the _async_on check and publishing
+static std::atomic<size_t> _ring_head(0);
+static size_t _ring_tail = 0;
+static std::atomic<uint32_t> _ring_drop(0);
+static _log_rec _ring[PRINTF_ASYNC_RING_SIZE];
+static std::thread _writer;
 
 static size_t _etoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, double value, uint32_t prec, uint32_t width, uint32_t flags);
 
@@ -17,6 +59,20 @@ inline void _out_buffer(char character, void* buffer, size_t idx, size_t maxlen)
     }
 }
 
+//collects characters and hands whole lines to the registered sink, the line keeps its own count
+static void _out_line(char character, void* buffer, size_t /*idx*/, size_t /*maxlen*/)
+{
+    _line_buf *line = (_line_buf*)buffer;
+    if (character == '\0') {
+        return;     //terminator of vsnprintf_, the sink takes a length
+    }
+    line->buf[line->n++] = character;
+    if (character == '\n' || line->n == sizeof(line->buf)) {
+        _out_sink(line->buf, line->n, _out_ctx);
+        line->n = 0U;
+    }
+}
+
 inline uint32_t _strnlen(const char *str, size_t maxsize)
 {
     const char *s = str;
@@ -343,7 +399,187 @@ static size_t _etoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, d
     return idx;
 }
 
-int vsnprintf_(out_fct_type out, char* buffer, const size_t maxlen, const char* format, va_list va)
+//argument sources of _vsnprintf
+struct _va_args {
+    va_list va;
+};
+
+struct _log_args {
+    const _log_rec *rec;
+    uint32_t n;
+};
+
+template <class T>
+inline T _next(_va_args &a)
+{
+    return va_arg(a.va, T);
+}
+
+template <class T>
+inline T _next(_log_args &a)
+{
+    return (T)a.rec->cap.arg[a.n++].u;
+}
+
+template <>
+inline double _next<double>(_log_args &a)
+{
+    return a.rec->cap.arg[a.n++].d;
+}
+
+template <>
+inline char* _next<char*>(_log_args &a)
+{
+    return (char*)a.rec->cap.str + a.rec->cap.arg[a.n++].u;
+}
+
+template <>
+inline void* _next<void*>(_log_args &a)
+{
+    return (void*)a.rec->cap.arg[a.n++].p;
+}
+
+//conversion of one specifier, shared by the format string and the token paths
+template <class Args>
+static size_t _format_spec(out_fct_type out, char* buffer, size_t idx, size_t maxlen, const char spec, uint32_t flags, uint32_t width, uint32_t precision, Args &args)
+{
+    switch (spec) {
+    case 'd' :
+    case 'i' :
+    case 'u' :
+    case 'x' :
+    case 'X' :
+    case 'o' :
+    case 'b' : {
+        // set the base
+        uint32_t base;
+        if (spec == 'x' || spec == 'X') {
+            base = 16U;
+        } else if (spec == 'o') {
+            base =  8U;
+        } else if (spec == 'b') {
+            base =  2U;
+        } else {
+            base = 10U;
+            flags &= ~FLAGS_HASH;   // no hash for dec format
+        }
+        // uppercase
+        if (spec == 'X') {
+            flags |= FLAGS_UPPERCASE;
+        }
+        // no plus or space flag for u, x, X, o, b
+        if ((spec != 'i') && (spec != 'd')) {
+            flags &= ~(FLAGS_PLUS | FLAGS_SPACE);
+        }
+        // ignore '0' flag when precision is given
+        if (flags & FLAGS_PRECISION) {
+            flags &= ~FLAGS_ZEROPAD;
+        }
+        // convert the integer
+        if ((spec == 'i') || (spec == 'd')) {
+            if (flags & FLAGS_LONG_LONG) {
+              const uint64_t value = _next<uint64_t>(args);
+              idx = _ntoa_long_long(out, buffer, idx, maxlen, (uint64_t)(value > 0 ? value : 0 - value), value < 0, base, precision, width, flags);
+            } else if (flags & FLAGS_LONG) {
+              const long value = _next<long>(args);
+              idx = _ntoa_long(out, buffer, idx, maxlen, (unsigned long)(value > 0 ? value : 0 - value), value < 0, base, precision, width, flags);
+            } else {
+              const int value = (flags & FLAGS_CHAR) ? (char)_next<int>(args) : (flags & FLAGS_SHORT) ? (short int)_next<int>(args) : _next<int>(args);
+              idx = _ntoa_long(out, buffer, idx, maxlen, (uint32_t)(value > 0 ? value : 0 - value), value < 0, base, precision, width, flags);
+            }
+        } else { // unsigned
+            if (flags & FLAGS_LONG_LONG) {
+              idx = _ntoa_long_long(out, buffer, idx, maxlen, _next<uint64_t>(args), false, base, precision, width, flags);
+            }
+            else if (flags & FLAGS_LONG) {
+              idx = _ntoa_long(out, buffer, idx, maxlen, _next<unsigned long>(args), false, base, precision, width, flags);
+            }
+            else {
+              const uint32_t value = (flags & FLAGS_CHAR) ? (uint8_t)_next<uint32_t>(args) : (flags & FLAGS_SHORT) ? (uint16_t)_next<uint32_t>(args) : _next<uint32_t>(args);
+              idx = _ntoa_long(out, buffer, idx, maxlen, value, false, base, precision, width, flags);
+            }
+        }
+        break;
+    }
+    case 'f' :
+    case 'F' :
+        if (spec == 'F') {
+            flags |= FLAGS_UPPERCASE;
+        }
+        idx = _ftoa(out, buffer, idx, maxlen, _next<double>(args), precision, width, flags);
+        break;
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        if ((spec == 'g')||(spec == 'G')) {
+            flags |= FLAGS_ADAPT_EXP;
+        }
+        if ((spec == 'E')||(spec == 'G')) {
+            flags |= FLAGS_UPPERCASE;
+        }
+        idx = _etoa(out, buffer, idx, maxlen, _next<double>(args), precision, width, flags);
+        break;
+    case 'c' : {
+        uint32_t l = 1U;
+        if (!(flags & FLAGS_LEFT)) {
+            while (l++ < width) {
+                out(' ', buffer, idx++, maxlen);
+            }
+        }
+        out((char)_next<int>(args), buffer, idx++, maxlen);
+        if (flags & FLAGS_LEFT) {
+            while (l++ < width) {
+                out(' ', buffer, idx++, maxlen);
+            }
+        }
+        break;
+    }
+    case 's' : {
+        const char* p = _next<char*>(args);
+        uint32_t l = _strnlen(p, precision ? precision : (size_t)-1);
+        if (flags & FLAGS_PRECISION) {
+            l = (l < precision ? l : precision);
+        }
+        if (!(flags & FLAGS_LEFT)) {
+            while (l++ < width) {
+                out(' ', buffer, idx++, maxlen);
+            }
+        }
+        while ((*p != 0) && (!(flags & FLAGS_PRECISION) || precision--)) {
+            out(*(p++), buffer, idx++, maxlen);
+        }
+        if (flags & FLAGS_LEFT) {
+            while (l++ < width) {
+                out(' ', buffer, idx++, maxlen);
+            }
+        }
+        break;
+    }
+    case 'p' : {
+        width = sizeof(void*) * 2U;
+        flags |= FLAGS_ZEROPAD | FLAGS_UPPERCASE;
+        const bool is_ll = sizeof(uintptr_t) == sizeof(uint64_t);
+        if (is_ll) {
+            idx = _ntoa_long_long(out, buffer, idx, maxlen, (uintptr_t)_next<void*>(args), false, 16U, precision, width, flags);
+        } else {
+            idx = _ntoa_long(out, buffer, idx, maxlen, (unsigned long)((uintptr_t)_next<void*>(args)), false, 16U, precision, width, flags);
+        }
+        break;
+    }
+    case '%' :
+        out('%', buffer, idx++, maxlen);
+        break;
+    default :
+        out(spec, buffer, idx++, maxlen);
+        break;
+    }
+    return idx;
+}
+
+//Args is _va_args, the token path also takes _log_args when a captured record is formatted later
+template <class Args>
+static int _vsnprintf(out_fct_type out, char* buffer, const size_t maxlen, const char* format, Args &args)
 {
     uint32_t flags, width, precision, n;
     size_t idx = 0U;
@@ -394,7 +630,7 @@ int vsnprintf_(out_fct_type out, char* buffer, const size_t maxlen, const char*
         if (_is_digit(*format)) {
             width = _atoi(&format);
         } else if (*format == '*') {
-            const int w = va_arg(va, int);
+            const int w = _next<int>(args);
             if (w < 0) {
                 flags |= FLAGS_LEFT;    // reverse padding
                 width = (uint32_t)-w;
@@ -412,7 +648,7 @@ int vsnprintf_(out_fct_type out, char* buffer, const size_t maxlen, const char*
             if (_is_digit(*format)) {
                 precision = _atoi(&format);
             } else if (*format == '*') {
-                const int prec = (int)va_arg(va, int);
+                const int prec = (int)_next<int>(args);
                 precision = prec > 0 ? (uint32_t)prec : 0U;
                 format++;
             }
@@ -453,163 +689,342 @@ int vsnprintf_(out_fct_type out, char* buffer, const size_t maxlen, const char*
         }
 
         // evaluate specifier
-        switch (*format) {
-        case 'd' :
-        case 'i' :
-        case 'u' :
-        case 'x' :
-        case 'X' :
-        case 'o' :
-        case 'b' : {
-            // set the base
-            uint32_t base;
-            if (*format == 'x' || *format == 'X') {
-                base = 16U;
-            } else if (*format == 'o') {
-                base =  8U;
-            } else if (*format == 'b') {
-                base =  2U;
-            } else {
-                base = 10U;
-                flags &= ~FLAGS_HASH;   // no hash for dec format
-            }
-            // uppercase
-            if (*format == 'X') {
-                flags |= FLAGS_UPPERCASE;
-            }
-            // no plus or space flag for u, x, X, o, b
-            if ((*format != 'i') && (*format != 'd')) {
-                flags &= ~(FLAGS_PLUS | FLAGS_SPACE);
-            }
-            // ignore '0' flag when precision is given
-            if (flags & FLAGS_PRECISION) {
-                flags &= ~FLAGS_ZEROPAD;
-            }
-            // convert the integer
-            if ((*format == 'i') || (*format == 'd')) {
-                if (flags & FLAGS_LONG_LONG) {
-                  const uint64_t value = va_arg(va, uint64_t);
-                  idx = _ntoa_long_long(out, buffer, idx, maxlen, (uint64_t)(value > 0 ? value : 0 - value), value < 0, base, precision, width, flags);
-                } else if (flags & FLAGS_LONG) {
-                  const long value = va_arg(va, long);
-                  idx = _ntoa_long(out, buffer, idx, maxlen, (unsigned long)(value > 0 ? value : 0 - value), value < 0, base, precision, width, flags);
-                } else {
-                  const int value = (flags & FLAGS_CHAR) ? (char)va_arg(va, int) : (flags & FLAGS_SHORT) ? (short int)va_arg(va, int) : va_arg(va, int);
-                  idx = _ntoa_long(out, buffer, idx, maxlen, (uint32_t)(value > 0 ? value : 0 - value), value < 0, base, precision, width, flags);
-                }
-            } else { // unsigned
-                if (flags & FLAGS_LONG_LONG) {
-                  idx = _ntoa_long_long(out, buffer, idx, maxlen, va_arg(va, uint64_t), false, base, precision, width, flags);
-                }
-                else if (flags & FLAGS_LONG) {
-                  idx = _ntoa_long(out, buffer, idx, maxlen, va_arg(va, unsigned long), false, base, precision, width, flags);
-                }
-                else {
-                  const uint32_t value = (flags & FLAGS_CHAR) ? (uint8_t)va_arg(va, uint32_t) : (flags & FLAGS_SHORT) ? (uint16_t)va_arg(va, uint32_t) : va_arg(va, uint32_t);
-                  idx = _ntoa_long(out, buffer, idx, maxlen, value, false, base, precision, width, flags);
-                }
-            }
+        idx = _format_spec(out, buffer, idx, maxlen, *format, flags, width, precision, args);
+        if (*format) {
             format++;
-            break;
         }
-        case 'f' :
-        case 'F' :
-            if (*format == 'F') {
-                flags |= FLAGS_UPPERCASE;
-            }
-            idx = _ftoa(out, buffer, idx, maxlen, va_arg(va, double), precision, width, flags);
-            format++;
-            break;
-        case 'e':
-        case 'E':
-        case 'g':
-        case 'G':
-            if ((*format == 'g')||(*format == 'G')) {
-                flags |= FLAGS_ADAPT_EXP;
-            }
-            if ((*format == 'E')||(*format == 'G')) {
-                flags |= FLAGS_UPPERCASE;
-            }
-            idx = _etoa(out, buffer, idx, maxlen, va_arg(va, double), precision, width, flags);
-            format++;
-            break;
-        case 'c' : {
-            uint32_t l = 1U;
-            if (!(flags & FLAGS_LEFT)) {
-                while (l++ < width) {
-                    out(' ', buffer, idx++, maxlen);
-                }
-            }
-            out((char)va_arg(va, int), buffer, idx++, maxlen);
-            if (flags & FLAGS_LEFT) {
-                while (l++ < width) {
-                    out(' ', buffer, idx++, maxlen);
-                }
-            }
-            format++;
-            break;
+    }
+    out((char)0, buffer, idx < maxlen ? idx : maxlen - 1U, maxlen);
+    // return written chars without terminating \0
+    return (int)idx;
+}
+
+//same conversions as _vsnprintf, the format was split into tokens at compile time
+template <class Args>
+static int _vsnprintf_tok(out_fct_type out, char* buffer, const size_t maxlen, const printf_tok* tok, size_t cnt, Args &args)
+{
+    size_t idx = 0U;
+    for (size_t i=0U; i<cnt; ++i) {
+        for (uint32_t j=0U; j<tok[i].litLen; ++j) {
+            out(tok[i].lit[j], buffer, idx++, maxlen);
         }
-        case 's' : {
-            const char* p = va_arg(va, char*);
-            uint32_t l = _strnlen(p, precision ? precision : (size_t)-1);
-            if (flags & FLAGS_PRECISION) {
-                l = (l < precision ? l : precision);
-            }
-            if (!(flags & FLAGS_LEFT)) {
-                while (l++ < width) {
-                    out(' ', buffer, idx++, maxlen);
-                }
-            }
-            while ((*p != 0) && (!(flags & FLAGS_PRECISION) || precision--)) {
-                out(*(p++), buffer, idx++, maxlen);
-            }
-            if (flags & FLAGS_LEFT) {
-                while (l++ < width) {
-                    out(' ', buffer, idx++, maxlen);
-                }
-            }
-            format++;
-            break;
+        if (tok[i].spec == '\0') {
+            continue;
         }
-        case 'p' : {
-            width = sizeof(void*) * 2U;
-            flags |= FLAGS_ZEROPAD | FLAGS_UPPERCASE;
-            const bool is_ll = sizeof(uintptr_t) == sizeof(uint64_t);
-            if (is_ll) {
-                idx = _ntoa_long_long(out, buffer, idx, maxlen, (uintptr_t)va_arg(va, void*), false, 16U, precision, width, flags);
+        uint32_t flags = tok[i].flags & ~(FLAGS_WIDTH_ARG | FLAGS_PREC_ARG);
+        uint32_t width = tok[i].width;
+        uint32_t precision = tok[i].precision;
+        if (tok[i].flags & FLAGS_WIDTH_ARG) {
+            const int w = _next<int>(args);
+            if (w < 0) {
+                flags |= FLAGS_LEFT;    // reverse padding
+                width = (uint32_t)-w;
             } else {
-                idx = _ntoa_long(out, buffer, idx, maxlen, (unsigned long)((uintptr_t)va_arg(va, void*)), false, 16U, precision, width, flags);
+                width = (uint32_t)w;
             }
-            format++;
-            break;
         }
-        case '%' :
-            out('%', buffer, idx++, maxlen);
-            format++;
-            break;
-        default :
-            out(*format, buffer, idx++, maxlen);
-            format++;
-            break;
+        if (tok[i].flags & FLAGS_PREC_ARG) {
+            const int prec = _next<int>(args);
+            precision = prec > 0 ? (uint32_t)prec : 0U;
         }
+        idx = _format_spec(out, buffer, idx, maxlen, tok[i].spec, flags, width, precision, args);
     }
     out((char)0, buffer, idx < maxlen ? idx : maxlen - 1U, maxlen);
-    // return written chars without terminating \0
     return (int)idx;
 }
 
-int printf_(const char* format, ...)
+int vsnprintf_(out_fct_type out, char* buffer, const size_t maxlen, const char* format, va_list va)
+{
+    _va_args args;
+    va_copy(args.va, va);
+    const int ret = _vsnprintf(out, buffer, maxlen, format, args);
+    va_end(args.va);
+    return ret;
+}
+
+int vsnprintf_tok(out_fct_type out, char* buffer, const size_t maxlen, const printf_tok* tok, size_t cnt, va_list va)
+{
+    _va_args args;
+    va_copy(args.va, va);
+    const int ret = _vsnprintf_tok(out, buffer, maxlen, tok, cnt, args);
+    va_end(args.va);
+    return ret;
+}
+
+//pulls the value of one conversion into the record, strings are copied because
+//the caller's buffer may be gone before the writer thread gets to the record
+static bool _capture_arg(_log_cap *rec, uint32_t &n, uint32_t &s, const char spec, uint32_t flags, _va_args &a)
+{
+    if (n + 1U > PRINTF_ASYNC_MAX_ARGS) {
+        return false;
+    }
+    switch (spec) {
+    case 'd' :
+    case 'i' :
+        if (flags & FLAGS_LONG_LONG) {
+            rec->arg[n++].u = _next<uint64_t>(a);
+        } else if (flags & FLAGS_LONG) {
+            rec->arg[n++].u = (uint64_t)(int64_t)_next<long>(a);
+        } else {
+            rec->arg[n++].u = (uint64_t)(int64_t)_next<int>(a);
+        }
+        break;
+    case 'u' :
+    case 'x' :
+    case 'X' :
+    case 'o' :
+    case 'b' :
+        if (flags & FLAGS_LONG_LONG) {
+            rec->arg[n++].u = _next<uint64_t>(a);
+        } else if (flags & FLAGS_LONG) {
+            rec->arg[n++].u = _next<unsigned long>(a);
+        } else {
+            rec->arg[n++].u = _next<uint32_t>(a);
+        }
+        break;
+    case 'f' :
+    case 'F' :
+    case 'e' :
+    case 'E' :
+    case 'g' :
+    case 'G' :
+        rec->arg[n++].d = _next<double>(a);
+        break;
+    case 'c' :
+        rec->arg[n++].u = (uint64_t)(int64_t)_next<int>(a);
+        break;
+    case 's' : {
+        const char* p = _next<char*>(a);
+        const uint32_t l = p ? _strnlen(p, PRINTF_ASYNC_STR_SIZE - s) : 0U;   //one more than fits tells a longer string
+        if (s + l >= PRINTF_ASYNC_STR_SIZE) {
+            return false;
+        }
+        memcpy(rec->str + s, p, l);
+        rec->str[s + l] = '\0';
+        rec->arg[n++].u = s;
+        s += l + 1U;
+        break;
+    }
+    case 'p' :
+        rec->arg[n++].p = _next<void*>(a);
+        break;
+    default :
+        break;
+    }
+    return true;
+}
+
+static bool _capture_star(_log_cap *rec, uint32_t &n, _va_args &a)
+{
+    if (n + 1U > PRINTF_ASYNC_MAX_ARGS) {
+        return false;
+    }
+    rec->arg[n++].u = (uint64_t)(int64_t)_next<int>(a);
+    return true;
+}
+
+static bool _capture_tok(_log_cap *rec, const printf_tok* tok, size_t cnt, _va_args &a)
+{
+    uint32_t n = 0U, s = 0U;
+    for (size_t i=0U; i<cnt; ++i) {
+        if (tok[i].spec == '\0') {
+            continue;
+        }
+        if ((tok[i].flags & FLAGS_WIDTH_ARG) && !_capture_star(rec, n, a)) {
+            return false;
+        }
+        if ((tok[i].flags & FLAGS_PREC_ARG) && !_capture_star(rec, n, a)) {
+            return false;
+        }
+        if (!_capture_arg(rec, n, s, tok[i].spec, tok[i].flags, a)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//a line longer than a record or the writer's buffer is cut, the mark shows it
+static int _async_cut(char* line, int len)
+{
+    if (len >= (int)PRINTF_ASYNC_LINE_SIZE) {
+        len = (int)PRINTF_ASYNC_LINE_SIZE - 1;
+        memcpy(line + len - 4, "...\n", 4);
+        line[len] = '\0';
+    }
+    return len;
+}
+
+//producers claim a record with one CAS, a full ring drops the line instead of blocking the caller
+static _log_rec *_async_claim(size_t &pos)
+{
+    pos = _ring_head.load(std::memory_order_relaxed);
+    for (;;) {
+        _log_rec *rec = &_ring[pos & (PRINTF_ASYNC_RING_SIZE - 1U)];
+        const size_t seq = rec->seq.load(std::memory_order_acquire);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (_ring_head.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed)) {
+                return rec;
+            }
+        } else if (dif < 0) {
+            _ring_drop.fetch_add(1U, std::memory_order_relaxed);
+            return NULL;
+        } else {
+            pos = _ring_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+//printf_ has to return the length, so the line is formatted here and only the output is left to the writer
+static int _async_text(const char* format, va_list va)
+{
+    size_t pos;
+    _log_rec *rec = _async_claim(pos);
+    if (rec == NULL) {
+        return -1;
+    }
+    _va_args args;
+    va_copy(args.va, va);
+    const int ret = _vsnprintf(_out_buffer, rec->text, PRINTF_ASYNC_LINE_SIZE, format, args);
+    va_end(args.va);
+    _async_cut(rec->text, ret);
+    rec->tok = NULL;
+    rec->seq.store(pos + 1U, std::memory_order_release);
+    return ret;
+}
+
+//the token path only copies the arguments, the writer formats them
+static void _async_tok(const printf_tok* tok, size_t cnt, va_list va)
 {
-    if (_out_char != NULL) {
-        va_list va;
-        va_start(va, format);
-        char buffer[1];
-        const int ret = vsnprintf_(_out_char, buffer, (size_t)-1, format, va);
-        va_end(va);
-        return ret;
+    size_t pos;
+    _log_rec *rec = _async_claim(pos);
+    if (rec == NULL) {
+        return;
+    }
+    _va_args cp;
+    va_copy(cp.va, va);
+    if (_capture_tok(&rec->cap, tok, cnt, cp)) {
+        rec->tok = tok;
+        rec->tokCnt = (uint32_t)cnt;
     } else {
+        //too many arguments or strings to capture, format on the caller's thread
+        _va_args args;
+        va_copy(args.va, va);
+        _async_cut(rec->text, _vsnprintf_tok(_out_buffer, rec->text, PRINTF_ASYNC_LINE_SIZE, tok, cnt, args));
+        va_end(args.va);
+        rec->tok = NULL;
+    }
+    va_end(cp.va);
+    rec->seq.store(pos + 1U, std::memory_order_release);
+}
+
+//formats every ready record, returns how many were written
+static uint32_t _async_drain(void)
+{
+    char line[PRINTF_ASYNC_LINE_SIZE];
+    uint32_t cnt = 0U;
+    for (;;) {
+        _log_rec *rec = &_ring[_ring_tail & (PRINTF_ASYNC_RING_SIZE - 1U)];
+        if (rec->seq.load(std::memory_order_acquire) != _ring_tail + 1U) {
+            break;
+        }
+        int len;
+        if (rec->tok != NULL) {
+            _log_args args = { rec, 0U };
+            len = _async_cut(line, _vsnprintf_tok(_out_buffer, line, sizeof(line), rec->tok, rec->tokCnt, args));
+        } else {
+            len = (int)_strnlen(rec->text, sizeof(rec->text));
+            memcpy(line, rec->text, len);
+        }
+        rec->seq.store(_ring_tail + PRINTF_ASYNC_RING_SIZE, std::memory_order_release);
+        ++_ring_tail;
+        ++cnt;
+        out_fct_type out = _out_char;
+        if (_out_sink != NULL) {
+            _out_sink(line, (size_t)len, _out_ctx);
+        } else if (out != NULL) {
+            for (int i=0; i<len; ++i) {
+                out(line[i], NULL, (size_t)i, (size_t)-1);
+            }
+        }
+    }
+    const uint32_t drop = _ring_drop.exchange(0U, std::memory_order_relaxed);
+    if (drop != 0U) {
+        const int len = sprintf_(line, "[printf_ dropped %u lines]\n", drop);
+        if (_out_sink != NULL) {
+            _out_sink(line, (size_t)len, _out_ctx);
+        } else if (_out_char != NULL) {
+            for (int i=0; i<len; ++i) {
+                _out_char(line[i], NULL, (size_t)i, (size_t)-1);
+            }
+        }
+    }
+    return cnt;
+}
+
+static void _async_writer(void)
+{
+    while (_async_run.load(std::memory_order_acquire)) {
+        if (_async_drain() == 0U) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(PRINTF_ASYNC_IDLE_MS));
+        }
+    }
+    _async_drain();     //lines pushed before printf_setAsync(false) returned
+}
+
+//tok is NULL for a format string
+static int _printf(const char* format, const printf_tok* tok, size_t cnt, va_list va)
+{
+    if (_out_sink == NULL && _out_char == NULL) {
         return 0;
     }
+    if (_async_on.load(std::memory_order_relaxed)) {
+        //counted before _async_on is checked again, printf_setAsync(false) waits for the count to drop
+        //so the writer's last drain sees every line that went to the ring
+        _async_busy.fetch_add(1U);
+        if (_async_on.load()) {
+            int ret = 0;
+            if (tok != NULL) {
+                _async_tok(tok, cnt, va);
+            } else {
+                ret = _async_text(format, va);
+            }
+            _async_busy.fetch_sub(1U, std::memory_order_release);
+            return ret;
+        }
+        _async_busy.fetch_sub(1U, std::memory_order_release);
+    }
+    out_fct_type out = _out_char;
+    _line_buf line;
+    char buffer[1];
+    char* p = buffer;
+    if (_out_sink != NULL) {
+        line.n = 0U;
+        out = _out_line;
+        p = (char*)&line;
+    }
+    const int ret = tok != NULL ? vsnprintf_tok(out, p, (size_t)-1, tok, cnt, va) : vsnprintf_(out, p, (size_t)-1, format, va);
+    if (_out_sink != NULL && line.n != 0U) {
+        _out_sink(line.buf, line.n, _out_ctx);  //text without a trailing newline
+    }
+    return ret;
+}
+
+int printf_(const char* format, ...)
+{
+    va_list va;
+    va_start(va, format);
+    const int ret = _printf(format, NULL, 0U, va);
+    va_end(va);
+    return ret;
+}
+
+void printf_tok_(const printf_tok* tok, size_t cnt, ...)
+{
+    va_list va;
+    va_start(va, cnt);
+    _printf(NULL, tok, cnt, va);
+    va_end(va);
 }
 
 int sprintf_(char* buffer, const char* format, ...)
@@ -625,3 +1040,33 @@ void register_internal_putchar(out_fct_type custom_putchar)
 {
     _out_char = custom_putchar;
 }
+
+void register_internal_sink(out_sink_type sink, void *ctx)
+{
+    _out_ctx = ctx;
+    _out_sink = sink;
+}
+
+void printf_setAsync(bool enable)
+{
+    if (enable == _async_run.load()) {
+        return;
+    }
+    if (enable) {
+        _ring_tail = _ring_head.load();
+        for (size_t i=0; i<PRINTF_ASYNC_RING_SIZE; ++i) {
+            const size_t pos = _ring_tail + i;
+            _ring[pos & (PRINTF_ASYNC_RING_SIZE - 1U)].seq.store(pos, std::memory_order_relaxed);
+        }
+        _async_run = true;
+        _writer = std::thread(_async_writer);
+        _async_on = true;
+    } else {
+        _async_on = false;
+        while (_async_busy.load() != 0U) {
+            std::this_thread::yield();
+        }
+        _async_run = false;
+        _writer.join();
+    }
+}
@@ -4,12 +4,20 @@
 //Date : Dec 02, 2026
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 //config
 #define PRINTF_NTOA_BUFFER_SIZE    32U
 #define PRINTF_FTOA_BUFFER_SIZE    32U
 #define PRINTF_DEFAULT_FLOAT_PRECISION  6U
 #define PRINTF_MAX_FLOAT 1e9
+#define PRINTF_ASYNC_RING_SIZE     1024U   //captured lines in flight, power of 2
+#define PRINTF_ASYNC_MAX_ARGS      16U
+#define PRINTF_ASYNC_STR_SIZE      128U    //copies of %s arguments of one line
+#define PRINTF_ASYNC_LINE_SIZE     512U    //longer async lines are cut and end with "...\n"
+#define PRINTF_ASYNC_IDLE_MS       1U
+#define PRINTF_LINE_BUF_SIZE       256U    //longer lines reach the sink in pieces
 
 #define FLAGS_ZEROPAD   (1U <<  0U)
 #define FLAGS_LEFT      (1U <<  1U)
@@ -23,20 +31,41 @@
 #define FLAGS_LONG_LONG (1U <<  9U)
 #define FLAGS_PRECISION (1U << 10U)
 #define FLAGS_ADAPT_EXP (1U << 11U)
+#define FLAGS_WIDTH_ARG (1U << 12U)     //token path, width is taken from the arguments
+#define FLAGS_PREC_ARG  (1U << 13U)     //token path, precision is taken from the arguments
 
 //types
 typedef void (*out_fct_type)(char character, void *buffer, size_t idx, size_t maxlen);
+typedef void (*out_sink_type)(const char *buf, size_t len, void *ctx);
+
+//literal text followed by one conversion, dfu_log.h splits a format into these at compile time
+struct printf_tok {
+    const char *lit;
+    uint32_t litLen;
+    uint32_t flags;
+    uint32_t width;
+    uint32_t precision;
+    char spec;          //'\0' for the literal after the last conversion
+};
 
 //functions
 int vsnprintf_(out_fct_type out, char* buffer, const size_t maxlen, const char* format, va_list va);
 int sprintf_(char* buffer, const char* format, ...);
 int printf_(const char* format, ...);
+int vsnprintf_tok(out_fct_type out, char* buffer, const size_t maxlen, const printf_tok* tok, size_t cnt, va_list va);
+//no length is returned, with printf_setAsync(true) the line is only formatted later
+void printf_tok_(const printf_tok* tok, size_t cnt, ...);
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 __declspec(dllexport) void register_internal_putchar(out_fct_type custom_putchar);
+//whole lines in one call, takes precedence over the putchar callback when both are set
+__declspec(dllexport) void register_internal_sink(out_sink_type sink, void *ctx);
+//printf_ formats into a ring and a writer thread does the output, printf_tok_ only captures its arguments
+//and the writer formats them too. stop it before unloading
+__declspec(dllexport) void printf_setAsync(bool enable);
 
 #ifdef __cplusplus
 }
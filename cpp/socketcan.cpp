@@ -0,0 +1,131 @@
+//SocketCAN transport for linux hosts
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#ifdef __linux__
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "socketcan.h"
+#include "dfu_engine.h"
+#include "dfu_log.h"
+
+SocketCanTransport::SocketCanTransport(int fd) : sock(fd)
+{
+    c.link = DFU_LINK_CAN;
+    c.maxPayload = 8;
+    c.maxBatch = DFU_MAX_BATCH;
+    c.dataGapUs = CAN_DATA_GAP_US;
+}
+
+SocketCanTransport::~SocketCanTransport()
+{
+    close(sock);
+}
+
+int SocketCanTransport::send(const DfuFrame *frames, int cnt)
+{
+    struct can_frame cf[DFU_MAX_BATCH];
+    struct mmsghdr msg[DFU_MAX_BATCH];
+    struct iovec iov[DFU_MAX_BATCH];
+    cnt = cnt > DFU_MAX_BATCH ? DFU_MAX_BATCH : cnt;
+    memset(cf, 0, sizeof(struct can_frame) * cnt);
+    memset(msg, 0, sizeof(struct mmsghdr) * cnt);
+    for (int i=0; i<cnt; ++i) {
+        cf[i].can_id = frames[i].id & CAN_SFF_MASK;  //standard frame, data frame
+        cf[i].can_dlc = (uint8_t)frames[i].len;
+        memcpy(cf[i].data, frames[i].data, frames[i].len);
+        iov[i].iov_base = &cf[i];
+        iov[i].iov_len = sizeof(struct can_frame);
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = 0;
+    while (sent < cnt) {    //one syscall for the whole batch unless the tx queue is full
+        int n = sendmmsg(sock, msg + sent, cnt - sent, 0);
+        if (n < 0) {
+            if (errno == ENOBUFS || errno == EAGAIN) {
+                struct pollfd pfd = { sock, POLLOUT, 0 };
+                poll(&pfd, 1, 10);
+                continue;
+            }
+            LOG_ERR("SocketCAN : send failed, errno %d\n", errno);
+            return sent ? sent : -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+int SocketCanTransport::receive(DfuFrame &frame, DfuDeadline deadline)
+{
+    struct can_frame cf;
+    while (true) {
+        //rounded up, a poll cut short to whole ms would give up before the deadline
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret = poll(&pfd, 1, left > 0 ? (int)left : 0);
+        if (ret < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ret > 0 && read(sock, &cf, sizeof(cf)) == sizeof(cf)) {
+            frame.id = cf.can_id & CAN_SFF_MASK;
+            frame.len = cf.can_dlc;
+            memcpy(frame.data, cf.data, 8);
+            return 1;
+        }
+        if (left <= 0) {
+            return 0;
+        }
+    }
+}
+
+void SocketCanTransport::flush(void)
+{
+    struct can_frame cf;
+    while (recv(sock, &cf, sizeof(cf), MSG_DONTWAIT) > 0) {
+    }
+}
+
+SocketCanTransport *socketcan_createTransport(const char *ifname)
+{
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0) {
+        LOG_ERR("could not open SocketCAN socket\n");
+        return NULL;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        LOG_ERR("could not find CAN interface %s\n", ifname);
+        close(fd);
+        return NULL;
+    }
+    struct can_filter filter;   //only the bootloader responses are delivered
+    filter.can_id = CAN_RSP_ID;
+    filter.can_mask = CAN_SFF_MASK;
+    setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERR("could not bind CAN interface %s\n", ifname);
+        close(fd);
+        return NULL;
+    }
+    return new SocketCanTransport(fd);
+}
+
+//the devirtualized path for linux hosts, the frames go straight to the socket
+template class DfuEngineT<SocketCanTransport>;
+
+#endif
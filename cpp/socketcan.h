@@ -0,0 +1,29 @@
+#pragma once
+
+//SocketCAN transport for linux hosts
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include "transport.h"
+
+#ifdef __linux__
+
+//frames go out in one sendmmsg per batch, the kernel filter only delivers the responses
+class SocketCanTransport final : public DfuTransport {
+public:
+    explicit SocketCanTransport(int fd);
+    ~SocketCanTransport() override;
+    const DfuTransportCaps &caps(void) const override { return c; }
+    int send(const DfuFrame *frames, int cnt) override;
+    int receive(DfuFrame &frame, DfuDeadline deadline) override;
+    void flush(void) override;
+
+private:
+    int sock;
+    DfuTransportCaps c;
+};
+
+//ifname is the netdev name such as can0, bitrate is set up outside with ip link
+SocketCanTransport *socketcan_createTransport(const char *ifname);
+
+#endif
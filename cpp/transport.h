@@ -0,0 +1,45 @@
+#pragma once
+
+//transport interface shared by CAN, RS-485 and the simulator
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <chrono>
+
+#ifndef _WIN32
+#define __declspec(x)   //SocketCAN builds on linux have no dll exports
+#endif
+
+#define DFU_LINK_CAN        0   //frames are id + 8 bytes, no SOP/CRC/EOP
+#define DFU_LINK_SERIAL     1   //frames are SOP LEN ... CRC EOP on a byte stream
+
+#define DFU_FRAME_MAX_LEN   (512 + 4)   //SOP + the largest data packet + CRC + EOP
+
+typedef std::chrono::steady_clock::time_point DfuDeadline;
+
+//one frame on the wire, id is only used by CAN
+struct DfuFrame {
+    uint32_t id;
+    uint16_t len;
+    uint8_t data[DFU_FRAME_MAX_LEN];
+};
+
+struct DfuTransportCaps {
+    uint8_t link;           //DFU_LINK_CAN or DFU_LINK_SERIAL
+    uint16_t maxPayload;    //bytes in one frame
+    uint16_t maxBatch;      //frames accepted by one send
+    uint32_t dataGapUs;     //time the FW needs after every data frame, 0 if it keeps up with the wire
+};
+
+class DfuTransport {
+public:
+    virtual ~DfuTransport() {}
+    virtual const DfuTransportCaps &caps(void) const = 0;
+    //returns the number of frames put on the wire, -1 on error
+    virtual int send(const DfuFrame *frames, int cnt) = 0;
+    //returns 1 when a frame is received, 0 when the deadline passed, -1 on error
+    virtual int receive(DfuFrame &frame, DfuDeadline deadline) = 0;
+    //drop everything received but not consumed yet
+    virtual void flush(void) = 0;
+};
@@ -1,12 +1,45 @@
 #include <string.h>
 #include <windows.h>
 #include <thread>
+#include <chrono>
 #include <vector>
 #include "uart.h"
 #include "dfu_common.h"
-#include "printf.h"
+#include "dfu_engine.h"
+#include "dfu_image.h"
+#include "dfu_log.h"
+
+//RS-485 side of a session, one self-delimited frame per send or receive
+class UartTransport final : public DfuTransport {
+public:
+    explicit UartTransport(UartSession *session);
+    const DfuTransportCaps &caps(void) const override { return c; }
+    int send(const DfuFrame *frames, int cnt) override;
+    int receive(DfuFrame &frame, DfuDeadline deadline) override;
+    void flush(void) override;
+    void setDataGap(uint32_t us) { c.dataGapUs = us; }
+
+private:
+    UartSession *s;
+    DfuTransportCaps c;
+};
 
-static HANDLE gSerial;
+//everything about one COM port, nothing is shared between sessions
+struct UartSession {
+    HANDLE serial = INVALID_HANDLE_VALUE;
+    uint32_t baudRate = 9600;
+    COMMTIMEOUTS timeouts;      //the ones used by the wifi protocol
+    std::chrono::steady_clock::time_point busIdle;     //earliest time the next RS-485 command may go out
+    uint32_t turnaroundUs = RS485_TURNAROUND_US;    //receive to send gap of this bus
+    //frame encoder state, the payload is never copied out of the image
+    const uint8_t *frameImage = NULL;
+    uint32_t frameImageLen = 0;
+    const DfuImageFile *frameFile = NULL;  //mapping frameImage points into, shared with other sessions
+    std::vector<uint8_t> frameChecksum;
+    uint8_t frame[WIFI_FRAME_SIZE];     //staging buffer, one frame goes out in one write
+    UartTransport transport{this};
+    DfuEngine engine{transport};
+};
 
 /* Old protocol for wifi upgrading */
 const uint8_t highBaudRateCmd[] = {
@@ -33,33 +66,51 @@ const uint8_t requestCompleteReseponse[] = {
     WIFI_SOP, 0xA3, 0x00, 0x00, 0x06, 0x57, WIFI_EOP,
 };
 
-static uint8_t wifi_checksum(uint8_t *buffer, int len)
+static int wifi_readFrameAck(UartSession *s)
 {
-    uint8_t sum = 0;
-    for (int i=0; i<len; ++i) {
-        sum += buffer[i];
+    uint8_t buffer[8];
+    DWORD bytesRead;
+    if (!ReadFile(s->serial, buffer, 7, &bytesRead, NULL)) {
+        LOG_ERR("cannot read request update response from UART\n");
+        return -1;
+    }
+    if (bytesRead != 7) {
+        LOG_ERR("couldn't receive enough bytes from UART\n");
+        return -1;
+    }
+    if (buffer[0] != WIFI_SOP && buffer[6] != WIFI_EOP) {
+        LOG_ERR("response packet SOF and EOF error\n");
+        return -1;
     }
-    sum = (~sum + 1) & 0xFF;
-    return sum;  
+    if (wifi_checksum(buffer + 1, 5) != 0x00) {
+        LOG_ERR("reponse packet checksum error\n");
+        return -1;
+    }
+    if (buffer[4] != 0x03) {
+        return 0;   //need host repeating 
+    }
+    return 1;   //successful 
 }
 
-bool uart_connect(const char *port, uint32_t baud_rate)
+UartSession *uart_connect(const char *port, uint32_t baud_rate)
 {
-    gSerial = CreateFileA(port, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (gSerial == INVALID_HANDLE_VALUE) {
-        return false;
+    HANDLE serial = CreateFileA(port, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (serial == INVALID_HANDLE_VALUE) {
+        return NULL;
     }
     DCB serial_params = {0};
     serial_params.DCBlength = sizeof(serial_params);
-    if (!GetCommState(gSerial, &serial_params)) {
-        return false;
+    if (!GetCommState(serial, &serial_params)) {
+        CloseHandle(serial);
+        return NULL;
     }
     serial_params.BaudRate = baud_rate;
     serial_params.ByteSize = 8;
     serial_params.StopBits = ONESTOPBIT;
     serial_params.Parity = NOPARITY;
-    if (!SetCommState(gSerial, &serial_params)) {
-        return false;
+    if (!SetCommState(serial, &serial_params)) {
+        CloseHandle(serial);
+        return NULL;
     }
     COMMTIMEOUTS timeout = {0};
     timeout.ReadIntervalTimeout = 50;   //in ms
@@ -67,83 +118,109 @@ bool uart_connect(const char *port, uint32_t baud_rate)
     timeout.ReadTotalTimeoutMultiplier = 10;    //in ms for every byte
     timeout.WriteTotalTimeoutConstant = 500;
     timeout.WriteTotalTimeoutMultiplier = 10;   //in ms for every byte
-    SetCommTimeouts(gSerial, &timeout);
-    return true;
+    SetCommTimeouts(serial, &timeout);
+    UartSession *s = new UartSession;
+    s->serial = serial;
+    s->timeouts = timeout;
+    s->baudRate = baud_rate;
+    s->busIdle = std::chrono::steady_clock::now();
+    return s;
 }
 
-bool uart_disconnect(void)
+bool uart_disconnect(UartSession *s)
 {
-    return CloseHandle(gSerial);
+    if (s == NULL) {
+        return false;
+    }
+    bool ret = CloseHandle(s->serial);
+    dfu_closeImageFile(s->frameFile);
+    delete s;
+    return ret;
 }
 
 //wifi upgrading
-bool uart_changeHostBaud(uint32_t baud_rate)
+bool uart_changeHostBaud(UartSession *s, uint32_t baud_rate)
 {
-    FlushFileBuffers(gSerial);
+    FlushFileBuffers(s->serial);
     DCB serial_params = {0};
     serial_params.DCBlength = sizeof(serial_params);
-    if (!GetCommState(gSerial, &serial_params)) {
+    if (!GetCommState(s->serial, &serial_params)) {
         return false;
     }
     serial_params.BaudRate = baud_rate;
-    if (!SetCommState(gSerial, &serial_params)) {
+    if (!SetCommState(s->serial, &serial_params)) {
         return false;
     }
-    PurgeComm(gSerial, PURGE_RXCLEAR | PURGE_TXCLEAR);
+    PurgeComm(s->serial, PURGE_RXCLEAR | PURGE_TXCLEAR);
+    s->baudRate = baud_rate;
     return true;
 }
 
-bool uart_requestSlaveBaud(bool to_high)
+bool uart_requestSlaveBaud(UartSession *s, bool to_high)
 {
     DWORD bytesWritten;
     if (to_high) {
-        if (!WriteFile(gSerial, highBaudRateCmd, sizeof(highBaudRateCmd), &bytesWritten, NULL)) {
-            printf_("cannot send out request update command to UART\n");
+        if (!WriteFile(s->serial, highBaudRateCmd, sizeof(highBaudRateCmd), &bytesWritten, NULL)) {
+            LOG_ERR("cannot send out request update command to UART\n");
             return false;
         }
     } else {
-        if (!WriteFile(gSerial, lowBaudRateCmd, sizeof(lowBaudRateCmd), &bytesWritten, NULL)) {
-            printf_("cannot send out request update command to UART\n");
+        if (!WriteFile(s->serial, lowBaudRateCmd, sizeof(lowBaudRateCmd), &bytesWritten, NULL)) {
+            LOG_ERR("cannot send out request update command to UART\n");
             return false;
         }
     }
     if (bytesWritten != sizeof(highBaudRateCmd)) {
-        printf_("couldn't send enough bytes to UART\n");
+        LOG_ERR("couldn't send enough bytes to UART\n");
         return false;
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
     return true;
 }
 
-bool uart_requestUpgrade(void)
+//a bus with slow slaves needs longer gaps than the protocol asks for, a shorter turnaround is only for benches
+bool uart_setRs485Timing(UartSession *s, uint32_t turnaroundUs, uint32_t dataProcessUs)
+{
+    if (s == NULL) {
+        return false;
+    }
+    if (turnaroundUs < RS485_TURNAROUND_US) {
+        LOG_WARN("turnaround %u us is below the 10 ms of the protocol, slaves may collide\n", turnaroundUs);
+    }
+    s->turnaroundUs = turnaroundUs;
+    s->transport.setDataGap(dataProcessUs);
+    return true;
+}
+
+bool uart_requestUpgrade(UartSession *s)
 {
     char buffer[8];
     DWORD bytesWritten, bytesRead;
-    if (!WriteFile(gSerial, requestUpdateCmd, sizeof(requestUpdateCmd), &bytesWritten, NULL)) {
-        printf_("cannot send out request update command to UART\n");
+    if (!WriteFile(s->serial, requestUpdateCmd, sizeof(requestUpdateCmd), &bytesWritten, NULL)) {
+        LOG_ERR("cannot send out request update command to UART\n");
         return false;
     }
     if (bytesWritten != sizeof(requestUpdateResponse)) {
-        printf_("couldn't send enough bytes to UART\n");
+        LOG_ERR("couldn't send enough bytes to UART\n");
         return false;
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(requestUpdateResponse), &bytesRead, NULL)) {
-        printf_("cannot read request update response from UART\n");
+    if (!ReadFile(s->serial, buffer, sizeof(requestUpdateResponse), &bytesRead, NULL)) {
+        LOG_ERR("cannot read request update response from UART\n");
         return false;
     }
     if (bytesRead != sizeof(requestUpdateResponse)) {
-        printf_("don't receive enough bytes from UART\n");
+        LOG_ERR("don't receive enough bytes from UART\n");
         return false;
     }
     if (memcmp(buffer, requestUpdateResponse, sizeof(requestUpdateResponse)) != 0) {
-        printf_("received response for request update command is not expected\n");
+        LOG_ERR("received response for request update command is not expected\n");
         return false;
     }
     return true;
 }
 
-bool uart_sendFrameCount(uint16_t cnt)
+bool uart_sendFrameCount(UartSession *s, uint16_t cnt)
 {
     //every frame has 512 bytes
     uint8_t buffer[8];
@@ -154,103 +231,126 @@ bool uart_sendFrameCount(uint16_t cnt)
     buffer[3] = cnt & 0xFF;   //lsb
     buffer[4] = wifi_checksum(buffer + 1, 3);
     buffer[5] = WIFI_EOP;
-    if (!WriteFile(gSerial, buffer, 6, &bytesWritten, NULL)) {
-        printf_("cannot send out request update command to UART\n");
+    if (!WriteFile(s->serial, buffer, 6, &bytesWritten, NULL)) {
+        LOG_ERR("cannot send out request update command to UART\n");
         return false;
     }
     if (bytesWritten != 6) {
-        printf_("couldn't send enough bytes to UART\n");
+        LOG_ERR("couldn't send enough bytes to UART\n");
         return false;
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, 7, &bytesRead, NULL)) {
-        printf_("cannot read request update response from UART\n");
+    if (!ReadFile(s->serial, buffer, 7, &bytesRead, NULL)) {
+        LOG_ERR("cannot read request update response from UART\n");
         return false;
     }
     if (bytesRead != 7) {
-        printf_("couldn't receive enough bytes from UART\n");
+        LOG_ERR("couldn't receive enough bytes from UART\n");
         return false;
     }
     if (buffer[0] != WIFI_SOP && buffer[6] != WIFI_EOP) {
-        printf_("response packet SOF and EOF error\n");
+        LOG_ERR("response packet SOF and EOF error\n");
         return false;
     }
     if (wifi_checksum(buffer + 1, 5) != 0x00) {
-        printf_("reponse packet checksum error\n");
+        LOG_ERR("reponse packet checksum error\n");
         return false;
     }
     return true;
 }
 
 //len <= 0x200
-int uart_sendFrameData(uint16_t seq, uint16_t len, uint8_t *dat)
+int uart_sendFrameData(UartSession *s, uint16_t seq, uint16_t len, uint8_t *dat)
 {
-    uint8_t buffer[0x206];
-    DWORD bytesWritten, bytesRead;
-    buffer[0] = WIFI_SOP;
-    buffer[1] = WIFI_UPGRADE_DATA;
-    buffer[2] = seq >> 8;   //msb
-    buffer[3] = seq & 0xFF; //lsb
-    memcpy(buffer+4, dat, len);
-    if (len < 0x200) {
-        memset(buffer+4+len, 0x00, 0x200-len);
-    }
-    buffer[0x204] = wifi_checksum(buffer + 4, 0x200);
-    buffer[0x205] = WIFI_EOP;
-    if (!WriteFile(gSerial, buffer, 0x206, &bytesWritten, NULL)) {
-        printf_("cannot send out request update command to UART\n");
+    uint8_t buffer[WIFI_FRAME_SIZE];
+    DWORD bytesWritten;
+    wifi_encodeFrameData(buffer, seq, len, dat);
+    if (!WriteFile(s->serial, buffer, WIFI_FRAME_SIZE, &bytesWritten, NULL)) {
+        LOG_ERR("cannot send out request update command to UART\n");
         return -1;
     }
-    if (bytesWritten != 0x206) {
-        printf_("couldn't send enough bytes to UART\n");
+    if (bytesWritten != WIFI_FRAME_SIZE) {
+        LOG_ERR("couldn't send enough bytes to UART\n");
         return -1;
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, 7, &bytesRead, NULL)) {
-        printf_("cannot read request update response from UART\n");
+    return wifi_readFrameAck(s);
+}
+
+//checksums of all the frames are calculated once, image should stay valid until next load
+int uart_loadFrameImage(UartSession *s, const uint8_t *image, uint32_t len)
+{
+    int cnt = wifi_frameChecksums(s->frameChecksum, image, len);
+    if (cnt < 0) {
         return -1;
     }
-    if (bytesRead != 7) {
-        printf_("couldn't receive enough bytes from UART\n");
+    wifi_initFrame(s->frame);
+    dfu_closeImageFile(s->frameFile);
+    s->frameFile = NULL;
+    s->frameImage = image;
+    s->frameImageLen = len;
+    return cnt;
+}
+
+//the file is mapped read-only, sessions loading the same file share the mapping
+int uart_loadFrameImageFile(UartSession *s, const char *path)
+{
+    const DfuImageFile *file = dfu_openImageFile(path);
+    if (file == NULL) {
         return -1;
     }
-    if (buffer[0] != WIFI_SOP && buffer[6] != WIFI_EOP) {
-        printf_("response packet SOF and EOF error\n");
+    int cnt = uart_loadFrameImage(s, dfu_imageFileData(file), dfu_imageFileLen(file));
+    if (cnt < 0) {
+        dfu_closeImageFile(file);
         return -1;
     }
-    if (wifi_checksum(buffer + 1, 5) != 0x00) {
-        printf_("reponse packet checksum error\n");
+    s->frameFile = file;
+    return cnt;
+}
+
+//seq starts from 1, only seq, payload and checksum of the staged frame change, the ack paces the next one
+int uart_sendImageFrame(UartSession *s, uint16_t seq)
+{
+    DWORD bytesWritten;
+    if (s->frameImage == NULL || seq == 0 || seq > s->frameChecksum.size()) {
+        LOG_ERR("frame %d is not in the loaded image\n", seq);
         return -1;
     }
-    if (buffer[4] != 0x03) {
-        return 0;   //need host repeating 
+    wifi_stageFrame(s->frame, seq, s->frameImage, s->frameImageLen, s->frameChecksum[seq - 1]);
+    if (!WriteFile(s->serial, s->frame, WIFI_FRAME_SIZE, &bytesWritten, NULL)) {
+        LOG_ERR("cannot send out frame data to UART\n");
+        return -1;
     }
-    return 1;   //successful 
+    if (bytesWritten != WIFI_FRAME_SIZE) {
+        LOG_ERR("couldn't send enough bytes to UART\n");
+        return -1;
+    }
+    return wifi_readFrameAck(s);
 }
 
-bool uart_requestComplete(void)
+bool uart_requestComplete(UartSession *s)
 {
     uint8_t buffer[8];
     DWORD bytesWritten, bytesRead;
-    if (!WriteFile(gSerial, requestCompleteCmd, sizeof(requestCompleteCmd), &bytesWritten, NULL)) {
-        printf_("cannot send out request update command to UART\n");
+    if (!WriteFile(s->serial, requestCompleteCmd, sizeof(requestCompleteCmd), &bytesWritten, NULL)) {
+        LOG_ERR("cannot send out request update command to UART\n");
         return false;
     }
     if (bytesWritten != sizeof(requestCompleteCmd)) {
-        printf_("couldn't send enough bytes to UART\n");
+        LOG_ERR("couldn't send enough bytes to UART\n");
         return false;
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(requestCompleteReseponse), &bytesRead, NULL)) {
-        printf_("cannot read request update response from UART\n");
+    if (!ReadFile(s->serial, buffer, sizeof(requestCompleteReseponse), &bytesRead, NULL)) {
+        LOG_ERR("cannot read request update response from UART\n");
         return false;
     }
     if (bytesRead != sizeof(requestCompleteReseponse)) {
-        printf_("don't receive enough bytes from UART\n");
+        LOG_ERR("don't receive enough bytes from UART\n");
         return false;
     }
     if (memcmp(buffer, requestCompleteReseponse, sizeof(requestCompleteReseponse)) != 0) {
-        printf_("received response for request complete command is not expected\n");
+        LOG_ERR("received response for request complete command is not expected\n");
         return false;
     }
     return true;
@@ -258,559 +358,262 @@ bool uart_requestComplete(void)
 
 
 //RS-485 upgrading
-int uart_prepareCmd(uint8_t addr, uint8_t *resp)
+static uint32_t rs485_airTimeUs(UartSession *s, uint32_t bytes)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    prepareCmd[CMD_LEN_OFFSET] = addr;
-    uint16_t crc = crc16(&prepareCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    prepareCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    prepareCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, prepareCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out prepare update command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(10), &bytesRead, NULL)) {
-        printf_("cannot get prepare update response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 10) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyPrepare(buffer, true)) {
-        return -1;
-    }
-    resp[0] = buffer[6];    //get the cell num
-    return 1;
+    return (uint32_t)(((uint64_t)bytes * RS485_BITS_PER_BYTE * 1000000 + s->baudRate - 1) / s->baudRate);
 }
 
-int uart_getBootloaderVerCmd(uint8_t addr, uint8_t *resp)
+static uint32_t rs485_turnaroundUs(UartSession *s)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getBootloaderVerCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getBootloaderVerCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    getBootloaderVerCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    getBootloaderVerCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getBootloaderVerCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out getBootloaderVer command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot get getBootloaderVer response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyGetBootloaderVer(buffer, true)) {
-        return -1;
-    }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET - 1], 5);
-    return 5;
+    uint32_t idle = rs485_airTimeUs(s, 7) / 2;    //3.5 characters
+    return idle > s->turnaroundUs ? idle : s->turnaroundUs;
 }
 
-int uart_getBatterySN(uint8_t addr, uint8_t *resp)
+static void rs485_waitUntil(std::chrono::steady_clock::time_point deadline)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getBatterySNCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getBatterySNCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    getBatterySNCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    getBatterySNCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getBatterySNCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out getBatterySN command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot getBatterySN response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-#if 0
-    if (!verifyGetBootloaderVer(buffer, true)) {
-        return -1;
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return;
+        }
+        if (deadline - now > std::chrono::milliseconds(2)) {
+            std::this_thread::sleep_for(deadline - now - std::chrono::milliseconds(1));
+        } else {
+            std::this_thread::yield();
+        }
     }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET - 1], 5);
-#endif 
-    return 30;
 }
 
-int uart_getHardwareInfoCmd(uint8_t addr, uint8_t *resp)
+//wait until the driver queue is drained and the last stop bit is on the wire
+static bool rs485_waitTxEmpty(UartSession *s, DWORD bytes, std::chrono::steady_clock::time_point start)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getHardwareInfoCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getHardwareInfoCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    getHardwareInfoCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    getHardwareInfoCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getHardwareInfoCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out getHardwareInfo command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot getHardwareInfo response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyGetHardwareInfo(buffer, true)) {
-        return -1;
+    auto done = start + std::chrono::microseconds(rs485_airTimeUs(s, bytes));
+    auto timeout = done + std::chrono::microseconds(RS485_TXEMPTY_TIMEOUT_US);
+    DWORD errors;
+    COMSTAT stat;
+    while (true) {
+        if (!ClearCommError(s->serial, &errors, &stat)) {
+            LOG_ERR("cannot get UART transmit status\n");
+            return false;
+        }
+        if (stat.cbOutQue == 0) {
+            rs485_waitUntil(done);
+            return true;
+        }
+        if (std::chrono::steady_clock::now() >= timeout) {
+            LOG_WARN("UART transmitter still has %u bytes queued\n", (uint32_t)stat.cbOutQue);
+            return false;
+        }
+        rs485_waitUntil(std::chrono::steady_clock::now() + std::chrono::microseconds(rs485_airTimeUs(s, stat.cbOutQue)));
     }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET-1], 5);
-    return 5;
 }
 
-int uart_getHardwareTypeCmd(uint8_t addr, uint8_t *resp)
+//read exactly len bytes unless the deadline passes first, returns the bytes read
+static DWORD rs485_readBytes(UartSession *s, uint8_t *buf, DWORD len, DfuDeadline deadline)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getHardwareTypeCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getHardwareTypeCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    getHardwareTypeCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    getHardwareTypeCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getHardwareTypeCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out getHardwareType command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot get getHardwareType response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyGetHardwareType(buffer, true)) {
-        return -1;
+    DWORD got = 0;
+    while (got < len) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            break;
+        }
+        COMMTIMEOUTS timeout = {0};
+        timeout.ReadIntervalTimeout = MAXDWORD;     //return as soon as any byte is there
+        timeout.ReadTotalTimeoutMultiplier = MAXDWORD;
+        timeout.ReadTotalTimeoutConstant = (DWORD)left;
+        timeout.WriteTotalTimeoutConstant = s->timeouts.WriteTotalTimeoutConstant;
+        timeout.WriteTotalTimeoutMultiplier = s->timeouts.WriteTotalTimeoutMultiplier;
+        SetCommTimeouts(s->serial, &timeout);
+        DWORD bytesRead = 0;
+        if (!ReadFile(s->serial, buf + got, len - got, &bytesRead, NULL)) {
+            LOG_ERR("cannot read response from UART\n");
+            break;
+        }
+        got += bytesRead;
     }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET-1], 5);
-    return 5;
+    return got;
 }
 
-int uart_getApplicationVerCmd(uint8_t addr, uint8_t *resp)
+//one response frame, SOP LEN ADR STA DATA CRC_L CRC_H EOP, the length comes from LEN
+static int rs485_readFrame(UartSession *s, uint8_t *buf, uint16_t cap, DfuDeadline deadline)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getApplicationVerCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getApplicationVerCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    getApplicationVerCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    getApplicationVerCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getApplicationVerCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out getApplicationVer command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot get getApplicationVer response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyGetApplicationVer(buffer, true)) {
-        return -1;
+    int ret = 0;
+    while (true) {
+        if (rs485_readBytes(s, buf, 1, deadline) != 1) {
+            break;
+        }
+        if (buf[RSP_SOP_OFFSET] != DFU_CMD_SOP && buf[RSP_SOP_OFFSET] != DFU_DAT_SOP && buf[RSP_SOP_OFFSET] != APP_CMD_SOP) {
+            continue;   //noise or the tail of a late frame
+        }
+        if (rs485_readBytes(s, buf + 1, 1, deadline) != 1) {
+            break;
+        }
+        DWORD rest = buf[RSP_LEN_OFFSET] + 3;
+        if (RS485_FRAME_LEN(buf[RSP_LEN_OFFSET]) > cap) {
+            LOG_ERR("response length %d is too long\n", buf[RSP_LEN_OFFSET]);
+            ret = -1;
+            break;
+        }
+        if (rs485_readBytes(s, buf + 2, rest, deadline) != rest) {
+            LOG_ERR("don't receive enough bytes from UART\n");
+            ret = -1;
+            break;
+        }
+        ret = RS485_FRAME_LEN(buf[RSP_LEN_OFFSET]);
+        break;
     }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET-1], 5);
-    return 5;
+    SetCommTimeouts(s->serial, &s->timeouts);
+    return ret;
 }
 
-int uart_getPacketLenCmd(uint8_t addr, uint8_t *resp)
+UartTransport::UartTransport(UartSession *session) : s(session)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getPacketLenCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getPacketLenCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    getPacketLenCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    getPacketLenCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getPacketLenCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out getPacketLen command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot getPacketLen response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyGetPacketLen(buffer, true)) {
-        return -1;
-    }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET-1], 4);
-    return 4;
+    c.link = DFU_LINK_SERIAL;
+    c.maxPayload = DFU_FRAME_MAX_LEN;
+    c.maxBatch = 1;     //half duplex, every command waits for its response
+    c.dataGapUs = RS485_DATA_PROCESS_US;
 }
 
-int uart_setPacketLenCmd(uint8_t addr, uint16_t packetLen)
+int UartTransport::send(const DfuFrame *frames, int cnt)
 {
-    uint8_t buffer[16];
-    if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
-        packetLen != 128 && packetLen != 256 && packetLen != 512) {
-        printf_("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
-		return -1;
-    }
-    DWORD bytesWritten, bytesRead;
-    setPacketLenCmd[CMD_ADR_OFFSET] = addr;
-    setPacketLenCmd[CMD_DAT_OFFSET] = packetLen & 0xFF;
-    setPacketLenCmd[CMD_DAT_OFFSET + 2] = 0x00;
-    setPacketLenCmd[CMD_DAT_OFFSET + 3] = 0x00;
-    setPacketLenCmd[CMD_DAT_OFFSET + 1] = (packetLen >> 8) & 0xFF;
-    uint16_t crc = crc16(&setPacketLenCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    setPacketLenCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    setPacketLenCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, setPacketLenCmd, 11, &bytesWritten, NULL)) {
-        printf_("cannot send out setPacketLen command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 11) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(8), &bytesRead, NULL)) {
-        printf_("cannot get setPacketLen response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 8) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifySetPacketLen(buffer, true)) {
-        return -1;
+    for (int i=0; i<cnt; ++i) {
+        DWORD bytesWritten;
+        rs485_waitUntil(s->busIdle);
+        auto start = std::chrono::steady_clock::now();
+        if (!WriteFile(s->serial, frames[i].data, frames[i].len, &bytesWritten, NULL)) {
+            LOG_ERR("cannot send out frame 0x%02X to UART\n", frames[i].data[CMD_CMD_OFFSET]);
+            return i ? i : -1;
+        }
+        if (bytesWritten != frames[i].len) {
+            LOG_ERR("couldn't send enough bytes to UART\n");
+            return i ? i : -1;
+        }
+        if (!rs485_waitTxEmpty(s, bytesWritten, start)) {
+            return i ? i : -1;
+        }
+        s->busIdle = std::chrono::steady_clock::now();
     }
-    return 0;
+    return cnt;
 }
 
-int uart_setApplicationLenCmd(uint8_t addr, uint32_t applicationLen, uint8_t *resp)
+int UartTransport::receive(DfuFrame &frame, DfuDeadline deadline)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    setApplicationLenCmd[CMD_ADR_OFFSET] = addr;
-    setApplicationLenCmd[CMD_DAT_OFFSET] = applicationLen & 0xFF;
-    setApplicationLenCmd[CMD_DAT_OFFSET + 1] = (applicationLen >> 8) & 0xFF;
-    setApplicationLenCmd[CMD_DAT_OFFSET + 2] = (applicationLen >> 16) & 0xFF;
-    setApplicationLenCmd[CMD_DAT_OFFSET + 3] = (applicationLen >> 24) & 0xFF;
-    uint16_t crc = crc16(&setApplicationLenCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    setApplicationLenCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    setApplicationLenCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, setApplicationLenCmd, 11, &bytesWritten, NULL)) {
-        printf_("cannot send out setApplicationLen command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 11) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot get setApplicationLen response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifySetApplicationLen(buffer, true)) {
-        return -1;
+    int len = rs485_readFrame(s, frame.data, DFU_FRAME_MAX_LEN, deadline);
+    s->busIdle = std::chrono::steady_clock::now() + std::chrono::microseconds(rs485_turnaroundUs(s));
+    if (len <= 0) {
+        return len;
     }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET], 4);
-    return 4;
+    frame.id = 0;
+    frame.len = (uint16_t)len;
+    return 1;
 }
 
-int uart_setPacketSeqCmd(uint8_t addr, uint16_t packetSeq, uint8_t *resp)
+void UartTransport::flush(void)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    setPacketSeqCmd[CMD_ADR_OFFSET] = addr;
-    setPacketSeqCmd[CMD_DAT_OFFSET] = packetSeq & 0xFF;
-    setPacketSeqCmd[CMD_DAT_OFFSET + 1] = (packetSeq >> 8) & 0xFF;
-    uint16_t crc = crc16(&setPacketSeqCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    setPacketSeqCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    setPacketSeqCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, setPacketSeqCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out setPacketSeq command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return false;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot get setPacketSeq response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifySetPacketSeq(buffer, true)) {
-        return -1;
-    }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET], 2);
-    return 2;
+    PurgeComm(s->serial, PURGE_RXCLEAR);
 }
 
-int uart_setPacketAddrCmd(uint8_t addr, uint32_t packetAddr, uint8_t *resp)
+DfuTransport *uart_getTransport(UartSession *s)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    setPacketAddrCmd[CMD_ADR_OFFSET] = addr;
-    setPacketAddrCmd[CMD_DAT_OFFSET] = packetAddr & 0xFF;
-    setPacketAddrCmd[CMD_DAT_OFFSET + 1] = (packetAddr >> 8) & 0xFF;
-    setPacketAddrCmd[CMD_DAT_OFFSET + 2] = (packetAddr >> 16) & 0xFF;
-    setPacketAddrCmd[CMD_DAT_OFFSET + 3] = (packetAddr >> 24) & 0xFF;
-    uint16_t crc = crc16(&setPacketAddrCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    setPacketAddrCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    setPacketAddrCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, setPacketAddrCmd, 11, &bytesWritten, NULL)) {
-        printf_("cannot send out setPacketAddr command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 11) {
-        printf_("couldn't send enough bytes to UART\n");
-        return -1;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(12), &bytesRead, NULL)) {
-        printf_("cannot get setPacketAddr response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 12) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifySetPacketSeq(buffer, true)) {
-        return -1;
-    }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET], 4);
-    return 4;
+    return &s->transport;
 }
 
-int uart_sendPacketData(uint16_t packetLen, uint8_t *data)
+int uart_prepareCmd(UartSession *s, uint8_t addr, uint8_t *resp)
 {
-    uint8_t buffer[512];
-    DWORD bytesWritten, bytesRead;
-    if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
-        packetLen != 128 && packetLen != 256 && packetLen != 512) {
-        printf_("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
-		return -1;
-    }
-    buffer[CMD_SOP_OFFSET] = DFU_DAT_SOP;
-    memcpy(buffer + 1, data, packetLen);
-    uint16_t crc = crc16(&buffer[CMD_SOP_OFFSET], packetLen, 0xffff);
-    buffer[CMD_CRC_OFFSET(packetLen)] = crc & 0xFF;
-    buffer[CMD_CRC_OFFSET(packetLen) + 1] = (crc >> 8) & 0xFF;
-    buffer[CMD_EOP_OFFSET(packetLen)] = DFU_CMD_EOP;
-    if (!WriteFile(gSerial, buffer, packetLen + 4, &bytesWritten, NULL)) {
-        printf_("cannot send out sendPacketData command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != packetLen + 4) {
-        printf_("couldn't send enough bytes to UART\n");
-        return -1;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(5));
-#if 0
-    if (!ReadFile(gSerial, buffer, sizeof(8), &bytesRead, NULL)) {
-        printf_("cannot get sendPacketData response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 8) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifySendPacketData(buffer, true)) {
-        return -1;
-    }
-#endif
-    return 0;
+    return s->engine.prepareCmd(addr, resp);
 }
 
-int uart_verifyPacketDataCmd(uint8_t addr, uint16_t packetCrc)
+int uart_getBootloaderVerCmd(UartSession *s, uint8_t addr, uint8_t *resp)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    verifyPacketDataCmd[CMD_ADR_OFFSET] = addr;
-    verifyPacketDataCmd[CMD_DAT_OFFSET] = packetCrc & 0xFF;
-    verifyPacketDataCmd[CMD_DAT_OFFSET + 1] = (packetCrc >> 8) & 0xFF;
-    uint16_t crc = crc16(&verifyPacketDataCmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-    verifyPacketDataCmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-    verifyPacketDataCmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, verifyPacketDataCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out verifyPacketData command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return -1;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(8), &bytesRead, NULL)) {
-        printf_("cannot get verifyPacketData response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 8) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyPacketData(buffer, true)) {
-        return -1;
-    }
-    return 0;
+    return s->engine.getBootloaderVerCmd(addr, resp);
 }
 
-int uart_verifyAllDataCmd(uint8_t addr, uint8_t crcType, uint32_t fileCrc)
+int uart_getBatterySN(UartSession *s, uint8_t addr, uint8_t *resp)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    if (crcType != 0 && crcType != 1) {
-        printf_("crc type should be 0 - crc16 or 1 - crc32\n");
-		return -1;
-    }
-    if (crcType == 0) {
-        verifyAllDataCrc16Cmd[CMD_ADR_OFFSET] = addr;
-        verifyAllDataCrc16Cmd[CMD_DAT_OFFSET + 1] = fileCrc & 0xFF;
-        verifyAllDataCrc16Cmd[CMD_DAT_OFFSET + 2] = (fileCrc >> 8) & 0xFF;
-        uint16_t crc = crc16(&verifyAllDataCrc16Cmd[CMD_LEN_OFFSET], 4+1, 0xffff);
-        verifyAllDataCrc16Cmd[CMD_CRC_OFFSET(4)] = crc & 0xFF;
-        verifyAllDataCrc16Cmd[CMD_CRC_OFFSET(4) + 1] = (crc >> 8) & 0xFF;
-        if (!WriteFile(gSerial, verifyAllDataCrc16Cmd, 10, &bytesWritten, NULL)) {
-            printf_("cannot send out verifyAllDataCrc16 command to UART\n");
-            return -1;
-        }
-        if (bytesWritten != 10) {
-            printf_("couldn't send enough bytes to UART\n");
-            return -1;
-        }
-    } else {
-        verifyAllDataCrc32Cmd[CMD_ADR_OFFSET] = addr;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 1] = fileCrc & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 2] = (fileCrc >> 8) & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 3] = (fileCrc >> 16) & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 4] = (fileCrc >> 24) & 0xFF;
-        uint16_t crc = crc16(&verifyAllDataCrc32Cmd[CMD_LEN_OFFSET], 6+1, 0xffff);
-        verifyAllDataCrc32Cmd[CMD_CRC_OFFSET(6)] = crc & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_CRC_OFFSET(6) + 1] = (crc >> 8) & 0xFF;
-        if (!WriteFile(gSerial, verifyAllDataCrc32Cmd, 12, &bytesWritten, NULL)) {
-            printf_("cannot send out verifyAllDataCrc32 command to UART\n");
-            return -1;
-        }
-        if (bytesWritten != 12) {
-            printf_("couldn't send enough bytes to UART\n");
-            return -1;
-        }
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(8), &bytesRead, NULL)) {
-        printf_("cannot get verify packet data response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 8) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyAllData(buffer, true)) {
-        return -1;
-    }
-    return 0;
+    return s->engine.getBatterySN(addr, resp);
 }
 
-int uart_updateStationCmd(uint8_t addr, bool all)
+int uart_getHardwareInfoCmd(UartSession *s, uint8_t addr, uint8_t *resp)
 {
-    DWORD bytesWritten;
-    if (all) {
-        updateStationCmd[CMD_ADR_OFFSET] = 0x00;
-        updateStationCmd[CMD_DAT_OFFSET] = 0x52;
-    } else {
-        updateStationCmd[CMD_ADR_OFFSET] = addr;
-        updateStationCmd[CMD_DAT_OFFSET] = 0x51;
-    }
-    uint16_t crc = crc16(&updateStationCmd[CMD_LEN_OFFSET], 5+1, 0xffff);
-    updateStationCmd[CMD_CRC_OFFSET(5)] = crc & 0xFF;
-    updateStationCmd[CMD_CRC_OFFSET(5) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, updateStationCmd, 9, &bytesWritten, NULL)) {
-        printf_("cannot send out updateStation command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 9) {
-        printf_("couldn't send enough bytes to UART\n");
-        return -1;
-    }
-    return 0;
+    return s->engine.getHardwareInfoCmd(addr, resp);
 }
 
-int uart_getUpdateStatusCmd(uint8_t addr, uint8_t *resp)
+int uart_getHardwareTypeCmd(UartSession *s, uint8_t addr, uint8_t *resp)
 {
-    uint8_t buffer[16];
-    DWORD bytesWritten, bytesRead;
-    getUpdateStatusCmd[CMD_ADR_OFFSET] = addr;
-    uint16_t crc = crc16(&getUpdateStatusCmd[CMD_LEN_OFFSET], 2+1, 0xffff);
-    getUpdateStatusCmd[CMD_CRC_OFFSET(2)] = crc & 0xFF;
-    getUpdateStatusCmd[CMD_CRC_OFFSET(2) + 1] = (crc >> 8) & 0xFF;
-    if (!WriteFile(gSerial, getUpdateStatusCmd, 7, &bytesWritten, NULL)) {
-        printf_("cannot send out updateStation command to UART\n");
-        return -1;
-    }
-    if (bytesWritten != 7) {
-        printf_("couldn't send enough bytes to UART\n");
-        return -1;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    if (!ReadFile(gSerial, buffer, sizeof(8), &bytesRead, NULL)) {
-        printf_("cannot get verify packet data response from UART\n");
-        return -1;
-    }
-    if (bytesRead != 8) {
-        printf_("don't receive enough bytes from UART\n");
-        return -1;
-    }
-    if (!verifyGetUpdateStatus(buffer, true)) {
-        return -1;
+    return s->engine.getHardwareTypeCmd(addr, resp);
+}
+
+int uart_getApplicationVerCmd(UartSession *s, uint8_t addr, uint8_t *resp)
+{
+    return s->engine.getApplicationVerCmd(addr, resp);
+}
+
+int uart_getPacketLenCmd(UartSession *s, uint8_t addr, uint8_t *resp)
+{
+    return s->engine.getPacketLenCmd(addr, resp);
+}
+
+int uart_setPacketLenCmd(UartSession *s, uint8_t addr, uint16_t packetLen)
+{
+    return s->engine.setPacketLenCmd(addr, packetLen);
+}
+
+int uart_setApplicationLenCmd(UartSession *s, uint8_t addr, uint32_t applicationLen, uint8_t *resp)
+{
+    return s->engine.setApplicationLenCmd(addr, applicationLen, resp);
+}
+
+int uart_setPacketSeqCmd(UartSession *s, uint8_t addr, uint16_t packetSeq, uint8_t *resp)
+{
+    return s->engine.setPacketSeqCmd(addr, packetSeq, resp);
+}
+
+int uart_setPacketAddrCmd(UartSession *s, uint8_t addr, uint32_t packetAddr, uint8_t *resp)
+{
+    return s->engine.setPacketAddrCmd(addr, packetAddr, resp);
+}
+
+int uart_sendPacketData(UartSession *s, uint16_t packetLen, uint8_t *data)
+{
+    return s->engine.sendPacketData(packetLen, data);
+}
+
+int uart_verifyPacketDataCmd(UartSession *s, uint8_t addr, uint16_t packetCrc)
+{
+    return s->engine.verifyPacketDataCmd(addr, packetCrc);
+}
+
+int uart_verifyAllDataCmd(UartSession *s, uint8_t addr, uint8_t crcType, uint32_t fileCrc)
+{
+    return s->engine.verifyAllDataCmd(addr, crcType, fileCrc);
+}
+
+int uart_updateStationCmd(UartSession *s, uint8_t addr, bool all)
+{
+    return s->engine.updateStationCmd(addr, all);
+}
+
+int uart_getUpdateStatusCmd(UartSession *s, uint8_t addr, uint8_t *resp)
+{
+    return s->engine.getUpdateStatusCmd(addr, resp);
+}
+
+//send the same command to every address back to back, each address gets rspLen bytes in resp
+//the slot of a silent address is left with zeros, returns the number of answered addresses
+int uart_queryBus(UartSession *s, uint8_t *cmd, const uint8_t *addrs, int addrCnt, uint8_t *resp, uint16_t rspLen)
+{
+    DfuFrame rsp;
+    int answered = 0;
+    for (int i=0; i<addrCnt; ++i) {
+        uint8_t *slot = resp + i * rspLen;
+        if (s->engine.sendCmd(cmd, addrs[i]) == 0 && s->engine.waitResponse(rsp, RS485_QUERY_TIMEOUT_MS) == 1 &&
+            rsp.len == rspLen && rsp.data[RSP_ADR_OFFSET] == addrs[i]) {
+            memcpy(slot, rsp.data, rspLen);
+            ++answered;
+        } else {
+            memset(slot, 0, rspLen);
+            s->transport.flush();  //drop the late bytes before next address
+        }
     }
-    memcpy(resp, &buffer[RSP_DAT_OFFSET], 3);
-    return 3;
+    return answered;
 }
@@ -1,50 +1,48 @@
 #pragma once
 
 #include <stdint.h>
+#include "transport.h"
+#include "wifi_frame.h"
 
-#define WIFI_SOP 0x5F
-#define WIFI_EOP 0xF5
+#define RS485_BITS_PER_BYTE         10              //8N1
+//upgrade protocol Rev 0.17, 1 communication format: "为防止总线冲突，485主机接收转发送的间隔，需要大于10ms。"
+//(against bus collisions the 485 host must wait more than 10 ms from receiving to sending)
+#define RS485_TURNAROUND_US         10000           //default of a session, uart_setRs485Timing changes it
+#define RS485_TXEMPTY_TIMEOUT_US    50000           //margin over air time before giving up on the driver
+#define RS485_DATA_PROCESS_US       5000            //flash write time of one data packet, not given by the protocol
+#define RS485_QUERY_TIMEOUT_MS      500             //a station that is silent this long is absent
 
-enum Wifi_Command {
-    WIFI_UPGRADE_REQUEST  = 0xC0,
-    WIFI_UPGRADE_LENGTH   = 0xC1,
-    WIFI_UPGRADE_DATA     = 0xC2,
-    WIFI_UPGRADE_COMPLETE = 0xC3,
-    WIFI_UPGRADE_EXECUTE  = 0xC4,
-    WIFI_GET_SN   = 0x42,
-    WIFI_GET_VER  = 0x33,
-    WIFI_SET_TIME = 0xCF,
-    WIFI_GET_PCS  = 0x40,
-    WIFI_GET_DOD  = 0x05,
-    WIFI_GET_DSGC = 0x12,
-    WIFI_GET_CHGT = 0x16,
-    WIFI_GET_DSGT = 0x1C,
-    WIFI_GET_DSGV = 0x2E,
-    WIFI_GET_SOCM = 0x47,
-};
+//one opened COM port, different sessions can be driven from different threads
+typedef struct UartSession UartSession;
 
-__declspec(dllexport) bool uart_connect(const char *port, uint32_t baud_rate);
-__declspec(dllexport) bool uart_disconnect(void);
-__declspec(dllexport) bool uart_changeHostBaud(uint32_t baud_rate);
-__declspec(dllexport) bool uart_requestSlaveBaud(bool to_high);
-__declspec(dllexport) bool uart_requestUpgrade(void);
-__declspec(dllexport) bool uart_sendFrameCount(uint16_t cnt);
-__declspec(dllexport) int uart_sendFrameData(uint16_t seq, uint16_t len, uint8_t *dat);
-__declspec(dllexport) bool uart_requestComplete(void);
+__declspec(dllexport) UartSession *uart_connect(const char *port, uint32_t baud_rate);
+__declspec(dllexport) bool uart_disconnect(UartSession *s);
+__declspec(dllexport) DfuTransport *uart_getTransport(UartSession *s);
+__declspec(dllexport) bool uart_changeHostBaud(UartSession *s, uint32_t baud_rate);
+__declspec(dllexport) bool uart_requestSlaveBaud(UartSession *s, bool to_high);
+__declspec(dllexport) bool uart_setRs485Timing(UartSession *s, uint32_t turnaroundUs, uint32_t dataProcessUs);
+__declspec(dllexport) bool uart_requestUpgrade(UartSession *s);
+__declspec(dllexport) bool uart_sendFrameCount(UartSession *s, uint16_t cnt);
+__declspec(dllexport) int uart_sendFrameData(UartSession *s, uint16_t seq, uint16_t len, uint8_t *dat);
+__declspec(dllexport) bool uart_requestComplete(UartSession *s);
+__declspec(dllexport) int uart_loadFrameImage(UartSession *s, const uint8_t *image, uint32_t len);
+__declspec(dllexport) int uart_loadFrameImageFile(UartSession *s, const char *path);
+__declspec(dllexport) int uart_sendImageFrame(UartSession *s, uint16_t seq);
 
-__declspec(dllexport) int uart_prepareCmd(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_getBootloaderVerCmd(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_getBatterySN(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_getHardwareInfoCmd(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_getHardwareTypeCmd(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_getApplicationVerCmd(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_getPacketLenCmd(uint8_t addr, uint8_t *resp);
-__declspec(dllexport) int uart_setPacketLenCmd(uint8_t addr, uint16_t packetLen);
-__declspec(dllexport) int uart_setApplicationLenCmd(uint8_t addr, uint32_t applicationLen, uint8_t *resp);
-__declspec(dllexport) int uart_setPacketSeqCmd(uint8_t addr, uint16_t packetSeq, uint8_t *resp);
-__declspec(dllexport) int uart_setPacketAddrCmd(uint8_t addr, uint32_t packetAddr, uint8_t *resp);
-__declspec(dllexport) int uart_sendPacketData(uint16_t packetLen, uint8_t *data);
-__declspec(dllexport) int uart_verifyPacketDataCmd(uint8_t addr, uint16_t packetCrc);
-__declspec(dllexport) int uart_verifyAllDataCmd(uint8_t addr, uint8_t crcType, uint32_t fileCrc);
-__declspec(dllexport) int uart_updateStationCmd(bool all);
-__declspec(dllexport) int uart_getUpdateStatusCmd(uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_prepareCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_getBootloaderVerCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_getBatterySN(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_getHardwareInfoCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_getHardwareTypeCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_getApplicationVerCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_getPacketLenCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_setPacketLenCmd(UartSession *s, uint8_t addr, uint16_t packetLen);
+__declspec(dllexport) int uart_setApplicationLenCmd(UartSession *s, uint8_t addr, uint32_t applicationLen, uint8_t *resp);
+__declspec(dllexport) int uart_setPacketSeqCmd(UartSession *s, uint8_t addr, uint16_t packetSeq, uint8_t *resp);
+__declspec(dllexport) int uart_setPacketAddrCmd(UartSession *s, uint8_t addr, uint32_t packetAddr, uint8_t *resp);
+__declspec(dllexport) int uart_sendPacketData(UartSession *s, uint16_t packetLen, uint8_t *data);
+__declspec(dllexport) int uart_verifyPacketDataCmd(UartSession *s, uint8_t addr, uint16_t packetCrc);
+__declspec(dllexport) int uart_verifyAllDataCmd(UartSession *s, uint8_t addr, uint8_t crcType, uint32_t fileCrc);
+__declspec(dllexport) int uart_updateStationCmd(UartSession *s, uint8_t addr, bool all);
+__declspec(dllexport) int uart_getUpdateStatusCmd(UartSession *s, uint8_t addr, uint8_t *resp);
+__declspec(dllexport) int uart_queryBus(UartSession *s, uint8_t *cmd, const uint8_t *addrs, int addrCnt, uint8_t *resp, uint16_t rspLen);
@@ -0,0 +1,89 @@
+//frame coding of the old wifi upgrade protocol, kept apart from the serial port so it runs anywhere
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include "wifi_frame.h"
+#include "dfu_log.h"
+
+uint8_t wifi_checksum(const uint8_t *buffer, int len)
+{
+    uint8_t sum = 0;
+    for (int i=0; i<len; ++i) {
+        sum += buffer[i];
+    }
+    sum = (~sum + 1) & 0xFF;
+    return sum;
+}
+
+//sum of all the bytes in one frame, 8 bytes per step with 16-bit lanes
+//len <= 0x200 so that lanes never overflow
+static uint8_t wifi_frameSum(const uint8_t *buffer, uint32_t len)
+{
+    uint64_t lanes = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, buffer + i, 8);
+        lanes += (w & 0x00FF00FF00FF00FFULL) + ((w >> 8) & 0x00FF00FF00FF00FFULL);
+    }
+    lanes += lanes >> 32;
+    lanes += lanes >> 16;
+    uint8_t sum = (uint8_t)lanes;
+    for (; i < len; ++i) {
+        sum += buffer[i];
+    }
+    return sum;
+}
+
+void wifi_encodeFrameData(uint8_t *frame, uint16_t seq, uint16_t len, const uint8_t *dat)
+{
+    frame[0] = WIFI_SOP;
+    frame[1] = WIFI_UPGRADE_DATA;
+    frame[2] = seq >> 8;   //msb
+    frame[3] = seq & 0xFF; //lsb
+    memcpy(frame + WIFI_FRAME_HDR_LEN, dat, len);
+    if (len < WIFI_FRAME_LEN) {
+        memset(frame + WIFI_FRAME_HDR_LEN + len, 0x00, WIFI_FRAME_LEN - len);
+    }
+    frame[WIFI_FRAME_HDR_LEN + WIFI_FRAME_LEN] = wifi_checksum(frame + WIFI_FRAME_HDR_LEN, WIFI_FRAME_LEN);
+    frame[WIFI_FRAME_HDR_LEN + WIFI_FRAME_LEN + 1] = WIFI_EOP;
+}
+
+int wifi_frameChecksums(std::vector<uint8_t> &sums, const uint8_t *image, uint32_t len)
+{
+    int cnt = (len + WIFI_FRAME_LEN - 1) / WIFI_FRAME_LEN;
+    if (image == NULL || cnt == 0 || cnt > 0xFFFF) {
+        LOG_ERR("frame image should have 1 ~ 65535 frames\n");
+        return -1;
+    }
+    sums.resize(cnt);
+    for (int i=0; i<cnt; ++i) {
+        uint32_t offset = i * WIFI_FRAME_LEN;
+        uint32_t size = (len - offset < WIFI_FRAME_LEN) ? len - offset : WIFI_FRAME_LEN;
+        uint8_t sum = wifi_frameSum(image + offset, size) + (uint8_t)(0xFF * (WIFI_FRAME_LEN - size));
+        sums[i] = (~sum + 1) & 0xFF;
+    }
+    return cnt;
+}
+
+void wifi_initFrame(uint8_t *frame)
+{
+    frame[0] = WIFI_SOP;
+    frame[1] = WIFI_UPGRADE_DATA;
+    frame[WIFI_FRAME_SIZE - 1] = WIFI_EOP;
+}
+
+//seq starts from 1, the last frame is padded with 0xFF like the image
+void wifi_stageFrame(uint8_t *frame, uint16_t seq, const uint8_t *image, uint32_t len, uint8_t checksum)
+{
+    uint32_t offset = (seq - 1) * WIFI_FRAME_LEN;
+    uint32_t size = (len - offset < WIFI_FRAME_LEN) ? len - offset : WIFI_FRAME_LEN;
+    frame[2] = seq >> 8;   //msb
+    frame[3] = seq & 0xFF; //lsb
+    memcpy(frame + WIFI_FRAME_HDR_LEN, image + offset, size);
+    if (size < WIFI_FRAME_LEN) {
+        memset(frame + WIFI_FRAME_HDR_LEN + size, 0xFF, WIFI_FRAME_LEN - size);
+    }
+    frame[WIFI_FRAME_HDR_LEN + WIFI_FRAME_LEN] = checksum;
+}
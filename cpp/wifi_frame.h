@@ -0,0 +1,49 @@
+#pragma once
+
+//frame coding of the old wifi upgrade protocol, kept apart from the serial port so it runs anywhere
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <vector>
+
+#define WIFI_SOP 0x5F
+#define WIFI_EOP 0xF5
+
+enum Wifi_Command {
+    WIFI_UPGRADE_REQUEST  = 0xC0,
+    WIFI_UPGRADE_LENGTH   = 0xC1,
+    WIFI_UPGRADE_DATA     = 0xC2,
+    WIFI_UPGRADE_COMPLETE = 0xC3,
+    WIFI_UPGRADE_EXECUTE  = 0xC4,
+    WIFI_GET_SN   = 0x42,
+    WIFI_GET_VER  = 0x33,
+    WIFI_SET_TIME = 0xCF,
+    WIFI_GET_PCS  = 0x40,
+    WIFI_GET_DOD  = 0x05,
+    WIFI_GET_DSGC = 0x12,
+    WIFI_GET_CHGT = 0x16,
+    WIFI_GET_DSGT = 0x1C,
+    WIFI_GET_DSGV = 0x2E,
+    WIFI_GET_SOCM = 0x47,
+};
+
+#define WIFI_FRAME_LEN      0x200   //every data frame carries 512 bytes
+#define WIFI_FRAME_HDR_LEN  4       //SOP, command, seq msb, seq lsb
+#define WIFI_FRAME_TRL_LEN  2       //checksum, EOP
+#define WIFI_FRAME_SIZE     (WIFI_FRAME_HDR_LEN + WIFI_FRAME_LEN + WIFI_FRAME_TRL_LEN)
+
+//two's complement of the byte sum, a frame with its checksum adds up to 0
+uint8_t wifi_checksum(const uint8_t *buffer, int len);
+
+//a whole data frame in the layout of uart_sendFrameData, len <= 0x200 and the rest is 0x00
+void wifi_encodeFrameData(uint8_t *frame, uint16_t seq, uint16_t len, const uint8_t *dat);
+
+//checksum of every frame of image in one pass, the last frame counts as padded with 0xFF.
+//returns the frame count, -1 when image does not make 1 ~ 65535 frames
+int wifi_frameChecksums(std::vector<uint8_t> &sums, const uint8_t *image, uint32_t len);
+
+//only writes what differs between frames into a WIFI_FRAME_SIZE staging buffer.
+//SOP, command and EOP are set once by wifi_initFrame
+void wifi_initFrame(uint8_t *frame);
+void wifi_stageFrame(uint8_t *frame, uint16_t seq, const uint8_t *image, uint32_t len, uint8_t checksum);
@@ -12,7 +12,8 @@
 #include "zlgcan.h"
 #include "dfu_common.h"
 #include "dfu_can.h"
-#include "printf.h"
+#include "dfu_engine.h"
+#include "dfu_log.h"
 
 //global variable
 static DEVICE_HANDLE dev = NULL;
@@ -33,6 +34,8 @@ static can_getValue ZCAN_GetValue = NULL;
 static can_getIProperty GetIProperty = NULL;
 static can_geleaseIProperty ReleaseIProperty = NULL;
 static SPSCQueue que;
+static std::thread rxThread;    //only started by can_createTransport
+static volatile int rxRunning = 0;
 
 const static int speed_option[] = {
     10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000,  
@@ -61,82 +64,89 @@ static bool SPSCQueuePop(can_frame &item)
     return true;
 }
 
-static ZCAN_Transmit_Data can_constructFrame(uint8_t len, uint8_t *data)
+ZlgTransport::ZlgTransport()
 {
-    ZCAN_Transmit_Data can_data;
-	memset(&can_data, 0, sizeof(can_data));
-	can_data.frame.can_id = MAKE_CAN_ID(CAN_CMD_ID, 0, 0, 0);   //standard frame, data frame
-	can_data.frame.can_dlc = 8; //always 8 bytes
-	can_data.transmit_type = TRANSMIT_NORMAL;
-	for (int i=0; i<len; ++i) {
-		can_data.frame.data[i] = data[i];
-	}
-    for (int i=len; i<8; ++i) {
-        can_data.frame.data[i] = 0x00;  //padding with 0x00
-    }
-    return can_data;
+    c.link = DFU_LINK_CAN;
+    c.maxPayload = 8;
+    c.maxBatch = DFU_MAX_BATCH;
+    c.dataGapUs = CAN_DATA_GAP_US;
 }
 
-static bool can_waitResponse(can_frame &item, uint32_t expected_id, int seconds) 
+int ZlgTransport::send(const DfuFrame *frames, int cnt)
 {
-    auto start = std::chrono::high_resolution_clock::now();
-    auto deadline = start + std::chrono::milliseconds(seconds * 1000);
-    while (std::chrono::high_resolution_clock::now() < deadline) {
+    ZCAN_Transmit_Data can_data[DFU_MAX_BATCH];
+    cnt = cnt > DFU_MAX_BATCH ? DFU_MAX_BATCH : cnt;
+    memset(can_data, 0, sizeof(ZCAN_Transmit_Data) * cnt);
+    for (int i=0; i<cnt; ++i) {
+        can_data[i].frame.can_id = MAKE_CAN_ID(frames[i].id, 0, 0, 0);   //standard frame, data frame
+        can_data[i].frame.can_dlc = (uint8_t)frames[i].len;
+        can_data[i].transmit_type = TRANSMIT_NORMAL;
+        memcpy(can_data[i].frame.data, frames[i].data, frames[i].len);
+    }
+    return (int)ZCAN_Transmit(chn, can_data, cnt);
+}
+
+int ZlgTransport::receive(DfuFrame &frame, DfuDeadline deadline)
+{
+    can_frame item;
+    while (true) {
         if (SPSCQueuePop(item)) {
-            if (item.can_id == expected_id) {
-                return true;
-            }
-        } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            frame.id = GET_ID(item.can_id);
+            frame.len = item.can_dlc;
+            memcpy(frame.data, item.data, 8);
+            return 1;
         }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return 0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void ZlgTransport::flush(void)
+{
+    can_frame item;
+    while (SPSCQueuePop(item)) {
     }
-    return false;
 }
 
+static ZlgTransport *transport = NULL;
+static DfuEngineT<ZlgTransport> *engine = NULL;
+
 void can_rx_thread(volatile int *running)
 {
+    ZCAN_Receive_Data response_data[DFU_MAX_BATCH];
     while (*running) {
         int num = ZCAN_GetReceiveNum(chn, 0);   //0 - CAN, 1 - CANFD
         if (num != 0) {
-            ZCAN_Receive_Data response_data;
-            if (ZCAN_Receive(chn, &response_data, 1, -1) != 1) {
-                printf_("CAN : receive packet timeout\n");
-            } else {
-#if 0
-                printf_("new packet with can id: %d, data ", response_data.frame.can_id);
-                for (int i=0; i<response_data.frame.can_id; ++i) {
-                    printf_("%02X ", response_data.frame.data[i]);
-                }
-                printf_("\n");
-#endif
-                while (!SPSCQueuePush(response_data.frame)) {
+            num = num > DFU_MAX_BATCH ? DFU_MAX_BATCH : num;
+            int got = ZCAN_Receive(chn, response_data, num, -1);
+            if (got <= 0) {
+                LOG_WARN("CAN : receive packet timeout\n");
+                continue;
+            }
+            for (int i=0; i<got; ++i) {
+                while (!SPSCQueuePush(response_data[i].frame)) {
                     std::this_thread::yield();
-                    printf_("CAN RX FIFO full\n");
+                    LOG_WARN("CAN RX FIFO full\n");
                 }
             }
-            break;
         } else {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
     }
 }
 
-bool can_connect(int can_chan, int can_speed)
+//the vendor dll is resolved once per process, reconnects reuse it
+static bool can_loadLibrary(void)
 {
-    char path[16];
-    char speed[16];
-
-    if (can_chan != 0 && can_chan != 1) {
-        printf_("ZLG USBCAN channel should be 0 or 1\n");
-        return false;
-    }
-    if (!std::binary_search(speed_option, speed_option + sizeof(speed_option)/sizeof(int), can_speed)) {
-        printf_("ZLG USBCAN speed doesn't support %d\n", can_speed);
+    static HINSTANCE handle = NULL;
+    if (handle != NULL) {
+        return true;
     }
-    //load library 
-    HINSTANCE handle = LoadLibraryA("zlgcan.dll");
+    handle = LoadLibraryA("zlgcan.dll");
     if (handle == NULL) {
-        printf_("could not load zlgcan.dll\n");
+        LOG_ERR("could not load zlgcan.dll\n");
         return false;
     }
     ZCAN_OpenDevice = (can_openDevice)GetProcAddress(handle, "ZCAN_OpenDevice");
@@ -154,11 +164,29 @@ bool can_connect(int can_chan, int can_speed)
     ZCAN_GetValue = (can_getValue)GetProcAddress(handle, "ZCAN_GetValue");
     GetIProperty = (can_getIProperty)GetProcAddress(handle, "GetIProperty");
     ReleaseIProperty = (can_geleaseIProperty)GetProcAddress(handle, "ReleaseIProperty");
+    return true;
+}
+
+bool can_connect(int can_chan, int can_speed)
+{
+    char path[16];
+    char speed[16];
+
+    if (can_chan != 0 && can_chan != 1) {
+        LOG_ERR("ZLG USBCAN channel should be 0 or 1\n");
+        return false;
+    }
+    if (!std::binary_search(speed_option, speed_option + sizeof(speed_option)/sizeof(int), can_speed)) {
+        LOG_ERR("ZLG USBCAN speed doesn't support %d\n", can_speed);
+    }
+    if (!can_loadLibrary()) {
+        return false;
+    }
 
 	ZCAN_CHANNEL_INIT_CONFIG config;
 	dev = ZCAN_OpenDevice(ZCAN_USBCAN2, 0, 0);
 	if (dev == INVALID_DEVICE_HANDLE) {
-		printf_("could not open ZLG USBCAN\n");
+		LOG_ERR("could not open ZLG USBCAN\n");
 		return false;
 	}
 	sprintf_(path, "%d/baud_rate", can_chan);
@@ -171,38 +199,59 @@ bool can_connect(int can_chan, int can_speed)
 	config.can.acc_mask = 0xFFFFFFFF;
 	chn = ZCAN_InitCAN(dev, can_chan, &config);
 	if (chn == INVALID_CHANNEL_HANDLE) {
-        printf_("could not init CAN channel %d\n", can_chan);
+        LOG_ERR("could not init CAN channel %d\n", can_chan);
 		return false;
 	}
 	if (ZCAN_StartCAN(chn) != STATUS_OK) {
-        printf_("could not start CAN channel %d\n", can_chan);
+        LOG_ERR("could not start CAN channel %d\n", can_chan);
 		return false;
 	}
     que.head = 0;
     que.tail = 0;
+    transport = new ZlgTransport();
+    engine = new DfuEngineT<ZlgTransport>(*transport);
     return true;
 }
 
 bool can_disconnect(void)
 {
+    rxRunning = 0;
+    if (rxThread.joinable()) {
+        rxThread.join();
+    }
+    delete engine;
+    delete transport;
+    engine = NULL;
+    transport = NULL;
 	if (ZCAN_ResetCAN(chn) != STATUS_OK) {
-        printf_("could not reset CAN channel\n");
+        LOG_ERR("could not reset CAN channel\n");
 		return false;
     }
 	if (ZCAN_CloseDevice(dev) != STATUS_OK) {
-        printf_("could not close CAN device\n");
+        LOG_ERR("could not close CAN device\n");
 		return false;
     }
     return true;
 }
 
+//the returned transport has its own receiving thread, it is released by can_disconnect
+DfuTransport *can_createTransport(int can_chan, int can_speed)
+{
+    if (!can_connect(can_chan, can_speed)) {
+        return NULL;
+    }
+    rxRunning = 1;
+    rxThread = std::thread(can_rx_thread, &rxRunning);
+    return transport;
+}
+
 bool can_getDeviceInfo(char *sn)
 {
     ZCAN_DEVICE_INFO info;
     if (ZCAN_GetDeviceInf(dev, &info) != STATUS_OK) {
         return false;
     }
-    printf_("USBCAN HW version is %04X, FW version is %04X, Driver Version is %04X, API version is %04X\n", 
+    LOG_INFO("USBCAN HW version is %04X, FW version is %04X, Driver Version is %04X, API version is %04X\n", 
         info.hw_Version, info.fw_Version, info.dr_Version, info.in_Version);
     strcpy(sn, info.str_Serial_Num);
     return true;
@@ -210,411 +259,80 @@ bool can_getDeviceInfo(char *sn)
 
 int can_prepareCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    prepareCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, prepareCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send prepare command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyPrepare(frame.data, false)) {
-        return -1;
-    }
-    resp[0] = frame.data[5];    //get the cell num
-    return 1;
+    return engine->prepareCmd(addr, resp);
 }
 
 int can_getBootloaderVerCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getBootloaderVerCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, getBootloaderVerCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getBootloaderVer command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetBootloaderVer(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET - 1], 5);
-    return 5;
+    return engine->getBootloaderVerCmd(addr, resp);
 }
 
 int can_getBatterySN(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getBatterySNCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, getBatterySNCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getBatterySN command failed\n");
-		return -1;
-    }
-    int seq = 1;
-    int idx = 0;
-    while (true) {
-        if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-            break;  //no remainging packet
-        }
-        uint8_t *p = frame.data;
-        if (p[RSP_STA_OFFSET - 1] != DFU_GET_HWINFO + 0x40) {
-            printf_("getBatterySN response error: command received %d, expected 0x61\n", p[RSP_STA_OFFSET - 1]);
-            return -1;
-        }
-        if (p[RSP_DAT_OFFSET - 1] != seq) {
-            printf_("getBatterySN response error: seq received %d, expected %d\n", p[RSP_DAT_OFFSET - 1], seq);
-            return -1;
-        }
-        int len = p[RSP_LEN_OFFSET - 1] - 3;
-        memcpy(resp + idx, &p[RSP_DAT_OFFSET], len);
-        idx += len;
-        ++seq;
-    }
-    return idx;
+    return engine->getBatterySN(addr, resp);
 }
 
 int can_getHardwareInfoCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getHardwareInfoCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, getHardwareInfoCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getHardwareInfo command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetHardwareInfo(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET-1], 5);
-    return 5;
+    return engine->getHardwareInfoCmd(addr, resp);
 }
 
 int can_getHardwareTypeCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getHardwareTypeCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, getHardwareTypeCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getHardwareType command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetHardwareType(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET-1], 5);
-    return 5;
+    return engine->getHardwareTypeCmd(addr, resp);
 }
 
 int can_getApplicationVerCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getApplicationVerCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, getApplicationVerCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getApplicationVer command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetApplicationVer(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET-1], 5);
-    return 5;
+    return engine->getApplicationVerCmd(addr, resp);
 }
 
 int can_getPacketLenCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getPacketLenCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, getPacketLenCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getPacketLen command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetPacketLen(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET-1], 4);
-    return 4;
+    return engine->getPacketLenCmd(addr, resp);
 }
 
 int can_setPacketLenCmd(uint8_t addr, uint16_t packetLen)
 {
-    can_frame frame;
-    if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
-        packetLen != 128 && packetLen != 256 && packetLen != 512) {
-        printf_("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
-		return -1;
-    }
-    setPacketLenCmd[CMD_ADR_OFFSET] = addr;
-    setPacketLenCmd[CMD_DAT_OFFSET] = packetLen & 0xFF;
-    setPacketLenCmd[CMD_DAT_OFFSET + 1] = (packetLen >> 8) & 0xFF;
-    setPacketLenCmd[CMD_DAT_OFFSET + 2] = 0x00;
-    setPacketLenCmd[CMD_DAT_OFFSET + 3] = 0x00;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(6 + 1, setPacketLenCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send setPacketLen command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifySetPacketLen(frame.data, false)) {
-        return -1;
-    }
-    return 0;
+    return engine->setPacketLenCmd(addr, packetLen);
 }
 
 int can_setApplicationLenCmd(uint8_t addr, uint32_t applicationLen, uint8_t *resp)
 {
-    can_frame frame;
-    setApplicationLenCmd[CMD_ADR_OFFSET] = addr;
-    setApplicationLenCmd[CMD_DAT_OFFSET] = applicationLen & 0xFF;
-    setApplicationLenCmd[CMD_DAT_OFFSET + 1] = (applicationLen >> 8) & 0xFF;
-    setApplicationLenCmd[CMD_DAT_OFFSET + 2] = (applicationLen >> 16) & 0xFF;
-    setApplicationLenCmd[CMD_DAT_OFFSET + 3] = (applicationLen >> 24) & 0xFF;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(6 + 1, setApplicationLenCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getApplicationLen command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifySetApplicationLen(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET], 4);
-    return 4;
+    return engine->setApplicationLenCmd(addr, applicationLen, resp);
 }
 
 int can_setPacketSeqCmd(uint8_t addr, uint16_t packetSeq, uint8_t *resp)
 {
-    can_frame frame;
-    setPacketSeqCmd[CMD_ADR_OFFSET] = addr;
-    setPacketSeqCmd[CMD_DAT_OFFSET] = packetSeq & 0xFF;
-    setPacketSeqCmd[CMD_DAT_OFFSET + 1] = (packetSeq >> 8) & 0xFF;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, setPacketSeqCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send setPacketSeq command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifySetPacketSeq(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET], 2);
-    return 2;
+    return engine->setPacketSeqCmd(addr, packetSeq, resp);
 }
 
 int can_setPacketAddrCmd(uint8_t addr, uint32_t packetAddr, uint8_t *resp)
 {
-    can_frame frame;
-    setPacketAddrCmd[CMD_ADR_OFFSET] = addr;
-    setPacketAddrCmd[CMD_DAT_OFFSET] = packetAddr & 0xFF;
-    setPacketAddrCmd[CMD_DAT_OFFSET + 1] = (packetAddr >> 8) & 0xFF;
-    setPacketAddrCmd[CMD_DAT_OFFSET + 2] = (packetAddr >> 16) & 0xFF;
-    setPacketAddrCmd[CMD_DAT_OFFSET + 3] = (packetAddr >> 24) & 0xFF;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(6 + 1, setPacketAddrCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send setPacketAddr command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifySetPacketAddr(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET], 4);
-    return 4;
+    return engine->setPacketAddrCmd(addr, packetAddr, resp);
 }
 
 int can_sendPacketData(uint16_t packetLen, uint8_t *data)
 {
-    if (packetLen != 8 && packetLen != 16 && packetLen != 32 && packetLen != 64 &&
-        packetLen != 128 && packetLen != 256 && packetLen != 512) {
-        printf_("packetLen should be 8, 16, 32, 64, 128, 256, 512\n");
-		return -1;
-    }
-    int offset = 0;
-    ZCAN_Transmit_Data can_data;
-	can_data.frame.can_id = MAKE_CAN_ID(CAN_DAT_ID, 0, 0, 0);   //standard frame, data frame
-	can_data.frame.can_dlc = 8; //always 8 bytes
-	can_data.transmit_type = TRANSMIT_NORMAL;
-    while (offset < packetLen) {
-        for (int i = 0; i < 8; ++i) {
-            can_data.frame.data[i] = data[i + offset];
-        }
-        if (ZCAN_Transmit(chn, &can_data, 1) != 1) {
-            printf_("send packet data command failed\n");
-            return -1;
-        }
-        offset += 8;
-#if 1
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));   //5 ms for FW to process the data
-#else
-        can_frame frame;
-        if (!can_waitResponse(frame, CAN_DAT_ID, 3)) {
-            printf_("wait CAN response timeout\n");
-            return -1;
-        }
-        if (!verifySendPacketData(frame.data, false)) {
-            return -1;
-        }
-#endif
-    }
-    return 0;
+    return engine->sendPacketData(packetLen, data);
 }
 
 int can_verifyPacketDataCmd(uint8_t addr, uint16_t packetCrc)
 {
-    can_frame frame;
-    verifyPacketDataCmd[CMD_ADR_OFFSET] = addr;
-    verifyPacketDataCmd[CMD_DAT_OFFSET] = packetCrc & 0xFF;
-    verifyPacketDataCmd[CMD_DAT_OFFSET + 1] = (packetCrc >> 8) & 0xFF;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, verifyPacketDataCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send verifyPacketData command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 5)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyPacketData(frame.data, false)) {
-        return -1;
-    }
-    return 0;
+    return engine->verifyPacketDataCmd(addr, packetCrc);
 }
 
 int can_verifyAllDataCmd(uint8_t addr, uint8_t crcType, uint32_t fileCrc)
 {
-    can_frame frame;
-    if (crcType != 0 && crcType != 1) {
-        printf_("crc type should be 0 - crc16 or 1 - crc32\n");
-		return -1;
-    }
-    ZCAN_Transmit_Data can_cmd;
-    if (crcType == 0) {
-        verifyAllDataCrc16Cmd[CMD_ADR_OFFSET] = addr;
-        verifyAllDataCrc16Cmd[CMD_DAT_OFFSET + 1] = fileCrc & 0xFF;
-        verifyAllDataCrc16Cmd[CMD_DAT_OFFSET + 2] = (fileCrc >> 8) & 0xFF;
-        can_cmd = can_constructFrame(5 + 1, verifyAllDataCrc16Cmd + CMD_LEN_OFFSET);
-    } else {
-        verifyAllDataCrc32Cmd[CMD_ADR_OFFSET] = addr;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 1] = fileCrc & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 2] = (fileCrc >> 8) & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 3] = (fileCrc >> 16) & 0xFF;
-        verifyAllDataCrc32Cmd[CMD_DAT_OFFSET + 4] = (fileCrc >> 24) & 0xFF;
-        can_cmd = can_constructFrame(7 + 1, verifyAllDataCrc32Cmd + CMD_LEN_OFFSET);
-    }
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send verifyAllData command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 10)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyAllData(frame.data, false)) {
-        return -1;
-    }
-    return 0;
+    return engine->verifyAllDataCmd(addr, crcType, fileCrc);
 }
 
 int can_updateStationCmd(uint8_t addr, bool all)
 {
-    if (all) {
-        updateStationCmd[CMD_ADR_OFFSET] = 0x00;
-        updateStationCmd[CMD_DAT_OFFSET] = 0x52;
-    } else {
-        updateStationCmd[CMD_ADR_OFFSET] = addr;
-        updateStationCmd[CMD_DAT_OFFSET] = 0x51;
-    }
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(4 + 1, updateStationCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send verifyAllData command failed\n");
-		return -1;
-    }
-    return 0;
+    return engine->updateStationCmd(addr, all);
 }
 
 int can_getUpdateStatusCmd(uint8_t addr, uint8_t *resp)
 {
-    can_frame frame;
-    getUpdateStatusCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(2 + 1, getUpdateStatusCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getUpdateStatus command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetUpdateStatus(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET], 3);
-    return 3;
+    return engine->getUpdateStatusCmd(addr, resp);
 }
-
-//application only 
-int can_getUpdateStatusCmd(uint8_t addr, uint8_t *resp)
-{
-    can_frame frame;
-    getUpdateStatusCmd[CMD_ADR_OFFSET] = addr;
-    ZCAN_Transmit_Data can_cmd = can_constructFrame(2 + 1, getUpdateStatusCmd + CMD_LEN_OFFSET);
-    if (ZCAN_Transmit(chn, &can_cmd, 1) != 1) {
-        printf_("send getUpdateStatus command failed\n");
-		return -1;
-    }
-    if (!can_waitResponse(frame, CAN_RSP_ID, 3)) {
-        printf_("wait CAN response timeout\n");
-        return -1;
-    }
-    if (!verifyGetUpdateStatus(frame.data, false)) {
-        return -1;
-    }
-    uint8_t *p = frame.data;
-    memcpy(resp, &p[RSP_DAT_OFFSET], 3);
-    return 3;
-}
\ No newline at end of file
@@ -5,6 +5,7 @@
 //Date : Dec 02, 2026
 
 #include <stdint.h>
+#include "transport.h"
 #include <atomic>
 
 //constants
@@ -178,3 +179,16 @@ typedef uint32_t (__stdcall *can_setValue)(DEVICE_HANDLE device_handle, char con
 typedef void const *(__stdcall *can_getValue)(DEVICE_HANDLE device_handle, char const *path);
 typedef IProperty *(__stdcall *can_getIProperty)(DEVICE_HANDLE device_handle);
 typedef uint32_t (__stdcall *can_geleaseIProperty)(IProperty *pIProperty);
+
+//frames go straight to ZCAN_Transmit, responses come from the queue filled by can_rx_thread
+class ZlgTransport final : public DfuTransport {
+public:
+    ZlgTransport();
+    const DfuTransportCaps &caps(void) const override { return c; }
+    int send(const DfuFrame *frames, int cnt) override;
+    int receive(DfuFrame &frame, DfuDeadline deadline) override;
+    void flush(void) override;
+
+private:
+    DfuTransportCaps c;
+};
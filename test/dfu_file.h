@@ -0,0 +1,54 @@
+#pragma once
+
+//.dfu containers for the test cases, laid out as dfu_parseContainer reads them
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdint.h>
+#include <vector>
+#include "dfu_container.h"
+
+#define TEST_DFU_LOAD       0x08004000U
+
+inline void test_dfuWr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+//payload crc32 and header crc16 again, after a field was changed
+inline void test_dfuSeal(std::vector<uint8_t> &file)
+{
+    test_dfuWr32(file.data() + DFU_HDR_CRC32_OFFSET, crc32(file.data() + DFU_PAYLOAD_OFFSET,
+        (uint32_t)file.size() - DFU_PAYLOAD_OFFSET, 0));
+    uint16_t crc = crc16(file.data(), DFU_HDR_CRC16_OFFSET, 0xFFFF);
+    file[DFU_HDR_CRC16_OFFSET] = crc >> 8;
+    file[DFU_HDR_CRC16_OFFSET + 1] = crc & 0xFF;
+}
+
+//one section over the whole payload at TEST_DFU_LOAD, version 1.2.3.4, the signature area is zero
+inline std::vector<uint8_t> test_dfuFile(uint32_t payloadLen, uint8_t salt)
+{
+    std::vector<uint8_t> file(DFU_PAYLOAD_OFFSET + payloadLen, 0x00);
+    uint8_t *h = file.data();
+    test_dfuWr32(h + DFU_HDR_FORMAT_OFFSET, 1);
+    test_dfuWr32(h + DFU_HDR_SECTIONS_OFFSET, 1);
+    test_dfuWr32(h + DFU_HDR_HWINFO_OFFSET, 0x04030201);
+    test_dfuWr32(h + DFU_HDR_LOAD_OFFSET, TEST_DFU_LOAD);
+    test_dfuWr32(h + DFU_HDR_SIZE_OFFSET, payloadLen);
+    test_dfuWr32(h + DFU_HDR_ENTRY_OFFSET, TEST_DFU_LOAD + 0x100);
+    h[DFU_HDR_VERSION_OFFSET] = 1;
+    h[DFU_HDR_VERSION_OFFSET + 1] = 2;
+    h[DFU_HDR_VERSION_OFFSET + 2] = 3;
+    h[DFU_HDR_VERSION_OFFSET + 3] = 4;
+    test_dfuWr32(h + DFU_HDR_TABLE_OFFSET, TEST_DFU_LOAD);
+    test_dfuWr32(h + DFU_HDR_TABLE_OFFSET + 4, payloadLen);
+    test_dfuWr32(h + DFU_HDR_TABLE_OFFSET + 8, 0);
+    for (uint32_t i=0; i<payloadLen; ++i) {
+        file[DFU_PAYLOAD_OFFSET + i] = (uint8_t)(i * 29 + salt + (i >> 8));
+    }
+    test_dfuSeal(file);
+    return file;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+//minimal test registry, every test_*.cpp adds its cases and main_test.cpp runs them
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+
+typedef void (*TestFn)(void);
+
+struct TestCase {
+    const char *name;
+    TestFn fn;
+    TestCase(const char *caseName, TestFn caseFn);
+};
+
+//failed checks of the case running
+extern int test_failures;
+
+#define TEST(name) \
+    static void name(void); \
+    static TestCase name##_case(#name, name); \
+    static void name(void)
+
+//a failed check is reported and the case goes on
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long a_ = (long long)(a); \
+        long long b_ = (long long)(b); \
+        if (a_ != b_) { \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+            ++test_failures; \
+        } \
+    } while (0)
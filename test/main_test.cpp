@@ -0,0 +1,47 @@
+//runs the test cases against the bootloader simulator, an argument runs only the cases it is part of
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "printf.h"
+
+int test_failures = 0;
+
+static std::vector<TestCase *> &test_cases(void)
+{
+    static std::vector<TestCase *> cases;
+    return cases;
+}
+
+TestCase::TestCase(const char *caseName, TestFn caseFn)
+    : name(caseName), fn(caseFn)
+{
+    test_cases().push_back(this);
+}
+
+inline void puts_(const char *buf, size_t len, void *ctx)
+{
+    fwrite(buf, 1, len, (FILE *)ctx);
+}
+
+int main(int argc, char **argv)
+{
+    register_internal_sink(puts_, stdout);
+    int run = 0;
+    int failed = 0;
+    for (TestCase *c : test_cases()) {
+        if (argc > 1 && strstr(c->name, argv[1]) == NULL) {
+            continue;
+        }
+        test_failures = 0;
+        c->fn();
+        ++run;
+        failed += test_failures != 0;
+        printf("%-40s %s\n", c->name, test_failures == 0 ? "ok" : "FAILED");
+    }
+    printf("%d cases, %d failed\n", run, failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+//cell stats kernels against the scalar loop, and the anomaly checks of a round
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "bms_analytics.h"
+#include "dfu_sim.h"
+
+static uint32_t lcg = 1;
+
+//cells around 3300 mV, now and then a wide one so min and max move around
+static uint16_t cell_mv(void)
+{
+    lcg = lcg * 1103515245 + 12345;
+    uint32_t r = lcg >> 16;
+    return (uint16_t)((r & 0x0F) == 0 ? 2500 + r % 1500 : 3280 + r % 40);
+}
+
+static void check_same(const BmsCellStats &a, const BmsCellStats &b)
+{
+    CHECK_EQ(a.min, b.min);
+    CHECK_EQ(a.max, b.max);
+    CHECK_EQ(a.minCell, b.minCell);
+    CHECK_EQ(a.maxCell, b.maxCell);
+    CHECK_EQ(a.delta, b.delta);
+    CHECK(a.mean == b.mean);        //the sums are integers, both finish them the same way
+    CHECK(a.stddev == b.stddev);
+}
+
+TEST(cell_stats_kernels_match_scalar)
+{
+    const uint8_t packs[] = { 1, 7, 8, 9, 15, 16, 17, 31, 33, 48, 63, 64 };
+    const uint8_t cells[] = { 1, 2, 15, 16, 32 };
+    int kernels = 0;
+    for (const char *name : { "sse2", "avx2" }) {
+        BmsCellStats probe;
+        uint16_t one = 3300;
+        if (!bms_cellStatsUsing(name, &one, 1, 1, 1, &probe)) {
+            printf("no %s on this cpu\n", name);
+            continue;
+        }
+        ++kernels;
+        for (uint8_t p : packs) {
+            for (uint8_t c : cells) {
+                //a stride of packCnt leaves no padding lanes, the tail must not read past the row
+                for (uint32_t stride : { (uint32_t)p, (uint32_t)BMS_PACK_STRIDE }) {
+                    std::vector<uint16_t> volt(stride * c);
+                    for (uint16_t &v : volt) {
+                        v = cell_mv();
+                    }
+                    if (p > 2) {
+                        volt[c / 2 * stride + 2] = volt[2];   //equal readings keep the first cell
+                    }
+                    std::vector<BmsCellStats> ref(p), got(p);
+                    CHECK(bms_cellStatsUsing("scalar", volt.data(), stride, p, c, ref.data()));
+                    CHECK(bms_cellStatsUsing(name, volt.data(), stride, p, c, got.data()));
+                    for (uint8_t k=0; k<p; ++k) {
+                        check_same(got[k], ref[k]);
+                    }
+                }
+            }
+        }
+    }
+    CHECK(kernels != 0 || strcmp(bms_cellStatsKernel(), "scalar") == 0);
+    CHECK(!bms_cellStatsUsing("neon", NULL, 0, 0, 0, NULL));
+}
+
+TEST(cell_stats_scalar_is_exact)
+{
+    uint16_t volt[3 * 4] = {
+        3300, 3310, 3290, 0,
+        3320, 3310, 3250, 0,
+        3280, 3310, 3330, 0,
+    };
+    BmsCellStats st[3];
+    CHECK(bms_cellStatsUsing("scalar", volt, 4, 3, 3, st));
+    CHECK_EQ(st[0].min, 3280);
+    CHECK_EQ(st[0].minCell, 2);
+    CHECK_EQ(st[0].max, 3320);
+    CHECK_EQ(st[0].maxCell, 1);
+    CHECK_EQ(st[0].delta, 40);
+    CHECK(st[0].mean > 3299.99f && st[0].mean < 3300.01f);
+    CHECK_EQ(st[1].delta, 0);
+    CHECK_EQ(st[1].minCell, 0);
+    CHECK(st[1].stddev == 0.0f);
+    CHECK_EQ(st[2].min, 3250);
+    CHECK_EQ(st[2].max, 3330);
+    //more packs than a row holds is refused, out is left alone
+    st[0].min = 1;
+    bms_cellStats(volt, 2, 3, 3, st);
+    CHECK_EQ(st[0].min, 1);
+}
+
+struct AnomalyLog {
+    std::vector<BmsCellStats> flagged;
+};
+
+static void log_anomaly(const BmsCellStats *st, void *ctx)
+{
+    ((AnomalyLog *)ctx)->flagged.push_back(*st);
+}
+
+static BmsSnapshot pack_snapshot(uint8_t addr, uint32_t round)
+{
+    BmsSnapshot snap;
+    memset(&snap, 0x00, sizeof(snap));
+    snap.addr = addr;
+    snap.round = round;
+    snap.valid = BMS_INFO_VOLT | BMS_INFO_TEMP;
+    snap.volt.cellCnt = 16;
+    for (uint8_t i=0; i<16; ++i) {
+        snap.volt.cell[i] = (uint16_t)(3300 + i % 3);
+    }
+    snap.temp.cellMin = 250;
+    snap.temp.cellMax = 270;
+    snap.temp.mos = 300;
+    return snap;
+}
+
+TEST(analytics_flags_a_round)
+{
+    const uint8_t addrs[] = { 1, 2, 3 };
+    BmsAnalytics analytics;
+    BmsAnalyticsConfig cfg;
+    AnomalyLog log;
+    bms_defaultAnalyticsConfig(cfg);
+    CHECK(analytics.configure(addrs, 3, 16, cfg));
+    analytics.onAnomaly(log_anomaly, &log);
+    BmsSnapshot a = pack_snapshot(1, 1);
+    BmsSnapshot b = pack_snapshot(2, 1);
+    b.volt.cell[5] = 3380;          //one cell runs away
+    BmsSnapshot c = pack_snapshot(3, 1);
+    c.valid = BMS_INFO_TEMP;
+    bms_analyticsSnapshot(&a, &analytics);
+    bms_analyticsSnapshot(&b, &analytics);
+    CHECK(log.flagged.empty());     //the round is analysed when it is complete
+    bms_analyticsSnapshot(&c, &analytics);
+    CHECK_EQ(log.flagged.size(), 1);    //a stale pack is only marked in its stats
+    CHECK_EQ(analytics.stats(1)->flags, 0);
+    CHECK_EQ(analytics.stats(1)->max, 3302);
+    const BmsCellStats *st = analytics.stats(2);
+    CHECK_EQ(st->flags, BMS_ANOM_IMBALANCE | BMS_ANOM_OUTLIER);
+    CHECK_EQ(st->outlierCell, 5);
+    CHECK_EQ(st->round, 1);
+    CHECK_EQ(analytics.stats(3)->flags, BMS_ANOM_STALE);
+    CHECK(analytics.stats(4) == NULL);
+    //a newer round flushes the packs of the old one that came in
+    a.round = 2;
+    a.temp.cellMax = 600;
+    bms_analyticsSnapshot(&a, &analytics);
+    b = pack_snapshot(2, 3);
+    bms_analyticsSnapshot(&b, &analytics);
+    CHECK_EQ(log.flagged.size(), 2);
+    CHECK_EQ(analytics.stats(1)->flags, BMS_ANOM_OVERTEMP | BMS_ANOM_TEMP_SPREAD);
+    CHECK_EQ(analytics.stats(1)->round, 2);
+}
+
+TEST(analytics_follows_telemetry)
+{
+    std::vector<uint8_t> addrs = { 5 };
+    DfuSimTransport sim(DFU_LINK_CAN, 5);
+    BmsTelemetry telemetry(sim);
+    BmsTelemetryConfig tcfg;
+    bms_defaultConfig(tcfg);
+    memcpy(tcfg.addrs, addrs.data(), addrs.size());
+    tcfg.addrCnt = (uint8_t)addrs.size();
+    tcfg.bitRate = 0;
+    BmsAnalytics analytics;
+    BmsAnalyticsConfig cfg;
+    AnomalyLog log;
+    bms_defaultAnalyticsConfig(cfg);
+    CHECK(analytics.configure(tcfg.addrs, tcfg.addrCnt, tcfg.cellCnt, cfg));
+    analytics.onAnomaly(log_anomaly, &log);
+    CHECK(telemetry.configure(tcfg));
+    CHECK(telemetry.subscribe(bms_analyticsSnapshot, &analytics));
+    CHECK_EQ(telemetry.poll(), 1);
+    CHECK(log.flagged.empty());
+    for (uint8_t a : addrs) {
+        const BmsCellStats *st = analytics.stats(a);
+        CHECK_EQ(st->flags, 0);
+        CHECK_EQ(st->round, 1);
+        CHECK_EQ(st->min, 3300 + a);    //the model puts the address into the cells
+        CHECK_EQ(st->max, 3300 + a + 15);
+        CHECK_EQ(st->maxCell, 15);
+    }
+}
@@ -0,0 +1,170 @@
+//several packs on one simulated bus, broadcast upgrades with lost frames and one pack after the other
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_engine.h"
+#include "dfu_sim.h"
+
+#define BCAST_FRAMES    16      //CAN data frames of a 128 bytes packet
+
+static std::vector<uint8_t> bcast_image(void)
+{
+    std::vector<uint8_t> data(6000);
+    for (size_t i=0; i<data.size(); ++i) {
+        data[i] = (uint8_t)(i * 11 + (i >> 7));
+    }
+    return data;
+}
+
+static bool bcast_flashed(DfuSimTransport &pack, const DfuImage &img, const std::vector<uint8_t> &data)
+{
+    return pack.applicationLen() == img.len && memcmp(pack.flash().data(), data.data(), data.size()) == 0;
+}
+
+//loss every 97th and 131st frame hits about every 6th and 8th packet, never several in a row
+TEST(broadcast_repairs_lost_packets)
+{
+    std::vector<uint8_t> data = bcast_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    const uint8_t addrs[3] = { 1, 2, 3 };
+    DfuSimBus bus(DFU_LINK_CAN, std::vector<uint8_t>(addrs, addrs + 3));
+    bus.pack(0).setDataLoss(97);
+    bus.pack(2).setDataLoss(131);
+    DfuEngine engine(bus);
+    engine.setUpdateWait(0);
+    volatile int running = 1;
+    int results[3] = { 1, 1, 1 };
+    CHECK_EQ(engine.upgradeBroadcast(addrs, 3, img, 0, &running, results), 3);
+    for (int i=0; i<3; ++i) {
+        CHECK_EQ(results[i], 0);
+        CHECK(bcast_flashed(bus.pack(i), img, data));
+    }
+    //the first pass is one copy of every packet for all packs, the repairs come on top
+    uint64_t pass = (uint64_t)img.packetCnt * BCAST_FRAMES;
+    CHECK(bus.dataFrames() > pass);
+    CHECK(bus.dataFrames() < 2 * pass);
+    CHECK(bus.pack(0).dataBytes() >= pass * 8);
+    CHECK(bus.pack(2).dataBytes() >= pass * 8);
+}
+
+//a pack that hears no data frame leaves after DFU_BCAST_DROP_MISSES, the others are still upgraded
+TEST(broadcast_drops_a_deaf_pack)
+{
+    std::vector<uint8_t> data = bcast_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    const uint8_t addrs[3] = { 4, 5, 6 };
+    DfuSimBus bus(DFU_LINK_CAN, std::vector<uint8_t>(addrs, addrs + 3));
+    bus.pack(1).setDataLoss(1);
+    bus.pack(2).setDataLoss(113);
+    DfuEngine engine(bus);
+    engine.setUpdateWait(0);
+    volatile int running = 1;
+    int results[3] = { 1, 1, 1 };
+    CHECK_EQ(engine.upgradeBroadcast(addrs, 3, img, 0, &running, results), 2);
+    CHECK_EQ(results[0], 0);
+    CHECK_EQ(results[1], -1);
+    CHECK_EQ(results[2], 0);
+    CHECK(bcast_flashed(bus.pack(0), img, data));
+    CHECK(bcast_flashed(bus.pack(2), img, data));
+    CHECK_EQ(bus.pack(1).dataBytes(), 0);
+    CHECK_EQ(bus.pack(1).updateStatus(), 0x00);     //never verified, never updated
+}
+
+//every 37th frame lost spoils nearly half the packets, DFU_BCAST_REPAIR_ROUNDS do not get them all
+//and the pack is neither verified nor updated while the others are
+TEST(broadcast_gives_up_after_the_repair_rounds)
+{
+    std::vector<uint8_t> data = bcast_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    const uint8_t addrs[2] = { 7, 8 };
+    DfuSimBus bus(DFU_LINK_CAN, std::vector<uint8_t>(addrs, addrs + 2));
+    bus.pack(0).setDataLoss(37);
+    DfuEngine engine(bus);
+    engine.setUpdateWait(0);
+    volatile int running = 1;
+    int results[2] = { 1, 1 };
+    CHECK_EQ(engine.upgradeBroadcast(addrs, 2, img, 0, &running, results), 1);
+    CHECK_EQ(results[0], -1);
+    CHECK_EQ(results[1], 0);
+    CHECK_EQ(bus.pack(0).updateStatus(), 0x00);
+    CHECK(bcast_flashed(bus.pack(1), img, data));
+}
+
+//serial stations share no data frame, a broadcast there is refused before anything is sent
+TEST(broadcast_needs_can)
+{
+    std::vector<uint8_t> data = bcast_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    const uint8_t addrs[1] = { 1 };
+    DfuSimBus bus(DFU_LINK_SERIAL, std::vector<uint8_t>(addrs, addrs + 1));
+    DfuEngine engine(bus);
+    engine.setUpdateWait(0);
+    volatile int running = 1;
+    int results[1] = { 1 };
+    CHECK_EQ(engine.upgradeBroadcast(addrs, 1, img, 0, &running, results), -1);
+    CHECK_EQ(bus.frames(), 0);
+}
+
+//one pack after the other on a shared bus, each upgrade changes only the pack it is addressed to.
+//the broadcast of the same image to the same packs costs the data frames of a single pack
+TEST(sim_bus_one_by_one_and_broadcast)
+{
+    std::vector<uint8_t> data = bcast_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    const std::vector<uint8_t> addrs = { 10, 11, 12, 13 };
+    uint64_t pass = (uint64_t)img.packetCnt * BCAST_FRAMES;
+    DfuSimBus bus(DFU_LINK_CAN, addrs);
+    DfuEngine engine(bus);
+    engine.setUpdateWait(0);
+    volatile int running = 1;
+    for (size_t i=0; i<addrs.size(); ++i) {
+        CHECK_EQ(engine.upgrade(addrs[i], img, 0, &running), 0);
+        for (size_t k=0; k<addrs.size(); ++k) {
+            CHECK_EQ(bus.pack(k).applicationLen(), k <= i ? img.len : 0);
+        }
+    }
+    for (size_t i=0; i<addrs.size(); ++i) {
+        CHECK(bcast_flashed(bus.pack(i), img, data));
+    }
+    CHECK_EQ(bus.dataFrames(), addrs.size() * pass);
+
+    DfuSimBus bcast(DFU_LINK_CAN, addrs);
+    DfuEngine fan(bcast);
+    fan.setUpdateWait(0);
+    int results[4] = { 1, 1, 1, 1 };
+    CHECK_EQ(fan.upgradeBroadcast(addrs.data(), (int)addrs.size(), img, 0, &running, results), 4);
+    for (size_t i=0; i<addrs.size(); ++i) {
+        CHECK_EQ(results[i], 0);
+        CHECK(bcast_flashed(bcast.pack(i), img, data));
+    }
+    CHECK_EQ(bcast.dataFrames(), pass);
+}
+
+//mode 1 sends the all stations update once to address 0, then every pack is polled until it is done
+TEST(broadcast_all_stations_update)
+{
+    std::vector<uint8_t> data = bcast_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 1) >= 0);
+    const std::vector<uint8_t> addrs = { 20, 21, 22 };
+    DfuSimBus bus(DFU_LINK_CAN, addrs);
+    bus.setLatency(500);
+    DfuEngine engine(bus);
+    engine.setUpdateWait(0);
+    volatile int running = 1;
+    int results[3] = { 1, 1, 1 };
+    CHECK_EQ(engine.upgradeBroadcast(addrs.data(), (int)addrs.size(), img, 1, &running, results), 3);
+    for (size_t i=0; i<addrs.size(); ++i) {
+        CHECK_EQ(results[i], 0);
+        CHECK(bcast_flashed(bus.pack(i), img, data));
+        CHECK_EQ(bus.pack(i).updateStatus(), 0xAA);
+    }
+}
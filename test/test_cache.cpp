@@ -0,0 +1,178 @@
+//image cache entries: a miss stores one, a hit serves the crcs from it, a stale one is rebuilt
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_file.h"
+#include "dfu_cache.h"
+#include "dfu_image.h"
+
+#define CACHE_DIR       "test_cache_dir"
+#define CACHE_IMAGE     "test_cache.dfu"
+
+static bool cache_save(const char *path, const std::vector<uint8_t> &data)
+{
+    FILE *fd = fopen(path, "wb");
+    if (fd == NULL) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), fd) == data.size();
+    fclose(fd);
+    return ok;
+}
+
+static std::vector<uint8_t> cache_read(const char *path)
+{
+    std::vector<uint8_t> buf(1 << 16);
+    FILE *fd = fopen(path, "rb");
+    buf.resize(fd != NULL ? fread(buf.data(), 1, buf.size(), fd) : 0);
+    if (fd != NULL) {
+        fclose(fd);
+    }
+    return buf;
+}
+
+static void cache_entry(char *path, size_t size, const std::vector<uint8_t> &file)
+{
+    snprintf(path, size, "%s/%016llx.dfc", CACHE_DIR,
+        (unsigned long long)dfu_hash64(file.data(), (uint32_t)file.size(), 0));
+}
+
+//what the image and container have to be, hit or miss
+static void check_image(const DfuImage &img, const DfuContainer &dfu, const std::vector<uint8_t> &file,
+    uint16_t packetLen, uint8_t crcType)
+{
+    DfuImage ref;
+    DfuContainer refDfu;
+    CHECK(dfu_prepareImage(ref, file.data(), (uint32_t)file.size(), packetLen, crcType) >= 0);
+    CHECK_EQ(dfu_parseContainer(refDfu, file.data(), (uint32_t)file.size()), 0);
+    CHECK_EQ(img.packetCnt, ref.packetCnt);
+    CHECK_EQ(img.len, ref.len);
+    CHECK_EQ(img.fileCrc, ref.fileCrc);
+    CHECK(img.packetCrc == ref.packetCrc);
+    CHECK(img.tail == ref.tail);
+    CHECK_EQ(dfu.loadAddr, refDfu.loadAddr);
+    CHECK_EQ(dfu.payloadLen, refDfu.payloadLen);
+    CHECK_EQ(dfu.sectionCnt, refDfu.sectionCnt);
+    CHECK(memcmp(dfu.version, refDfu.version, sizeof(dfu.version)) == 0);
+    CHECK(dfu.payload == img.data + DFU_PAYLOAD_OFFSET);
+}
+
+static int cache_load(DfuImage &img, DfuContainer &dfu, uint16_t packetLen, uint8_t crcType)
+{
+    dfu_unloadImage(img);
+    return dfu_loadCachedImage(img, dfu, CACHE_IMAGE, CACHE_DIR, packetLen, crcType);
+}
+
+TEST(cache_miss_hit_stale)
+{
+    std::vector<uint8_t> file = test_dfuFile(3001, 5);     //the last packet is padded at every length
+    char entry[256];
+    cache_entry(entry, sizeof(entry), file);
+    remove(entry);
+    CHECK(cache_save(CACHE_IMAGE, file));
+    DfuImage img;
+    DfuContainer dfu;
+
+    //miss: built from the file and stored
+    CHECK(cache_load(img, dfu, 128, 0) > 0);
+    check_image(img, dfu, file, 128, 0);
+    std::vector<uint8_t> stored = cache_read(entry);
+    CHECK(stored.size() > 0);
+
+    //hit at every packet length and both crc types
+    for (uint16_t packetLen=8; packetLen<=512; packetLen <<= 1) {
+        CHECK(cache_load(img, dfu, packetLen, 1) > 0);
+        check_image(img, dfu, file, packetLen, 1);
+    }
+
+    //the crcs really come from the entry: a changed table entry shows up in the image
+    std::vector<uint8_t> poked = stored;
+    const uint8_t *h = poked.data();
+    uint32_t magic;
+    memcpy(&magic, h, 4);
+    CHECK_EQ(magic, DFU_CACHE_MAGIC);
+    CHECK(cache_load(img, dfu, 128, 0) > 0);
+    uint16_t first = img.packetCrc[0];
+    size_t at = 0;
+    for (size_t i=0; i + 1 < poked.size(); i += 2) {
+        if ((poked[i] | (poked[i + 1] << 8)) == first && memcmp(&poked[i + 2], &img.packetCrc[1], 2) == 0) {
+            at = i;
+            break;
+        }
+    }
+    CHECK(at != 0);
+    poked[at] ^= 0x5A;
+    CHECK(cache_save(entry, poked));
+    CHECK(cache_load(img, dfu, 128, 0) > 0);
+    CHECK_EQ(img.packetCrc[0], first ^ 0x5A);
+
+    //stale: an entry of an older version is rebuilt and the image is right again
+    std::vector<uint8_t> old = stored;
+    old[4] = DFU_CACHE_VERSION + 1;
+    CHECK(cache_save(entry, old));
+    CHECK(cache_load(img, dfu, 128, 0) > 0);
+    check_image(img, dfu, file, 128, 0);
+    CHECK(cache_read(entry) == stored);
+
+    //cut short, the entry no longer fits its header
+    stored.resize(stored.size() - 2);
+    CHECK(cache_save(entry, stored));
+    CHECK(cache_load(img, dfu, 64, 1) > 0);
+    check_image(img, dfu, file, 64, 1);
+
+    //another image never takes the entry of the first one
+    std::vector<uint8_t> other = test_dfuFile(3001, 6);
+    char otherEntry[256];
+    cache_entry(otherEntry, sizeof(otherEntry), other);
+    CHECK(strcmp(entry, otherEntry) != 0);
+    CHECK(cache_save(CACHE_IMAGE, other));
+    CHECK(cache_load(img, dfu, 128, 0) > 0);
+    check_image(img, dfu, other, 128, 0);
+
+    dfu_unloadImage(img);
+    remove(entry);
+    remove(otherEntry);
+    remove(CACHE_IMAGE);
+    remove(CACHE_DIR);
+}
+
+//a broken container is neither loaded nor stored
+TEST(cache_refuses_bad_container)
+{
+    std::vector<uint8_t> file = test_dfuFile(1000, 7);
+    file[DFU_PAYLOAD_OFFSET] ^= 1;
+    char entry[256];
+    cache_entry(entry, sizeof(entry), file);
+    CHECK(cache_save(CACHE_IMAGE, file));
+    DfuImage img;
+    DfuContainer dfu;
+    CHECK_EQ(dfu_loadCachedImage(img, dfu, CACHE_IMAGE, CACHE_DIR, 128, 0), -1);
+    FILE *fd = fopen(entry, "rb");
+    CHECK(fd == NULL);
+    if (fd != NULL) {
+        fclose(fd);
+    }
+    remove(CACHE_IMAGE);
+    remove(CACHE_DIR);
+}
+
+//a dir too long for the entry name loads the image without the cache instead of a cut path
+TEST(cache_dir_too_long)
+{
+    std::vector<uint8_t> file = test_dfuFile(1000, 8);
+    std::string dir(600, 'd');
+    CHECK(cache_save(CACHE_IMAGE, file));
+    DfuImage img;
+    DfuContainer dfu;
+    CHECK(dfu_loadCachedImage(img, dfu, CACHE_IMAGE, dir.c_str(), 128, 0) > 0);
+    check_image(img, dfu, file, 128, 0);
+    dfu_unloadImage(img);
+    remove(CACHE_IMAGE);
+}
@@ -0,0 +1,159 @@
+//pre-flight check of a directory of builds, good files pass and every kind of damage is reported
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "dfu_test.h"
+#include "dfu_file.h"
+#include "dfu_check.h"
+#include "dfu_engine.h"
+
+#define CHECK_DIR       "test_check_dir"
+
+static bool check_save(const char *name, const std::vector<uint8_t> &data)
+{
+    std::string path = std::string(CHECK_DIR "/") + name;
+    FILE *fd = fopen(path.c_str(), "wb");
+    if (fd == NULL) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), fd) == data.size();
+    fclose(fd);
+    return ok;
+}
+
+//anything but a blank signature area, the checker does not verify it
+static std::vector<uint8_t> signed_file(uint32_t payloadLen, uint8_t salt)
+{
+    std::vector<uint8_t> file = test_dfuFile(payloadLen, salt);
+    for (uint32_t i=DFU_SIG_OFFSET; i<DFU_PAYLOAD_OFFSET; ++i) {
+        file[i] = (uint8_t)(i * 13);
+    }
+    return file;
+}
+
+static const char *check_names[] = {
+    "a_good.dfu", "b_unsigned.dfu", "c_payload.dfu", "d_short.dfu", "e_hw.dfu", "f_gap.dfu",
+};
+
+TEST(check_dir_good_and_corrupted)
+{
+#ifdef _WIN32
+    CreateDirectoryA(CHECK_DIR, NULL);
+#else
+    mkdir(CHECK_DIR, 0755);
+#endif
+    std::vector<uint8_t> good = signed_file(2001, 1);
+    CHECK(check_save("a_good.dfu", good));
+    CHECK(check_save("b_unsigned.dfu", test_dfuFile(2000, 2)));
+    std::vector<uint8_t> f = good;
+    f[DFU_PAYLOAD_OFFSET + 300] ^= 0x10;
+    CHECK(check_save("c_payload.dfu", f));
+    f = good;
+    f.resize(f.size() - 100);
+    CHECK(check_save("d_short.dfu", f));
+    f = good;
+    f[DFU_HDR_HWINFO_OFFSET] = 0x09;
+    test_dfuSeal(f);
+    CHECK(check_save("e_hw.dfu", f));
+    //two sections with 100 bytes between them that are not erased
+    f = good;
+    uint8_t *t = f.data() + DFU_HDR_TABLE_OFFSET;
+    test_dfuWr32(f.data() + DFU_HDR_SECTIONS_OFFSET, 2);
+    test_dfuWr32(t + 4, 1000);
+    test_dfuWr32(t + DFU_SECTION_ENTRY_LEN, TEST_DFU_LOAD + 1100);
+    test_dfuWr32(t + DFU_SECTION_ENTRY_LEN + 4, 901);
+    uint32_t gap = 0;
+    for (uint32_t i=1000; i<1100; ++i) {
+        gap += f[DFU_PAYLOAD_OFFSET + i] != 0xFF;
+    }
+    test_dfuSeal(f);
+    CHECK(check_save("f_gap.dfu", f));
+    CHECK(check_save("notes.txt", good));   //not a build
+
+    std::vector<std::string> paths;
+    CHECK_EQ(dfu_listImages(CHECK_DIR, paths), 6);
+    for (size_t i=0; i<paths.size() && i<6; ++i) {
+        CHECK(paths[i].find(check_names[i]) != std::string::npos);
+    }
+    DfuCheckOpts opts;
+    opts.threads = 3;
+    opts.hwSet = true;
+    memcpy(opts.hwInfo, good.data() + DFU_HDR_HWINFO_OFFSET, sizeof(opts.hwInfo));
+    std::vector<DfuCheckResult> results;
+    CHECK_EQ(dfu_checkImages(paths, opts, results), 3);
+    CHECK_EQ(results.size(), paths.size());
+    if (results.size() == 6) {
+        const DfuCheckResult &ok = results[0];
+        CHECK(ok.path == paths[0]);
+        CHECK_EQ(ok.status, DFU_CHECK_OK);
+        CHECK(strcmp(ok.reason, "") == 0);
+        CHECK_EQ(ok.len, good.size());
+        CHECK_EQ(ok.loadAddr, TEST_DFU_LOAD);
+        CHECK_EQ(ok.sectionCnt, 1);
+        CHECK_EQ(ok.version[3], 4);
+        //the crcs the engine would send at every packet length
+        for (int i=0; i<DFU_CHECK_LENS; ++i) {
+            DfuImage ref16;
+            DfuImage ref32;
+            uint16_t packetLen = (uint16_t)(8 << i);
+            CHECK(dfu_prepareImage(ref16, good.data(), (uint32_t)good.size(), packetLen, 0) >= 0);
+            CHECK(dfu_prepareImage(ref32, good.data(), (uint32_t)good.size(), packetLen, 1) >= 0);
+            CHECK_EQ(ok.pad[i], ref16.len - good.size());
+            CHECK_EQ(ok.crc16[i], ref16.fileCrc);
+            CHECK_EQ(ok.crc32[i], ref32.fileCrc);
+        }
+        CHECK_EQ(results[1].status, DFU_CHECK_WARN);
+        CHECK(strcmp(results[1].reason, "unsigned") == 0);
+        CHECK_EQ(results[2].status, DFU_CHECK_FAIL);
+        CHECK(strcmp(results[2].reason, "container") == 0);
+        CHECK_EQ(results[3].status, DFU_CHECK_FAIL);
+        CHECK(strcmp(results[3].reason, "container") == 0);
+        CHECK_EQ(results[4].status, DFU_CHECK_FAIL);
+        CHECK(strcmp(results[4].reason, "hwinfo") == 0);
+        CHECK_EQ(results[5].status, DFU_CHECK_WARN);
+        CHECK(strcmp(results[5].reason, "gap data") == 0);
+        CHECK(gap > 0);
+        CHECK_EQ(results[5].gapBytes, gap);
+        CHECK_EQ(results[5].sectionCnt, 2);
+    }
+
+    //one thread gives the same results
+    std::vector<DfuCheckResult> serial;
+    opts.threads = 1;
+    CHECK_EQ(dfu_checkImages(paths, opts, serial), 3);
+    for (size_t i=0; i<serial.size() && i<results.size(); ++i) {
+        CHECK_EQ(serial[i].status, results[i].status);
+        CHECK_EQ(serial[i].crc32[DFU_CHECK_LENS - 1], results[i].crc32[DFU_CHECK_LENS - 1]);
+    }
+
+    for (const char *name : check_names) {
+        remove((std::string(CHECK_DIR "/") + name).c_str());
+    }
+    remove(CHECK_DIR "/notes.txt");
+    remove(CHECK_DIR);
+}
+
+TEST(check_missing_file_or_dir)
+{
+    DfuCheckResult r;
+    DfuCheckOpts opts;
+    opts.threads = 1;
+    opts.hwSet = false;
+    r.path = CHECK_DIR "/missing.dfu";
+    dfu_checkImage(r, opts);
+    CHECK_EQ(r.status, DFU_CHECK_FAIL);
+    CHECK(strcmp(r.reason, "open") == 0);
+    std::vector<std::string> paths;
+    CHECK_EQ(dfu_listImages("test_check_missing_dir", paths), -1);
+}
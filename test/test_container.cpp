@@ -0,0 +1,113 @@
+//.dfu container index, a good file parses and every broken header field is refused
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_file.h"
+
+static int parse(const std::vector<uint8_t> &file)
+{
+    DfuContainer c;
+    return dfu_parseContainer(c, file.data(), (uint32_t)file.size());
+}
+
+//second section right after the first, the payload is split between them
+static void two_sections(std::vector<uint8_t> &file, uint32_t secondAddr)
+{
+    uint32_t len = (uint32_t)file.size() - DFU_PAYLOAD_OFFSET;
+    uint8_t *t = file.data() + DFU_HDR_TABLE_OFFSET;
+    test_dfuWr32(file.data() + DFU_HDR_SECTIONS_OFFSET, 2);
+    test_dfuWr32(t + 4, len / 2);
+    test_dfuWr32(t + DFU_SECTION_ENTRY_LEN, secondAddr);
+    test_dfuWr32(t + DFU_SECTION_ENTRY_LEN + 4, len - len / 2);
+}
+
+TEST(container_parses_fields)
+{
+    std::vector<uint8_t> file = test_dfuFile(3000, 1);
+    two_sections(file, TEST_DFU_LOAD + 0x1000);
+    test_dfuSeal(file);
+    DfuContainer c;
+    CHECK_EQ(dfu_parseContainer(c, file.data(), (uint32_t)file.size()), 0);
+    CHECK_EQ(c.format, 1);
+    CHECK_EQ(c.loadAddr, TEST_DFU_LOAD);
+    CHECK_EQ(c.entryAddr, TEST_DFU_LOAD + 0x100);
+    CHECK_EQ(c.payloadLen, 3000);
+    CHECK_EQ(c.sectionCnt, 2);
+    CHECK_EQ(c.section[1].addr, TEST_DFU_LOAD + 0x1000);
+    CHECK_EQ(c.section[1].len, 1500);
+    CHECK(c.payload == file.data() + DFU_PAYLOAD_OFFSET);
+    CHECK(c.signature == file.data() + DFU_SIG_OFFSET);
+    CHECK_EQ(dfu_containerAddr(c, DFU_PAYLOAD_OFFSET + 10), TEST_DFU_LOAD + 10);
+    CHECK_EQ(dfu_containerAddr(c, 10), 0);
+    CHECK_EQ(dfu_containerSection(c, TEST_DFU_LOAD + 1499), 0);
+    CHECK_EQ(dfu_containerSection(c, TEST_DFU_LOAD + 1500), -1);   //gap between the sections
+    CHECK_EQ(dfu_containerSection(c, TEST_DFU_LOAD + 0x1000), 1);
+    const uint8_t installed[5] = { 4, 0, 3, 2, 1 };
+    const uint8_t older[5] = { 3, 0, 3, 2, 1 };
+    CHECK(dfu_containerInstalled(c, installed));
+    CHECK(!dfu_containerInstalled(c, older));
+}
+
+TEST(container_rejects_broken_files)
+{
+    std::vector<uint8_t> good = test_dfuFile(2000, 2);
+    CHECK_EQ(parse(good), 0);
+
+    std::vector<uint8_t> f = good;
+    f.resize(DFU_PAYLOAD_OFFSET);   //header only
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    f[DFU_HDR_LOAD_OFFSET] ^= 1;    //not sealed again
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    f[DFU_PAYLOAD_OFFSET + 100] ^= 0x40;
+    CHECK_EQ(parse(f), -1);         //payload crc
+
+    f = good;
+    f.push_back(0xFF);              //file longer than the header says
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    test_dfuWr32(f.data() + DFU_HDR_SECTIONS_OFFSET, 0);
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    test_dfuWr32(f.data() + DFU_HDR_SECTIONS_OFFSET, DFU_MAX_SECTIONS + 1);
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    test_dfuWr32(f.data() + DFU_HDR_TABLE_OFFSET + 4, 0);   //empty section
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    test_dfuWr32(f.data() + DFU_HDR_TABLE_OFFSET, 0xFFFFFF00);   //wraps past 4G
+    test_dfuWr32(f.data() + DFU_HDR_LOAD_OFFSET, 0xFFFFFF00);
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    two_sections(f, TEST_DFU_LOAD + 100);   //starts inside the first one
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);
+
+    f = good;
+    test_dfuWr32(f.data() + DFU_HDR_LOAD_OFFSET, TEST_DFU_LOAD + 4);
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);         //load address starts no section
+
+    f = good;
+    test_dfuWr32(f.data() + DFU_HDR_ENTRY_OFFSET, TEST_DFU_LOAD + 2000);
+    test_dfuSeal(f);
+    CHECK_EQ(parse(f), -1);         //entry right after the only section
+
+    DfuContainer c;
+    CHECK_EQ(dfu_parseContainer(c, NULL, 0), -1);
+}
@@ -0,0 +1,345 @@
+//BmsExport round trip, the csv is parsed back and the parquet pages are decoded again
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "dfu_test.h"
+#include "bms_export.h"
+
+#define EXPORT_ROWS         3000    //below the queue size, nothing is dropped while the writer sleeps
+#define EXPORT_CELLS        16
+#define EXPORT_FIXED_COLS   26      //columns before cell_1
+#define COL_TIME            0
+#define COL_ADDR            1
+#define COL_ROUND           2
+#define COL_VALID           3
+#define COL_BAT_VOLTAGE     4
+#define COL_BAT_CURRENT     5
+#define COL_TEMP_CELL_MIN   14
+#define COL_SOC_REMAIN_CAP  20
+
+static BmsSnapshot export_snapshot(int i)
+{
+    BmsSnapshot s;
+    memset(&s, 0x00, sizeof(s));
+    s.addr = (uint8_t)(i % 4 + 1);
+    s.round = (uint32_t)(i / 4 + 1);
+    s.timeMs = 1790000000000ULL + (uint64_t)i * 25;
+    s.valid = BMS_INFO_ALL;
+    if (i % 7 == 3) {
+        s.valid &= ~BMS_INFO_BAT;
+    }
+    if (i % 5 == 1) {
+        s.valid &= ~BMS_INFO_VOLT;
+    }
+    if (i % 31 == 0) {
+        s.valid = 0;    //a silent pack, only the fixed columns
+    }
+    s.bat.voltage = (uint16_t)(5120 + i % 13);
+    s.bat.current = (int16_t)(i % 500 - 250);
+    s.temp.cellMin = (int16_t)(-50 + i % 100);
+    s.soc.remainCap = 90000 + (uint32_t)i * 3;
+    s.volt.cellCnt = EXPORT_CELLS;
+    for (int k=0; k<EXPORT_CELLS; ++k) {
+        s.volt.cell[k] = (uint16_t)(3300 + (i * (k + 1)) % 17);
+    }
+    return s;
+}
+
+//the columns checked value by value, false for the others
+static bool export_value(const BmsSnapshot &s, int col, int64_t &v, uint8_t &part)
+{
+    part = 0;
+    switch (col) {
+    case COL_TIME: v = (int64_t)s.timeMs; return true;
+    case COL_ADDR: v = s.addr; return true;
+    case COL_ROUND: v = s.round; return true;
+    case COL_VALID: v = s.valid; return true;
+    case COL_BAT_VOLTAGE: part = BMS_INFO_BAT; v = s.bat.voltage; return true;
+    case COL_BAT_CURRENT: part = BMS_INFO_BAT; v = s.bat.current; return true;
+    case COL_TEMP_CELL_MIN: part = BMS_INFO_TEMP; v = s.temp.cellMin; return true;
+    case COL_SOC_REMAIN_CAP: part = BMS_INFO_SOC; v = s.soc.remainCap; return true;
+    default:
+        if (col >= EXPORT_FIXED_COLS) {
+            part = BMS_INFO_VOLT;
+            v = s.volt.cell[col - EXPORT_FIXED_COLS];
+            return true;
+        }
+        return false;
+    }
+}
+
+static bool export_file(const char *path)
+{
+    BmsExport ex;
+    if (!ex.open(path, EXPORT_CELLS)) {
+        return false;
+    }
+    for (int i=0; i<EXPORT_ROWS; ++i) {
+        BmsSnapshot s = export_snapshot(i);
+        bms_exportSnapshot(&s, &ex);
+    }
+    ex.close();
+    CHECK_EQ(ex.rows(), EXPORT_ROWS);
+    CHECK_EQ(ex.dropped(), 0);
+    return true;
+}
+
+static std::vector<uint8_t> read_file(const char *path)
+{
+    std::vector<uint8_t> buf;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return buf;
+    }
+    fseek(f, 0, SEEK_END);
+    buf.resize((size_t)ftell(f));
+    fseek(f, 0, SEEK_SET);
+    if (fread(buf.data(), 1, buf.size(), f) != buf.size()) {
+        buf.clear();
+    }
+    fclose(f);
+    return buf;
+}
+
+TEST(export_csv_round_trip)
+{
+    CHECK(export_file("test_export.csv"));
+    std::vector<uint8_t> buf = read_file("test_export.csv");
+    std::string text(buf.begin(), buf.end());
+    size_t at = 0;
+    int line = -1;  //the header
+    while (at < text.size()) {
+        size_t end = text.find('\n', at);
+        CHECK(end != std::string::npos);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::vector<std::string> fields;
+        size_t from = at;
+        for (size_t i=at; i<=end; ++i) {
+            if (i == end || text[i] == ',') {
+                fields.push_back(text.substr(from, i - from));
+                from = i + 1;
+            }
+        }
+        at = end + 1;
+        CHECK_EQ(fields.size(), EXPORT_FIXED_COLS + EXPORT_CELLS);
+        if (fields.size() != EXPORT_FIXED_COLS + EXPORT_CELLS) {
+            break;
+        }
+        if (line < 0) {
+            CHECK(fields[COL_TIME] == "time_ms");
+            CHECK(fields[COL_SOC_REMAIN_CAP] == "soc_remain_cap");
+            CHECK(fields[EXPORT_FIXED_COLS] == "cell_1");
+            CHECK(fields.back() == "cell_16");
+            ++line;
+            continue;
+        }
+        BmsSnapshot s = export_snapshot(line);
+        for (int c=0; c<(int)fields.size(); ++c) {
+            int64_t v;
+            uint8_t part;
+            if (!export_value(s, c, v, part)) {
+                continue;
+            }
+            if (part != 0 && !(s.valid & part)) {
+                CHECK(fields[c].empty());   //not answered is empty, not 0
+            } else {
+                CHECK(!fields[c].empty());
+                CHECK_EQ(strtoll(fields[c].c_str(), NULL, 10), v);
+            }
+        }
+        ++line;
+    }
+    CHECK_EQ(line, EXPORT_ROWS);
+    remove("test_export.csv");
+}
+
+//thrift compact protocol, the integer fields of one struct and of one nested struct, the rest is skipped
+struct ThriftFields {
+    int64_t val[16];
+    bool has[16];
+};
+
+static uint64_t get_varint(const uint8_t *&p)
+{
+    uint64_t v = 0;
+    for (uint32_t shift=0; ; shift+=7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+}
+
+static int64_t get_zigzag(const uint8_t *&p)
+{
+    uint64_t u = get_varint(p);
+    return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static const uint8_t *thrift_struct(const uint8_t *p, ThriftFields *out, int nestId, ThriftFields *nest);
+
+static const uint8_t *thrift_skip(const uint8_t *p, uint8_t type)
+{
+    switch (type) {
+    case 1: case 2: return p;
+    case 3: return p + 1;
+    case 4: case 5: case 6: get_varint(p); return p;
+    case 7: return p + 8;
+    case 8: { uint64_t n = get_varint(p); return p + n; }
+    case 9: case 10: {
+        uint8_t h = *p++;
+        uint64_t n = h >> 4;
+        if (n == 15) {
+            n = get_varint(p);
+        }
+        for (uint64_t i=0; i<n; ++i) {
+            p = thrift_skip(p, h & 0x0F);
+        }
+        return p;
+    }
+    case 12: return thrift_struct(p, NULL, -1, NULL);
+    default: return p;  //maps are not in the parquet footer of an export
+    }
+}
+
+static const uint8_t *thrift_struct(const uint8_t *p, ThriftFields *out, int nestId, ThriftFields *nest)
+{
+    int id = 0;
+    if (out != NULL) {
+        memset(out, 0x00, sizeof(*out));
+    }
+    for (;;) {
+        uint8_t h = *p++;
+        if (h == 0) {
+            return p;
+        }
+        uint8_t type = h & 0x0F;
+        id = (h >> 4) ? id + (h >> 4) : (int)get_zigzag(p);
+        if (type == 12 && id == nestId) {
+            p = thrift_struct(p, nest, -1, NULL);
+        } else if ((type == 5 || type == 6) && out != NULL && id < 16) {
+            out->val[id] = get_zigzag(p);
+            out->has[id] = true;
+        } else {
+            p = thrift_skip(p, type);
+        }
+    }
+}
+
+//DELTA_BINARY_PACKED back to values
+static const uint8_t *delta_decode(const uint8_t *p, std::vector<int64_t> &out)
+{
+    uint32_t block = (uint32_t)get_varint(p);
+    uint32_t minis = (uint32_t)get_varint(p);
+    uint32_t total = (uint32_t)get_varint(p);
+    int64_t v = get_zigzag(p);
+    uint32_t perMini = block / minis;
+    out.clear();
+    if (total == 0) {
+        return p;
+    }
+    out.push_back(v);
+    while (out.size() < total) {
+        int64_t minDelta = get_zigzag(p);
+        const uint8_t *width = p;
+        p += minis;
+        for (uint32_t m=0; m<minis && out.size()<total; ++m) {
+            uint64_t bitPos = 0;
+            for (uint32_t i=0; i<perMini; ++i) {
+                uint64_t u = 0;
+                for (uint8_t b=0; b<width[m]; ++b, ++bitPos) {
+                    u |= (uint64_t)((p[bitPos >> 3] >> (bitPos & 7)) & 1) << b;
+                }
+                if (out.size() < total) {
+                    v += minDelta + (int64_t)u;
+                    out.push_back(v);
+                }
+            }
+            p += (size_t)perMini * width[m] / 8;
+        }
+    }
+    return p;
+}
+
+TEST(export_parquet_round_trip)
+{
+    CHECK(export_file("test_export.parquet"));
+    std::vector<uint8_t> buf = read_file("test_export.parquet");
+    CHECK(buf.size() > 12);
+    if (buf.size() <= 12) {
+        return;
+    }
+    CHECK(memcmp(buf.data(), "PAR1", 4) == 0);
+    CHECK(memcmp(buf.data() + buf.size() - 4, "PAR1", 4) == 0);
+    uint32_t metaLen;
+    memcpy(&metaLen, buf.data() + buf.size() - 8, 4);
+    CHECK(metaLen < buf.size() - 12);
+    ThriftFields meta;
+    thrift_struct(buf.data() + buf.size() - 8 - metaLen, &meta, -1, NULL);
+    CHECK_EQ(meta.val[1], 1);       //version
+    CHECK_EQ(meta.val[3], EXPORT_ROWS);
+    //one row group, a data page per column right after the magic
+    const uint8_t *p = buf.data() + 4;
+    std::vector<BmsSnapshot> snaps;
+    for (int i=0; i<EXPORT_ROWS; ++i) {
+        snaps.push_back(export_snapshot(i));
+    }
+    for (int c=0; c<EXPORT_FIXED_COLS + EXPORT_CELLS; ++c) {
+        ThriftFields hdr;
+        ThriftFields data;
+        const uint8_t *page = thrift_struct(p, &hdr, 5, &data);
+        CHECK_EQ(hdr.val[1], 0);    //DATA_PAGE
+        CHECK_EQ(data.val[1], EXPORT_ROWS);
+        p = page + hdr.val[3];
+        std::vector<bool> present(EXPORT_ROWS, true);
+        if (c >= COL_BAT_VOLTAGE) {
+            //definition levels, one bit packed run of the whole page
+            uint32_t len;
+            memcpy(&len, page, 4);
+            const uint8_t *lv = page + 4;
+            uint64_t groups = get_varint(lv) >> 1;
+            CHECK_EQ(groups, (EXPORT_ROWS + 7) / 8);
+            for (int r=0; r<EXPORT_ROWS; ++r) {
+                present[r] = (lv[r >> 3] >> (r & 7)) & 1;
+            }
+            page += 4 + len;
+        }
+        std::vector<int64_t> vals;
+        const uint8_t *end = delta_decode(page, vals);
+        CHECK(end <= p);
+        size_t k = 0;
+        for (int r=0; r<EXPORT_ROWS; ++r) {
+            int64_t v;
+            uint8_t part;
+            if (!export_value(snaps[r], c, v, part)) {
+                k += present[r] ? 1 : 0;
+                continue;
+            }
+            CHECK_EQ(present[r], part == 0 || (snaps[r].valid & part) != 0);
+            if (present[r]) {
+                CHECK(k < vals.size());
+                if (k < vals.size()) {
+                    CHECK_EQ(vals[k], v);
+                }
+                ++k;
+            }
+        }
+        CHECK_EQ(k, vals.size());
+        if (test_failures != 0) {
+            printf("column %d does not read back\n", c);
+            break;
+        }
+    }
+    CHECK(p == buf.data() + buf.size() - 8 - metaLen);
+    remove("test_export.parquet");
+}
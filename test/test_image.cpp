@@ -0,0 +1,104 @@
+//shared read-only image mappings and the padded tail of a loaded image
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_image.h"
+
+#define IMAGE_FILE      "test_image.bin"
+#define IMAGE_OTHER     "test_image2.bin"
+
+static std::vector<uint8_t> image_data(uint32_t len, uint8_t salt)
+{
+    std::vector<uint8_t> data(len);
+    for (uint32_t i=0; i<len; ++i) {
+        data[i] = (uint8_t)(i * 31 + salt);
+    }
+    return data;
+}
+
+static bool image_save(const char *path, const std::vector<uint8_t> &data)
+{
+    FILE *fd = fopen(path, "wb");
+    if (fd == NULL) {
+        return false;
+    }
+    bool ok = data.empty() || fwrite(data.data(), 1, data.size(), fd) == data.size();
+    fclose(fd);
+    return ok;
+}
+
+//a second open of the same file, also under another name, takes a reference on the first mapping
+TEST(image_file_mapping_shared)
+{
+    std::vector<uint8_t> data = image_data(1000, 1);
+    std::vector<uint8_t> other = image_data(1000, 2);
+    CHECK(image_save(IMAGE_FILE, data));
+    CHECK(image_save(IMAGE_OTHER, other));
+    const DfuImageFile *a = dfu_openImageFile(IMAGE_FILE);
+    const DfuImageFile *b = dfu_openImageFile("./" IMAGE_FILE);
+    const DfuImageFile *c = dfu_openImageFile(IMAGE_OTHER);
+    CHECK(a != NULL && c != NULL);
+    CHECK(a == b);
+    CHECK(a != c);
+    if (a == NULL || c == NULL) {
+        return;
+    }
+    CHECK_EQ(dfu_imageFileLen(a), data.size());
+    CHECK(memcmp(dfu_imageFileData(a), data.data(), data.size()) == 0);
+    CHECK(memcmp(dfu_imageFileData(c), other.data(), other.size()) == 0);
+    //the mapping outlives the first close while the other reference holds it
+    const uint8_t *view = dfu_imageFileData(a);
+    dfu_closeImageFile(a);
+    CHECK(memcmp(view, data.data(), data.size()) == 0);
+    dfu_closeImageFile(b);
+    dfu_closeImageFile(c);
+    //once every reference is gone the file is mapped again from scratch
+    const DfuImageFile *d = dfu_openImageFile(IMAGE_FILE);
+    CHECK(d != NULL);
+    if (d != NULL) {
+        CHECK(memcmp(dfu_imageFileData(d), data.data(), data.size()) == 0);
+        dfu_closeImageFile(d);
+    }
+    remove(IMAGE_FILE);
+    remove(IMAGE_OTHER);
+}
+
+TEST(image_file_missing_or_empty)
+{
+    CHECK(dfu_openImageFile("test_image_missing.bin") == NULL);
+    CHECK(image_save(IMAGE_FILE, std::vector<uint8_t>()));
+    CHECK(dfu_openImageFile(IMAGE_FILE) == NULL);
+    remove(IMAGE_FILE);
+}
+
+//a loaded image has the crcs of the file padded with 0xFF, the padding lives only in the tail
+TEST(image_load_pads_tail)
+{
+    std::vector<uint8_t> data = image_data(1000, 3);
+    CHECK(image_save(IMAGE_FILE, data));
+    DfuImage img;
+    DfuImage ref;
+    std::vector<uint8_t> padded = data;
+    padded.resize(1024, 0xFF);
+    CHECK(dfu_loadImage(img, IMAGE_FILE, 128, 1) >= 0);
+    CHECK(dfu_prepareImage(ref, padded.data(), (uint32_t)padded.size(), 128, 1) >= 0);
+    CHECK(img.file != NULL);
+    CHECK_EQ(img.dataLen, 1000);
+    CHECK_EQ(img.len, 1024);
+    CHECK_EQ(img.packetCnt, 8);
+    CHECK_EQ(img.fileCrc, ref.fileCrc);
+    CHECK(img.packetCrc == ref.packetCrc);
+    int same = 0;
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        same += memcmp(dfu_imagePacket(img, i), padded.data() + i * 128, 128) == 0;
+    }
+    CHECK_EQ(same, 8);
+    CHECK(dfu_imagePacket(img, 7) == img.tail.data());
+    dfu_unloadImage(img);
+    CHECK(img.file == NULL);
+    remove(IMAGE_FILE);
+}
@@ -0,0 +1,102 @@
+//LZ4 packets, a bootloader with the decoder gets them compressed and one without gets them plain
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_engine.h"
+#include "dfu_lz.h"
+#include "dfu_sim.h"
+
+#define LZ_ADDR         3
+#define LZ_CAN_DATA     8       //payload bytes of one CAN data frame
+
+//repeats with small changes, like code built from the same few constructs
+static std::vector<uint8_t> lz_image(void)
+{
+    std::vector<uint8_t> data(5000);
+    for (size_t i=0; i<data.size(); ++i) {
+        data[i] = (uint8_t)((i % 48) * 5 + (i / 700));
+    }
+    return data;
+}
+
+//data frames a payload of len bytes takes on CAN
+static uint64_t can_frames(uint32_t len)
+{
+    return (len + LZ_CAN_DATA - 1) / LZ_CAN_DATA;
+}
+
+//every block decodes to its packet against the padded image before it
+TEST(lz_blocks_decode_to_the_packets)
+{
+    std::vector<uint8_t> data = lz_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    CHECK(dfu_compressImage(img) > 0);
+    CHECK_EQ(img.lzOffset.size(), img.packetCnt + 1);
+    std::vector<uint8_t> padded = data;
+    padded.resize(img.len, 0xFF);
+    std::vector<uint8_t> out(img.packetLen);
+    int compressed = 0;
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        uint16_t n = dfu_imageLzLen(img, i);
+        if (n == img.packetLen) {
+            continue;
+        }
+        ++compressed;
+        uint32_t at = i * img.packetLen;
+        uint32_t win = at < DFU_LZ_WINDOW ? at : DFU_LZ_WINDOW;
+        const uint8_t *block = img.lz.data() + img.lzOffset[i];
+        CHECK_EQ(dfu_lzDecompress(block, n, out.data(), img.packetLen, padded.data() + at - win, win), img.packetLen);
+        CHECK(memcmp(out.data(), padded.data() + at, img.packetLen) == 0);
+        //a block cut short does not fill the packet
+        CHECK_EQ(dfu_lzDecompress(block, n - 1, out.data(), img.packetLen, padded.data() + at - win, win), -1);
+    }
+    CHECK(compressed > (int)img.packetCnt / 2);
+}
+
+//the same image to a pack with and without DFU_CAP_LZ, both end with the same flash.
+//serial takes a packet as one frame of its own length, CAN in frames of 8 bytes padded with 0x00
+TEST(lz_upgrade_follows_the_caps)
+{
+    std::vector<uint8_t> data = lz_image();
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    CHECK(dfu_compressImage(img) > 0);
+    uint64_t lzBytes = 0;
+    uint64_t lzFrames = 0;
+    for (uint32_t i=0; i<img.packetCnt; ++i) {
+        lzBytes += dfu_imageLzLen(img, i);
+        lzFrames += can_frames(dfu_imageLzLen(img, i));
+    }
+    uint64_t plainBytes = (uint64_t)img.packetCnt * img.packetLen;
+    uint64_t plainFrames = img.packetCnt * can_frames(img.packetLen);
+    CHECK(lzBytes < plainBytes);
+    CHECK(lzFrames < plainFrames);
+
+    const uint8_t links[2] = { DFU_LINK_CAN, DFU_LINK_SERIAL };
+    const uint8_t caps[2] = { DFU_CAP_LZ, 0 };
+    for (uint8_t link : links) {
+        for (uint8_t c : caps) {
+            DfuSimBus bus(link, std::vector<uint8_t>(1, LZ_ADDR));
+            bus.pack(0).setCaps(c);
+            DfuEngine engine(bus);
+            engine.setUpdateWait(0);
+            volatile int running = 1;
+            CHECK_EQ(engine.upgrade(LZ_ADDR, img, 0, &running), 0);
+            const DfuSimTransport &pack = bus.pack(0);
+            CHECK_EQ(pack.applicationLen(), img.len);
+            CHECK(pack.flash().size() >= data.size() && memcmp(pack.flash().data(), data.data(), data.size()) == 0);
+            bool lz = (c & DFU_CAP_LZ) != 0;
+            if (link == DFU_LINK_CAN) {
+                CHECK_EQ(bus.dataFrames(), lz ? lzFrames : plainFrames);
+                CHECK_EQ(pack.dataBytes(), bus.dataFrames() * LZ_CAN_DATA);
+            } else {
+                CHECK_EQ(bus.dataFrames(), img.packetCnt);
+                CHECK_EQ(pack.dataBytes(), lz ? lzBytes : plainBytes);
+            }
+        }
+    }
+}
@@ -0,0 +1,81 @@
+//DfuNvm backup and restore against the bootloader simulator
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_nvm.h"
+#include "dfu_sim.h"
+
+#define NVM_SECTORS     (DFU_NVM_SIZE / DFU_NVM_SECTOR)
+
+//calibration like content, a blank tail in the last sector
+static void nvm_pattern(std::vector<uint8_t> &nvm)
+{
+    for (size_t i=0; i<nvm.size(); ++i) {
+        nvm[i] = i >= DFU_NVM_SIZE - 0x300 ? 0xFF : (uint8_t)(i * 131 + (i >> 8));
+    }
+}
+
+static void nvm_backup_in_chunks(uint8_t link, uint32_t reads)
+{
+    DfuSimTransport sim(link, 6);
+    nvm_pattern(sim.nvmData());
+    DfuNvm nvm(sim);
+    std::vector<uint8_t> image;
+    CHECK_EQ(nvm.backup(6, image), DFU_NVM_SIZE);
+    CHECK(image == sim.nvmData());
+    CHECK_EQ(nvm.stat().cmds, reads);
+    CHECK_EQ(nvm.stat().retries, 0);
+    //a range not on a chunk boundary
+    uint8_t part[100];
+    CHECK_EQ(nvm.read(6, 0x7F0, sizeof(part), part), sizeof(part));
+    CHECK(memcmp(part, image.data() + 0x7F0, sizeof(part)) == 0);
+    //past the end is refused by the pack
+    CHECK_EQ(nvm.read(6, DFU_NVM_SIZE - 8, 16, part), -1);
+}
+
+TEST(nvm_backup_reads_in_chunks_over_can)
+{
+    //255 frames of 4 bytes hold 1016 bytes and the crc, 8192 bytes take 9 reads
+    nvm_backup_in_chunks(DFU_LINK_CAN, 9);
+}
+
+TEST(nvm_backup_reads_in_chunks_over_serial)
+{
+    nvm_backup_in_chunks(DFU_LINK_SERIAL, DFU_NVM_SIZE / DFU_NVM_MAX_READ);
+}
+
+TEST(nvm_restore_writes_only_changed_sectors)
+{
+    DfuSimTransport sim(DFU_LINK_CAN, 6);
+    std::vector<uint8_t> &flash = sim.nvmData();
+    nvm_pattern(flash);
+    DfuNvm nvm(sim);
+    std::vector<uint8_t> saved;
+    CHECK_EQ(nvm.backup(6, saved), DFU_NVM_SIZE);
+
+    //nothing differs, nothing is erased
+    CHECK_EQ(nvm.restore(6, saved.data(), NULL), 0);
+    CHECK(flash == saved);
+
+    //a calibration value and a blanked sector change on the pack
+    flash[DFU_NVM_SECTOR + 0x123] ^= 0x5A;
+    memset(flash.data() + 3 * DFU_NVM_SECTOR, 0x00, 16);
+    uint32_t cmds = nvm.stat().cmds;
+    CHECK_EQ(nvm.restore(6, saved.data(), NULL), 2);
+    CHECK_EQ(nvm.stat().sectors, 2);
+    CHECK(flash == saved);
+    //reads of the whole NVM, enable and disable, 2 erases, and writes of the 512 bytes that are not blank
+    uint32_t writes = DFU_NVM_SECTOR / MAXIMUM_PKT_LEN + (DFU_NVM_SECTOR - 0x300) / MAXIMUM_PKT_LEN + 1;
+    CHECK_EQ(nvm.stat().cmds - cmds, 9 + 2 + 2 + writes);
+
+    //the current content is known, no read goes first
+    std::vector<uint8_t> image = saved;
+    image[5] = 0x00;
+    cmds = nvm.stat().cmds;
+    CHECK_EQ(nvm.restore(6, image.data(), saved.data()), 1);
+    CHECK(flash == image);
+    CHECK_EQ(nvm.stat().cmds - cmds, 2 + 1 + DFU_NVM_SECTOR / MAXIMUM_PKT_LEN);
+}
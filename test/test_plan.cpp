@@ -0,0 +1,126 @@
+//transfer plan files, a plan reads back as it was written and a damaged file is refused
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_engine.h"
+#include "dfu_plan.h"
+
+#define PLAN_FILE           "test_plan.dfp"
+#define PLAN_HDR_OPCNT      32      //offset of opCnt in the file header
+
+static std::vector<uint8_t> plan_image(void)
+{
+    std::vector<uint8_t> data(5000);
+    for (size_t i=0; i<data.size(); ++i) {
+        data[i] = (uint8_t)(i * 7 + (i >> 9));
+    }
+    return data;
+}
+
+static std::vector<uint8_t> read_plan(void)
+{
+    std::vector<uint8_t> buf(1 << 20);
+    FILE *fd = fopen(PLAN_FILE, "rb");
+    buf.resize(fd != NULL ? fread(buf.data(), 1, buf.size(), fd) : 0);
+    if (fd != NULL) {
+        fclose(fd);
+    }
+    return buf;
+}
+
+static void write_plan(const std::vector<uint8_t> &buf)
+{
+    FILE *fd = fopen(PLAN_FILE, "wb");
+    if (fd != NULL) {
+        fwrite(buf.data(), 1, buf.size(), fd);
+        fclose(fd);
+    }
+}
+
+TEST(plan_reads_back_as_written)
+{
+    std::vector<uint8_t> data = plan_image();
+    DfuImage img;
+    DfuPlan plan;
+    DfuPlan back;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    CHECK(dfu_compilePlan(plan, img, DFU_LINK_CAN, false) > 0);
+    CHECK_EQ(dfu_savePlan(plan, PLAN_FILE), 0);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), (int)plan.ops.size());
+    CHECK_EQ(back.imageHash, plan.imageHash);
+    CHECK_EQ(back.packetCnt, plan.packetCnt);
+    CHECK(back.bytes == plan.bytes);
+    CHECK_EQ(back.frames.size(), plan.frames.size());
+    CHECK(memcmp(back.ops.data(), plan.ops.data(), plan.ops.size() * sizeof(DfuPlanOp)) == 0);
+    remove(PLAN_FILE);
+}
+
+TEST(plan_counts_have_to_match_the_file)
+{
+    std::vector<uint8_t> data = plan_image();
+    DfuImage img;
+    DfuPlan plan;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    CHECK(dfu_compilePlan(plan, img, DFU_LINK_SERIAL, false) > 0);
+    CHECK_EQ(dfu_savePlan(plan, PLAN_FILE), 0);
+    const std::vector<uint8_t> good = read_plan();
+    CHECK(good.size() > PLAN_HDR_OPCNT + 4);
+    DfuPlan back;
+
+    std::vector<uint8_t> bad(good.begin(), good.end() - 1);
+    write_plan(bad);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), -1);
+
+    bad = good;
+    bad.push_back(0x00);
+    write_plan(bad);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), -1);
+
+    //a count that would ask for gigabytes is refused before anything is allocated
+    bad = good;
+    uint32_t opCnt = 0x40000000;
+    memcpy(&bad[PLAN_HDR_OPCNT], &opCnt, 4);
+    write_plan(bad);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), -1);
+    CHECK(back.ops.size() < 0x40000000);
+
+    write_plan(good);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), (int)plan.ops.size());
+    remove(PLAN_FILE);
+}
+
+//a serial command frame has to be as long as its LEN says, the runner would patch the crc elsewhere
+TEST(plan_frame_len_has_to_match)
+{
+    std::vector<uint8_t> data = plan_image();
+    DfuImage img;
+    DfuPlan plan;
+    DfuPlan back;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    CHECK(dfu_compilePlan(plan, img, DFU_LINK_SERIAL, false) > 0);
+    const DfuPlanOp *cmdOp = NULL;
+    for (const DfuPlanOp &op : plan.ops) {
+        if (op.cmd != 0 && op.frameCnt != 0) {
+            cmdOp = &op;
+            break;
+        }
+    }
+    CHECK(cmdOp != NULL);
+    if (cmdOp == NULL) {
+        return;
+    }
+    uint8_t &len = plan.bytes[plan.frames[cmdOp->frame].offset + CMD_LEN_OFFSET];
+    len += 1;
+    CHECK_EQ(dfu_savePlan(plan, PLAN_FILE), 0);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), -1);
+    len -= 1;
+    CHECK_EQ(dfu_savePlan(plan, PLAN_FILE), 0);
+    CHECK_EQ(dfu_loadPlan(back, PLAN_FILE), (int)plan.ops.size());
+    remove(PLAN_FILE);
+}
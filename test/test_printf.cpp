@@ -0,0 +1,115 @@
+//printf_ with the async writer, what reaches the sink is the same as without it
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_log.h"
+#include "printf.h"
+
+//lines as the sink got them, the writer thread and synchronous callers may both call it
+struct SinkLog {
+    std::mutex lock;
+    std::vector<std::string> lines;
+    uint32_t dropped = 0;
+};
+
+static void sink_log(const char *buf, size_t len, void *ctx)
+{
+    SinkLog *log = (SinkLog *)ctx;
+    std::lock_guard<std::mutex> guard(log->lock);
+    uint32_t n = 0;
+    if (sscanf(std::string(buf, len).c_str(), "[printf_ dropped %u lines]", &n) == 1) {
+        log->dropped += n;
+        return;
+    }
+    log->lines.emplace_back(buf, len);
+}
+
+static void sink_stdout(const char *buf, size_t len, void *ctx)
+{
+    fwrite(buf, 1, len, (FILE *)ctx);
+}
+
+TEST(printf_async_returns_length)
+{
+    SinkLog log;
+    register_internal_sink(sink_log, &log);
+    const int sync = printf_("station %d app %s crc 0x%04X\n", 12, "v1.2.3", 0xBEEF);
+    printf_setAsync(true);
+    const int async = printf_("station %d app %s crc 0x%04X\n", 12, "v1.2.3", 0xBEEF);
+    printf_setAsync(false);
+    register_internal_sink(sink_stdout, stdout);
+    CHECK_EQ(sync, (int)strlen("station 12 app v1.2.3 crc 0xBEEF\n"));
+    CHECK_EQ(async, sync);
+    CHECK_EQ(log.lines.size(), 2);
+    if (log.lines.size() == 2) {
+        CHECK(log.lines[0] == log.lines[1]);
+    }
+}
+
+//a line longer than a record is cut with a mark on both the printf_ and the LOG_ path
+TEST(printf_async_long_line_marked)
+{
+    std::string name(600, 'x');
+    SinkLog log;
+    register_internal_sink(sink_log, &log);
+    printf_setAsync(true);
+    const int ret = printf_("%s\n", name.c_str());
+    LOG_INFO("%s\n", name.c_str());     //more string bytes than a record captures
+    LOG_INFO("%s %d\n", "short", 7);
+    printf_setAsync(false);
+    register_internal_sink(sink_stdout, stdout);
+    CHECK_EQ(ret, 601);
+    CHECK_EQ(log.lines.size(), 3);
+    if (log.lines.size() == 3) {
+        for (int i=0; i<2; ++i) {
+            CHECK_EQ(log.lines[i].size(), PRINTF_ASYNC_LINE_SIZE - 1);
+            CHECK(log.lines[i].compare(log.lines[i].size() - 4, 4, "...\n") == 0);
+            CHECK(log.lines[i].compare(0, 8, "xxxxxxxx") == 0);
+        }
+        CHECK(log.lines[2] == "short 7\n");
+    }
+}
+
+//producers keep going while the writer is started and stopped, every line is either written or counted as dropped
+TEST(printf_async_stop_loses_no_line)
+{
+    const int producers = 4;
+    const int perThread = 5000;
+    SinkLog log;
+    register_internal_sink(sink_log, &log);
+    std::atomic<int> started(0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<producers; ++t) {
+        threads.emplace_back([t, &started]() {
+            ++started;
+            for (int i=0; i<perThread; ++i) {
+                if (i & 1) {
+                    LOG_INFO("thread %d line %d\n", t, i);
+                } else {
+                    printf_("thread %d line %d\n", t, i);
+                }
+            }
+        });
+    }
+    while (started.load() != producers) {
+        std::this_thread::yield();
+    }
+    for (int round=0; round<20; ++round) {
+        printf_setAsync(true);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        printf_setAsync(false);
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    register_internal_sink(sink_stdout, stdout);
+    CHECK_EQ(log.lines.size() + log.dropped, producers * perThread);
+}
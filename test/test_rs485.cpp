@@ -0,0 +1,73 @@
+//RS-485 frames byte by byte against upgrade protocol Rev 0.17, 1 communication format
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_engine.h"
+
+//keeps what the engine puts on the wire, nothing ever answers
+class CaptureTransport final : public DfuTransport {
+public:
+    CaptureTransport(uint8_t link) { c = { link, DFU_FRAME_MAX_LEN, 1, 0 }; }
+    const DfuTransportCaps &caps(void) const override { return c; }
+    int send(const DfuFrame *frames, int cnt) override
+    {
+        for (int i=0; i<cnt; ++i) {
+            wire.push_back(frames[i]);
+        }
+        return cnt;
+    }
+    int receive(DfuFrame &, DfuDeadline) override { return 0; }
+    void flush(void) override {}
+
+    std::vector<DfuFrame> wire;
+
+private:
+    DfuTransportCaps c;
+};
+
+static bool same_bytes(const DfuFrame &f, const uint8_t *expect, uint16_t len)
+{
+    return f.len == len && memcmp(f.data, expect, len) == 0;
+}
+
+//the example of the protocol, prepare to station 0
+TEST(rs485_command_frame_bytes)
+{
+    static const uint8_t expect[] = { 0x5B, 0x04, 0x00, 0x10, 0x8C, 0xBE, 0xE5, 0x51, 0x18 };
+    uint8_t cmd[16];
+    DfuFrame f;
+    dfu_loadCmd(cmd, prepareCmd);
+    dfu_encodeCmd(f, cmd, 0, true);
+    CHECK_EQ(f.id, 0);
+    CHECK(same_bytes(f, expect, sizeof(expect)));
+}
+
+//CAN carries LEN ADR CMD DATA in 8 bytes without SOP, CRC or EOP
+TEST(can_command_frame_bytes)
+{
+    static const uint8_t expect[] = { 0x04, 0x03, 0x10, 0x8C, 0xBE, 0x00, 0x00, 0x00 };
+    uint8_t cmd[16];
+    DfuFrame f;
+    dfu_loadCmd(cmd, prepareCmd);
+    dfu_encodeCmd(f, cmd, 3, false);
+    CHECK_EQ(f.id, CAN_CMD_ID);
+    CHECK(same_bytes(f, expect, sizeof(expect)));
+}
+
+//data frame has no LEN or ADR, the crc covers only the payload
+TEST(rs485_data_frame_bytes)
+{
+    static const uint8_t payload[] = { 0x01, 0x02, 0x03, 0x04, 0xA5, 0x5A, 0xFF, 0x00 };
+    static const uint8_t expect[] = { 0x5C, 0x01, 0x02, 0x03, 0x04, 0xA5, 0x5A, 0xFF, 0x00, 0x10, 0xDB, 0x18 };
+    CaptureTransport bus(DFU_LINK_SERIAL);
+    DfuEngine engine(bus);
+    CHECK_EQ(engine.sendPacketData(sizeof(payload), payload), 0);
+    CHECK_EQ(bus.wire.size(), 1);
+    if (bus.wire.size() == 1) {
+        CHECK_EQ(bus.wire[0].id, 0);
+        CHECK(same_bytes(bus.wire[0], expect, sizeof(expect)));
+    }
+}
@@ -0,0 +1,82 @@
+//BmsRtcSync against the bootloader simulator with different bus delays
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <chrono>
+#include "dfu_test.h"
+#include "bms_rtc.h"
+#include "dfu_sim.h"
+
+//pack clock minus host clock, the simulated packs read their fields as UTC
+static int64_t pack_skew_us(DfuSimTransport &pack)
+{
+    int64_t host = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    return pack.rtcNow() - host;
+}
+
+static void rtc_sync(uint8_t link, uint8_t addr, uint32_t latencyUs, uint32_t maxErrUs)
+{
+    DfuSimTransport sim(link, addr);
+    sim.setLatency(latencyUs);
+    CHECK(pack_skew_us(sim) > DFU_SIM_RTC_OFFSET_US - 1000000);   //an hour off before
+    BmsRtcConfig cfg;
+    bms_rtcDefaultConfig(cfg);
+    cfg.addrs[0] = addr;
+    cfg.addrCnt = 1;
+    cfg.utc = true;
+    cfg.verifySteps = 5;    //a probe a second, 5 leave the skew at +/- 31 ms
+    BmsRtcSync rtc(sim);
+    BmsRtcResult r;
+    CHECK(rtc.configure(cfg));
+    CHECK_EQ(rtc.sync(&r), 1);
+    int64_t skew = pack_skew_us(sim);
+    CHECK_EQ(r.addr, addr);
+    CHECK(r.ok);
+    //the round trip is twice the one way delay and what the host takes to turn around
+    CHECK(r.rttUs >= 2 * latencyUs && r.rttUs < 2 * latencyUs + 5000);
+    //the half round trip is taken off, without it the pack would be behind by the delay
+    CHECK(skew > -(int64_t)maxErrUs && skew < (int64_t)maxErrUs);
+    //what the probes found has to hold the true skew
+    CHECK(r.skewErrMs < 1000);
+    CHECK(skew / 1000 >= r.skewMs - (int64_t)r.skewErrMs - 1 && skew / 1000 <= r.skewMs + (int64_t)r.skewErrMs + 1);
+    if (skew <= -(int64_t)maxErrUs || skew >= (int64_t)maxErrUs) {
+        printf("pack %d rtt %u us is off by %lld us\n", r.addr, r.rttUs, (long long)skew);
+    }
+}
+
+TEST(rtc_sync_takes_off_the_can_delay)
+{
+    //one way delays far above the error allowed, so an uncompensated set would fail
+    rtc_sync(DFU_LINK_CAN, 3, 1000, 5000);
+    rtc_sync(DFU_LINK_CAN, 9, 25000, 5000);
+}
+
+TEST(rtc_sync_takes_off_the_serial_delay)
+{
+    rtc_sync(DFU_LINK_SERIAL, 2, 20000, 5000);
+}
+
+TEST(rtc_silent_pack_is_not_set)
+{
+    DfuSimTransport sim(DFU_LINK_CAN, 1);
+    BmsRtcConfig cfg;
+    bms_rtcDefaultConfig(cfg);
+    cfg.addrs[0] = 1;
+    cfg.addrs[1] = 7;
+    cfg.addrCnt = 2;
+    cfg.utc = true;
+    cfg.verifySteps = 0;
+    cfg.timeoutMs = 20;
+    BmsRtcSync rtc(sim);
+    BmsRtcResult res[2];
+    CHECK(rtc.configure(cfg));
+    CHECK_EQ(rtc.sync(res), 1);
+    CHECK(res[0].ok);
+    CHECK_EQ(res[0].skewErrMs, 1000);   //not checked
+    CHECK(!res[1].ok);
+    CHECK_EQ(res[1].rttUs, UINT32_MAX);
+    int64_t skew = pack_skew_us(sim);
+    CHECK(skew > -5000 && skew < 5000);
+}
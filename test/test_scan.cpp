@@ -0,0 +1,97 @@
+//bus scan over an address range, answers are matched back by ADR whatever order they come in
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_engine.h"
+#include "dfu_sim.h"
+
+static uint32_t scan_ms(DfuEngine &engine, const char *range, std::vector<DfuStation> &found, int &ret)
+{
+    std::vector<uint8_t> addrs;
+    CHECK(dfu_parseAddrs(range, addrs));
+    auto start = std::chrono::steady_clock::now();
+    ret = engine.scanStations(addrs.data(), (int)addrs.size(), found);
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//the farthest pack answers last, so the answers come back out of the order the probes went
+TEST(scan_finds_every_pack_on_can)
+{
+    const std::vector<uint8_t> at = { 3, 17, 42 };
+    const uint32_t latencyUs[3] = { 6000, 500, 3000 };
+    DfuSimBus bus(DFU_LINK_CAN, at);
+    bus.setLatency(1000);   //silent addresses wait out their timeout
+    for (size_t i=0; i<at.size(); ++i) {
+        const uint8_t ver[5] = { (uint8_t)i, 0, (uint8_t)(i + 2), 1, 0 };
+        bus.pack(i).setAppVersion(ver);
+        bus.pack(i).setLatency(latencyUs[i]);
+    }
+    DfuEngine engine(bus);
+    std::vector<DfuStation> found;
+    int ret;
+    uint32_t ms = scan_ms(engine, "0-255", found, ret);
+    CHECK_EQ(ret, 3);
+    CHECK_EQ(found.size(), 3);
+    for (size_t i=0; i<found.size() && i<at.size(); ++i) {
+        CHECK_EQ(found[i].addr, at[i]);
+        CHECK_EQ(found[i].appVer[0], i);
+        CHECK_EQ(found[i].appVer[2], i + 2);
+        CHECK(found[i].boot);
+        CHECK(found[i].hwKnown);
+        CHECK_EQ(found[i].bootVer[3], 1);
+        CHECK_EQ(found[i].cellNum, DFU_SIM_CELL_NUM);
+    }
+    //the whole range in flight, the 253 silent addresses share one timeout per query
+    CHECK(ms < 1000);
+}
+
+//RS-485 is half duplex, every silent address waits for its own timeout
+TEST(scan_serial_one_at_a_time)
+{
+    DfuSimBus bus(DFU_LINK_SERIAL, std::vector<uint8_t>({ 2, 5 }));
+    bus.setLatency(1000);
+    DfuEngine engine(bus);
+    std::vector<DfuStation> found;
+    int ret;
+    uint32_t ms = scan_ms(engine, "0-7", found, ret);
+    CHECK_EQ(ret, 2);
+    CHECK_EQ(found.size(), 2);
+    if (found.size() == 2) {
+        CHECK_EQ(found[0].addr, 2);
+        CHECK_EQ(found[1].addr, 5);
+        CHECK_EQ(found[1].cellNum, DFU_SIM_CELL_NUM);
+    }
+    CHECK(ms >= 6 * DFU_SCAN_TIMEOUT_MS);
+}
+
+TEST(scan_empty_range)
+{
+    DfuSimBus bus(DFU_LINK_CAN, std::vector<uint8_t>({ 100 }));
+    DfuEngine engine(bus);
+    std::vector<DfuStation> found;
+    int ret;
+    scan_ms(engine, "0-15", found, ret);
+    CHECK_EQ(ret, 0);
+    CHECK(found.empty());
+}
+
+TEST(scan_address_ranges)
+{
+    std::vector<uint8_t> addrs;
+    CHECK(dfu_parseAddrs("7", addrs));
+    CHECK(addrs == std::vector<uint8_t>({ 7 }));
+    CHECK(dfu_parseAddrs("0-15", addrs));
+    CHECK_EQ(addrs.size(), 16);
+    CHECK(dfu_parseAddrs("1,4,6-9", addrs));
+    CHECK(addrs == std::vector<uint8_t>({ 1, 4, 6, 7, 8, 9 }));
+    CHECK(dfu_parseAddrs("0-255", addrs));
+    CHECK_EQ(addrs.size(), 256);
+    const char *bad[] = { "", "a", "5-", "9-3", "256", "1,,2", "3;4" };
+    for (const char *s : bad) {
+        CHECK(!dfu_parseAddrs(s, addrs));
+    }
+}
@@ -0,0 +1,148 @@
+//RSA signature of the .dfu, a good file is updated and a tampered or truncated one never gets DFU_UPDATE
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_file.h"
+#include "dfu_engine.h"
+#include "dfu_sign.h"
+#include "dfu_sim.h"
+
+#define SIGN_ADDR       4
+#define SIGN_PAYLOAD    1500
+#define SIGN_SALT       9
+
+//made once with openssl: genrsa 1024, rsa -pubout -outform DER, and dgst -sha256 -sign over the
+//header before DFU_SIG_OFFSET followed by the payload of test_dfuFile(SIGN_PAYLOAD, SIGN_SALT)
+static const uint8_t sign_key_der[162] = {
+    0x30, 0x81, 0x9F, 0x30, 0x0D, 0x06, 0x09, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x01, 0x01,
+    0x05, 0x00, 0x03, 0x81, 0x8D, 0x00, 0x30, 0x81, 0x89, 0x02, 0x81, 0x81, 0x00, 0xB4, 0xA6, 0xD4,
+    0x5E, 0xB2, 0xAE, 0x34, 0xFD, 0x09, 0x23, 0x77, 0x99, 0x50, 0x73, 0x57, 0x0F, 0x65, 0x8A, 0xE5,
+    0x6D, 0x5D, 0x3B, 0x8A, 0x44, 0x8D, 0x6A, 0x61, 0x28, 0x3C, 0xBB, 0x95, 0x3A, 0x16, 0x85, 0xDF,
+    0xBE, 0x5C, 0x89, 0xC0, 0xB5, 0xAF, 0xCA, 0x6A, 0x31, 0x3C, 0xD6, 0x02, 0x56, 0xC1, 0xB3, 0x69,
+    0xB1, 0xE8, 0x13, 0x15, 0x0C, 0x41, 0x54, 0xB4, 0x6F, 0x79, 0x84, 0xDD, 0xB1, 0xE3, 0x6D, 0x80,
+    0x09, 0x95, 0xD1, 0xE6, 0xDD, 0x12, 0x7F, 0x33, 0xD7, 0xD7, 0x92, 0x57, 0x67, 0x59, 0xC7, 0x85,
+    0xD8, 0x3A, 0xAE, 0x42, 0xBE, 0x46, 0xB0, 0x20, 0xAD, 0xE5, 0xC7, 0xEF, 0xFC, 0x2D, 0xBC, 0x31,
+    0xB6, 0x23, 0x63, 0xC1, 0xD6, 0x78, 0x85, 0x34, 0x3B, 0x4C, 0xA2, 0xED, 0x14, 0xA6, 0x40, 0x53,
+    0xC8, 0xBA, 0xC7, 0xFB, 0xEE, 0x63, 0xA1, 0x88, 0xD8, 0x76, 0x78, 0xE5, 0xA7, 0x02, 0x03, 0x01,
+    0x00, 0x01,
+};
+static const uint8_t sign_sig[128] = {
+    0x4E, 0xB8, 0x69, 0x2B, 0x7F, 0x42, 0xC2, 0xC9, 0x70, 0x77, 0x4A, 0xCB, 0x9C, 0xC7, 0xE9, 0xA4,
+    0xAC, 0x18, 0x14, 0x71, 0x1F, 0x38, 0xD4, 0x17, 0x80, 0x2C, 0xB3, 0x78, 0x16, 0xF2, 0x02, 0x12,
+    0x59, 0xA5, 0x61, 0xDB, 0x74, 0x55, 0xB9, 0x89, 0x74, 0xC7, 0x1F, 0x0B, 0x34, 0x51, 0xE2, 0x2B,
+    0x7A, 0x6A, 0x2E, 0xAB, 0xEC, 0xF2, 0xDE, 0x70, 0xB4, 0x72, 0x6A, 0x18, 0xFA, 0x3D, 0x9C, 0x14,
+    0x7E, 0x40, 0x22, 0x9F, 0x68, 0x75, 0x2E, 0xD9, 0x8D, 0xDD, 0x50, 0xB5, 0x82, 0xAD, 0xEB, 0x36,
+    0xD4, 0x0A, 0xAD, 0xA2, 0x89, 0x82, 0x36, 0x4D, 0xD7, 0x8C, 0xA1, 0x77, 0x76, 0x3A, 0xED, 0x86,
+    0x3E, 0x64, 0xD0, 0xC6, 0x53, 0x5D, 0x58, 0x99, 0x9F, 0xF8, 0x7D, 0xEC, 0xAB, 0x8D, 0x96, 0xC2,
+    0x25, 0x59, 0x21, 0x39, 0xCA, 0x16, 0xDD, 0xE5, 0x46, 0xBB, 0xE1, 0x78, 0x71, 0xDB, 0x97, 0x2B,
+};
+
+//passes every frame on to the pack and counts the DFU_UPDATE commands among them
+class UpdateWatch final : public DfuTransport {
+public:
+    UpdateWatch(DfuTransport &to) : t(to), updates(0) {}
+    const DfuTransportCaps &caps(void) const override { return t.caps(); }
+    int send(const DfuFrame *frames, int cnt) override
+    {
+        for (int i=0; i<cnt; ++i) {
+            //CAN frames carry no SOP, CMD is one byte earlier than on serial
+            updates += frames[i].id == CAN_CMD_ID && frames[i].data[CMD_CMD_OFFSET - 1] == DFU_UPDATE;
+        }
+        return t.send(frames, cnt);
+    }
+    int receive(DfuFrame &frame, DfuDeadline deadline) override { return t.receive(frame, deadline); }
+    void flush(void) override { t.flush(); }
+
+    DfuTransport &t;
+    int updates;
+};
+
+static std::vector<uint8_t> signed_file(void)
+{
+    std::vector<uint8_t> file = test_dfuFile(SIGN_PAYLOAD, SIGN_SALT);
+    memcpy(&file[DFU_SIG_OFFSET], sign_sig, sizeof(sign_sig));
+    return file;
+}
+
+static bool sign_key(DfuPublicKey &key)
+{
+    return dfu_parsePublicKey(key, sign_key_der, sizeof(sign_key_der)) == 0 && key.bytes == sizeof(sign_sig);
+}
+
+TEST(sign_verify_good_tampered_truncated)
+{
+    DfuPublicKey key;
+    CHECK(sign_key(key));
+    std::vector<uint8_t> good = signed_file();
+    CHECK_EQ(dfu_verifySignature(key, good.data(), (uint32_t)good.size()), 0);
+
+    std::vector<uint8_t> f = good;
+    f[DFU_PAYLOAD_OFFSET + 700] ^= 0x01;
+    CHECK_EQ(dfu_verifySignature(key, f.data(), (uint32_t)f.size()), -1);
+
+    f = good;
+    f[DFU_HDR_VERSION_OFFSET] ^= 0x01;     //the header is signed as well
+    CHECK_EQ(dfu_verifySignature(key, f.data(), (uint32_t)f.size()), -1);
+
+    f = good;
+    f[DFU_SIG_OFFSET + 5] ^= 0x80;
+    CHECK_EQ(dfu_verifySignature(key, f.data(), (uint32_t)f.size()), -1);
+
+    //signature written short, the rest of the area stays zero
+    f = good;
+    memset(&f[DFU_SIG_OFFSET + sizeof(sign_sig) - 16], 0, 16);
+    CHECK_EQ(dfu_verifySignature(key, f.data(), (uint32_t)f.size()), -1);
+
+    f = good;
+    f.resize(f.size() - 1);
+    CHECK_EQ(dfu_verifySignature(key, f.data(), (uint32_t)f.size()), -1);
+    f.resize(DFU_PAYLOAD_OFFSET);
+    CHECK_EQ(dfu_verifySignature(key, f.data(), (uint32_t)f.size()), -1);
+}
+
+//the whole file goes to the pack as the tool sends it, the check runs beside the transfer
+static int gated_upgrade(const std::vector<uint8_t> &file, UpdateWatch &watch, volatile int &running)
+{
+    DfuPublicKey key;
+    CHECK(sign_key(key));
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, file.data(), (uint32_t)file.size(), 128, 0) >= 0);
+    DfuSignCheck check;
+    DfuEngine engine(watch);
+    engine.setUpdateWait(0);
+    check.start(key, file.data(), (uint32_t)file.size(), &running);
+    engine.setUpdateGate(DfuSignCheck::gate, &check);
+    return engine.upgrade(SIGN_ADDR, img, 0, &running);
+}
+
+TEST(sign_gate_holds_back_update)
+{
+    std::vector<uint8_t> good = signed_file();
+    {
+        DfuSimTransport sim(DFU_LINK_CAN, SIGN_ADDR);
+        UpdateWatch watch(sim);
+        volatile int running = 1;
+        CHECK_EQ(gated_upgrade(good, watch, running), 0);
+        CHECK_EQ(watch.updates, 1);
+        CHECK_EQ(running, 1);
+        CHECK(memcmp(sim.flash().data(), good.data(), good.size()) == 0);
+    }
+
+    std::vector<uint8_t> tampered = good;
+    tampered[DFU_PAYLOAD_OFFSET + 700] ^= 0x01;
+    test_dfuSeal(tampered);     //the crcs hold, only the signature tells
+    std::vector<uint8_t> truncated = good;
+    memset(&truncated[DFU_SIG_OFFSET + sizeof(sign_sig) - 16], 0, 16);
+    const std::vector<uint8_t> *bad[2] = { &tampered, &truncated };
+    for (const std::vector<uint8_t> *f : bad) {
+        DfuSimTransport sim(DFU_LINK_CAN, SIGN_ADDR);
+        UpdateWatch watch(sim);
+        volatile int running = 1;
+        CHECK_EQ(gated_upgrade(*f, watch, running), -1);
+        CHECK_EQ(watch.updates, 0);
+        CHECK_EQ(running, 0);
+    }
+}
@@ -0,0 +1,120 @@
+//SocketCAN transport over a socketpair, the bootloader simulator answers on the other end
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#ifdef __linux__
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_engine.h"
+#include "dfu_sim.h"
+#include "socketcan.h"
+
+//the other end of the socket, can_frame in, can_frame out, as a CAN adapter would move them
+struct SimPeer {
+    int fd;
+    DfuSimTransport sim;
+    std::atomic<bool> stop{false};
+    uint64_t frames = 0;
+
+    SimPeer(int peerFd, uint8_t addr) : fd(peerFd), sim(DFU_LINK_CAN, addr) {}
+
+    void run(void)
+    {
+        struct can_frame cf;
+        DfuFrame f;
+        while (!stop) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, 10) > 0 && read(fd, &cf, sizeof(cf)) == sizeof(cf)) {
+                f.id = cf.can_id;
+                f.len = cf.can_dlc;
+                memcpy(f.data, cf.data, 8);
+                sim.send(&f, 1);
+                ++frames;
+            }
+            while (sim.receive(f, std::chrono::steady_clock::now()) == 1) {
+                memset(&cf, 0, sizeof(cf));
+                cf.can_id = f.id;
+                cf.can_dlc = (uint8_t)f.len;
+                memcpy(cf.data, f.data, 8);
+                if (write(fd, &cf, sizeof(cf)) != sizeof(cf)) {
+                    return;
+                }
+            }
+        }
+    }
+};
+
+TEST(socketcan_upgrade_through_socket)
+{
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+    SimPeer peer(fds[1], 2);
+    std::thread th(&SimPeer::run, &peer);
+    SocketCanTransport *can = new SocketCanTransport(fds[0]);
+    CHECK_EQ(can->caps().link, DFU_LINK_CAN);
+
+    std::vector<uint8_t> data(600);
+    for (size_t i=0; i<data.size(); ++i) {
+        data[i] = (uint8_t)(i * 7 + 1);
+    }
+    DfuImage img;
+    CHECK(dfu_prepareImage(img, data.data(), (uint32_t)data.size(), 128, 0) >= 0);
+    volatile int running = 1;
+    {
+        DfuEngineT<SocketCanTransport> engine(*can);     //the devirtualized engine of socketcan.cpp
+        engine.setUpdateWait(0);
+        CHECK_EQ(engine.upgrade(2, img, 0, &running), 0);
+    }
+    CHECK_EQ(peer.sim.applicationLen(), img.len);
+    CHECK(peer.sim.flash().size() >= data.size() &&
+        memcmp(peer.sim.flash().data(), data.data(), data.size()) == 0);
+    //every data frame went as one can_frame, 600 bytes are 5 packets of 16 frames
+    CHECK_EQ(peer.sim.dataBytes(), 5 * 128);
+
+    peer.stop = true;
+    th.join();
+    delete can;     //closes fds[0]
+    close(fds[1]);
+}
+
+//a batch of commands goes out in one send, receive gives up at the deadline when nothing answers
+TEST(socketcan_batch_and_timeout)
+{
+    int fds[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+    SocketCanTransport can(fds[0]);
+    DfuFrame tx[DFU_MAX_BATCH];
+    for (int i=0; i<DFU_MAX_BATCH; ++i) {
+        tx[i].id = CAN_DAT_ID;
+        tx[i].len = 8;
+        memset(tx[i].data, i, 8);
+    }
+    CHECK_EQ(can.send(tx, DFU_MAX_BATCH), DFU_MAX_BATCH);
+    struct can_frame cf;
+    int got = 0;
+    while (recv(fds[1], &cf, sizeof(cf), MSG_DONTWAIT) == sizeof(cf)) {
+        got += cf.can_id == CAN_DAT_ID && cf.can_dlc == 8 && cf.data[7] == got;
+    }
+    CHECK_EQ(got, DFU_MAX_BATCH);
+
+    DfuFrame rx;
+    auto start = std::chrono::steady_clock::now();
+    CHECK_EQ(can.receive(rx, start + std::chrono::milliseconds(20)), 0);
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+    close(fds[1]);
+}
+
+TEST(socketcan_unknown_interface)
+{
+    CHECK(socketcan_createTransport("nocan0") == NULL);
+}
+
+#endif
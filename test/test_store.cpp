@@ -0,0 +1,161 @@
+//BmsStore window queries and compressed blocks, the file is written to the working directory
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "bms_store.h"
+
+#define STORE_FILE      "test_store.bmss"
+
+static const uint8_t store_addrs[] = { 1, 7 };
+
+//a cell that drifts a few mV around 3300 every 100 ms
+static int32_t sample_value(int i)
+{
+    return 3300 + (i * 7) % 23 - 11;
+}
+
+static uint64_t sample_time(int i)
+{
+    return 1000 + (uint64_t)i * 100;
+}
+
+static void fill(BmsStore &store, int signal, int from, int cnt)
+{
+    for (int i=from; i<from + cnt; ++i) {
+        store.append(signal, sample_time(i), sample_value(i));
+    }
+}
+
+//what query() has to find, taken straight from the samples
+static BmsStoreStat expect(int cnt, uint64_t fromMs, uint64_t toMs)
+{
+    BmsStoreStat st = {0, 0, 0, 0.0};
+    double sum = 0.0;
+    for (int i=0; i<cnt; ++i) {
+        uint64_t t = sample_time(i);
+        int32_t v = sample_value(i);
+        if (t < fromMs || t > toMs) {
+            continue;
+        }
+        st.min = (st.count == 0 || v < st.min) ? v : st.min;
+        st.max = (st.count == 0 || v > st.max) ? v : st.max;
+        sum += v;
+        ++st.count;
+    }
+    st.avg = st.count ? sum / st.count : 0.0;
+    return st;
+}
+
+TEST(store_window_query_matches_samples)
+{
+    BmsStore store;
+    CHECK(store.create(STORE_FILE, store_addrs, 2, 16, 64));
+    int sig = store.signalId(7, BMS_SIG_VOLT, 3);
+    CHECK_EQ(sig, 20 + 3);
+    CHECK_EQ(store.signalId(7, BMS_SIG_TEMP, 1), 20 + 16 + 1);
+    CHECK_EQ(store.signalId(2, BMS_SIG_VOLT, 0), -1);
+    fill(store, sig, 0, 2000);
+    //whole blocks come from their summaries, the edges are decoded
+    const uint64_t windows[][2] = { { 0, UINT64_MAX }, { 5050, 61230 }, { 1000, 1000 }, { 100000, 150000 },
+        { 170000, 400000 } };
+    for (const auto &w : windows) {
+        BmsStoreStat st;
+        BmsStoreStat ref = expect(2000, w[0], w[1]);
+        CHECK_EQ(store.query(sig, w[0], w[1], st), ref.count != 0);
+        CHECK_EQ(st.count, ref.count);
+        CHECK_EQ(st.min, ref.min);
+        CHECK_EQ(st.max, ref.max);
+        CHECK(st.avg > ref.avg - 1e-9 && st.avg < ref.avg + 1e-9);
+    }
+    BmsStoreStat st;
+    CHECK(!store.query(sig, 500000, 600000, st));
+    CHECK(!store.query(sig + 1, 0, UINT64_MAX, st));    //nothing appended there
+    std::vector<uint64_t> t(2000);
+    std::vector<int32_t> v(2000);
+    CHECK_EQ(store.read(sig, 0, UINT64_MAX, t.data(), v.data(), 2000), 2000);
+    for (int i=0; i<2000; ++i) {
+        CHECK_EQ(t[i], sample_time(i));
+        CHECK_EQ(v[i], sample_value(i));
+    }
+    store.close();
+    remove(STORE_FILE);
+}
+
+TEST(store_blocks_are_compressed_and_ring)
+{
+    BmsStore store;
+    CHECK(store.create(STORE_FILE, store_addrs, 2, 4, 8));
+    size_t size = store.size();
+    //8 blocks of 256 bytes hold 900 samples only when they take about 2 bytes each
+    fill(store, 0, 0, 900);
+    BmsStoreStat st;
+    CHECK(store.query(0, 0, UINT64_MAX, st));
+    CHECK_EQ(st.count, 900);
+    //the ring then drops the oldest blocks, never the newest samples
+    fill(store, 0, 900, 5000);
+    CHECK(store.query(0, 0, UINT64_MAX, st));
+    CHECK(st.count > 500 && st.count < 1200);
+    uint64_t t[1];
+    int32_t v[1];
+    CHECK_EQ(store.read(0, sample_time(5899), UINT64_MAX, t, v, 1), 1);
+    CHECK_EQ(v[0], sample_value(5899));
+    CHECK_EQ(store.read(0, 0, sample_time(5000), t, v, 1), 0);
+    //a time going back is taken as the last one
+    CHECK(store.append(0, 10, 3000));
+    CHECK_EQ(store.read(0, sample_time(5899), UINT64_MAX, t, v, 1), 1);
+    CHECK_EQ(store.size(), size);
+    store.close();
+    remove(STORE_FILE);
+}
+
+TEST(store_snapshots_survive_reopen)
+{
+    BmsStore store;
+    CHECK(store.create(STORE_FILE, store_addrs, 2, 4, 16));
+    BmsSnapshot snap;
+    memset(&snap, 0x00, sizeof(snap));
+    snap.addr = 7;
+    snap.valid = BMS_INFO_VOLT | BMS_INFO_TEMP;
+    snap.volt.cellCnt = 16;     //more than the store keeps
+    for (int r=0; r<10; ++r) {
+        snap.timeMs = sample_time(r);
+        for (uint8_t i=0; i<16; ++i) {
+            snap.volt.cell[i] = (uint16_t)(3300 + i + r);
+        }
+        snap.temp.cellMin = (int16_t)(250 - r);
+        snap.temp.cellMax = (int16_t)(260 + r);
+        bms_storeSnapshot(&snap, &store);
+    }
+    snap.addr = 3;      //not in the store, ignored
+    bms_storeSnapshot(&snap, &store);
+    store.close();
+
+    CHECK(store.open(STORE_FILE));
+    BmsStoreStat st;
+    CHECK(store.query(store.signalId(7, BMS_SIG_VOLT, 3), 0, UINT64_MAX, st));
+    CHECK_EQ(st.count, 10);
+    CHECK_EQ(st.min, 3303);
+    CHECK_EQ(st.max, 3312);
+    CHECK(store.query(store.signalId(7, BMS_SIG_TEMP, 0), 0, UINT64_MAX, st));
+    CHECK_EQ(st.min, 241);
+    CHECK(store.query(store.signalId(7, BMS_SIG_TEMP, 1), 0, UINT64_MAX, st));
+    CHECK_EQ(st.max, 269);
+    CHECK(!store.query(store.signalId(1, BMS_SIG_VOLT, 0), 0, UINT64_MAX, st));
+    //appending goes on in the block where the first run stopped
+    int sig = store.signalId(7, BMS_SIG_VOLT, 0);
+    CHECK(store.append(sig, sample_time(10), 3400));
+    uint64_t t[16];
+    int32_t v[16];
+    CHECK_EQ(store.read(sig, 0, UINT64_MAX, t, v, 16), 11);
+    CHECK_EQ(v[0], 3300);
+    CHECK_EQ(v[9], 3309);
+    CHECK_EQ(v[10], 3400);
+    CHECK_EQ(t[10], sample_time(10));
+    store.close();
+    CHECK(!store.open("test_store_missing.bmss"));
+    remove(STORE_FILE);
+}
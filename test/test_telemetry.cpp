@@ -0,0 +1,92 @@
+//BmsTelemetry rounds against the bootloader simulator
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "bms_telemetry.h"
+#include "dfu_sim.h"
+
+struct SnapLog {
+    std::vector<BmsSnapshot> snaps;
+};
+
+static void log_snapshot(const BmsSnapshot *snap, void *ctx)
+{
+    ((SnapLog *)ctx)->snaps.push_back(*snap);
+}
+
+static void telemetry_config(BmsTelemetryConfig &cfg, const std::vector<uint8_t> &addrs)
+{
+    bms_defaultConfig(cfg);
+    memcpy(cfg.addrs, addrs.data(), addrs.size());
+    cfg.addrCnt = (uint8_t)addrs.size();
+    cfg.bitRate = 0;
+}
+
+TEST(telemetry_round_decodes_the_pack)
+{
+    std::vector<uint8_t> addrs = { 5 };
+    DfuSimTransport sim(DFU_LINK_CAN, 5);
+    BmsTelemetry telemetry(sim);
+    BmsTelemetryConfig cfg;
+    telemetry_config(cfg, addrs);
+    SnapLog log;
+    CHECK(telemetry.configure(cfg));
+    CHECK(telemetry.subscribe(log_snapshot, &log));
+    CHECK_EQ(telemetry.poll(), 1);
+    CHECK_EQ(log.snaps.size(), 1);
+    for (const BmsSnapshot &s : log.snaps) {
+        CHECK_EQ(s.addr, 5);
+        CHECK_EQ(s.valid, BMS_INFO_ALL);
+        CHECK_EQ(s.round, 1);
+        CHECK_EQ(s.bat.voltage, 5120);
+        CHECK_EQ(s.bat.current, 250);
+        CHECK_EQ(s.temp.cellMax, 263);
+        CHECK_EQ(s.soc.remainCap, 90000);
+        CHECK_EQ(s.volt.cellCnt, 16);
+        for (uint8_t i=0; i<16; ++i) {
+            CHECK_EQ(s.volt.cell[i], 3300 + s.addr + i);   //the model puts the address into the cells
+        }
+    }
+}
+
+TEST(telemetry_silent_pack_is_published_empty)
+{
+    std::vector<uint8_t> addrs = { 1, 3 };
+    DfuSimTransport sim(DFU_LINK_CAN, 1);
+    BmsTelemetry telemetry(sim);
+    BmsTelemetryConfig cfg;
+    telemetry_config(cfg, addrs);
+    cfg.timeoutMs = 20;
+    SnapLog log;
+    CHECK(telemetry.configure(cfg));
+    CHECK(telemetry.subscribe(log_snapshot, &log));
+    CHECK_EQ(telemetry.poll(), 1);
+    CHECK_EQ(log.snaps.size(), 2);
+    for (const BmsSnapshot &s : log.snaps) {
+        CHECK_EQ(s.valid, s.addr == 3 ? 0 : BMS_INFO_ALL);
+    }
+    CHECK_EQ(telemetry.poll(), 1);
+    CHECK_EQ(log.snaps.back().round, 2);
+}
+
+TEST(telemetry_serial_waits_for_every_answer)
+{
+    std::vector<uint8_t> addrs = { 4 };
+    DfuSimTransport sim(DFU_LINK_SERIAL, 4);
+    BmsTelemetry telemetry(sim);
+    BmsTelemetryConfig cfg;
+    telemetry_config(cfg, addrs);
+    cfg.infoMask = BMS_INFO_VOLT | BMS_INFO_BAT;
+    SnapLog log;
+    CHECK(telemetry.configure(cfg));
+    CHECK(telemetry.subscribe(log_snapshot, &log));
+    CHECK_EQ(telemetry.poll(), 1);
+    CHECK_EQ(log.snaps.size(), 1);
+    for (const BmsSnapshot &s : log.snaps) {
+        CHECK_EQ(s.valid, BMS_INFO_VOLT | BMS_INFO_BAT);
+        CHECK_EQ(s.volt.cell[15], 3300 + s.addr + 15);
+    }
+}
@@ -0,0 +1,81 @@
+//trace ring file, records come back oldest first and half written ones are skipped
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <stdio.h>
+#include <vector>
+#include "dfu_test.h"
+#include "dfu_trace.h"
+
+#define TRACE_FILE      "test_trace.dft"
+#define TRACE_CAPACITY  8
+
+//20 records into a ring of 8, value is the order they were written in
+static bool trace_write(void)
+{
+    if (!dfu_traceOpen(TRACE_FILE, TRACE_CAPACITY)) {
+        return false;
+    }
+    for (uint32_t i=0; i<20; ++i) {
+        dfu_trace(DFU_TRACE_CMD, 0, 1, 0x10, (uint16_t)i, 0, 0, i);
+    }
+    dfu_traceClose();
+    return true;
+}
+
+static bool trace_read(DfuTraceHdr &hdr, std::vector<DfuTraceRec> &ring)
+{
+    FILE *fd = fopen(TRACE_FILE, "rb");
+    if (fd == NULL) {
+        return false;
+    }
+    bool ok = fread(&hdr, sizeof(hdr), 1, fd) == 1 && hdr.capacity == TRACE_CAPACITY;
+    ring.resize(TRACE_CAPACITY);
+    ok = ok && fread(ring.data(), sizeof(DfuTraceRec), ring.size(), fd) == ring.size();
+    fclose(fd);
+    return ok;
+}
+
+TEST(trace_ring_oldest_first)
+{
+    DfuTraceHdr hdr;
+    std::vector<DfuTraceRec> ring;
+    std::vector<DfuTraceRec> recs;
+    CHECK(trace_write());
+    CHECK(trace_read(hdr, ring));
+    CHECK_EQ(hdr.version, DFU_TRACE_VERSION);
+    CHECK_EQ(hdr.head.load(), 20);
+    CHECK_EQ(dfu_traceRecords(hdr, ring.data(), ring.size(), recs), 0);
+    CHECK_EQ(recs.size(), TRACE_CAPACITY);
+    for (size_t i=0; i<recs.size(); ++i) {
+        CHECK_EQ(recs[i].value, 12 + i);
+        CHECK_EQ(recs[i].lap, dfu_traceLap(12 + i, TRACE_CAPACITY));
+    }
+    //a file cut short keeps the records it still has
+    CHECK_EQ(dfu_traceRecords(hdr, ring.data(), 3, recs), 0);
+    CHECK_EQ(recs.size(), 3);
+    remove(TRACE_FILE);
+}
+
+//a writer that claimed a slot and did not finish leaves lap 0 or the lap of the pass before
+TEST(trace_skips_unfinished_records)
+{
+    DfuTraceHdr hdr;
+    std::vector<DfuTraceRec> ring;
+    std::vector<DfuTraceRec> recs;
+    CHECK(trace_write());
+    CHECK(trace_read(hdr, ring));
+    ring[15 % TRACE_CAPACITY].lap = 0;      //stopped in the middle of the fields
+    ring[17 % TRACE_CAPACITY].value = 99;   //new fields, old lap
+    ring[17 % TRACE_CAPACITY].lap = dfu_traceLap(9, TRACE_CAPACITY);
+    hdr.head.store(21);     //claimed, nothing written, the slot still holds record 12
+    CHECK_EQ(dfu_traceRecords(hdr, ring.data(), ring.size(), recs), 3);
+    CHECK_EQ(recs.size(), TRACE_CAPACITY - 3);
+    for (const DfuTraceRec &r : recs) {
+        CHECK(r.value != 15 && r.value != 17 && r.value != 99 && r.value != 12);
+    }
+    //lap stays out of 0 when it wraps around
+    CHECK_EQ(dfu_traceLap(254ULL * TRACE_CAPACITY, TRACE_CAPACITY), 255);
+    CHECK_EQ(dfu_traceLap(255ULL * TRACE_CAPACITY, TRACE_CAPACITY), 1);
+    remove(TRACE_FILE);
+}
@@ -0,0 +1,75 @@
+//wifi data frames, the staged encoder puts out the same bytes as uart_sendFrameData on the padded image
+//Author : richard xu (junzexu@outlook.com)
+//Date : Dec 02, 2026
+
+#include <string.h>
+#include <vector>
+#include "dfu_test.h"
+#include "wifi_frame.h"
+
+static std::vector<uint8_t> wifi_image(uint32_t len)
+{
+    std::vector<uint8_t> data(len);
+    for (uint32_t i=0; i<len; ++i) {
+        data[i] = (uint8_t)(i * 13 + (i >> 8));
+    }
+    return data;
+}
+
+//the file is padded with 0xFF to whole frames and every frame is sent with len 0x200, as main_wifi always did
+static void check_frames(uint32_t len)
+{
+    std::vector<uint8_t> image = wifi_image(len);
+    std::vector<uint8_t> padded = image;
+    padded.resize((len + WIFI_FRAME_LEN - 1) / WIFI_FRAME_LEN * WIFI_FRAME_LEN, 0xFF);
+    std::vector<uint8_t> sums;
+    int cnt = wifi_frameChecksums(sums, image.data(), len);
+    CHECK_EQ(cnt, padded.size() / WIFI_FRAME_LEN);
+    uint8_t staged[WIFI_FRAME_SIZE];
+    uint8_t legacy[WIFI_FRAME_SIZE];
+    wifi_initFrame(staged);
+    int same = 0;
+    for (int seq=1; seq<=cnt; ++seq) {
+        wifi_stageFrame(staged, (uint16_t)seq, image.data(), len, sums[seq - 1]);
+        wifi_encodeFrameData(legacy, (uint16_t)seq, WIFI_FRAME_LEN, padded.data() + (seq - 1) * WIFI_FRAME_LEN);
+        same += memcmp(staged, legacy, WIFI_FRAME_SIZE) == 0;
+        CHECK_EQ(wifi_checksum(staged + WIFI_FRAME_HDR_LEN, WIFI_FRAME_LEN + 1), 0);
+    }
+    CHECK_EQ(same, cnt);
+}
+
+TEST(wifi_staged_frames_match_legacy_bytes)
+{
+    check_frames(WIFI_FRAME_LEN * 6);
+    check_frames(WIFI_FRAME_LEN * 6 + 77);
+    check_frames(1);
+}
+
+//the staging buffer is reused, a short last frame leaves nothing of the frame before it
+TEST(wifi_staged_frame_after_full_frame)
+{
+    std::vector<uint8_t> image = wifi_image(WIFI_FRAME_LEN + 3);
+    std::vector<uint8_t> sums;
+    CHECK_EQ(wifi_frameChecksums(sums, image.data(), (uint32_t)image.size()), 2);
+    uint8_t frame[WIFI_FRAME_SIZE];
+    wifi_initFrame(frame);
+    wifi_stageFrame(frame, 1, image.data(), (uint32_t)image.size(), sums[0]);
+    wifi_stageFrame(frame, 2, image.data(), (uint32_t)image.size(), sums[1]);
+    CHECK_EQ(frame[0], WIFI_SOP);
+    CHECK_EQ(frame[1], WIFI_UPGRADE_DATA);
+    CHECK_EQ(frame[2], 0x00);
+    CHECK_EQ(frame[3], 0x02);
+    CHECK(memcmp(frame + WIFI_FRAME_HDR_LEN, image.data() + WIFI_FRAME_LEN, 3) == 0);
+    CHECK_EQ(frame[WIFI_FRAME_HDR_LEN + 3], 0xFF);
+    CHECK_EQ(frame[WIFI_FRAME_HDR_LEN + WIFI_FRAME_LEN - 1], 0xFF);
+    CHECK_EQ(frame[WIFI_FRAME_SIZE - 2], sums[1]);
+    CHECK_EQ(frame[WIFI_FRAME_SIZE - 1], WIFI_EOP);
+}
+
+TEST(wifi_image_out_of_range)
+{
+    std::vector<uint8_t> sums;
+    uint8_t b = 0;
+    CHECK_EQ(wifi_frameChecksums(sums, NULL, 100), -1);
+    CHECK_EQ(wifi_frameChecksums(sums, &b, 0), -1);
+}